@@ -1409,14 +1409,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) {
             params.lookup_cache_static = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_LOOKUP}));
+    ).set_examples({LLAMA_EXAMPLE_LOOKUP, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"-lcd", "--lookup-cache-dynamic"}, "FNAME",
         "path to dynamic lookup cache to use for lookup decoding (updated by generation)",
         [](common_params & params, const std::string & value) {
             params.lookup_cache_dynamic = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_LOOKUP}));
+    ).set_examples({LLAMA_EXAMPLE_LOOKUP, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"-c", "--ctx-size"}, "N",
         string_format("size of the prompt context (default: %d, 0 = loaded from model)", params.n_ctx),
@@ -2194,6 +2194,16 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.defrag_thold = std::stof(value);
         }
     ).set_env("LLAMA_ARG_DEFRAG_THOLD"));
+    add_opt(common_arg(
+        {"--kv-block-size"}, "N",
+        string_format("number of cells per block of the paged KV cache, the tokens of each sequence are placed in the blocks owned by the sequence (default: %d, 0 = disabled)", params.kv_block_size),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.kv_block_size = value;
+        }
+    ).set_env("LLAMA_ARG_KV_BLOCK_SIZE"));
     add_opt(common_arg(
         {"-np", "--parallel"}, "N",
         string_format("number of parallel sequences to decode (default: %d)", params.n_parallel),
@@ -2222,6 +2232,31 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.cont_batching = false;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_NO_CONT_BATCHING"));
+    add_opt(common_arg(
+        {"--prefill-chunk"}, "N",
+        string_format("max number of prompt tokens to process per batch while other slots are generating, so that long prompts do not stall token generation (default: %d, 0 = up to n_batch)", params.n_prefill_chunk),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.n_prefill_chunk = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREFILL_CHUNK"));
+    add_opt(common_arg(
+        {"--preempt"},
+        "allow requests with a higher \"priority\" to preempt generating slots, the preempted requests are resumed once a slot is free\n"
+        "the KV cache of a preempted request is kept with --kv-spill-ram or --kv-spill-disk, otherwise its prompt and the tokens generated so far are processed again when it is resumed (default: disabled)",
+        [](common_params & params) {
+            params.preempt = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREEMPT"));
+    add_opt(common_arg(
+        {"--priority-max"}, "N",
+        string_format("max \"priority\" that a request can ask for, higher values are clamped to N (default: %d)", params.priority_max),
+        [](common_params & params, int value) {
+            params.priority_max = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PRIORITY_MAX"));
     add_opt(common_arg(
         {"--mmproj"}, "FILE",
         "path to a multimodal projector file. see tools/mtmd/README.md\n"
@@ -2288,12 +2323,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         "- distribute: spread execution evenly over all nodes\n"
         "- isolate: only spawn threads on CPUs on the node that execution started on\n"
         "- numactl: use the CPU map provided by numactl\n"
+        "- split: like distribute, and split the rows of the weights over the nodes, so that each thread multiplies local rows\n"
         "if run without this previously, it is recommended to drop the system page cache before using this\n"
         "see https://github.com/ggml-org/llama.cpp/issues/1437",
         [](common_params & params, const std::string & value) {
             /**/ if (value == "distribute" || value == "") { params.numa = GGML_NUMA_STRATEGY_DISTRIBUTE; }
             else if (value == "isolate") { params.numa = GGML_NUMA_STRATEGY_ISOLATE; }
             else if (value == "numactl") { params.numa = GGML_NUMA_STRATEGY_NUMACTL; }
+            else if (value == "split") { params.numa = GGML_NUMA_STRATEGY_SPLIT; }
             else { throw std::invalid_argument("invalid value"); }
         }
     ).set_env("LLAMA_ARG_NUMA"));
@@ -2778,6 +2815,21 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.api_keys.push_back(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_API_KEY"));
+    add_opt(common_arg(
+        {"--api-key-weight"}, "KEY:WEIGHT",
+        "fair-share weight of an API key when requests are waiting for a free slot, can be repeated (default: 1 for every key)",
+        [](common_params & params, const std::string & value) {
+            const auto pos = value.rfind(':');
+            if (pos == std::string::npos || pos == 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            const int32_t weight = std::stoi(value.substr(pos + 1));
+            if (weight < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.api_key_weights[value.substr(0, pos)] = weight;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--api-key-file"}, "FNAME",
         "path to file containing API keys (default: none)",
@@ -2952,6 +3004,87 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.slot_prompt_similarity = std::stof(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--prefix-cache-min"}, "N",
+        string_format("min length of a prompt prefix to reuse from the KV cells of another slot via the shared prefix cache (default: %d, 0 = disabled)", params.prefix_cache_min),
+        [](common_params & params, int value) {
+            params.prefix_cache_min = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREFIX_CACHE_MIN"));
+    add_opt(common_arg(
+        {"--prefix-cache-size"}, "N",
+        string_format("max number of tokens indexed by the shared prefix cache, least recently used prefixes are evicted first (default: %d, 0 = unlimited)", params.prefix_cache_size),
+        [](common_params & params, int value) {
+            params.prefix_cache_size = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PREFIX_CACHE_SIZE"));
+    add_opt(common_arg(
+        {"--kv-spill-ram"}, "MiB",
+        string_format("host memory budget in MiB for the KV states of idle sessions evicted from the KV cache (default: %d, 0 = disabled)", params.kv_spill_ram),
+        [](common_params & params, int value) {
+            params.kv_spill_ram = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_KV_SPILL_RAM"));
+    add_opt(common_arg(
+        {"--kv-spill-disk"}, "MiB",
+        string_format("disk budget in MiB for the KV states that do not fit in --kv-spill-ram (default: %d, 0 = disabled)", params.kv_spill_disk),
+        [](common_params & params, int value) {
+            params.kv_spill_disk = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_KV_SPILL_DISK"));
+    add_opt(common_arg(
+        {"--kv-spill-path"}, "PATH",
+        "directory for the KV states spilled to disk (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.kv_spill_path = value;
+            // if doesn't end with DIRECTORY_SEPARATOR, add it
+            if (!params.kv_spill_path.empty() && params.kv_spill_path[params.kv_spill_path.size() - 1] != DIRECTORY_SEPARATOR) {
+                params.kv_spill_path += DIRECTORY_SEPARATOR;
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_KV_SPILL_PATH"));
+    add_opt(common_arg(
+        {"--prompt-store"}, "PATH",
+        "directory where the KV states of frequently used prompt prefixes are persisted and reloaded from, also across restarts (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.prompt_store_path = value;
+            // if doesn't end with DIRECTORY_SEPARATOR, add it
+            if (!params.prompt_store_path.empty() && params.prompt_store_path[params.prompt_store_path.size() - 1] != DIRECTORY_SEPARATOR) {
+                params.prompt_store_path += DIRECTORY_SEPARATOR;
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PROMPT_STORE"));
+    add_opt(common_arg(
+        {"--prompt-store-block"}, "N",
+        string_format("the prompt prefixes are persisted at multiples of N tokens (default: %d)", params.prompt_store_block),
+        [](common_params & params, int value) {
+            if (value <= 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.prompt_store_block = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PROMPT_STORE_BLOCK"));
+    add_opt(common_arg(
+        {"--prompt-store-hits"}, "N",
+        string_format("number of prompts that must share a prefix before it is persisted (default: %d)", params.prompt_store_hits),
+        [](common_params & params, int value) {
+            params.prompt_store_hits = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PROMPT_STORE_HITS"));
+    add_opt(common_arg(
+        {"--prompt-store-size"}, "MiB",
+        string_format("disk budget in MiB of the prompt store, least recently used prefixes are deleted first (default: %d, 0 = unlimited)", params.prompt_store_size),
+        [](common_params & params, int value) {
+            params.prompt_store_size = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_PROMPT_STORE_SIZE"));
+    add_opt(common_arg(
+        {"--logits-top-k"},
+        string_format("select the top-k logits of each output in the graph and copy only them to host memory, when the sampling parameters of all the requests in the batch allow it (default: %s)", params.logits_top_k ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.logits_top_k = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOGITS_TOP_K"));
     add_opt(common_arg(
         {"--lora-init-without-apply"},
         string_format("load LoRA adapters without applying them (apply later via POST /lora-adapters) (default: %s)", params.lora_init_without_apply ? "enabled" : "disabled"),
@@ -3208,6 +3341,20 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.speculative.p_min = std::stof(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_P_MIN"));
+    add_opt(common_arg(
+        {"--no-draft-adaptive"},
+        string_format("always draft up to --draft-max tokens, instead of adapting the draft length of each slot to its acceptance rate and to the cost of drafting (default: %s)", params.speculative.adaptive ? "adaptive" : "fixed"),
+        [](common_params & params) {
+            params.speculative.adaptive = false;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_NO_DRAFT_ADAPTIVE"));
+    add_opt(common_arg(
+        {"--draft-lookup"},
+        string_format("draft from the n-grams of the prompt and of the generated text (prompt lookup decoding) instead of a draft model, can be changed per request (default: %s)", params.speculative.lookup ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.speculative.lookup = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_LOOKUP"));
     add_opt(common_arg(
         {"-cd", "--ctx-size-draft"}, "N",
         string_format("size of the prompt context for the draft model (default: %d, 0 = loaded from model)", params.speculative.n_ctx),
@@ -1165,6 +1165,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.pooling_type      = params.pooling_type;
     cparams.attention_type    = params.attention_type;
     cparams.defrag_thold      = params.defrag_thold;
+    cparams.kv_block_size     = params.kv_block_size;
     cparams.cb_eval           = params.cb_eval;
     cparams.cb_eval_user_data = params.cb_eval_user_data;
     cparams.offload_kqv       = !params.no_kv_offload;
@@ -1301,17 +1302,25 @@ std::vector<llama_token> common_tokenize(
     const struct llama_vocab * vocab,
            const std::string & text,
                         bool   add_special,
-                        bool   parse_special) {
+                        bool   parse_special,
+                     int32_t   n_threads) {
+    const auto tokenize = [&](llama_token * tokens, int32_t n_tokens_max) {
+        if (n_threads == 1) {
+            return llama_tokenize(vocab, text.data(), text.length(), tokens, n_tokens_max, add_special, parse_special);
+        }
+        return llama_tokenize_parallel(vocab, text.data(), text.length(), tokens, n_tokens_max, add_special, parse_special, n_threads, 0);
+    };
+
     // upper limit for the number of tokens
     int n_tokens = text.length() + 2 * add_special;
     std::vector<llama_token> result(n_tokens);
-    n_tokens = llama_tokenize(vocab, text.data(), text.length(), result.data(), result.size(), add_special, parse_special);
+    n_tokens = tokenize(result.data(), result.size());
     if (n_tokens == std::numeric_limits<int32_t>::min()) {
         throw std::runtime_error("Tokenization failed: input text too large, tokenization result exceeds int32_t limit");
     }
     if (n_tokens < 0) {
         result.resize(-n_tokens);
-        int check = llama_tokenize(vocab, text.data(), text.length(), result.data(), result.size(), add_special, parse_special);
+        int check = tokenize(result.data(), result.size());
         GGML_ASSERT(check == -n_tokens);
     } else {
         result.resize(n_tokens);
@@ -1363,6 +1372,30 @@ std::string common_detokenize(const struct llama_vocab * vocab, const std::vecto
     return text;
 }
 
+std::string common_detokenizer_push(struct llama_detokenizer * detok, llama_token token, bool special) {
+    std::string text;
+    text.resize(text.capacity());
+    const int n_chars = llama_detokenizer_push(detok, token, &text[0], text.size(), special);
+    if (n_chars < 0) {
+        text.resize(-n_chars);
+        int check = llama_detokenizer_push(detok, token, &text[0], text.size(), special);
+        GGML_ASSERT(check == -n_chars);
+    } else {
+        text.resize(n_chars);
+    }
+
+    return text;
+}
+
+std::string common_detokenizer_flush(struct llama_detokenizer * detok) {
+    std::string text;
+    text.resize(llama_detokenizer_n_pending(detok));
+    const int n_chars = llama_detokenizer_flush(detok, &text[0], text.size());
+    GGML_ASSERT(n_chars == (int) text.size());
+
+    return text;
+}
+
 //
 // Embedding utils
 //
@@ -201,6 +201,8 @@ struct common_params_speculative {
     int32_t n_gpu_layers =    -1; // number of layers to store in VRAM for the draft model (-1 - use default)
     float   p_split      =  0.1f; // speculative decoding split probability
     float   p_min        = 0.75f; // minimum speculative decoding probability (greedy)
+    bool    adaptive     =  true; // adapt the draft length to the measured acceptance rate and draft cost
+    bool    lookup       = false; // draft from the n-grams of the prompt and of the generated text instead of a draft model
 
     ggml_type cache_type_k = GGML_TYPE_F16; // KV cache data type for the K
     ggml_type cache_type_v = GGML_TYPE_F16; // KV cache data type for the V
@@ -253,6 +255,7 @@ struct common_params {
     float   yarn_beta_slow        =  1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx         =     0; // YaRN original context length
     float   defrag_thold          =  0.1f; // KV cache defragmentation threshold
+    int32_t kv_block_size         =     0; // number of cells per block of the paged KV cache (0 = disabled)
 
     // offload params
     std::vector<ggml_backend_dev_t> devices; // devices to use for offloading
@@ -391,6 +394,7 @@ struct common_params {
     bool prefill_assistant = true;                                                                          // if true, any trailing assistant message will be prefilled into the response
 
     std::vector<std::string> api_keys;
+    std::map<std::string, int32_t> api_key_weights; // fair-share weight of each API key when slots are contended (default: 1)
 
     std::string ssl_file_key  = "";                                                                         // NOLINT
     std::string ssl_file_cert = "";                                                                         // NOLINT
@@ -409,6 +413,24 @@ struct common_params {
 
     float slot_prompt_similarity = 0.5f;
 
+    int32_t n_prefill_chunk = 0; // max prompt tokens per batch while other slots are generating (0 = n_batch)
+    bool    preempt         = false; // allow requests with a higher priority to preempt generating slots
+    int32_t priority_max    = 0;     // max priority a request can ask for, higher values are clamped
+
+    int32_t prefix_cache_min  = 0;     // min prefix length to attach from another slot via the shared prefix cache (0 = disabled)
+    int32_t prefix_cache_size = 65536; // max number of tokens indexed by the shared prefix cache (0 = unlimited)
+
+    int32_t     kv_spill_ram  = 0; // host memory budget in MiB for the states evicted from the KV cache (0 = disabled)
+    int32_t     kv_spill_disk = 0; // disk budget in MiB for the states evicted from the KV cache (0 = disabled)
+    std::string kv_spill_path;     // directory for the states spilled to disk
+
+    std::string prompt_store_path;         // directory of the persistent prompt store (empty = disabled)
+    int32_t     prompt_store_block = 256;  // the prompt prefixes are stored at multiples of this number of tokens
+    int32_t     prompt_store_hits  = 2;    // number of prompts that must share a prefix before it is stored
+    int32_t     prompt_store_size  = 4096; // disk budget in MiB of the prompt store (0 = unlimited)
+
+    bool logits_top_k = false; // copy only the top-k logits to host memory when the samplers of the batch allow it
+
     // batched-bench params
     bool is_pp_shared = false;
 
@@ -613,11 +635,13 @@ std::vector<llama_token> common_tokenize(
                         bool   add_special,
                         bool   parse_special = false);
 
+// n_threads != 1: long texts are split into chunks that are tokenized in parallel (see llama_tokenize_parallel)
 std::vector<llama_token> common_tokenize(
     const struct llama_vocab * vocab,
            const std::string & text,
                         bool   add_special,
-                        bool   parse_special = false);
+                        bool   parse_special = false,
+                     int32_t   n_threads     = 1);
 
 // tokenizes a token into a piece, optionally renders special/control tokens
 // should work similar to Python's `tokenizer.id_to_piece`
@@ -644,6 +668,15 @@ std::string common_detokenize(
         const std::vector<llama_token> & tokens,
                                   bool   special = true);
 
+// converts the next generated token into text, up to the last complete UTF-8 code point
+// the bytes of an incomplete code point are returned with one of the next tokens, or by common_detokenizer_flush
+std::string common_detokenizer_push(
+        struct llama_detokenizer * detok,
+                     llama_token   token,
+                            bool   special = true);
+
+std::string common_detokenizer_flush(struct llama_detokenizer * detok);
+
 //
 // Embedding utils
 //
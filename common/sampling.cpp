@@ -3,7 +3,13 @@
 #include "common.h"
 #include "log.h"
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <algorithm>
 
@@ -100,6 +106,133 @@ struct ring_buffer {
     std::vector<T> data;
 };
 
+// threads that are kept between short parallel loops, so that the loops do not create and join threads each time
+struct common_thread_pool {
+    ~common_thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv_start.notify_all();
+
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    // call fn(i) for each i in [0, n), on up to n_threads threads including the calling thread
+    // if fn throws, the remaining iterations are skipped and the first exception is rethrown on the calling thread
+    void parallel_for(int n_threads, int n, const std::function<void(int)> & fn) {
+        n_threads = std::max(1, std::min(n_threads, n));
+
+        if (n_threads == 1) {
+            for (int i = 0; i < n; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock_loop(mutex_loop);
+
+        while ((int) workers.size() < n_threads - 1) {
+            workers.emplace_back(&common_thread_pool::worker, this, (int) workers.size());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            this->fn = &fn;
+            this->n  = n;
+
+            n_workers = n_threads - 1;
+            n_running = n_workers;
+            error     = nullptr;
+            next      = 0;
+
+            generation++;
+        }
+        cv_start.notify_all();
+
+        run();
+
+        std::exception_ptr err;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_done.wait(lock, [&]() { return n_running == 0; });
+
+            this->fn = nullptr;
+
+            std::swap(err, error);
+        }
+
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+
+private:
+    void worker(int iw) {
+        uint64_t seen = 0;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv_start.wait(lock, [&]() { return stop || generation != seen; });
+            if (stop) {
+                return;
+            }
+            seen = generation;
+
+            if (iw >= n_workers) {
+                continue;
+            }
+
+            lock.unlock();
+            run();
+            lock.lock();
+
+            if (--n_running == 0) {
+                cv_done.notify_one();
+            }
+        }
+    }
+
+    void run() {
+        try {
+            for (int i = next++; i < n; i = next++) {
+                (*fn)(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next = n;
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    // one loop at a time
+    std::mutex mutex_loop;
+
+    std::mutex              mutex;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+
+    // the current loop, protected by mutex
+    const std::function<void(int)> * fn = nullptr;
+
+    int      n          = 0;
+    int      n_workers  = 0; // the workers that take part in the loop
+    int      n_running  = 0; // the workers that have not finished the loop yet
+    uint64_t generation = 0;
+    bool     stop       = false;
+
+    std::exception_ptr error;
+
+    std::atomic<int> next { 0 };
+};
+
 struct common_sampler {
     common_params_sampling params;
 
@@ -113,20 +246,19 @@ struct common_sampler {
     llama_token_data_array cur_p;
 
     void set_logits(struct llama_context * ctx, int idx) {
-        const auto * logits = llama_get_logits_ith(ctx, idx);
-
-        const llama_model * model = llama_get_model(ctx);
-        const llama_vocab * vocab = llama_model_get_vocab(model);
+        // only the top k logits were output - they are already sorted
+        set_logits(llama_get_logits_ith(ctx, idx), llama_get_logits_ids_ith(ctx, idx), llama_n_logits(ctx));
+    }
 
-        const int n_vocab = llama_vocab_n_tokens(vocab);
+    void set_logits(const float * logits, const llama_token * ids, int n_logits) {
+        cur.resize(n_logits);
 
-        cur.resize(n_vocab);
+        cur_p = { cur.data(), cur.size(), -1, false };
 
-        for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-            cur[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
-        }
+        // otherwise build only the candidates that the samplers can select
+        llama_token_data_array_from_logits(&cur_p, logits, ids, n_logits, ids ? 0 : common_sampler_n_logits(this));
 
-        cur_p = { cur.data(), cur.size(), -1, false };
+        cur_p.sorted = cur_p.sorted || ids != nullptr;
     }
 };
 
@@ -335,8 +467,8 @@ void common_perf_print(const struct llama_context * ctx, const struct common_sam
     }
 }
 
-llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first) {
-    gsmpl->set_logits(ctx, idx);
+static llama_token common_sampler_sample_impl(struct common_sampler * gsmpl, const float * logits, const llama_token * ids, int n_logits, bool grammar_first) {
+    gsmpl->set_logits(logits, ids, n_logits);
 
     auto & grmr  = gsmpl->grmr;
     auto & chain = gsmpl->chain;
@@ -371,7 +503,7 @@ llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_co
 
     // resampling:
     // if the token is not valid, sample again, but first apply the grammar sampler and then the sampling chain
-    gsmpl->set_logits(ctx, idx);
+    gsmpl->set_logits(logits, ids, n_logits);
 
     llama_sampler_apply(grmr,  &cur_p);
     llama_sampler_apply(chain, &cur_p);
@@ -381,6 +513,42 @@ llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_co
     return cur_p.data[cur_p.selected].id;
 }
 
+llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first) {
+    return common_sampler_sample_impl(gsmpl, llama_get_logits_ith(ctx, idx), llama_get_logits_ids_ith(ctx, idx), llama_n_logits(ctx), grammar_first);
+}
+
+std::vector<llama_token> common_sampler_sample_batch(const std::vector<struct common_sampler *> & gsmpls, struct llama_context * ctx, const std::vector<int> & idxs, bool grammar_first) {
+    GGML_ASSERT(gsmpls.size() == idxs.size() && "gsmpls.size() must be idxs.size()");
+
+    const int n = gsmpls.size();
+
+    std::vector<llama_token> result(n);
+
+    if (n == 0) {
+        return result;
+    }
+
+    // read the outputs on this thread, so that the context is synchronized only once
+    std::vector<const float *>       logits(n);
+    std::vector<const llama_token *> ids(n);
+
+    for (int i = 0; i < n; ++i) {
+        logits[i] = llama_get_logits_ith(ctx, idxs[i]);
+        ids[i]    = llama_get_logits_ids_ith(ctx, idxs[i]);
+    }
+
+    const int n_logits = llama_n_logits(ctx);
+
+    // the threads are kept between the calls, this is called for every decoded batch
+    static common_thread_pool pool;
+
+    pool.parallel_for(llama_n_threads(ctx), n, [&](int i) {
+        result[i] = common_sampler_sample_impl(gsmpls[i], logits[i], ids[i], n_logits, grammar_first);
+    });
+
+    return result;
+}
+
 std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sampler * gsmpl, struct llama_context * ctx, const std::vector<int> & idxs, const llama_tokens & draft, bool grammar_first) {
     GGML_ASSERT(idxs.size() == draft.size() + 1 && "idxs.size() must be draft.size() + 1");
 
@@ -424,12 +592,25 @@ uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl) {
     return llama_sampler_get_seed(gsmpl->chain);
 }
 
+void common_sampler_prefetch(const struct common_sampler * gsmpl) {
+    llama_sampler_prefetch(gsmpl->grmr);
+}
+
 // helpers
 
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl) {
     return &gsmpl->cur_p;
 }
 
+int32_t common_sampler_n_logits(const struct common_sampler * gsmpl) {
+    // the grammar and the probabilities of the candidates need the full logits
+    if (!gsmpl->params.grammar.empty() || gsmpl->params.n_probs > 0) {
+        return 0;
+    }
+
+    return llama_sampler_n_logits(gsmpl->chain);
+}
+
 llama_token common_sampler_last(const struct common_sampler * gsmpl) {
     return gsmpl->prev.rat(0);
 }
@@ -60,6 +60,19 @@ void common_perf_print(const struct llama_context * ctx, const struct common_sam
 //
 llama_token common_sampler_sample(struct common_sampler * gsmpl, struct llama_context * ctx, int idx, bool grammar_first = false);
 
+// sample a token for each of the (sampler, output index) pairs, in parallel using up to llama_n_threads(ctx) threads
+//
+//      common_sampler_sample_batch({ gsmpl_0, gsmpl_1 }, ctx, { idx_0, idx_1 });
+//
+// is equivalent to
+//
+//      common_sampler_sample(gsmpl_0, ctx, idx_0);
+//      common_sampler_sample(gsmpl_1, ctx, idx_1);
+//
+// the samplers must be distinct; the tokens are not accepted
+//
+std::vector<llama_token> common_sampler_sample_batch(const std::vector<struct common_sampler *> & gsmpls, struct llama_context * ctx, const std::vector<int> & idxs, bool grammar_first = false);
+
 // generalized version of common_sampler_sample
 //
 // will cross-reference the sampled tokens with a batch of draft tokens and accept those that match
@@ -83,11 +96,20 @@ std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sample
 
 uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl);
 
+// precompute the tokens allowed by the grammar for the next sample (see llama_sampler_prefetch)
+// can run on another thread while the next batch is evaluated
+void common_sampler_prefetch(const struct common_sampler * gsmpl);
+
 // helpers
 
 // access the internal list of current candidate tokens
 llama_token_data_array * common_sampler_get_candidates(struct common_sampler * gsmpl);
 
+// number of top logits that the sampler needs to sample exactly the same as with the full logits
+// returns 0 if the sampler needs the full logits (grammar, logit bias, penalties before top-k, etc.)
+// can be passed to llama_set_logits_top_k() to avoid copying the full logits to host memory
+int32_t common_sampler_n_logits(const struct common_sampler * gsmpl);
+
 // get the last accepted token
 llama_token common_sampler_last(const struct common_sampler * gsmpl);
 
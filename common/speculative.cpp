@@ -14,15 +14,19 @@ struct common_speculative {
     struct llama_context * ctx;
     struct common_sampler * smpl;
 
+    llama_seq_id seq_id;
+
     llama_batch batch;
     llama_tokens prompt;
 };
 
 struct common_speculative * common_speculative_init(
-        struct llama_context * ctx_dft) {
+        struct llama_context * ctx_dft,
+        llama_seq_id seq_id) {
     auto * result = new common_speculative {
         /* .ctx    = */ ctx_dft,
         /* .smpl   = */ nullptr,
+        /* .seq_id = */ seq_id,
         /* .batch  = */ llama_batch_init(llama_n_batch(ctx_dft), 0, 1),
         /* .prompt = */ {},
     };
@@ -59,6 +63,9 @@ struct common_speculative * common_speculative_init(
     }
 #endif
 
+    // the draft sampler only looks at the top candidates - do not copy the full logits of the draft model
+    llama_set_logits_top_k(ctx_dft, common_sampler_n_logits(result->smpl));
+
     return result;
 }
 
@@ -139,21 +146,38 @@ llama_tokens common_speculative_gen_draft(
         struct common_speculative_params params,
         const llama_tokens & prompt_tgt,
         llama_token id_last) {
-    auto & batch  = spec->batch;
-    auto & ctx    = spec->ctx;
-    auto & smpl   = spec->smpl;
-    auto & prompt = spec->prompt;
+    std::vector<common_speculative_draft> drafts = {
+        { spec, params, &prompt_tgt, id_last, {} },
+    };
+
+    common_speculative_gen_drafts(drafts);
+
+    return std::move(drafts[0].result);
+}
+
+// reuse as much as possible from the old draft context
+// returns false if the draft could be taken entirely from the previous one, otherwise the remaining tokens of the
+// prompt are left in prompt_tgt[i_new:] and need to be evaluated before sampling
+static bool common_speculative_prepare(common_speculative_draft & draft, int & i_new) {
+    const auto & params     = draft.params;
+    const auto & prompt_tgt = *draft.prompt;
+
+    auto & ctx    = draft.spec->ctx;
+    auto & prompt = draft.spec->prompt;
+    auto & result = draft.result;
+
+    const llama_seq_id seq_id = draft.spec->seq_id;
 
     auto * mem = llama_get_memory(ctx);
 
     int reuse_i = 0;
     int reuse_n = 0;
 
-    const int n_ctx = llama_n_ctx(ctx) - params.n_draft;
+    // the draft context is split evenly between the sequences
+    const int n_ctx = llama_n_ctx(ctx) / llama_n_seq_max(ctx) - params.n_draft;
 
     const int i_start = std::max<int>(0, (int) prompt_tgt.size() - n_ctx);
 
-    // reuse as much as possible from the old draft context
     // ideally, the draft context should be as big as the target context and we will always reuse the entire prompt
     for (int i = 0; i < (int) prompt.size(); ++i) {
         int cur = 0;
@@ -169,19 +193,19 @@ llama_tokens common_speculative_gen_draft(
         }
     }
 
-    LOG_DBG("%s: reuse_i = %d, reuse_n = %d, prompt = %d\n", __func__, reuse_i, reuse_n, (int) prompt.size());
+    LOG_DBG("%s: seq_id = %d, reuse_i = %d, reuse_n = %d, prompt = %d\n", __func__, seq_id, reuse_i, reuse_n, (int) prompt.size());
 
-    llama_tokens result;
+    result.clear();
     result.reserve(params.n_draft);
 
     if (reuse_n == 0) {
-        llama_memory_clear(mem, false);
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
 
         prompt.clear();
     } else {
         // this happens when a previous draft has been discarded (for example, due to being too small), but the
         // target model agreed with it. in this case, we simply pass back the previous results to save compute
-        if (reuse_i + reuse_n < (int) prompt.size() && prompt[reuse_i + reuse_n] == id_last) {
+        if (reuse_i + reuse_n < (int) prompt.size() && prompt[reuse_i + reuse_n] == draft.id_last) {
             for (int i = reuse_i + reuse_n + 1; i < (int) prompt.size(); ++i) {
                 result.push_back(prompt[i]);
 
@@ -190,91 +214,219 @@ llama_tokens common_speculative_gen_draft(
                 }
             }
 
-            return result;
+            return false;
         }
 
         if (reuse_i > 0) {
-            llama_memory_seq_rm (mem, 0, 0, reuse_i);
-            llama_memory_seq_add(mem, 0, reuse_i, -1, -reuse_i);
+            llama_memory_seq_rm (mem, seq_id, 0, reuse_i);
+            llama_memory_seq_add(mem, seq_id, reuse_i, -1, -reuse_i);
 
             prompt.erase(prompt.begin(), prompt.begin() + reuse_i);
         }
 
         if (reuse_n < (int) prompt.size()) {
-            llama_memory_seq_rm (mem, 0, reuse_n, -1);
+            llama_memory_seq_rm (mem, seq_id, reuse_n, -1);
 
             prompt.erase(prompt.begin() + reuse_n, prompt.end());
         }
     }
 
-    // prepare a batch to evaluate any new tokens in the prompt
-    common_batch_clear(batch);
+    common_sampler_reset(draft.spec->smpl);
+
+    i_new = i_start + reuse_n;
+
+    return true;
+}
 
-    for (size_t i = i_start + reuse_n; i < prompt_tgt.size(); ++i) {
-        //LOG_DBG("i = %d, i_start = %d, reuse_n = %d, i - i_start = %d, id = %6d\n", i, i_start, reuse_n, i - i_start, prompt_tgt[i]);
-        common_batch_add(batch, prompt_tgt[i], i - i_start, { 0 }, false);
+// sample the next token of the draft from the output idx of the last batch
+// returns true if the draft should be extended further
+static bool common_speculative_sample(common_speculative_draft & draft, int idx) {
+    auto & ctx  = draft.spec->ctx;
+    auto & smpl = draft.spec->smpl;
 
-        prompt.push_back(prompt_tgt[i]);
+    common_sampler_sample(smpl, ctx, idx, true);
+
+    const auto * cur_p = common_sampler_get_candidates(smpl);
+
+    for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
+        LOG_DBG(" - draft candidate %3d, seq %3d, pos %3d: %6d (%8.3f) '%s'\n",
+                k, draft.spec->seq_id, (int) draft.result.size(), cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
     }
 
-    // we should rarely end-up here during normal decoding
-    if (batch.n_tokens > 0) {
-        //LOG_DBG("%s: draft prompt batch: %s\n", __func__, string_from(ctx, batch).c_str());
+    // add drafted token for each sequence
+    const llama_token id = cur_p->data[0].id;
 
-        llama_decode(ctx, batch);
+    common_sampler_accept(smpl, id, true);
+
+    draft.result.push_back(id);
+
+    if (draft.params.n_draft <= (int) draft.result.size()) {
+        return false;
+    }
+
+    // only collect very high-confidence draft tokens
+    if (cur_p->data[0].p < draft.params.p_min) {
+        return false;
+    }
+
+    return true;
+}
+
+void common_speculative_gen_drafts(std::vector<common_speculative_draft> & drafts) {
+    if (drafts.empty()) {
+        return;
     }
 
-    const llama_pos n_past = prompt.size();
+    // all speculators share the same draft context, so the batch of the first one is used for all sequences
+    auto & ctx   = drafts[0].spec->ctx;
+    auto & batch = drafts[0].spec->batch;
 
-    LOG_DBG("%s: n_past = %d\n", __func__, n_past);
+    const int n_batch = llama_n_batch(ctx);
+
+    // the drafts with an output in the current batch, and the index of that output
+    std::vector<std::pair<common_speculative_draft *, int>> queued;
+
+    // the drafts that need to be extended by one more token
+    std::vector<common_speculative_draft *> active;
 
     common_batch_clear(batch);
-    common_batch_add  (batch, id_last, n_past, { 0 }, true);
 
-    prompt.push_back(id_last);
+    auto decode = [&]() {
+        if (batch.n_tokens == 0) {
+            return;
+        }
 
-    //LOG_DBG("%s: draft prompt: %s\n", __func__, string_from(ctx, prompt).c_str());
+        llama_decode(ctx, batch);
 
-    llama_decode(ctx, batch);
+        for (auto & [draft, idx] : queued) {
+            if (common_speculative_sample(*draft, idx)) {
+                active.push_back(draft);
+            }
+        }
 
-    common_sampler_reset(smpl);
+        queued.clear();
 
-    // sample n_draft tokens from the draft model
-    for (int i = 0; i < params.n_draft; ++i) {
         common_batch_clear(batch);
+    };
+
+    auto add = [&](common_speculative_draft & draft, llama_token id, bool output) {
+        if (batch.n_tokens >= n_batch) {
+            decode();
+        }
 
-        common_sampler_sample(smpl, ctx, 0, true);
+        auto & prompt = draft.spec->prompt;
 
-        const auto * cur_p = common_sampler_get_candidates(smpl);
+        if (output) {
+            queued.emplace_back(&draft, batch.n_tokens);
+        }
+
+        common_batch_add(batch, id, prompt.size(), { draft.spec->seq_id }, output);
+
+        prompt.push_back(id);
+    };
 
-        for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
-            LOG_DBG(" - draft candidate %3d, pos %3d: %6d (%8.3f) '%s'\n",
-                    k, i, cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
+    // evaluate the new tokens of all prompts followed by their last token, in as few batches as possible
+    // we should rarely end-up with more than a few new tokens per sequence during normal decoding
+    for (auto & draft : drafts) {
+        GGML_ASSERT(draft.spec->ctx == ctx);
+
+        int i_new = 0;
+        if (!common_speculative_prepare(draft, i_new)) {
+            continue;
         }
 
-        // add drafted token for each sequence
-        const llama_token id = cur_p->data[0].id;
+        const auto & prompt_tgt = *draft.prompt;
+
+        for (size_t i = i_new; i < prompt_tgt.size(); ++i) {
+            add(draft, prompt_tgt[i], false);
+        }
+
+        add(draft, draft.id_last, true);
+    }
 
-        common_sampler_accept(smpl, id, true);
+    decode();
 
-        result.push_back(id);
+    // sample the drafts in lockstep, one token of each active draft per batch
+    while (!active.empty()) {
+        auto cur = std::move(active);
+        active.clear();
 
-        if (params.n_draft <= (int) result.size()) {
-            break;
+        for (auto * draft : cur) {
+            add(*draft, draft->result.back(), true);
         }
 
-        // only collect very high-confidence draft tokens
-        if (cur_p->data[0].p < params.p_min) {
-            break;
+        decode();
+    }
+}
+
+//
+// common_speculative_stats
+//
+
+void common_speculative_stats::reset() {
+    *this = {};
+}
+
+float common_speculative_stats::p_accept() const {
+    return n_tested > 0.0f ? n_accept / n_tested : 0.0f;
+}
+
+void common_speculative_stats::update_accept(int32_t n_drafted, int32_t n_accepted) {
+    // the tokens after the first rejected one are not tested
+    const int32_t n_test = std::min(n_drafted, n_accepted + 1);
+
+    n_tested = decay*n_tested + n_test;
+    n_accept = decay*n_accept + n_accepted;
+
+    n_verified++;
+}
+
+void common_speculative_stats::update_cost(double t_draft, double t_verify, double t_step) {
+    if (t_step <= 0.0) {
+        return;
+    }
+
+    const float c = (t_draft + t_verify) / t_step;
+
+    cost = cost > 0.0f ? decay*cost + (1.0f - decay)*c : c;
+}
+
+int32_t common_speculative_stats::next(int32_t n_min, int32_t n_max) {
+    if (n_verified < n_warmup || cost <= 0.0f) {
+        n_draft = -1;
+        return n_max;
+    }
+
+    const float p = std::min(p_accept(), 0.999f);
+
+    // expected number of tokens per unit of cost, without draft it is 1
+    float   best_gain = 1.0f;
+    int32_t best_n    = 0;
+
+    float p_n = p; // p^(n+1)
+    for (int32_t n = 1; n <= n_max; ++n) {
+        p_n *= p;
+
+        const float gain = (1.0f - p_n)/(1.0f - p) / (1.0f + n*cost);
+
+        if (n >= n_min && gain > best_gain) {
+            best_gain = gain;
+            best_n    = n;
         }
+    }
 
-        common_batch_add(batch, id, n_past + i + 1, { 0 }, true);
+    n_draft = best_n;
 
-        // evaluate the drafted tokens on the draft model
-        llama_decode(ctx, batch);
+    if (n_draft > 0) {
+        n_idle = 0;
+        return n_draft;
+    }
 
-        prompt.push_back(id);
+    // draft from time to time anyway, to notice when the acceptance rate improves
+    if (++n_idle >= n_probe) {
+        n_idle = 0;
+        return std::max(n_min, 1);
     }
 
-    return result;
+    return 0;
 }
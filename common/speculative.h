@@ -12,7 +12,8 @@ struct common_speculative_params {
     float p_min = 0.75f; // min probability required to accept a token in the draft
 };
 
-struct common_speculative * common_speculative_init(struct llama_context * ctx_dft);
+// the draft context can be shared by several speculators, each one using a different sequence of it
+struct common_speculative * common_speculative_init(struct llama_context * ctx_dft, llama_seq_id seq_id = 0);
 
 void common_speculative_free(struct common_speculative * spec);
 
@@ -26,3 +27,51 @@ llama_tokens common_speculative_gen_draft(
         struct common_speculative_params   params,
                       const llama_tokens & prompt,
                              llama_token   id_last);
+
+struct common_speculative_draft {
+    struct common_speculative * spec;
+
+    struct common_speculative_params params;
+
+    const llama_tokens * prompt; // the tokens in the target context
+    llama_token          id_last;
+
+    llama_tokens result; // output
+};
+
+// same as common_speculative_gen_draft(), for several speculators that share the same draft context
+// the drafts of all sequences are sampled in lockstep, with a single llama_decode() per drafted position
+void common_speculative_gen_drafts(std::vector<common_speculative_draft> & drafts);
+
+// online statistics of the speculative decoding of a sequence, used to pick the length of the next draft
+// each draft token is assumed to be accepted with the same probability p, independently of the previous ones, so
+// that a draft of n tokens yields (1 - p^(n+1))/(1 - p) tokens per step of the target model. the cost of such a step
+// is 1 + n*c, where c is the cost of drafting and verifying one token relative to a step without draft
+struct common_speculative_stats {
+    static constexpr float   decay     = 0.9f; // weight of the past observations, per draft
+    static constexpr int32_t n_warmup  = 4;    // number of verified drafts before the estimates are used
+    static constexpr int32_t n_probe   = 16;   // number of steps between two drafts while drafting is not profitable
+    static constexpr int32_t n_refresh = 64;   // number of steps with draft between two measurements of a step without
+
+    float n_tested = 0.0f; // decayed number of tested draft tokens
+    float n_accept = 0.0f; // decayed number of accepted draft tokens
+    float cost     = 0.0f; // relative cost of a draft token, EMA
+
+    int32_t n_verified = 0;  // number of verified drafts
+    int32_t n_draft    = -1; // length of the next draft (0 = paused, -1 = not estimated yet)
+    int32_t n_idle     = 0;  // number of steps without draft while paused
+
+    void reset();
+
+    float p_accept() const;
+
+    // n_drafted tokens were tested, the first n_accepted of them were accepted
+    void update_accept(int32_t n_drafted, int32_t n_accepted);
+
+    // t_draft is the time to draft one token, t_verify the additional time of the step of the target model per draft
+    // token and t_step the time of a step of the target model without any draft token
+    void update_cost(double t_draft, double t_verify, double t_step);
+
+    // length of the next draft, between n_min and n_max, or 0 if no draft should be made at this step
+    int32_t next(int32_t n_min, int32_t n_max);
+};
@@ -529,6 +529,7 @@ extern "C" {
         GGML_OP_OPT_STEP_ADAMW,
 
         GGML_OP_GLU,
+        GGML_OP_ARGSORT_TOP_K,
 
         GGML_OP_COUNT,
     };
@@ -2022,6 +2023,14 @@ extern "C" {
             struct ggml_tensor  * a,
             int                   k);
 
+    // indices of the top k elements per row, in descending order
+    // same result as ggml_top_k, but computed as a single op that only partially sorts each row
+    // result is I32 [k, ne1, ne2, ne3]
+    GGML_API struct ggml_tensor * ggml_argsort_top_k(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            int                   k);
+
 #define GGML_KQ_MASK_PAD 64
 
     // q:    [n_embd_k, n_batch,     n_head,    ne3 ]
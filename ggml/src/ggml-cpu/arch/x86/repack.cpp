@@ -175,6 +175,80 @@ static inline __m256i mul_sum_i8_pairs_acc_int32x8(const __m256i acc, const __m2
 }
 #endif
 
+#if defined(__AVX2__)
+// The repacked Q8_0, Q5_K, Q6_K and IQ4_XS blocks interleave 8 rows in chunks of 8 bytes: a 256 bit vector holds a chunk
+// of rows 0-3 and the next one holds the same chunk of rows 4-7. The products with a chunk of the activations, broadcast
+// to the four 64 bit lanes, are accumulated in two int32 for each row
+
+// add the two int32 of each row and return the sums of the 8 rows in order
+static inline __m256i hsum_rows_int32x8(const __m256i rows_0123, const __m256i rows_4567) {
+    // R0 R1 R4 R5 | R2 R3 R6 R7
+    const __m256i sums = _mm256_hadd_epi32(rows_0123, rows_4567);
+    return _mm256_permute4x64_epi64(sums, 0xD8);
+}
+
+// broadcast the 64 bit chunk of activations to the four 64 bit lanes
+static inline __m256i load_chunk_int8x8(const int8_t * x) {
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) x));
+}
+
+// spread the int16 scales of the 8 rows over the four int16 of each row in the vectors of rows 0-3 and of rows 4-7
+static inline void spread_scales_int16x8(const __m128i scales, __m256i & scales_0123, __m256i & scales_4567) {
+    const __m256i s = _mm256_broadcastsi128_si256(scales);
+    scales_0123 = _mm256_shuffle_epi8(s, _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3,
+                                                          4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7));
+    scales_4567 = _mm256_shuffle_epi8(s, _mm256_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 10, 11, 10, 11, 10, 11, 10, 11,
+                                                          12, 13, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15, 14, 15));
+}
+
+// unsigned quants of 8 rows times a chunk of activations, weighted by the int16 scales of the rows
+static inline __m256i mul_scale_us8_acc_int32x8(const __m256i acc, const __m256i q, const __m256i a, const __m256i scales) {
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(q, a), scales));
+}
+
+// signed quants of 8 rows times a chunk of activations, weighted by the int16 scales of the rows
+static inline __m256i mul_scale_i8_acc_int32x8(const __m256i acc, const __m256i q, const __m256i a, const __m256i scales) {
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(q, q), _mm256_sign_epi8(a, q)), scales));
+}
+
+// products of the int16 scales of two sub blocks of 8 rows, interleaved row by row, with the sums of the activations
+// of the two sub blocks
+static inline __m256i mul_bsums_acc_int32x8(const __m256i acc, const __m256i scales, int16_t bsum_0, int16_t bsum_1) {
+    const __m256i bsums = _mm256_set1_epi32((int32_t) (((uint32_t) (uint16_t) bsum_1 << 16) | (uint16_t) bsum_0));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(scales, bsums));
+}
+
+// the 6 bit scales and mins of the 8 sub blocks of 8 rows of a block_q5_Kx8, unpacked as in block_q4_Kx8:
+// the scales of sub block i at utmp + 16*i and its mins at utmp + 16*i + 8
+static inline void unpack_scales_mins_Kx8(const uint8_t * scales, uint32_t * utmp) {
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    for (int sb = 0; sb < 8; sb++) {
+        memcpy(utmp + sb * 4, scales + sb * 12, 12);
+        utmp[sb * 4 + 3] = ((utmp[sb * 4 + 2] >> 4) & kmask2) | (((utmp[sb * 4 + 1] >> 6) & kmask3) << 4);
+        const uint32_t uaux_0 = utmp[sb * 4 + 1] & kmask1;
+        utmp[sb * 4 + 1] = (utmp[sb * 4 + 2] & kmask2) | (((utmp[sb * 4 + 0] >> 6) & kmask3) << 4);
+        utmp[sb * 4 + 2] = uaux_0;
+        utmp[sb * 4 + 0] &= kmask1;
+    }
+}
+
+// the scales of the 8 sub blocks of 8 rows of a block_iq4_xsx8, minus 32, the 8 rows of sub block i at scales + 8*i
+static inline void unpack_scales_iq4_xsx8(const block_iq4_xsx8 * b, int16_t * scales) {
+    const __m256i scales_h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) b->scales_h));
+    const __m256i scales_l = _mm256_loadu_si256((const __m256i *) b->scales_l);
+
+    for (int ib = 0; ib < QK_K / 32; ib++) {
+        const __m256i l = _mm256_and_si256(_mm256_srl_epi32(scales_l, _mm_cvtsi32_si128(4 * ib)), _mm256_set1_epi32(0xF));
+        const __m256i h = _mm256_and_si256(_mm256_srl_epi32(scales_h, _mm_cvtsi32_si128(2 * ib)), _mm256_set1_epi32(3));
+        const __m256i ls = _mm256_sub_epi32(_mm256_or_si256(l, _mm256_slli_epi32(h, 4)), _mm256_set1_epi32(32));
+        _mm_storeu_si128((__m128i *) (scales + ib * 8), _mm_packs_epi32(_mm256_castsi256_si128(ls), _mm256_extracti128_si256(ls, 1)));
+    }
+}
+#endif
+
 void ggml_quantize_mat_q8_0_4x8(const float * GGML_RESTRICT x, void * GGML_RESTRICT vy, int64_t k) {
     assert(QK8_0 == 32);
     assert(k % QK8_0 == 0);
@@ -990,6 +1064,274 @@ void ggml_gemv_q4_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
 #endif
 }
 
+void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+        for (int b = 0; b < nb; b++) {
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+            for (int k = 0; k < 4; k++) {
+                const __m256i lhs = load_chunk_int8x8(a_ptr[b].qs + k * 8);
+                iacc_0123 = mul_sum_i8_pairs_acc_int32x8(iacc_0123, _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + k * 64)), lhs);
+                iacc_4567 = mul_sum_i8_pairs_acc_int32x8(iacc_4567, _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + k * 64 + 32)), lhs);
+            }
+            const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+            const __m256 row_scale_f32 = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d));
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+        }
+        _mm256_storeu_ps(s + x * ncols_interleaved, acc_row);
+    }
+    UNUSED(bs);
+    UNUSED(nr);
+#else
+    ggml_gemv_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m5b = _mm256_set1_epi8(0x10);
+
+    uint32_t utmp[32];
+
+    const block_q8_K * a_ptr = (const block_q8_K *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_q5_Kx8 * b_ptr = (const block_q5_Kx8 *) vx + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+        __m256 acc_min_rows = _mm256_setzero_ps();
+        for (int b = 0; b < nb; b++) {
+            unpack_scales_mins_Kx8(b_ptr[b].scales, utmp);
+            const uint8_t * scales = (const uint8_t *) utmp;
+
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+            __m256i iacc_min = _mm256_setzero_si256();
+
+            // the sub blocks 2*p and 2*p + 1 are in the low and high nibbles of the chunks 4*p to 4*p + 3 of qs, with
+            // their fifth bits in the bits 2*p and 2*p + 1 of the chunks of qh
+            for (int p = 0; p < 4; p++) {
+                __m256i scales_0_0123, scales_0_4567, scales_1_0123, scales_1_4567;
+                spread_scales_int16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (scales + p * 32))), scales_0_0123, scales_0_4567);
+                spread_scales_int16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (scales + p * 32 + 16))), scales_1_0123, scales_1_4567);
+
+                const __m128i shift = _mm_cvtsi32_si128(2 * p);
+                for (int c = 0; c < 4; c++) {
+                    const __m256i qs_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (p * 4 + c) * 64));
+                    const __m256i qs_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (p * 4 + c) * 64 + 32));
+                    const __m256i qh_0123 = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + c * 64)), shift);
+                    const __m256i qh_4567 = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + c * 64 + 32)), shift);
+
+                    const __m256i q_0_0123 = _mm256_or_si256(_mm256_and_si256(qs_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 4), m5b));
+                    const __m256i q_0_4567 = _mm256_or_si256(_mm256_and_si256(qs_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 4), m5b));
+                    const __m256i q_1_0123 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_0123, 4), m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 3), m5b));
+                    const __m256i q_1_4567 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_4567, 4), m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 3), m5b));
+
+                    const __m256i lhs_0 = load_chunk_int8x8(a_ptr[b].qs + p * 64 + c * 8);
+                    const __m256i lhs_1 = load_chunk_int8x8(a_ptr[b].qs + p * 64 + c * 8 + 32);
+
+                    iacc_0123 = mul_scale_us8_acc_int32x8(iacc_0123, q_0_0123, lhs_0, scales_0_0123);
+                    iacc_4567 = mul_scale_us8_acc_int32x8(iacc_4567, q_0_4567, lhs_0, scales_0_4567);
+                    iacc_0123 = mul_scale_us8_acc_int32x8(iacc_0123, q_1_0123, lhs_1, scales_1_0123);
+                    iacc_4567 = mul_scale_us8_acc_int32x8(iacc_4567, q_1_4567, lhs_1, scales_1_4567);
+                }
+
+                const __m256i mins = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (scales + p * 32 + 8)),
+                                                                            _mm_loadl_epi64((const __m128i *) (scales + p * 32 + 24))));
+                iacc_min = mul_bsums_acc_int32x8(iacc_min, mins,
+                                                 a_ptr[b].bsums[p * 4 + 0] + a_ptr[b].bsums[p * 4 + 1],
+                                                 a_ptr[b].bsums[p * 4 + 2] + a_ptr[b].bsums[p * 4 + 3]);
+            }
+
+            const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d);
+            const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+            const __m256 col_dmin_f32  = GGML_F32Cx8_LOAD(b_ptr[b].dmin);
+
+            acc_row      = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+            acc_min_rows = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc_min), _mm256_mul_ps(col_dmin_f32, row_scale_f32), acc_min_rows);
+        }
+        _mm256_storeu_ps(s + x * ncols_interleaved, _mm256_sub_ps(acc_row, acc_min_rows));
+    }
+    UNUSED(bs);
+    UNUSED(nr);
+#else
+    ggml_gemv_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m2b = _mm256_set1_epi8(0x30);
+
+    const block_q8_K * a_ptr = (const block_q8_K *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+        for (int b = 0; b < nb; b++) {
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+
+            // the quants are stored with an offset of 32, subtracted at the end as 32 * scale * bsum for each sub block
+            __m256i iacc_offset = _mm256_setzero_si256();
+            for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                const __m256i scales = _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + sb * 8)),
+                                                                              _mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + sb * 8 + 8))));
+                iacc_offset = mul_bsums_acc_int32x8(iacc_offset, scales, a_ptr[b].bsums[sb], a_ptr[b].bsums[sb + 1]);
+            }
+
+            // each half of the super block has its lower bits in 8 chunks of ql and its upper bits in 4 chunks of qh,
+            // the 4 quants of a byte of qh belong to sub blocks 2 apart
+            for (int h = 0; h < 2; h++) {
+                // the chunks 2*kk and 2*kk + 1 share the sub blocks, their products are added in int16 before the scales
+                for (int kk = 0; kk < 2; kk++) {
+                    const int sb = h * 8 + kk;
+
+                    __m256i scales_0123[4], scales_4567[4];
+                    for (int t = 0; t < 4; t++) {
+                        spread_scales_int16x8(_mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + (sb + 2 * t) * 8))), scales_0123[t], scales_4567[t]);
+                    }
+
+                    __m256i p_0123[4], p_4567[4];
+                    for (int t = 0; t < 4; t++) {
+                        p_0123[t] = _mm256_setzero_si256();
+                        p_4567[t] = _mm256_setzero_si256();
+                    }
+
+                    for (int k = kk * 2; k < kk * 2 + 2; k++) {
+                        const __m256i ql_0_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k) * 64));
+                        const __m256i ql_0_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k) * 64 + 32));
+                        const __m256i ql_1_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k + 4) * 64));
+                        const __m256i ql_1_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k + 4) * 64 + 32));
+                        const __m256i qh_0123   = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + (h * 4 + k) * 64));
+                        const __m256i qh_4567   = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + (h * 4 + k) * 64 + 32));
+
+                        const __m256i q_0123[4] = {
+                            _mm256_or_si256(_mm256_and_si256(ql_0_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 4), m2b)),
+                            _mm256_or_si256(_mm256_and_si256(ql_1_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 2), m2b)),
+                            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0_0123, 4), m4b), _mm256_and_si256(qh_0123, m2b)),
+                            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_1_0123, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m2b)),
+                        };
+                        const __m256i q_4567[4] = {
+                            _mm256_or_si256(_mm256_and_si256(ql_0_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 4), m2b)),
+                            _mm256_or_si256(_mm256_and_si256(ql_1_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 2), m2b)),
+                            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0_4567, 4), m4b), _mm256_and_si256(qh_4567, m2b)),
+                            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_1_4567, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m2b)),
+                        };
+
+                        for (int t = 0; t < 4; t++) {
+                            const __m256i lhs = load_chunk_int8x8(a_ptr[b].qs + h * 128 + k * 8 + t * 32);
+                            p_0123[t] = _mm256_add_epi16(p_0123[t], _mm256_maddubs_epi16(q_0123[t], lhs));
+                            p_4567[t] = _mm256_add_epi16(p_4567[t], _mm256_maddubs_epi16(q_4567[t], lhs));
+                        }
+                    }
+
+                    for (int t = 0; t < 4; t++) {
+                        iacc_0123 = _mm256_add_epi32(iacc_0123, _mm256_madd_epi16(p_0123[t], scales_0123[t]));
+                        iacc_4567 = _mm256_add_epi32(iacc_4567, _mm256_madd_epi16(p_4567[t], scales_4567[t]));
+                    }
+                }
+            }
+
+            const __m256i iacc = _mm256_sub_epi32(hsum_rows_int32x8(iacc_0123, iacc_4567), _mm256_slli_epi32(iacc_offset, 5));
+
+            const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d);
+            const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+        }
+        _mm256_storeu_ps(s + x * ncols_interleaved, acc_row);
+    }
+    UNUSED(bs);
+    UNUSED(nr);
+#else
+    ggml_gemv_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+
+    int16_t scales[QK_K / 32 * 8];
+
+    const block_q8_K * a_ptr = (const block_q8_K *) vy;
+    for (int x = 0; x < nc / ncols_interleaved; x++) {
+        const block_iq4_xsx8 * b_ptr = (const block_iq4_xsx8 *) vx + (x * nb);
+
+        __m256 acc_row = _mm256_setzero_ps();
+        for (int b = 0; b < nb; b++) {
+            unpack_scales_iq4_xsx8(b_ptr + b, scales);
+
+            __m256i iacc_0123 = _mm256_setzero_si256();
+            __m256i iacc_4567 = _mm256_setzero_si256();
+
+            // each sub block of 32 is in 2 chunks, with the quants 16 apart in the two nibbles of a byte
+            for (int ib = 0; ib < QK_K / 32; ib++) {
+                __m256i scales_0123, scales_4567;
+                spread_scales_int16x8(_mm_loadu_si128((const __m128i *) (scales + ib * 8)), scales_0123, scales_4567);
+
+                for (int k = 0; k < 2; k++) {
+                    const __m256i qs_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (ib * 2 + k) * 64));
+                    const __m256i qs_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (ib * 2 + k) * 64 + 32));
+
+                    const __m256i lhs_0 = load_chunk_int8x8(a_ptr[b].qs + ib * 32 + k * 8);
+                    const __m256i lhs_1 = load_chunk_int8x8(a_ptr[b].qs + ib * 32 + k * 8 + 16);
+
+                    iacc_0123 = mul_scale_i8_acc_int32x8(iacc_0123, _mm256_shuffle_epi8(values, _mm256_and_si256(qs_0123, m4b)), lhs_0, scales_0123);
+                    iacc_4567 = mul_scale_i8_acc_int32x8(iacc_4567, _mm256_shuffle_epi8(values, _mm256_and_si256(qs_4567, m4b)), lhs_0, scales_4567);
+                    iacc_0123 = mul_scale_i8_acc_int32x8(iacc_0123, _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(qs_0123, 4), m4b)), lhs_1, scales_0123);
+                    iacc_4567 = mul_scale_i8_acc_int32x8(iacc_4567, _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(qs_4567, 4), m4b)), lhs_1, scales_4567);
+                }
+            }
+
+            const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d);
+            const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+            acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123, iacc_4567)), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+        }
+        _mm256_storeu_ps(s + x * ncols_interleaved, acc_row);
+    }
+    UNUSED(bs);
+    UNUSED(nr);
+#else
+    ggml_gemv_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
 void ggml_gemm_q4_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
     const int qk = QK8_0;
     const int nb = n / qk;
@@ -3283,3 +3625,305 @@ void ggml_gemm_q4_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
     }
 #endif
 }
+
+void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + (x * nb);
+
+            __m256 acc_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for (int b = 0; b < nb; b++) {
+                __m256i iacc_0123[4], iacc_4567[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                }
+                for (int k = 0; k < 4; k++) {
+                    const __m256i rhs_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + k * 64));
+                    const __m256i rhs_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + k * 64 + 32));
+                    for (int m = 0; m < 4; m++) {
+                        const __m256i lhs = load_chunk_int8x8(a_ptr[b].qs + k * 32 + m * 8);
+                        iacc_0123[m] = mul_sum_i8_pairs_acc_int32x8(iacc_0123[m], rhs_0123, lhs);
+                        iacc_4567[m] = mul_sum_i8_pairs_acc_int32x8(iacc_4567[m], rhs_4567, lhs);
+                    }
+                }
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    const __m256 row_scale_f32 = _mm256_set1_ps(GGML_CPU_FP16_TO_FP32(a_ptr[b].d[m]));
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123[m], iacc_4567[m])), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * ncols_interleaved, acc_rows[m]);
+            }
+        }
+    }
+#else
+    ggml_gemm_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m5b = _mm256_set1_epi8(0x10);
+
+    uint32_t utmp[32];
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = (const block_q8_Kx4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q5_Kx8 * b_ptr = (const block_q5_Kx8 *) vx + (x * nb);
+
+            __m256 acc_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            __m256 acc_min_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for (int b = 0; b < nb; b++) {
+                unpack_scales_mins_Kx8(b_ptr[b].scales, utmp);
+                const uint8_t * scales = (const uint8_t *) utmp;
+
+                __m256i iacc_0123[4], iacc_4567[4], iacc_min[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                    iacc_min[m]  = _mm256_setzero_si256();
+                }
+
+                for (int p = 0; p < 4; p++) {
+                    __m256i scales_0_0123, scales_0_4567, scales_1_0123, scales_1_4567;
+                    spread_scales_int16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (scales + p * 32))), scales_0_0123, scales_0_4567);
+                    spread_scales_int16x8(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (scales + p * 32 + 16))), scales_1_0123, scales_1_4567);
+
+                    const __m128i shift = _mm_cvtsi32_si128(2 * p);
+                    for (int c = 0; c < 4; c++) {
+                        const __m256i qs_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (p * 4 + c) * 64));
+                        const __m256i qs_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (p * 4 + c) * 64 + 32));
+                        const __m256i qh_0123 = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + c * 64)), shift);
+                        const __m256i qh_4567 = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + c * 64 + 32)), shift);
+
+                        const __m256i q_0_0123 = _mm256_or_si256(_mm256_and_si256(qs_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 4), m5b));
+                        const __m256i q_0_4567 = _mm256_or_si256(_mm256_and_si256(qs_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 4), m5b));
+                        const __m256i q_1_0123 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_0123, 4), m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 3), m5b));
+                        const __m256i q_1_4567 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_4567, 4), m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 3), m5b));
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m256i lhs_0 = load_chunk_int8x8(a_ptr[b].qs + (p * 8 + c) * 32 + m * 8);
+                            const __m256i lhs_1 = load_chunk_int8x8(a_ptr[b].qs + (p * 8 + c + 4) * 32 + m * 8);
+
+                            iacc_0123[m] = mul_scale_us8_acc_int32x8(iacc_0123[m], q_0_0123, lhs_0, scales_0_0123);
+                            iacc_4567[m] = mul_scale_us8_acc_int32x8(iacc_4567[m], q_0_4567, lhs_0, scales_0_4567);
+                            iacc_0123[m] = mul_scale_us8_acc_int32x8(iacc_0123[m], q_1_0123, lhs_1, scales_1_0123);
+                            iacc_4567[m] = mul_scale_us8_acc_int32x8(iacc_4567[m], q_1_4567, lhs_1, scales_1_4567);
+                        }
+                    }
+
+                    // the sums of the 16 activations of row m are at bsums[(g / 4) * 16 + m * 4 + g % 4] for group g
+                    const __m256i mins = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (scales + p * 32 + 8)),
+                                                                                _mm_loadl_epi64((const __m128i *) (scales + p * 32 + 24))));
+                    for (int m = 0; m < 4; m++) {
+                        const int16_t * bsums = a_ptr[b].bsums + p * 16 + m * 4;
+                        iacc_min[m] = mul_bsums_acc_int32x8(iacc_min[m], mins, bsums[0] + bsums[1], bsums[2] + bsums[3]);
+                    }
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                const __m256 col_dmin_f32  = GGML_F32Cx8_LOAD(b_ptr[b].dmin);
+                for (int m = 0; m < 4; m++) {
+                    const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d[m]);
+                    acc_rows[m]     = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123[m], iacc_4567[m])), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                    acc_min_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc_min[m]), _mm256_mul_ps(col_dmin_f32, row_scale_f32), acc_min_rows[m]);
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * ncols_interleaved, _mm256_sub_ps(acc_rows[m], acc_min_rows[m]));
+            }
+        }
+    }
+#else
+    ggml_gemm_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m2b = _mm256_set1_epi8(0x30);
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = (const block_q8_Kx4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + (x * nb);
+
+            __m256 acc_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for (int b = 0; b < nb; b++) {
+                __m256i iacc_0123[4], iacc_4567[4], iacc_offset[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m]   = _mm256_setzero_si256();
+                    iacc_4567[m]   = _mm256_setzero_si256();
+                    iacc_offset[m] = _mm256_setzero_si256();
+                }
+
+                // the quants are stored with an offset of 32, subtracted at the end as 32 * scale * bsum for each sub block
+                for (int sb = 0; sb < QK_K / 16; sb += 2) {
+                    const __m256i scales = _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + sb * 8)),
+                                                                                  _mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + sb * 8 + 8))));
+                    for (int m = 0; m < 4; m++) {
+                        const int16_t * bsums = a_ptr[b].bsums + (sb / 4) * 16 + m * 4 + sb % 4;
+                        iacc_offset[m] = mul_bsums_acc_int32x8(iacc_offset[m], scales, bsums[0], bsums[1]);
+                    }
+                }
+
+                for (int h = 0; h < 2; h++) {
+                    // the chunks kk and kk + 1 share the sub blocks, their scales are decoded once
+                    for (int kk = 0; kk < 4; kk += 2) {
+                        const int sb = h * 8 + kk / 2;
+
+                        __m256i scales_0123[4], scales_4567[4];
+                        for (int t = 0; t < 4; t++) {
+                            spread_scales_int16x8(_mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *) (b_ptr[b].scales + (sb + 2 * t) * 8))), scales_0123[t], scales_4567[t]);
+                        }
+
+                        for (int k = kk; k < kk + 2; k++) {
+                            const __m256i ql_0_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k) * 64));
+                            const __m256i ql_0_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k) * 64 + 32));
+                            const __m256i ql_1_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k + 4) * 64));
+                            const __m256i ql_1_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].ql + (h * 8 + k + 4) * 64 + 32));
+                            const __m256i qh_0123   = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + (h * 4 + k) * 64));
+                            const __m256i qh_4567   = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qh + (h * 4 + k) * 64 + 32));
+
+                            const __m256i q_0123[4] = {
+                                _mm256_or_si256(_mm256_and_si256(ql_0_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 4), m2b)),
+                                _mm256_or_si256(_mm256_and_si256(ql_1_0123, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_0123, 2), m2b)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0_0123, 4), m4b), _mm256_and_si256(qh_0123, m2b)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_1_0123, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh_0123, 2), m2b)),
+                            };
+                            const __m256i q_4567[4] = {
+                                _mm256_or_si256(_mm256_and_si256(ql_0_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 4), m2b)),
+                                _mm256_or_si256(_mm256_and_si256(ql_1_4567, m4b), _mm256_and_si256(_mm256_slli_epi16(qh_4567, 2), m2b)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0_4567, 4), m4b), _mm256_and_si256(qh_4567, m2b)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_1_4567, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh_4567, 2), m2b)),
+                            };
+
+                            for (int t = 0; t < 4; t++) {
+                                for (int m = 0; m < 4; m++) {
+                                    const __m256i lhs = load_chunk_int8x8(a_ptr[b].qs + (h * 16 + k + t * 4) * 32 + m * 8);
+                                    iacc_0123[m] = mul_scale_us8_acc_int32x8(iacc_0123[m], q_0123[t], lhs, scales_0123[t]);
+                                    iacc_4567[m] = mul_scale_us8_acc_int32x8(iacc_4567[m], q_4567[t], lhs, scales_4567[t]);
+                                }
+                            }
+                        }
+                    }
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    const __m256i iacc = _mm256_sub_epi32(hsum_rows_int32x8(iacc_0123[m], iacc_4567[m]), _mm256_slli_epi32(iacc_offset[m], 5));
+                    const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d[m]);
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * ncols_interleaved, acc_rows[m]);
+            }
+        }
+    }
+#else
+    ggml_gemm_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+
+    int16_t scales[QK_K / 32 * 8];
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_Kx4 * a_ptr = (const block_q8_Kx4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_iq4_xsx8 * b_ptr = (const block_iq4_xsx8 *) vx + (x * nb);
+
+            __m256 acc_rows[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+            for (int b = 0; b < nb; b++) {
+                unpack_scales_iq4_xsx8(b_ptr + b, scales);
+
+                __m256i iacc_0123[4], iacc_4567[4];
+                for (int m = 0; m < 4; m++) {
+                    iacc_0123[m] = _mm256_setzero_si256();
+                    iacc_4567[m] = _mm256_setzero_si256();
+                }
+
+                for (int ib = 0; ib < QK_K / 32; ib++) {
+                    __m256i scales_0123, scales_4567;
+                    spread_scales_int16x8(_mm_loadu_si128((const __m128i *) (scales + ib * 8)), scales_0123, scales_4567);
+
+                    for (int k = 0; k < 2; k++) {
+                        const __m256i qs_0123 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (ib * 2 + k) * 64));
+                        const __m256i qs_4567 = _mm256_loadu_si256((const __m256i *) (b_ptr[b].qs + (ib * 2 + k) * 64 + 32));
+
+                        const __m256i q_0_0123 = _mm256_shuffle_epi8(values, _mm256_and_si256(qs_0123, m4b));
+                        const __m256i q_0_4567 = _mm256_shuffle_epi8(values, _mm256_and_si256(qs_4567, m4b));
+                        const __m256i q_1_0123 = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(qs_0123, 4), m4b));
+                        const __m256i q_1_4567 = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(qs_4567, 4), m4b));
+
+                        for (int m = 0; m < 4; m++) {
+                            const __m256i lhs_0 = load_chunk_int8x8(a_ptr[b].qs + (ib * 4 + k) * 32 + m * 8);
+                            const __m256i lhs_1 = load_chunk_int8x8(a_ptr[b].qs + (ib * 4 + k + 2) * 32 + m * 8);
+
+                            iacc_0123[m] = mul_scale_i8_acc_int32x8(iacc_0123[m], q_0_0123, lhs_0, scales_0123);
+                            iacc_4567[m] = mul_scale_i8_acc_int32x8(iacc_4567[m], q_0_4567, lhs_0, scales_4567);
+                            iacc_0123[m] = mul_scale_i8_acc_int32x8(iacc_0123[m], q_1_0123, lhs_1, scales_0123);
+                            iacc_4567[m] = mul_scale_i8_acc_int32x8(iacc_4567[m], q_1_4567, lhs_1, scales_4567);
+                        }
+                    }
+                }
+
+                const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+                for (int m = 0; m < 4; m++) {
+                    const __m256 row_scale_f32 = _mm256_set1_ps(a_ptr[b].d[m]);
+                    acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hsum_rows_int32x8(iacc_0123[m], iacc_4567[m])), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                _mm256_storeu_ps(s + (y * 4 + m) * bs + x * ncols_interleaved, acc_rows[m]);
+            }
+        }
+    }
+#else
+    ggml_gemm_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
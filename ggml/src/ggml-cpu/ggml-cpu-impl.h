@@ -506,6 +506,32 @@ static __m256 __lasx_xvreplfr2vr_s(const float val) {
 }
 #endif
 
+// GGML_NUMA_STRATEGY_SPLIT is active, see ggml_numa_place_tensor
+bool ggml_numa_is_split(void);
+
+// the rows [ir0, ir1) of a matrix with nr rows that are placed on the given node with GGML_NUMA_STRATEGY_SPLIT
+static inline void ggml_numa_split_rows(int64_t nr, int n_nodes, int node, int64_t * ir0, int64_t * ir1) {
+    *ir0 = nr*node/n_nodes;
+    *ir1 = nr*(node + 1)/n_nodes;
+}
+
+// the rows [ir0, ir1) of a matrix with nr rows that are computed by thread ith of nth with GGML_NUMA_STRATEGY_SPLIT:
+// thread ith runs on node ith % n_nodes (see set_numa_thread_affinity) and only takes rows of its node, nth >= n_nodes
+static inline void ggml_numa_split_thread_rows(int64_t nr, int n_nodes, int ith, int nth, int64_t * ir0, int64_t * ir1) {
+    const int node     = ith % n_nodes;
+    const int ith_node = ith / n_nodes;
+    const int nth_node = (nth - node + n_nodes - 1) / n_nodes;
+
+    int64_t ir0_node;
+    int64_t ir1_node;
+    ggml_numa_split_rows(nr, n_nodes, node, &ir0_node, &ir1_node);
+
+    const int64_t dr = (ir1_node - ir0_node + nth_node - 1) / nth_node;
+
+    *ir0 = ir0_node + dr*ith_node < ir1_node ? ir0_node + dr*ith_node : ir1_node;
+    *ir1 = *ir0 + dr < ir1_node ? *ir0 + dr : ir1_node;
+}
+
 // TODO: move to ggml-threading
 void ggml_barrier(struct ggml_threadpool * tp);
 
@@ -431,6 +431,59 @@ typedef pthread_mutex_t    ggml_mutex_t;
 
 #endif
 
+// maximum number of nodes with work in a segment of the graph scheduled as a DAG
+#define GGML_SCHED_MAX_NODES 64
+
+// maximum distance between a ROPE and the CPY of its result that it is fused with
+#define GGML_FUSION_MAX_ROPE_CPY 16
+
+// sequences of nodes computed by a single kernel, see ggml_graph_fuse
+enum ggml_fusion {
+    GGML_FUSION_NONE = 0,
+    GGML_FUSION_ADD_RMS_NORM_MUL, // [ADD ->] RMS_NORM [-> MUL]
+    GGML_FUSION_MUL_MAT_ADD,      // MUL_MAT -> ADD of a bias
+    GGML_FUSION_SILU_MUL,         // UNARY(SILU) -> MUL
+    GGML_FUSION_ROPE_CPY,         // ROPE -> CPY to F16
+};
+
+// the graph is split into segments: a node that needs all the threads in lockstep (e.g. it uses barriers or shared
+// work data) is a segment on its own, while the consecutive nodes that split their work only by ith/nth form a DAG,
+// whose chunks are distributed through per-thread work-stealing deques, with a single barrier at the end of the segment
+struct ggml_sched_node {
+    int32_t n_tasks;      // chunks of the node, 0 if it has no work
+    int32_t n_deps;       // nodes of the segment that must be computed before
+    int32_t succ;         // offset of the nodes that depend on it in ggml_sched::succ
+    int32_t n_succ;
+    size_t  wdata;        // offset of the work data of the node
+
+    int32_t fusion;       // enum ggml_fusion, for the first node of a fused sequence
+    int32_t fused[2];     // the other nodes of the sequence, -1 if unused
+    int32_t fused_into;   // the first node of the sequence that computes this node, -1 if none
+
+    atomic_int n_deps_left;
+    atomic_int n_tasks_left;
+    int32_t    next_task; // protected by the lock of the deque that holds the node
+};
+
+struct ggml_sched_segment {
+    int32_t begin;
+    int32_t end;
+    int32_t n_nodes;      // nodes with work, scheduled as a DAG if > 1
+
+    atomic_int n_done;
+};
+
+struct ggml_sched {
+    struct ggml_sched_node    * nodes;
+    struct ggml_sched_segment * segments;
+    int32_t                   * succ;
+
+    int32_t n_nodes_max;
+    int32_t n_segments;
+    int32_t n_succ;
+    int32_t n_succ_max;
+};
+
 // Threadpool def
 struct ggml_threadpool {
     ggml_mutex_t mutex;       // mutex for cond.var
@@ -457,6 +510,8 @@ struct ggml_threadpool {
     int32_t      prio;        // Scheduling priority
     uint32_t     poll;        // Polling level (0 - no polling)
 
+    struct ggml_sched sched;  // segments of the current graph
+
     enum ggml_status ec;
 };
 
@@ -470,6 +525,12 @@ struct ggml_compute_state {
 #endif
     struct ggml_threadpool * threadpool;
     int ith;
+
+    // nodes of the current segment with chunks left, the owner takes the last one and the other threads the first one
+    atomic_flag GGML_CACHE_ALIGN sched_lock;
+    int32_t sched_head;
+    int32_t sched_tail;
+    int32_t sched_queue[GGML_SCHED_MAX_NODES];
 };
 
 // Helpers for polling loops
@@ -492,6 +553,9 @@ static inline void ggml_thread_cpu_relax(void) {;}
 #define GGML_NUMA_MAX_NODES 8
 #define GGML_NUMA_MAX_CPUS 512
 
+// the largest batch (columns of src1) for which the matrix multiplications follow the rows placed with GGML_NUMA_STRATEGY_SPLIT
+#define GGML_NUMA_SPLIT_MAX_BATCH 32
+
 struct ggml_numa_node {
     uint32_t cpus[GGML_NUMA_MAX_CPUS]; // hardware threads on this node
     uint32_t n_cpus;
@@ -516,6 +580,8 @@ struct ggml_numa_nodes {
 
 struct ggml_state {
     struct ggml_numa_nodes numa;
+
+    bool disable_fusion; // GGML_CPU_DISABLE_FUSION
 };
 
 static struct ggml_state g_state = {0};
@@ -673,6 +739,83 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
+bool ggml_numa_is_split(void) {
+    return ggml_is_numa() && g_state.numa.numa_strategy == GGML_NUMA_STRATEGY_SPLIT;
+}
+
+#if defined(__gnu_linux__) && defined(SYS_move_pages)
+static bool ggml_numa_move_pages_failed = false;
+
+static bool ggml_numa_move_pages(void ** pages, int * nodes, int * status, int n_pages) {
+    // MPOL_MF_MOVE from <numaif.h>, which is not installed everywhere
+    const int mpol_mf_move = 1 << 1;
+
+    // the pages that cannot be moved are reported in status and are left where they are
+    if (syscall(SYS_move_pages, 0, (unsigned long) n_pages, pages, nodes, status, mpol_mf_move) < 0) {
+        GGML_LOG_WARN("%s: move_pages() failed: %s, the weights are left where they are\n", __func__, strerror(errno));
+        ggml_numa_move_pages_failed = true;
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+void ggml_numa_place_tensor(const struct ggml_tensor * tensor) {
+#if defined(__gnu_linux__) && defined(SYS_move_pages)
+    // the tensors of the extra buffer types (repack, AMX, ...) are not multiplied by ggml_compute_forward_mul_mat
+    if (!ggml_numa_is_split() || ggml_numa_move_pages_failed ||
+        tensor->data == NULL || tensor->extra != NULL || tensor->ne[1] < (int64_t) g_state.numa.n_nodes) {
+        return;
+    }
+
+    const uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    enum { n_batch = 1024 };
+
+    void * pages [n_batch];
+    int    nodes [n_batch];
+    int    status[n_batch];
+    int    n_pages = 0;
+
+    for (int64_t i3 = 0; i3 < tensor->ne[3]; i3++) {
+        for (int64_t i2 = 0; i2 < tensor->ne[2]; i2++) {
+            const uintptr_t base = (uintptr_t) tensor->data + i2*tensor->nb[2] + i3*tensor->nb[3];
+
+            for (int node = 0; node < (int) g_state.numa.n_nodes; node++) {
+                int64_t ir0;
+                int64_t ir1;
+                ggml_numa_split_rows(tensor->ne[1], g_state.numa.n_nodes, node, &ir0, &ir1);
+
+                // a page across the boundary of two nodes stays with the first one
+                const uintptr_t p0 = (base + ir0*tensor->nb[1] + page_size - 1) & ~(page_size - 1);
+                const uintptr_t p1 =  base + ir1*tensor->nb[1];
+
+                for (uintptr_t p = p0; p < p1; p += page_size) {
+                    // move_pages skips the pages that are not mapped yet, e.g. the pages of an mmap that is not prefetched
+                    (void) *(volatile const char *) p;
+
+                    pages[n_pages] = (void *) p;
+                    nodes[n_pages] = node;
+                    if (++n_pages == n_batch) {
+                        if (!ggml_numa_move_pages(pages, nodes, status, n_pages)) {
+                            return;
+                        }
+                        n_pages = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    if (n_pages > 0) {
+        ggml_numa_move_pages(pages, nodes, status, n_pages);
+    }
+#else
+    UNUSED(tensor);
+#endif
+}
+
 #if defined(__ARM_ARCH)
 
 #if defined(__linux__) && defined(__aarch64__)
@@ -1103,9 +1246,11 @@ void ggml_set_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
 
 // ggml_compute_forward_mul_mat
 
+// add is the ADD of a bias fused with the MUL_MAT (see ggml_graph_fuse) or NULL: the result is written to it instead of dst
 static void ggml_compute_forward_mul_mat_one_chunk(
     const struct ggml_compute_params * params,
     struct ggml_tensor * dst,
+    const struct ggml_tensor * add,
     const enum ggml_type type,
     const int64_t num_rows_per_vec_dot,
     const int64_t ir0_start,
@@ -1185,6 +1330,18 @@ static void ggml_compute_forward_mul_mat_one_chunk(
                     vec_dot(ne00, &tmp[ir0 - iir0], (num_rows_per_vec_dot > 1 ? 16 : 0), src0_row + ir0 * nb01, (num_rows_per_vec_dot > 1 ? nb01 : 0), src1_col, (num_rows_per_vec_dot > 1 ? src1_col_stride : 0), num_rows_per_vec_dot);
                 }
 
+                if (add) {
+                    const float * bias    = (const float *) add->src[1]->data;
+                    float       * add_col = (float *) ((char *) add->data + ((char *) dst_col - (char *) dst->data));
+
+                    for (int cn = 0; cn < num_rows_per_vec_dot; ++cn) {
+                        for (int64_t ir0 = iir0; ir0 < MIN(iir0 + blck_0, ir0_end); ++ir0) {
+                            add_col[ir0 + cn * nb1 / nb0] = tmp[cn * 16 + ir0 - iir0] + bias[ir0];
+                        }
+                    }
+                    continue;
+                }
+
                 for (int cn = 0; cn < num_rows_per_vec_dot; ++cn) {
                     memcpy(&dst_col[iir0 + cn * nb1 / nb0], tmp + (cn * 16), (MIN(iir0 + blck_0, ir0_end) - iir0) * sizeof(float));
                 }
@@ -1193,9 +1350,38 @@ static void ggml_compute_forward_mul_mat_one_chunk(
     }
 }
 
-void ggml_compute_forward_mul_mat(
+#if GGML_USE_LLAMAFILE
+// adds the bias of a fused ADD to the result of llamafile_sgemm, once all the threads have written it
+static void ggml_compute_forward_mul_mat_bias(
         const struct ggml_compute_params * params,
-              struct ggml_tensor * dst) {
+        const struct ggml_tensor * dst,
+              struct ggml_tensor * add) {
+
+    const float * bias = (const float *) add->src[1]->data;
+
+    const int64_t ne0 = dst->ne[0];
+    const int64_t ne1 = dst->ne[1];
+    const int64_t ne2 = dst->ne[2];
+    const int64_t nr  = ggml_nrows(dst);
+
+    ggml_barrier(params->threadpool);
+
+    for (int64_t ir = params->ith; ir < nr; ir += params->nth) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        const size_t offs = i1*dst->nb[1] + i2*dst->nb[2] + i3*dst->nb[3];
+
+        ggml_vec_add_f32(ne0, (float *) ((char *) add->data + offs), (const float *) ((const char *) dst->data + offs), bias);
+    }
+}
+#endif
+
+static void ggml_compute_forward_mul_mat_add(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst,
+              struct ggml_tensor * add) {
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -1227,6 +1413,14 @@ void ggml_compute_forward_mul_mat(
     // nb01 >= nb00 - src0 is not transposed
     //   compute by src0 rows
 
+    // with GGML_NUMA_STRATEGY_SPLIT, the rows of the weights are spread over the nodes by ggml_numa_place_tensor
+    // and the threads of each node only multiply the rows of their node
+    // this only pays off while the multiplication is bound by the reads of the weights: the larger batches are left to
+    // llamafile_sgemm, which reuses each row of the weights for many columns of src1
+    const bool numa_split = ggml_numa_is_split() && nth >= (int) g_state.numa.n_nodes && ne01 >= (int64_t) g_state.numa.n_nodes &&
+        ne11 <= GGML_NUMA_SPLIT_MAX_BATCH &&
+        src0->buffer && ggml_backend_buffer_get_usage(src0->buffer) == GGML_BACKEND_BUFFER_USAGE_WEIGHTS;
+
     // TODO: extract to "extra_op"
 #if GGML_USE_LLAMAFILE
     // broadcast factors
@@ -1235,7 +1429,8 @@ void ggml_compute_forward_mul_mat(
 
     const bool src1_cont = ggml_is_contiguous(src1);
 
-    if (src1_cont) {
+    // llamafile_sgemm distributes its tiles over all the threads, regardless of the node of the rows
+    if (src1_cont && !numa_split) {
         for (int64_t i13 = 0; i13 < ne13; i13++)
             for (int64_t i12 = 0; i12 < ne12; i12++)
                 if (!llamafile_sgemm(params,
@@ -1250,6 +1445,9 @@ void ggml_compute_forward_mul_mat(
                                      src1->type,
                                      dst->type))
                     goto UseGgmlGemm1;
+        if (add) {
+            ggml_compute_forward_mul_mat_bias(params, dst, add);
+        }
         return;
     }
 UseGgmlGemm1:;
@@ -1300,7 +1498,7 @@ UseGgmlGemm1:;
     ggml_barrier(params->threadpool);
 
 #if GGML_USE_LLAMAFILE
-    if (src1->type != vec_dot_type) {
+    if (src1->type != vec_dot_type && !numa_split) {
         const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
@@ -1318,6 +1516,9 @@ UseGgmlGemm1:;
                                      vec_dot_type,
                                      dst->type))
                     goto UseGgmlGemm2;
+        if (add) {
+            ggml_compute_forward_mul_mat_bias(params, dst, add);
+        }
         return;
     }
 UseGgmlGemm2:;
@@ -1329,6 +1530,20 @@ UseGgmlGemm2:;
     // This is the size of the rest of the dimensions of the result
     const int64_t nr1 = ne1 * ne2 * ne3;
 
+    if (numa_split) {
+        int64_t ir0_start;
+        int64_t ir0_end;
+        ggml_numa_split_thread_rows(nr0, g_state.numa.n_nodes, ith, nth, &ir0_start, &ir0_end);
+
+        int64_t num_rows_per_vec_dot = vec_dot_num_rows;
+        if ((nr0 % 2 != 0) || (ne11 % 2 != 0) || ((ir0_end - ir0_start) % 2 != 0) || (nr1 % 2 != 0)) {
+            num_rows_per_vec_dot = 1;
+        }
+        ggml_compute_forward_mul_mat_one_chunk(params, dst, add, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, 0, nr1);
+
+        return;
+    }
+
     // Now select a reasonable chunk size.
     int chunk_size = 16;
 
@@ -1377,7 +1592,7 @@ UseGgmlGemm2:;
         if ((nr0 % 2 != 0) || (ne11 % 2 != 0) || ((ir0_end - ir0_start) % 2 != 0) || ((ir1_end - ir1_start) % 2 != 0)) {
             num_rows_per_vec_dot = 1;
         }
-        ggml_compute_forward_mul_mat_one_chunk(params, dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
+        ggml_compute_forward_mul_mat_one_chunk(params, dst, add, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
 
         if (nth >= nchunk0 * nchunk1) {
             break;
@@ -1387,6 +1602,12 @@ UseGgmlGemm2:;
     }
 }
 
+void ggml_compute_forward_mul_mat(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+    ggml_compute_forward_mul_mat_add(params, dst, NULL);
+}
+
 // ggml_compute_forward_mul_mat_id
 
 #define MMID_MATRIX_ROW(row_id, i1) matrix_rows[(row_id)*ids->ne[0]*ids->ne[1] + (i1)]
@@ -1918,6 +2139,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_argsort(params, tensor);
             } break;
+        case GGML_OP_ARGSORT_TOP_K:
+            {
+                ggml_compute_forward_argsort_top_k(params, tensor);
+            } break;
         case GGML_OP_LEAKY_RELU:
             {
                 ggml_compute_forward_leaky_relu(params, tensor);
@@ -2036,7 +2261,9 @@ static void set_numa_thread_affinity(int thread_n) {
 
     switch(g_state.numa.numa_strategy) {
         case GGML_NUMA_STRATEGY_DISTRIBUTE:
+        case GGML_NUMA_STRATEGY_SPLIT:
             // run thread on node_num thread_n / (threads per node)
+            // GGML_NUMA_STRATEGY_SPLIT: ggml_compute_forward_mul_mat relies on this mapping
             node_num = thread_n % g_state.numa.n_nodes;
             break;
         case GGML_NUMA_STRATEGY_ISOLATE:
@@ -2254,6 +2481,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_ARANGE:
         case GGML_OP_TIMESTEP_EMBEDDING:
         case GGML_OP_ARGSORT:
+        case GGML_OP_ARGSORT_TOP_K:
         case GGML_OP_FLASH_ATTN_EXT:
         case GGML_OP_FLASH_ATTN_BACK:
         case GGML_OP_SSM_CONV:
@@ -2587,6 +2815,10 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
     ggml_cond_destroy(&threadpool->cond);
 #endif // GGML_USE_OPENMP
 
+    free(threadpool->sched.nodes);
+    free(threadpool->sched.segments);
+    free(threadpool->sched.succ);
+
     const size_t workers_size = sizeof(struct ggml_compute_state) * n_threads;
     ggml_aligned_free(threadpool->workers, workers_size);
     ggml_aligned_free(threadpool, sizeof(struct ggml_threadpool));
@@ -2631,6 +2863,224 @@ void ggml_threadpool_resume(struct ggml_threadpool * threadpool) {
 #endif
 }
 
+// ops that split their work only by ith/nth, without barriers, shared chunk counters or work data shared between threads:
+// their chunks can run in any order, and concurrently with the chunks of the nodes that they do not depend on
+static bool ggml_graph_node_is_schedulable(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+        case GGML_OP_DUP:
+        case GGML_OP_ADD:
+        case GGML_OP_ADD1:
+        case GGML_OP_SUB:
+        case GGML_OP_MUL:
+        case GGML_OP_DIV:
+        case GGML_OP_SQR:
+        case GGML_OP_SQRT:
+        case GGML_OP_LOG:
+        case GGML_OP_SIN:
+        case GGML_OP_COS:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_L2_NORM:
+        case GGML_OP_SCALE:
+        case GGML_OP_CPY:
+        case GGML_OP_CONT:
+        case GGML_OP_GET_ROWS:
+        case GGML_OP_SET_ROWS:
+        case GGML_OP_SOFT_MAX:
+        case GGML_OP_ROPE:
+        case GGML_OP_CLAMP:
+        case GGML_OP_UNARY:
+        case GGML_OP_GLU:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ggml_graph_node_has_work(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+            return false;
+        default:
+            return !ggml_is_empty(node);
+    }
+}
+
+// part of the work buffer reserved for a node of a DAG: the ops that use a slice of it per thread add a cache line to each
+static size_t ggml_sched_work_size(size_t cur, int n_threads) {
+    return cur > 0 ? GGML_PAD(cur + CACHE_LINE_SIZE*n_threads, CACHE_LINE_SIZE) : 0;
+}
+
+// size of the work buffer used by a node
+static size_t ggml_graph_node_work_size(struct ggml_tensor * node, int n_threads, int n_tasks) {
+    size_t cur = 0;
+
+    if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
+        switch (node->op) {
+            case GGML_OP_CPY:
+            case GGML_OP_DUP:
+                {
+                    if (ggml_is_quantized(node->type) ||
+                        // F16 -> BF16 and BF16 -> F16 copies go through intermediate F32
+                        (node->src[0]->type == GGML_TYPE_F16  && node->src[1] && node->src[1]->type == GGML_TYPE_BF16) ||
+                        (node->src[0]->type == GGML_TYPE_BF16 && node->src[1] && node->src[1]->type == GGML_TYPE_F16)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_ADD:
+            case GGML_OP_ADD1:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_ACC:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_COUNT_EQUAL:
+                {
+                    cur = ggml_type_size(node->type)*n_tasks;
+                } break;
+            case GGML_OP_ARGSORT_TOP_K:
+                {
+                    cur = sizeof(int32_t)*(node->src[0]->ne[0] + CACHE_LINE_SIZE_F32)*n_tasks;
+                } break;
+            case GGML_OP_MUL_MAT:
+                {
+                    const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
+
+                    if (node->src[1]->type != vec_dot_type) {
+                        cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
+                    }
+                } break;
+            case GGML_OP_MUL_MAT_ID:
+                {
+                    cur = 0;
+                    const struct ggml_tensor * src0 = node->src[0];
+                    const struct ggml_tensor * src1 = node->src[1];
+                    const struct ggml_tensor * ids = node->src[2];
+                    const enum ggml_type vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
+                    const int n_as = src0->ne[2];
+                    // src1
+                    if (src1->type != vec_dot_type) {
+                        cur += ggml_row_size(vec_dot_type, ggml_nelements(src1)) + sizeof(int64_t);
+                    }
+                    // matrix_row_counts
+                    cur += n_as * sizeof(int64_t) + sizeof(int64_t);
+                    // matrix_rows
+                    cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
+                    // atomic_current_chunk
+                    cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
+                } break;
+            case GGML_OP_OUT_PROD:
+                {
+                    if (ggml_is_quantized(node->src[0]->type)) {
+                        cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
+                    }
+                } break;
+            case GGML_OP_SOFT_MAX:
+            case GGML_OP_ROPE:
+            case GGML_OP_ROPE_BACK:
+                {
+                    cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
+                } break;
+            case GGML_OP_CONV_TRANSPOSE_1D:
+                {
+                    GGML_ASSERT(node->src[0]->ne[3] == 1);
+                    GGML_ASSERT(node->src[1]->ne[2] == 1);
+                    GGML_ASSERT(node->src[1]->ne[3] == 1);
+
+                    const int64_t ne00 = node->src[0]->ne[0];  // K
+                    const int64_t ne01 = node->src[0]->ne[1];  // Cout
+                    const int64_t ne02 = node->src[0]->ne[2];  // Cin
+                    const int64_t ne10 = node->src[1]->ne[0];  // L
+                    const int64_t ne11 = node->src[1]->ne[1];  // Cin
+
+                    if ((node->src[0]->type == GGML_TYPE_F16 ||
+                         node->src[0]->type == GGML_TYPE_BF16) &&
+                        node->src[1]->type == GGML_TYPE_F32) {
+                        cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
+                        cur += sizeof(ggml_fp16_t)*ne10*ne11;
+                    } else if (node->src[0]->type == GGML_TYPE_F32 &&
+                               node->src[1]->type == GGML_TYPE_F32) {
+                        cur += sizeof(float)*ne00*ne01*ne02;
+                        cur += sizeof(float)*ne10*ne11;
+                    } else {
+                        GGML_ABORT("fatal error");
+                    }
+                } break;
+            case GGML_OP_CONV_2D:
+                {
+                    cur = GGML_IM2COL_WORK_SIZE;
+                } break;
+            case GGML_OP_CONV_TRANSPOSE_2D:
+                {
+                    const int64_t ne00 = node->src[0]->ne[0]; // W
+                    const int64_t ne01 = node->src[0]->ne[1]; // H
+                    const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
+                    const int64_t ne03 = node->src[0]->ne[3]; // Channels In
+
+                    const int64_t ne10 = node->src[1]->ne[0]; // W
+                    const int64_t ne11 = node->src[1]->ne[1]; // H
+                    const int64_t ne12 = node->src[1]->ne[2]; // Channels In
+
+                    cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
+                    cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
+                } break;
+            case GGML_OP_FLASH_ATTN_EXT:
+                {
+                    const int64_t ne10 = node->src[1]->ne[0]; // DK
+                    const int64_t ne20 = node->src[2]->ne[0]; // DV
+
+                    // per thread: tiles of Q, of the V accumulators and of KQ, a row of V, the maximum and the sum of each query
+                    cur = sizeof(float)*(GGML_FA_TILE_Q*(ne10 + ne20 + GGML_FA_TILE_KV + 2) + ne20)*n_tasks;
+                } break;
+            case GGML_OP_FLASH_ATTN_BACK:
+                {
+                    const int64_t    D = node->src[0]->ne[0];
+                    const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
+                    const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
+                    if (node->src[1]->type == GGML_TYPE_F32) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    } else if (node->src[1]->type == GGML_TYPE_F16) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    } else if (node->src[1]->type == GGML_TYPE_BF16) {
+                        cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
+                        cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
+                    }
+                } break;
+
+            case GGML_OP_CROSS_ENTROPY_LOSS:
+                {
+                    cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
+                } break;
+            case GGML_OP_COUNT:
+                {
+                    GGML_ABORT("fatal error");
+                }
+            default:
+                break;
+        }
+    }
+
+
+    return cur;
+}
+
 struct ggml_cplan ggml_graph_plan(
           const struct ggml_cgraph * cgraph,
                                int   n_threads,
@@ -2650,6 +3100,9 @@ struct ggml_cplan ggml_graph_plan(
 
     int max_tasks = 1;
 
+    // work data of the consecutive nodes that can be scheduled as a DAG
+    size_t work_size_dag = 0;
+
     // thread scheduling for the different operations + work buffer size estimation
     for (int i = 0; i < cgraph->n_nodes; i++) {
         struct ggml_tensor * node = cgraph->nodes[i];
@@ -2658,157 +3111,17 @@ struct ggml_cplan ggml_graph_plan(
 
         max_tasks = MAX(max_tasks, n_tasks);
 
-        size_t cur = 0;
-
-        if (!ggml_cpu_extra_work_size(n_threads, node, &cur)) {
-            switch (node->op) {
-                case GGML_OP_CPY:
-                case GGML_OP_DUP:
-                    {
-                        if (ggml_is_quantized(node->type) ||
-                            // F16 -> BF16 and BF16 -> F16 copies go through intermediate F32
-                            (node->src[0]->type == GGML_TYPE_F16  && node->src[1] && node->src[1]->type == GGML_TYPE_BF16) ||
-                            (node->src[0]->type == GGML_TYPE_BF16 && node->src[1] && node->src[1]->type == GGML_TYPE_F16)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_ADD:
-                case GGML_OP_ADD1:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_ACC:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[1]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_COUNT_EQUAL:
-                    {
-                        cur = ggml_type_size(node->type)*n_tasks;
-                    } break;
-                case GGML_OP_MUL_MAT:
-                    {
-                        const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
+        const size_t cur = ggml_graph_node_work_size(node, n_threads, n_tasks);
 
-                        if (node->src[1]->type != vec_dot_type) {
-                            cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
-                        }
-                    } break;
-                case GGML_OP_MUL_MAT_ID:
-                    {
-                        cur = 0;
-                        const struct ggml_tensor * src0 = node->src[0];
-                        const struct ggml_tensor * src1 = node->src[1];
-                        const struct ggml_tensor * ids = node->src[2];
-                        const enum ggml_type vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
-                        const int n_as = src0->ne[2];
-                        // src1
-                        if (src1->type != vec_dot_type) {
-                            cur += ggml_row_size(vec_dot_type, ggml_nelements(src1)) + sizeof(int64_t);
-                        }
-                        // matrix_row_counts
-                        cur += n_as * sizeof(int64_t) + sizeof(int64_t);
-                        // matrix_rows
-                        cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
-                        // atomic_current_chunk
-                        cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
-                    } break;
-                case GGML_OP_OUT_PROD:
-                    {
-                        if (ggml_is_quantized(node->src[0]->type)) {
-                            cur = ggml_type_size(GGML_TYPE_F32) * node->src[0]->ne[0] * n_tasks;
-                        }
-                    } break;
-                case GGML_OP_SOFT_MAX:
-                case GGML_OP_ROPE:
-                case GGML_OP_ROPE_BACK:
-                    {
-                        cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
-                    } break;
-                case GGML_OP_CONV_TRANSPOSE_1D:
-                    {
-                        GGML_ASSERT(node->src[0]->ne[3] == 1);
-                        GGML_ASSERT(node->src[1]->ne[2] == 1);
-                        GGML_ASSERT(node->src[1]->ne[3] == 1);
-
-                        const int64_t ne00 = node->src[0]->ne[0];  // K
-                        const int64_t ne01 = node->src[0]->ne[1];  // Cout
-                        const int64_t ne02 = node->src[0]->ne[2];  // Cin
-                        const int64_t ne10 = node->src[1]->ne[0];  // L
-                        const int64_t ne11 = node->src[1]->ne[1];  // Cin
-
-                        if ((node->src[0]->type == GGML_TYPE_F16 ||
-                             node->src[0]->type == GGML_TYPE_BF16) &&
-                            node->src[1]->type == GGML_TYPE_F32) {
-                            cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02;
-                            cur += sizeof(ggml_fp16_t)*ne10*ne11;
-                        } else if (node->src[0]->type == GGML_TYPE_F32 &&
-                                   node->src[1]->type == GGML_TYPE_F32) {
-                            cur += sizeof(float)*ne00*ne01*ne02;
-                            cur += sizeof(float)*ne10*ne11;
-                        } else {
-                            GGML_ABORT("fatal error");
-                        }
-                    } break;
-                case GGML_OP_CONV_2D:
-                    {
-                        cur = GGML_IM2COL_WORK_SIZE;
-                    } break;
-                case GGML_OP_CONV_TRANSPOSE_2D:
-                    {
-                        const int64_t ne00 = node->src[0]->ne[0]; // W
-                        const int64_t ne01 = node->src[0]->ne[1]; // H
-                        const int64_t ne02 = node->src[0]->ne[2]; // Channels Out
-                        const int64_t ne03 = node->src[0]->ne[3]; // Channels In
-
-                        const int64_t ne10 = node->src[1]->ne[0]; // W
-                        const int64_t ne11 = node->src[1]->ne[1]; // H
-                        const int64_t ne12 = node->src[1]->ne[2]; // Channels In
-
-                        cur += sizeof(ggml_fp16_t)*ne00*ne01*ne02*ne03;
-                        cur += sizeof(ggml_fp16_t)*ne10*ne11*ne12;
-                    } break;
-                case GGML_OP_FLASH_ATTN_EXT:
-                    {
-                        const int64_t ne10 = node->src[1]->ne[0]; // DK
-                        const int64_t ne20 = node->src[2]->ne[0]; // DV
-
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
-                    } break;
-                case GGML_OP_FLASH_ATTN_BACK:
-                    {
-                        const int64_t    D = node->src[0]->ne[0];
-                        const int64_t ne11 = ggml_up(node->src[1]->ne[1], GGML_SOFT_MAX_UNROLL);
-                        const int64_t mxDn = MAX(D, ne11) * 2; // *2 because of S and SM in ggml_compute_forward_flash_attn_back
-                        if (node->src[1]->type == GGML_TYPE_F32) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        } else if (node->src[1]->type == GGML_TYPE_F16) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        } else if (node->src[1]->type == GGML_TYPE_BF16) {
-                            cur  = sizeof(float)*mxDn*n_tasks; // TODO: this can become (n_tasks-1)
-                            cur += sizeof(float)*mxDn*n_tasks; // this is overestimated by x2
-                        }
-                    } break;
+        work_size = MAX(work_size, cur);
 
-                case GGML_OP_CROSS_ENTROPY_LOSS:
-                    {
-                        cur = ggml_type_size(node->type)*(n_tasks + node->src[0]->ne[0]*n_tasks);
-                    } break;
-                case GGML_OP_COUNT:
-                    {
-                        GGML_ABORT("fatal error");
-                    }
-                default:
-                    break;
-            }
+        // the nodes of a DAG run concurrently, each with its own part of the work buffer
+        if (n_threads > 1 && ggml_graph_node_is_schedulable(node)) {
+            work_size_dag += ggml_sched_work_size(cur, n_threads);
+            work_size      = MAX(work_size, work_size_dag);
+        } else {
+            work_size_dag = 0;
         }
-
-        work_size = MAX(work_size, cur);
     }
 
     if (work_size > 0) {
@@ -2823,6 +3136,549 @@ struct ggml_cplan ggml_graph_plan(
     return cplan;
 }
 
+static bool ggml_sched_overlaps(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (a == NULL || b == NULL || a->data == NULL || b->data == NULL) {
+        return false;
+    }
+
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// true if node b reads or writes the memory that node a writes, or writes the memory that node a reads
+static bool ggml_sched_depends(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (ggml_sched_overlaps(a, b)) {
+        return true;
+    }
+
+    for (int i = 0; i < GGML_MAX_SRC; i++) {
+        if (ggml_sched_overlaps(a, b->src[i]) || ggml_sched_overlaps(a->src[i], b)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ggml_sched_reserve(struct ggml_sched * sched, int n_nodes) {
+    if (sched->n_nodes_max < n_nodes) {
+        free(sched->nodes);
+        free(sched->segments);
+
+        sched->nodes       = malloc(sizeof(struct ggml_sched_node)*n_nodes);
+        sched->segments    = malloc(sizeof(struct ggml_sched_segment)*n_nodes);
+        sched->n_nodes_max = n_nodes;
+
+        GGML_ASSERT(sched->nodes && sched->segments);
+    }
+}
+
+static int32_t * ggml_sched_add_succ(struct ggml_sched * sched, int n) {
+    if (sched->n_succ + n > sched->n_succ_max) {
+        sched->n_succ_max = MAX(2*sched->n_succ_max, sched->n_succ + n);
+        sched->succ       = realloc(sched->succ, sizeof(int32_t)*sched->n_succ_max);
+
+        GGML_ASSERT(sched->succ);
+    }
+
+    int32_t * succ = sched->succ + sched->n_succ;
+    sched->n_succ += n;
+
+    return succ;
+}
+
+// number of uses of a node in the whole graph, including the uses by the nodes outside of a view of the graph
+static int32_t ggml_graph_node_n_uses(const struct ggml_cgraph * cgraph, const struct ggml_tensor * node) {
+    const size_t hash_pos = ggml_hash_find(&cgraph->visited_hash_set, node);
+    if (hash_pos == GGML_HASHSET_FULL || !ggml_bitset_get(cgraph->visited_hash_set.used, hash_pos)) {
+        return -1;
+    }
+    return cgraph->use_counts[hash_pos];
+}
+
+static bool ggml_fuse_is_f32_rows(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->nb[0] == sizeof(float);
+}
+
+// RMS_NORM -> MUL by a weight broadcast over the rows
+static bool ggml_fuse_rms_norm_mul(const struct ggml_cgraph * cgraph, int i) {
+    const enum ggml_op ops[] = { GGML_OP_RMS_NORM, GGML_OP_MUL };
+    if (!ggml_can_fuse(cgraph, i, ops, 2)) {
+        return false;
+    }
+
+    const struct ggml_tensor * norm = cgraph->nodes[i];
+    const struct ggml_tensor * mul  = cgraph->nodes[i + 1];
+
+    return mul->src[0] == norm && ggml_fuse_is_f32_rows(norm->src[0]) && ggml_fuse_is_f32_rows(mul) &&
+        ggml_fuse_is_f32_rows(mul->src[1]) && ggml_can_repeat(mul->src[1], norm);
+}
+
+// ADD -> RMS_NORM of the sum, the sum can have other uses (e.g. the residual stream)
+static bool ggml_fuse_add_rms_norm(const struct ggml_cgraph * cgraph, int i) {
+    if (i + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * add  = cgraph->nodes[i];
+    const struct ggml_tensor * norm = cgraph->nodes[i + 1];
+
+    return add->op == GGML_OP_ADD && norm->op == GGML_OP_RMS_NORM && norm->src[0] == add &&
+        ggml_fuse_is_f32_rows(add) && ggml_fuse_is_f32_rows(add->src[0]) && ggml_fuse_is_f32_rows(add->src[1]) &&
+        ggml_fuse_is_f32_rows(norm) && ggml_can_repeat(add->src[1], add) && add->src[1] != add->src[0];
+}
+
+// MUL_MAT -> ADD of a bias with a single row
+static bool ggml_fuse_mul_mat_add(const struct ggml_cgraph * cgraph, int i) {
+    if (i + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * mm  = cgraph->nodes[i];
+    const struct ggml_tensor * add = cgraph->nodes[i + 1];
+
+    if (mm->op != GGML_OP_MUL_MAT || add->op != GGML_OP_ADD || add->src[0] != mm || !ggml_node_has_n_uses(cgraph, i, 1)) {
+        return false;
+    }
+
+    const struct ggml_tensor * bias = add->src[1];
+
+    return bias != mm && bias->type == GGML_TYPE_F32 && ggml_is_contiguous(bias) && bias->ne[0] == mm->ne[0] && ggml_nrows(bias) == 1 &&
+        add->type == GGML_TYPE_F32 && ggml_are_same_stride(add, mm);
+}
+
+// UNARY(SILU) -> MUL by another tensor of the same shape
+static bool ggml_fuse_silu_mul(const struct ggml_cgraph * cgraph, int i) {
+    const enum ggml_op ops[] = { GGML_OP_UNARY, GGML_OP_MUL };
+    if (!ggml_can_fuse(cgraph, i, ops, 2) || ggml_get_unary_op(cgraph->nodes[i]) != GGML_UNARY_OP_SILU) {
+        return false;
+    }
+
+    const struct ggml_tensor * silu  = cgraph->nodes[i];
+    const struct ggml_tensor * mul   = cgraph->nodes[i + 1];
+    const struct ggml_tensor * other = mul->src[0] == silu ? mul->src[1] : mul->src[0];
+
+    return other != silu && silu->src[0]->type == GGML_TYPE_F32 && other->type == GGML_TYPE_F32 && mul->type == GGML_TYPE_F32 &&
+        ggml_is_contiguous_1(silu->src[0]) && ggml_is_contiguous_1(other) && ggml_is_contiguous_1(mul) &&
+        ggml_are_same_shape(silu->src[0], other);
+}
+
+// ROPE -> [RESHAPE/VIEW ->] CPY to F16, returns the index of the CPY or -1
+// the nodes in between, e.g. the projection of V, must not use the memory written by the CPY
+static int ggml_fuse_rope_cpy(const struct ggml_cgraph * cgraph, int i) {
+    const struct ggml_tensor * rope = cgraph->nodes[i];
+
+    if (rope->op != GGML_OP_ROPE || rope->type != GGML_TYPE_F32 || rope->src[0]->type != GGML_TYPE_F32 ||
+        !ggml_is_contiguous(rope) || (rope->flags & GGML_TENSOR_FLAG_OUTPUT) || ggml_graph_node_n_uses(cgraph, rope) != 1) {
+        return -1;
+    }
+
+    const struct ggml_tensor * cur = rope;
+
+    for (int j = i + 1; j < cgraph->n_nodes && j <= i + GGML_FUSION_MAX_ROPE_CPY; j++) {
+        const struct ggml_tensor * node = cgraph->nodes[j];
+
+        if (node->src[0] != cur) {
+            continue;
+        }
+
+        if (node->op == GGML_OP_RESHAPE || node->op == GGML_OP_VIEW) {
+            if (node->view_offs != 0 || (node->flags & GGML_TENSOR_FLAG_OUTPUT) || ggml_graph_node_n_uses(cgraph, node) != 1) {
+                return -1;
+            }
+            cur = node;
+            continue;
+        }
+
+        if (node->op != GGML_OP_CPY || node->type != GGML_TYPE_F16 || !ggml_is_contiguous(node) || !ggml_is_contiguous(cur) ||
+            ggml_nelements(node) != ggml_nelements(rope)) {
+            return -1;
+        }
+
+        for (int k = i + 1; k < j; k++) {
+            if (ggml_graph_node_has_work(cgraph->nodes[k]) && ggml_sched_depends(cgraph->nodes[k], node)) {
+                return -1;
+            }
+        }
+
+        return j;
+    }
+
+    return -1;
+}
+
+static bool ggml_fuse_has_tensor_traits(const struct ggml_cgraph * cgraph, int i, int n) {
+    for (int k = 0; k < n; k++) {
+        if (ggml_cpu_extra_has_tensor_traits(cgraph->nodes[i + k])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// finds the sequences of nodes that are computed by a single kernel, in a single pass over the data:
+// the intermediate results that have no other use are not written, and the nodes after the first one have no work
+static void ggml_graph_fuse(struct ggml_sched * sched, const struct ggml_cgraph * cgraph) {
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_sched_node * sn = &sched->nodes[i];
+
+        sn->fusion     = GGML_FUSION_NONE;
+        sn->fused[0]   = -1;
+        sn->fused[1]   = -1;
+        sn->fused_into = -1;
+    }
+
+    if (g_state.disable_fusion) {
+        return;
+    }
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_sched_node * sn = &sched->nodes[i];
+
+        if (sn->fused_into >= 0 || !ggml_graph_node_has_work(cgraph->nodes[i])) {
+            continue;
+        }
+
+        int n_fused = 0;
+
+        if (ggml_fuse_add_rms_norm(cgraph, i)) {
+            sn->fusion = GGML_FUSION_ADD_RMS_NORM_MUL;
+            n_fused    = ggml_fuse_rms_norm_mul(cgraph, i + 1) ? 2 : 1;
+        } else if (ggml_fuse_rms_norm_mul(cgraph, i)) {
+            sn->fusion = GGML_FUSION_ADD_RMS_NORM_MUL;
+            n_fused    = 1;
+        } else if (ggml_fuse_mul_mat_add(cgraph, i)) {
+            sn->fusion = GGML_FUSION_MUL_MAT_ADD;
+            n_fused    = 1;
+        } else if (ggml_fuse_silu_mul(cgraph, i)) {
+            sn->fusion = GGML_FUSION_SILU_MUL;
+            n_fused    = 1;
+        } else {
+            const int j = ggml_fuse_rope_cpy(cgraph, i);
+            if (j >= 0 && sched->nodes[j].fused_into < 0 &&
+                    !ggml_cpu_extra_has_tensor_traits(cgraph->nodes[i]) && !ggml_cpu_extra_has_tensor_traits(cgraph->nodes[j])) {
+                sn->fusion   = GGML_FUSION_ROPE_CPY;
+                sn->fused[0] = j;
+                sched->nodes[j].fused_into = i;
+            }
+            continue;
+        }
+
+        if (ggml_fuse_has_tensor_traits(cgraph, i, n_fused + 1)) {
+            sn->fusion = GGML_FUSION_NONE;
+            continue;
+        }
+
+        for (int k = 0; k < n_fused; k++) {
+            sn->fused[k] = i + 1 + k;
+            sched->nodes[i + 1 + k].fused_into = i;
+        }
+    }
+}
+
+// true if a node of the fused sequence of b depends on a node of the fused sequence of a
+static bool ggml_sched_group_depends(const struct ggml_sched * sched, const struct ggml_cgraph * cgraph, int a, int b) {
+    const struct ggml_sched_node * sa = &sched->nodes[a];
+    const struct ggml_sched_node * sb = &sched->nodes[b];
+
+    for (int ka = -1; ka < 2; ka++) {
+        const int ia = ka < 0 ? a : sa->fused[ka];
+        if (ia < 0) {
+            continue;
+        }
+        for (int kb = -1; kb < 2; kb++) {
+            const int ib = kb < 0 ? b : sb->fused[kb];
+            if (ib >= 0 && ggml_sched_depends(cgraph->nodes[ia], cgraph->nodes[ib])) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// finds the dependencies between the nodes with work of a segment
+static void ggml_sched_build_dag(struct ggml_sched * sched, const struct ggml_cgraph * cgraph, const struct ggml_sched_segment * seg) {
+    int32_t ids[GGML_SCHED_MAX_NODES];
+    int n_ids = 0;
+
+    for (int i = seg->begin; i < seg->end; i++) {
+        if (sched->nodes[i].n_tasks > 0) {
+            ids[n_ids++] = i;
+        }
+    }
+
+    for (int b = 0; b < n_ids; b++) {
+        for (int a = 0; a < b; a++) {
+            if (ggml_sched_group_depends(sched, cgraph, ids[a], ids[b])) {
+                sched->nodes[ids[a]].n_succ++;
+                sched->nodes[ids[b]].n_deps++;
+            }
+        }
+    }
+
+    for (int a = 0; a < n_ids; a++) {
+        struct ggml_sched_node * sn = &sched->nodes[ids[a]];
+
+        int32_t * succ = ggml_sched_add_succ(sched, sn->n_succ);
+        sn->succ = succ - sched->succ;
+
+        int n_succ = 0;
+        for (int b = a + 1; b < n_ids && n_succ < sn->n_succ; b++) {
+            if (ggml_sched_group_depends(sched, cgraph, ids[a], ids[b])) {
+                succ[n_succ++] = ids[b];
+            }
+        }
+    }
+}
+
+// splits the graph into segments, see ggml_sched
+static void ggml_graph_sched_build(struct ggml_threadpool * tp, const struct ggml_cgraph * cgraph, const struct ggml_cplan * cplan, int n_threads) {
+    struct ggml_sched * sched = &tp->sched;
+
+    ggml_sched_reserve(sched, cgraph->n_nodes);
+
+    ggml_graph_fuse(sched, cgraph);
+
+    sched->n_segments = 0;
+    sched->n_succ     = 0;
+
+    struct ggml_sched_segment * seg = NULL;
+
+    // work data of the nodes of the current segment
+    size_t wdata = 0;
+
+    for (int i = 0; i < cgraph->n_nodes; i++) {
+        struct ggml_tensor     * node = cgraph->nodes[i];
+        struct ggml_sched_node * sn   = &sched->nodes[i];
+
+        // the nodes fused into another node are computed with it
+        const bool has_work = sn->fused_into < 0 && ggml_graph_node_has_work(node);
+
+        bool schedulable = n_threads > 1 && ggml_graph_node_is_schedulable(node);
+        for (int k = 0; k < 2; k++) {
+            if (sn->fused[k] >= 0) {
+                schedulable = schedulable && ggml_graph_node_is_schedulable(cgraph->nodes[sn->fused[k]]);
+            }
+        }
+
+        const size_t cur = has_work && schedulable ?
+            ggml_sched_work_size(ggml_graph_node_work_size(node, n_threads, ggml_get_n_tasks(node, n_threads)), n_threads) : 0;
+
+        if (seg == NULL || (has_work && seg->n_nodes != 0 &&
+                    (!schedulable || seg->n_nodes < 0 || seg->n_nodes == GGML_SCHED_MAX_NODES || wdata + cur > cplan->work_size))) {
+            seg = &sched->segments[sched->n_segments++];
+            seg->begin   = i;
+            seg->n_nodes = 0;
+            atomic_store_explicit(&seg->n_done, 0, memory_order_relaxed);
+
+            wdata = 0;
+        }
+
+        seg->end = i + 1;
+
+        sn->n_tasks   = 0;
+        sn->n_deps    = 0;
+        sn->succ      = 0;
+        sn->n_succ    = 0;
+        sn->wdata     = 0;
+        sn->next_task = 0;
+
+        if (has_work) {
+            // a node that is not schedulable is alone in its segment, marked by a negative count
+            seg->n_nodes = schedulable ? seg->n_nodes + 1 : -1;
+
+            sn->n_tasks = n_threads;
+            sn->wdata   = wdata;
+
+            wdata += cur;
+        }
+    }
+
+    for (int s = 0; s < sched->n_segments; s++) {
+        seg = &sched->segments[s];
+
+        if (seg->n_nodes > 1) {
+            ggml_sched_build_dag(sched, cgraph, seg);
+        }
+
+        for (int i = seg->begin; i < seg->end; i++) {
+            struct ggml_sched_node * sn = &sched->nodes[i];
+
+            if (seg->n_nodes <= 1) {
+                // computed in lockstep by all the threads, with the whole work buffer
+                sn->wdata = 0;
+            }
+
+            atomic_store_explicit(&sn->n_deps_left,  sn->n_deps,  memory_order_relaxed);
+            atomic_store_explicit(&sn->n_tasks_left, sn->n_tasks, memory_order_relaxed);
+        }
+    }
+
+    for (int j = 0; j < n_threads; j++) {
+        struct ggml_compute_state * state = &tp->workers[j];
+
+        atomic_flag_clear(&state->sched_lock);
+        state->sched_head = 0;
+        state->sched_tail = 0;
+    }
+}
+
+static inline void ggml_sched_lock(struct ggml_compute_state * state) {
+    while (atomic_flag_test_and_set(&state->sched_lock)) {
+        ggml_thread_cpu_relax();
+    }
+}
+
+static inline void ggml_sched_unlock(struct ggml_compute_state * state) {
+    atomic_flag_clear(&state->sched_lock);
+}
+
+static void ggml_sched_push(struct ggml_compute_state * state, int32_t node_n) {
+    ggml_sched_lock(state);
+    GGML_ASSERT(state->sched_tail < GGML_SCHED_MAX_NODES);
+    state->sched_queue[state->sched_tail++] = node_n;
+    ggml_sched_unlock(state);
+}
+
+// claims the next chunk of a node in the deque of a thread, from the back for the owner and from the front for the others
+static bool ggml_sched_pop(struct ggml_compute_state * state, struct ggml_sched * sched, bool back, int32_t * node_n, int32_t * task) {
+    bool found = false;
+
+    ggml_sched_lock(state);
+    while (state->sched_head < state->sched_tail) {
+        const int32_t i = state->sched_queue[back ? state->sched_tail - 1 : state->sched_head];
+
+        struct ggml_sched_node * sn = &sched->nodes[i];
+        if (sn->next_task < sn->n_tasks) {
+            *node_n = i;
+            *task   = sn->next_task++;
+            found   = true;
+            break;
+        }
+
+        // all the chunks of the node are claimed
+        if (back) {
+            state->sched_tail--;
+        } else {
+            state->sched_head++;
+        }
+    }
+    ggml_sched_unlock(state);
+
+    return found;
+}
+
+// computes a node, or the fused sequence of nodes that starts with it
+static void ggml_graph_compute_node(struct ggml_compute_params * params, const struct ggml_cgraph * cgraph, const struct ggml_sched * sched, int node_n) {
+    const struct ggml_sched_node * sn = &sched->nodes[node_n];
+
+    struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    if (sn->fused_into >= 0) {
+        return;
+    }
+
+    struct ggml_tensor * fused0 = sn->fused[0] >= 0 ? cgraph->nodes[sn->fused[0]] : NULL;
+    struct ggml_tensor * fused1 = sn->fused[1] >= 0 ? cgraph->nodes[sn->fused[1]] : NULL;
+
+    switch (sn->fusion) {
+        case GGML_FUSION_ADD_RMS_NORM_MUL:
+            if (node->op == GGML_OP_ADD) {
+                ggml_compute_forward_add_rms_norm_mul(params, node, fused0, fused1);
+            } else {
+                ggml_compute_forward_add_rms_norm_mul(params, NULL, node, fused0);
+            }
+            break;
+        case GGML_FUSION_MUL_MAT_ADD:
+            ggml_compute_forward_mul_mat_add(params, node, fused0);
+            break;
+        case GGML_FUSION_SILU_MUL:
+            ggml_compute_forward_silu_mul(params, node, fused0);
+            break;
+        case GGML_FUSION_ROPE_CPY:
+            ggml_compute_forward_rope_cpy(params, node, fused0);
+            break;
+        default:
+            ggml_compute_forward(params, node);
+            break;
+    }
+}
+
+// computes the chunks of the nodes of a segment as soon as the nodes that they depend on are computed
+static void ggml_graph_compute_dag(struct ggml_compute_state * state, struct ggml_compute_params * params, struct ggml_sched_segment * seg) {
+    struct ggml_threadpool   * tp     = state->threadpool;
+    struct ggml_sched        * sched  = &tp->sched;
+    const struct ggml_cgraph * cgraph = tp->cgraph;
+    const struct ggml_cplan  * cplan  = tp->cplan;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // the nodes without dependencies are spread over the threads
+    for (int i = seg->begin, n_roots = 0; i < seg->end; i++) {
+        const struct ggml_sched_node * sn = &sched->nodes[i];
+        if (sn->n_tasks > 0 && sn->n_deps == 0) {
+            if (n_roots++ % nth == ith) {
+                ggml_sched_push(state, i);
+            }
+        }
+    }
+
+    int n_idle = 0;
+
+    while (atomic_load_explicit(&seg->n_done, memory_order_acquire) < seg->n_nodes) {
+        int32_t node_n = -1;
+        int32_t task   = -1;
+
+        bool found = ggml_sched_pop(state, sched, true, &node_n, &task);
+        for (int j = 1; j < nth && !found; j++) {
+            found = ggml_sched_pop(&tp->workers[(ith + j) % nth], sched, false, &node_n, &task);
+        }
+
+        if (!found) {
+            // let the threads that compute the remaining chunks run, when there are more threads than cores
+            if (++n_idle % 256 == 0) {
+                sched_yield();
+            } else {
+                ggml_thread_cpu_relax();
+            }
+            continue;
+        }
+
+        n_idle = 0;
+
+        struct ggml_sched_node * sn = &sched->nodes[node_n];
+
+        struct ggml_compute_params params_task = *params;
+        params_task.ith   = task;
+        params_task.nth   = sn->n_tasks;
+        params_task.wdata = cplan->work_data ? (char *) cplan->work_data + sn->wdata : NULL;
+
+        ggml_graph_compute_node(&params_task, cgraph, sched, node_n);
+
+        if (atomic_fetch_add_explicit(&sn->n_tasks_left, -1, memory_order_acq_rel) == 1) {
+            // last chunk of the node
+            for (int k = 0; k < sn->n_succ; k++) {
+                const int32_t succ_n = sched->succ[sn->succ + k];
+                if (atomic_fetch_add_explicit(&sched->nodes[succ_n].n_deps_left, -1, memory_order_acq_rel) == 1) {
+                    ggml_sched_push(state, succ_n);
+                }
+            }
+
+            atomic_fetch_add_explicit(&seg->n_done, 1, memory_order_release);
+        }
+    }
+
+    // leave the deque empty for the next segment
+    ggml_sched_lock(state);
+    state->sched_head = 0;
+    state->sched_tail = 0;
+    ggml_sched_unlock(state);
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -2840,18 +3696,28 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         /*.threadpool=*/ tp,
     };
 
-    for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
-        struct ggml_tensor * node = cgraph->nodes[node_n];
+    for (int s = 0; s < tp->sched.n_segments; s++) {
+        struct ggml_sched_segment * seg = &tp->sched.segments[s];
 
-        ggml_compute_forward(&params, node);
+        if (atomic_load_explicit(&tp->abort, memory_order_relaxed) == seg->begin) {
+            break;
+        }
+
+        if (seg->n_nodes > 1) {
+            ggml_graph_compute_dag(state, &params, seg);
+        } else {
+            for (int node_n = seg->begin; node_n < seg->end; node_n++) {
+                ggml_graph_compute_node(&params, cgraph, &tp->sched, node_n);
+            }
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
-            atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
+            atomic_store_explicit(&tp->abort, seg->end, memory_order_relaxed);
             tp->ec    = GGML_STATUS_ABORTED;
         }
 
-        if (node_n + 1 < cgraph->n_nodes) {
+        if (s + 1 < tp->sched.n_segments) {
             ggml_barrier(state->threadpool);
         }
     }
@@ -3033,6 +3899,8 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    memset(&threadpool->sched, 0, sizeof(threadpool->sched));
+
     // Allocate and init workers state
     const size_t workers_size = sizeof(struct ggml_compute_state) * tpp->n_threads;
     struct ggml_compute_state * workers = ggml_aligned_malloc(workers_size);
@@ -3116,12 +3984,15 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
                 // update the number of threads from the actual number of threads that we got from OpenMP
                 n_threads = omp_get_num_threads();
                 atomic_store_explicit(&threadpool->n_threads_cur, n_threads, memory_order_relaxed);
+
+                ggml_graph_sched_build(threadpool, cgraph, cplan, n_threads);
             }
 
             ggml_graph_compute_thread(&threadpool->workers[omp_get_thread_num()]);
         }
     } else {
         atomic_store_explicit(&threadpool->n_threads_cur, 1, memory_order_relaxed);
+        ggml_graph_sched_build(threadpool, cgraph, cplan, 1);
         ggml_graph_compute_thread(&threadpool->workers[0]);
     }
 #else
@@ -3130,6 +4001,8 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         n_threads = threadpool->n_threads_max;
     }
 
+    ggml_graph_sched_build(threadpool, cgraph, cplan, n_threads);
+
     // Kick all threads to start the new graph
     ggml_graph_compute_kickoff(threadpool, n_threads);
 
@@ -3546,6 +4419,8 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        g_state.disable_fusion = getenv("GGML_CPU_DISABLE_FUSION") != NULL;
+
         is_first_call = false;
     }
 
@@ -4,6 +4,7 @@
 #include "repack.h"
 #include "traits.h"
 #include "ggml-impl.h"
+#include "ggml-cpu-impl.h"
 #include "amx/amx.h"
 
 #include <cctype>
@@ -66,6 +67,20 @@ std::vector<ggml_backend_buffer_type_t>& ggml_backend_cpu_get_extra_buffers_type
 }
 
 static ggml_backend_buffer_type_t * ggml_backend_cpu_device_get_extra_buffers_type(ggml_backend_dev_t device) {
+    // the weights of the extra buffer types are not multiplied by ggml_compute_forward_mul_mat, so they would not be
+    // split over the NUMA nodes - with --numa split they are left in the regular CPU buffers
+    if (ggml_numa_is_split()) {
+        static ggml_backend_buffer_type_t none[] = { NULL };
+
+        static bool warned = false;
+        if (!warned && ggml_backend_cpu_get_extra_buffers_type().size() > 1) {
+            GGML_LOG_WARN("%s: the extra buffer types (repack, AMX, ...) are disabled with the NUMA split strategy\n", __func__);
+            warned = true;
+        }
+
+        return none;
+    }
+
     return ggml_backend_cpu_get_extra_buffers_type().data();
 
     GGML_UNUSED(device);
@@ -635,6 +650,9 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_cpu_is_numa") == 0) {
         return (void *)ggml_is_numa;
     }
+    if (strcmp(name, "ggml_backend_cpu_numa_place_tensor") == 0) {
+        return (void *)ggml_numa_place_tensor;
+    }
 
     // threadpool - TODO:  move to ggml-base
     if (strcmp(name, "ggml_threadpool_new") == 0) {
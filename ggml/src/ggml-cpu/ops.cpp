@@ -7,6 +7,7 @@
 #include "unary-ops.h"
 #include "vec.h"
 
+#include <algorithm>
 #include <float.h>
 
 // ggml_compute_forward_dup
@@ -3532,6 +3533,40 @@ static void ggml_compute_forward_swiglu_f32(
     }
 }
 
+// UNARY(SILU) -> MUL in a single pass over each row, like a split SWIGLU, see ggml_graph_fuse
+void ggml_compute_forward_silu_mul(
+        const ggml_compute_params * params,
+        ggml_tensor * silu,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = silu->src[0];
+    const ggml_tensor * src1 = mul->src[0] == silu ? mul->src[1] : mul->src[0];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32 && mul->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_contiguous_1(src0) && ggml_is_contiguous_1(src1) && ggml_is_contiguous_1(mul));
+    GGML_ASSERT(ggml_are_same_shape(src0, src1) && ggml_are_same_shape(src0, mul));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = src0->ne[0];
+    const int nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        ggml_vec_swiglu_f32(nc,
+                (float *) ((char *) mul->data  + i1*mul->nb[1]),
+                (float *) ((char *) src0->data + i1*src0->nb[1]),
+                (float *) ((char *) src1->data + i1*src1->nb[1]));
+    }
+}
+
 static void ggml_compute_forward_swiglu_f16(
     const ggml_compute_params * params,
     ggml_tensor * dst) {
@@ -4042,6 +4077,87 @@ void ggml_compute_forward_rms_norm(
     }
 }
 
+// ggml_compute_forward_add_rms_norm_mul
+
+// [ADD ->] RMS_NORM [-> MUL] in a single pass over each row, see ggml_graph_fuse
+// the result of the ADD is written too, as the residual stream still uses it, while the result of the RMS_NORM is not
+// written when it is fused with the MUL
+void ggml_compute_forward_add_rms_norm_mul(
+        const ggml_compute_params * params,
+        ggml_tensor * add,
+        ggml_tensor * norm,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = norm->src[0];
+    const ggml_tensor * dst  = mul ? mul : norm;
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && dst->type == GGML_TYPE_F32);
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && dst->nb[0] == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_LOCALS(int64_t, ne0, src0, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb0, src0, nb)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst,  nb)
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    // the operands of the ADD and the weight of the MUL, broadcast like in apply_binary_op
+    const ggml_tensor * a = add ? add->src[0] : nullptr;
+    const ggml_tensor * b = add ? add->src[1] : nullptr;
+    const ggml_tensor * w = mul ? mul->src[1] : nullptr;
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+                if (add) {
+                    const float * a_row = (const float *) ((const char *) a->data + i01*a->nb[1] + i02*a->nb[2] + i03*a->nb[3]);
+                    const float * b_row = (const float *) ((const char *) b->data +
+                            (i01 % b->ne[1])*b->nb[1] + (i02 % b->ne[2])*b->nb[2] + (i03 % b->ne[3])*b->nb[3]);
+
+                    for (int64_t r = 0; r < ne00/b->ne[0]; r++) {
+                        ggml_vec_add_f32(b->ne[0], x + r*b->ne[0], a_row + r*b->ne[0], b_row);
+                    }
+                }
+
+                ggml_float sum = 0.0;
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    sum += (ggml_float)(x[i00] * x[i00]);
+                }
+
+                const float mean = sum/ne00;
+
+                const float scale = 1.0f/sqrtf(mean + eps);
+
+                // if you hit this, likely you got an inf somewhere earlier
+                assert(scale > 0.0f);
+
+                float * y = (float *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+
+                if (mul) {
+                    const float * w_row = (const float *) ((const char *) w->data +
+                            (i01 % w->ne[1])*w->nb[1] + (i02 % w->ne[2])*w->nb[2] + (i03 % w->ne[3])*w->nb[3]);
+
+                    for (int64_t r = 0; r < ne00/w->ne[0]; r++) {
+                        for (int64_t i00 = 0; i00 < w->ne[0]; i00++) {
+                            y[r*w->ne[0] + i00] = (x[r*w->ne[0] + i00]*scale)*w_row[i00];
+                        }
+                    }
+                } else {
+                    memcpy(y, x, ne00 * sizeof(float));
+                    ggml_vec_scale_f32(ne00, y, scale);
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -6357,6 +6473,36 @@ void ggml_compute_forward_rope(
     }
 }
 
+// ROPE -> CPY to F16, e.g. when storing K in the KV cache, see ggml_graph_fuse
+// each thread converts the rows that it has just rotated, while they are still in its cache
+void ggml_compute_forward_rope_cpy(
+        const ggml_compute_params * params,
+        ggml_tensor * rope,
+        ggml_tensor * cpy) {
+
+    GGML_ASSERT(rope->type == GGML_TYPE_F32 && cpy->type == GGML_TYPE_F16);
+    GGML_ASSERT(ggml_is_contiguous(rope) && ggml_is_contiguous(cpy));
+    GGML_ASSERT(ggml_nelements(rope) == ggml_nelements(cpy));
+
+    ggml_compute_forward_rope(params, rope);
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t ne0 = rope->ne[0];
+    const int     nr  = ggml_nrows(rope);
+
+    // the row range of this thread in ggml_compute_forward_rope_f32
+    const int dr = (nr + nth - 1)/nth;
+
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    if (ir0 < ir1) {
+        ggml_cpu_fp32_to_fp16((const float *) rope->data + ir0*ne0, (ggml_fp16_t *) cpy->data + ir0*ne0, (ir1 - ir0)*ne0);
+    }
+}
+
 // ggml_compute_forward_rope_back
 
 void ggml_compute_forward_rope_back(
@@ -7985,8 +8131,77 @@ void ggml_compute_forward_argsort(
     }
 }
 
+// ggml_compute_forward_argsort_top_k
+
+static void ggml_compute_forward_argsort_top_k_f32(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    GGML_ASSERT(nb00 == sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t nr = ggml_nrows(src0);
+    const int64_t k  = ne0;
+
+    int32_t * idx = (int32_t *) params->wdata + (ne00 + CACHE_LINE_SIZE_F32) * ith;
+
+    for (int64_t ir = ith; ir < nr; ir += nth) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const float * src_data = (const float *) ((const char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+              int32_t * dst_data = (int32_t *) ((char *) dst->data + i01*nb1 + i02*nb2 + i03*nb3);
+
+        for (int64_t j = 0; j < ne00; j++) {
+            idx[j] = j;
+        }
+
+        // ties are broken by the lower index so that the result is deterministic
+        auto cmp = [src_data](int32_t a, int32_t b) {
+            return src_data[a] > src_data[b] || (src_data[a] == src_data[b] && a < b);
+        };
+
+        // select the k largest elements in O(ne00) and sort only those
+        if (k < ne00) {
+            std::nth_element(idx, idx + k, idx + ne00, cmp);
+        }
+        std::sort(idx, idx + k, cmp);
+
+        memcpy(dst_data, idx, k*sizeof(int32_t));
+    }
+}
+
+void ggml_compute_forward_argsort_top_k(
+    const ggml_compute_params * params,
+    ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_argsort_top_k_f32(params, dst);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 // ggml_compute_forward_flash_attn_ext
 
+// the queries are processed in tiles of up to GGML_FA_TILE_Q rows that attend to the same K and V (consecutive tokens
+// of a head, or the heads that share a KV head), against tiles of GGML_FA_TILE_KV rows of K and V:
+// each row of K and V is read and converted once per tile of queries, and the online softmax rescales the
+// accumulators once per tile of K/V instead of on every new maximum
 static void ggml_compute_forward_flash_attn_ext_f16(
         const ggml_compute_params * params,
         const ggml_tensor * q,
@@ -8038,7 +8253,7 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     const int64_t rv2 = neq2/nev2;
     const int64_t rv3 = neq3/nev3;
 
-    // parallelize by q rows using ggml_vec_dot_f32
+    // parallelize by q rows
 
     // total rows in q
     const int nr = neq1*neq2*neq3;
@@ -8076,31 +8291,26 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
     GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
-
-        const uint32_t h = iq2; // head index
-        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+    const size_t q_row_size = ggml_row_size(k_vec_dot_type, DK);
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
+    // work buffer of the thread, see ggml_graph_plan
+    float * VKQ32 = (float *) params->wdata + ith*(GGML_FA_TILE_Q*(DK + DV + GGML_FA_TILE_KV + 2) + DV + CACHE_LINE_SIZE_F32);
+    float * KQ    = VKQ32 + GGML_FA_TILE_Q*DV;                       // KQ values of the tile, then their softmax
+    float * V32   = KQ    + GGML_FA_TILE_Q*GGML_FA_TILE_KV;          // (temporary) FP32 V row
+    float * M     = V32   + DV;                                      // maximum KQ value of each query
+    float * S     = M     + GGML_FA_TILE_Q;                          // sum of each query
+    char  * Q_q   = (char *) (S + GGML_FA_TILE_Q);                   // Q converted to the vec_dot type of K
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
-
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, DV*sizeof(float));
-        }
+    int                 tq1[GGML_FA_TILE_Q];
+    int                 tq2[GGML_FA_TILE_Q];
+    int                 tq3[GGML_FA_TILE_Q];
+    float               slope[GGML_FA_TILE_Q];
+    const ggml_fp16_t * mp[GGML_FA_TILE_Q];
 
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+    for (int ir = ir0; ir < ir1; ) {
+        // q indices of the first query of the tile
+        const int iq3 = ir/(neq2*neq1);
+        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
 
         // k indices
         const int ik3 = iq3 / rk3;
@@ -8110,99 +8320,159 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         const int iv3 = iq3 / rv3;
         const int iv2 = iq2 / rv2;
 
-        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
-        q_to_vec_dot(pq, Q_q, DK);
+        // the next queries that use the same K and V
+        int nq = 0;
+        for (; nq < GGML_FA_TILE_Q && ir + nq < ir1; ++nq) {
+            const int jr  = ir + nq;
+            const int jq3 = jr/(neq2*neq1);
+            const int jq2 = (jr - jq3*neq2*neq1)/neq1;
+            const int jq1 = (jr - jq3*neq2*neq1 - jq2*neq1);
+
+            if (jq3/rk3 != ik3 || jq2/rk2 != ik2 || jq3/rv3 != iv3 || jq2/rv2 != iv2) {
+                break;
+            }
+
+            tq1[nq] = jq1;
+            tq2[nq] = jq2;
+            tq3[nq] = jq3;
+
+            const uint32_t h = jq2; // head index
+            slope[nq] = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+            mp[nq] = mask ? (const ggml_fp16_t *)((const char *) mask->data + jq1*mask->nb[1] + (jq2%mask->ne[2])*mask->nb[2] + (jq3%mask->ne[3])*mask->nb[3]) : NULL;
+
+            const float * pq = (const float *) ((const char *) q->data + (jq1*nbq1 + jq2*nbq2 + jq3*nbq3));
+            q_to_vec_dot(pq, Q_q + nq*q_row_size, DK);
+
+            M[nq] = -INFINITY;
+            S[nq] = 0.0f;
+        }
+
+        memset(VKQ32, 0, nq*DV*sizeof(float));
 
         // online softmax / attention
-        // loop over n_kv and n_head_kv
+        // loop over n_kv in tiles
         // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
+        for (int64_t ic0 = 0; ic0 < nek1; ic0 += GGML_FA_TILE_KV) {
+            const int nc = MIN(GGML_FA_TILE_KV, nek1 - ic0);
+
+            // mask values, the masked KQ values are not computed
+            bool masked = true;
+            for (int iq = 0; iq < nq; ++iq) {
+                float * kq = KQ + iq*GGML_FA_TILE_KV;
+                for (int c = 0; c < nc; ++c) {
+                    kq[c] = mp[iq] ? slope[iq]*GGML_CPU_FP16_TO_FP32(mp[iq][ic0 + c]) : 0.0f;
+                }
+                for (int c = 0; c < nc && masked; ++c) {
+                    masked = kq[c] == -INFINITY;
+                }
+            }
+
+            if (masked) {
+                // e.g. the future tokens of all the queries of the tile, with a causal mask
                 continue;
             }
 
-            float s; // KQ value
+            for (int c = 0; c < nc; ++c) {
+                const char * k_data = (const char *) k->data + ((ic0 + c)*nbk1 + ik2*nbk2 + ik3*nbk3);
 
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
+                for (int iq = 0; iq < nq; ++iq) {
+                    float * kq = KQ + iq*GGML_FA_TILE_KV + c;
+                    if (*kq == -INFINITY) {
+                        continue;
+                    }
 
-            s = s*scale; // scale KQ value
+                    float s; // KQ value
+                    kq_vec_dot(DK, &s, 0, k_data, 0, Q_q + iq*q_row_size, 0, 1);
 
-            if (logit_softcap != 0.0f) {
-                s = logit_softcap*tanhf(s);
-            }
+                    s = s*scale; // scale KQ value
 
-            s += mv; // apply mask
+                    if (logit_softcap != 0.0f) {
+                        s = logit_softcap*tanhf(s);
+                    }
+
+                    *kq += s; // apply mask
+                }
+            }
 
-            const float Mold = M;
+            // softmax of the KQ values of the tile, and rescaling of the accumulators with the new maximum
+            for (int iq = 0; iq < nq; ++iq) {
+                float * kq = KQ + iq*GGML_FA_TILE_KV;
 
-            float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
-            float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+                float max = -INFINITY;
+                ggml_vec_max_f32(nc, &max, kq);
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+                if (max == -INFINITY) {
+                    memset(kq, 0, nc*sizeof(float));
+                    continue;
+                }
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                const float Mnew = MAX(M[iq], max);
+                const float ms   = expf(M[iq] - Mnew);
 
+                if (ms != 1.0f) {
                     // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(DV, VKQ16, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    ggml_vec_scale_f32(DV, VKQ32 + iq*DV, ms);
                 }
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
-            } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                // kq = expf(kq - M)
+                const ggml_float sum = ggml_vec_soft_max_f32(nc, kq, kq, Mnew);
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(DV, VKQ32, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                S[iq] = S[iq]*ms + (float) sum;
+                M[iq] = Mnew;
+            }
+
+            // V += v*expf(s - M), each row of V is converted once for the tile of queries
+            for (int c = 0; c < nc; ++c) {
+                bool used = false;
+                for (int iq = 0; iq < nq && !used; ++iq) {
+                    used = KQ[iq*GGML_FA_TILE_KV + c] != 0.0f;
                 }
 
-                // V += v*expf(s - M)
-                if (v_to_float) {
-                    v_to_float(v_data, V32, DV);
-                    ggml_vec_mad_f32(DV, VKQ32, V32, vs);
-                } else {
-                    // V is F32
-                    ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
+                if (!used) {
+                    continue;
                 }
-            }
 
-            S = S*ms + vs; // scale and increment sum with partial sum
-        }
+                const char * v_data = (const char *) v->data + ((ic0 + c)*nbv1 + iv2*nbv2 + iv3*nbv3);
+
+                const float * v32 = V32;
+                if (v->type == GGML_TYPE_F32) {
+                    v32 = (const float *) v_data;
+                } else if (v->type == GGML_TYPE_F16) {
+                    ggml_cpu_fp16_to_fp32((const ggml_fp16_t *) v_data, V32, DV);
+                } else {
+                    v_to_float(v_data, V32, DV);
+                }
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < DV; ++d) {
-                VKQ32[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
+                for (int iq = 0; iq < nq; ++iq) {
+                    const float vs = KQ[iq*GGML_FA_TILE_KV + c];
+                    if (vs != 0.0f) {
+                        ggml_vec_mad_f32(DV, VKQ32 + iq*DV, v32, vs);
+                    }
+                }
             }
         }
 
-        // V /= S
-        const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(DV, VKQ32, S_inv);
+        for (int iq = 0; iq < nq; ++iq) {
+            float * VKQ = VKQ32 + iq*DV;
 
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
+            // V /= S
+            const float S_inv = 1.0f/S[iq];
+            ggml_vec_scale_f32(DV, VKQ, S_inv);
+
+            // dst indices
+            const int i1 = tq1[iq];
+            const int i2 = tq2[iq];
+            const int i3 = tq3[iq];
 
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+            // original
+            //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ, nb1);
+        }
 
-        // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+        ir += nq;
     }
 }
 
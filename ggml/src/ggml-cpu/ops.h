@@ -23,6 +23,10 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Tiles of queries and of K/V rows in FLASH_ATTN_EXT
+#define GGML_FA_TILE_Q  16
+#define GGML_FA_TILE_KV 64
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -81,6 +85,7 @@ void ggml_compute_forward_roll(const struct ggml_compute_params * params, struct
 void ggml_compute_forward_arange(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_timestep_embedding(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_argsort(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+void ggml_compute_forward_argsort_top_k(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_leaky_relu(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_flash_attn_ext(
     const struct ggml_compute_params * params,
@@ -113,6 +118,11 @@ void ggml_compute_forward_cross_entropy_loss_back(const struct ggml_compute_para
 void ggml_compute_forward_opt_step_adamw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 
+// fused kernels, see ggml_graph_fuse
+void ggml_compute_forward_add_rms_norm_mul(const struct ggml_compute_params * params, struct ggml_tensor * add, struct ggml_tensor * norm, struct ggml_tensor * mul);
+void ggml_compute_forward_silu_mul(const struct ggml_compute_params * params, struct ggml_tensor * silu, struct ggml_tensor * mul);
+void ggml_compute_forward_rope_cpy(const struct ggml_compute_params * params, struct ggml_tensor * rope, struct ggml_tensor * cpy);
+
 #ifdef __cplusplus
 }
 #endif
@@ -42,7 +42,7 @@
 #define LLAMA_FILE_MAGIC_GGSQ 0x67677371u // 'ggsq'
 
 #define LLAMA_SESSION_MAGIC   LLAMA_FILE_MAGIC_GGSN
-#define LLAMA_SESSION_VERSION 9
+#define LLAMA_SESSION_VERSION 10
 
 #define LLAMA_STATE_SEQ_MAGIC   LLAMA_FILE_MAGIC_GGSQ
 #define LLAMA_STATE_SEQ_VERSION 2
@@ -61,6 +61,7 @@ extern "C" {
     struct llama_model;
     struct llama_context;
     struct llama_sampler;
+    struct llama_detokenizer;
 
     typedef struct llama_memory_i * llama_memory_t;
 
@@ -338,6 +339,8 @@ extern "C" {
         bool kv_unified;  // use a unified buffer across the input sequences when computing the attention
                           // try to disable when n_seq_max > 1 for improved performance when the sequences do not share a large prefix
                           // ref: https://github.com/ggml-org/llama.cpp/pull/14363
+
+        uint32_t kv_block_size; // number of cells per block of the paged KV cache, 0 = disabled (default) [EXPERIMENTAL]
     };
 
     // model quantization parameters
@@ -865,6 +868,25 @@ extern "C" {
                           size_t   n_token_capacity,
                           size_t * n_token_count_out);
 
+    // Same as llama_state_seq_load_file(), but the state is read from a read-only memory mapping of the file
+    // instead of being copied through an intermediate buffer
+    LLAMA_API size_t llama_state_seq_load_file_mmap(
+            struct llama_context * ctx,
+                      const char * filepath,
+                    llama_seq_id   dest_seq_id,
+                     llama_token * tokens_out,
+                          size_t   n_token_capacity,
+                          size_t * n_token_count_out);
+
+    // Save a sequence state copied with llama_state_seq_get_data() to a file that llama_state_seq_load_file() can load
+    // The context is not used, so the file can be written on another thread while the context keeps decoding
+    LLAMA_API size_t llama_state_seq_save_file_data(
+                      const char * filepath,
+                   const uint8_t * src,
+                          size_t   size,
+               const llama_token * tokens,
+                          size_t   n_token_count);
+
     //
     // Decoding
     //
@@ -943,6 +965,11 @@ extern "C" {
     // If true, all model tensors are activated during llama_decode() to load and cache their weights.
     LLAMA_API void llama_set_warmup(struct llama_context * ctx, bool warmup);
 
+    // Set the number of logits to output per token. If k > 0, the k largest logits of each output are
+    // selected in the graph and only they are copied to host memory, together with their token ids.
+    // Use when the sampler only needs the top k candidates. 0 outputs the full logits (default)
+    LLAMA_API void llama_set_logits_top_k(struct llama_context * ctx, int32_t k);
+
     // Set abort callback
     LLAMA_API void llama_set_abort_callback(struct llama_context * ctx, ggml_abort_callback abort_callback, void * abort_callback_data);
 
@@ -955,15 +982,22 @@ extern "C" {
     // The logits for which llama_batch.logits[i] != 0 are stored contiguously
     // in the order they have appeared in the batch.
     // Rows: number of tokens for which llama_batch.logits[i] != 0
-    // Cols: n_vocab
+    // Cols: llama_n_logits(ctx)
     LLAMA_API float * llama_get_logits(struct llama_context * ctx);
 
     // Logits for the ith token. For positive indices, Equivalent to:
-    // llama_get_logits(ctx) + ctx->output_ids[i]*n_vocab
+    // llama_get_logits(ctx) + ctx->output_ids[i]*llama_n_logits(ctx)
     // Negative indicies can be used to access logits in reverse order, -1 is the last logit.
     // returns NULL for invalid ids.
     LLAMA_API float * llama_get_logits_ith(struct llama_context * ctx, int32_t i);
 
+    // Token ids of the logits returned by llama_get_logits_ith(), sorted by descending logit
+    // returns NULL when the last call to llama_decode() output the full logits (see llama_set_logits_top_k())
+    LLAMA_API const llama_token * llama_get_logits_ids_ith(struct llama_context * ctx, int32_t i);
+
+    // Number of logits per output of the last call to llama_decode(): n_vocab, or k for top k logits
+    LLAMA_API int32_t llama_n_logits(const struct llama_context * ctx);
+
     // Get all output token embeddings.
     // when pooling_type == LLAMA_POOLING_TYPE_NONE or when using a generative model,
     // the embeddings for which llama_batch.logits[i] != 0 are stored contiguously
@@ -1069,6 +1103,22 @@ extern "C" {
                             bool   add_special,
                             bool   parse_special);
 
+    /// @details Same as llama_tokenize(), but a long text is split into chunks that are tokenized on several threads, with
+    /// the same result. Meant for very long texts (e.g. whole documents), llama_tokenize() is faster for short ones.
+    /// Only the BPE vocabs whose pre-tokenizer allows it are split, the other texts are tokenized on the calling thread.
+    /// @param n_threads Max number of threads, including the calling thread (<= 0 = hardware concurrency)
+    /// @param n_chunk_min Min size of the chunks in bytes, texts shorter than 2*n_chunk_min are not split (<= 0 = 32 KiB)
+    LLAMA_API int32_t llama_tokenize_parallel(
+        const struct llama_vocab * vocab,
+                      const char * text,
+                         int32_t   text_len,
+                     llama_token * tokens,
+                         int32_t   n_tokens_max,
+                            bool   add_special,
+                            bool   parse_special,
+                         int32_t   n_threads,
+                         int32_t   n_chunk_min);
+
     // Token Id -> Piece.
     // Uses the vocabulary in the provided context.
     // Does not write null terminator to the buffer.
@@ -1097,6 +1147,33 @@ extern "C" {
                             bool   remove_special,
                             bool   unparse_special);
 
+    /// @details Incremental detokenizer, for the tokens that are generated one at a time.
+    /// The bytes of a UTF-8 code point that is split between tokens are held back until the next tokens complete it.
+    LLAMA_API struct llama_detokenizer * llama_detokenizer_init(const struct llama_vocab * vocab);
+
+    LLAMA_API void llama_detokenizer_free(struct llama_detokenizer * detok);
+
+    /// @details Convert the token into text and append it to the held back bytes, then output them up to the last complete code point.
+    /// @return Returns the number of chars/bytes on success, no more than text_len_max.
+    /// @return Returns a negative number on failure - the number of chars/bytes that would have been returned. The token is not consumed then.
+    /// @param special If true, special tokens are rendered in the output.
+    LLAMA_API int32_t llama_detokenizer_push(
+        struct llama_detokenizer * detok,
+                     llama_token   token,
+                            char * text,
+                         int32_t   text_len_max,
+                            bool   special);
+
+    /// @details Output the held back bytes, even if they do not form a complete code point (e.g. at the end of the generation).
+    /// @return Same as llama_detokenizer_push()
+    LLAMA_API int32_t llama_detokenizer_flush(
+        struct llama_detokenizer * detok,
+                            char * text,
+                         int32_t   text_len_max);
+
+    /// @details Number of bytes held back, of the code point that is not complete yet
+    LLAMA_API int32_t llama_detokenizer_n_pending(const struct llama_detokenizer * detok);
+
     //
     // Chat templates
     //
@@ -1344,6 +1421,27 @@ extern "C" {
     // Returns the seed used by the sampler if applicable, LLAMA_DEFAULT_SEED otherwise
     LLAMA_API uint32_t llama_sampler_get_seed(const struct llama_sampler * smpl);
 
+    // Returns k > 0 if the sampler only depends on the k largest logits, i.e. sampling from the top k candidates
+    // gives the same result as sampling from all of them. Returns 0 if the sampler needs all the candidates
+    LLAMA_API int32_t llama_sampler_n_logits(const struct llama_sampler * smpl);
+
+    // Precompute the work of the next llama_sampler_apply that depends only on the accepted tokens,
+    // e.g. the tokens allowed by a grammar, so that it overlaps with the evaluation of the next batch
+    // Can be called from another thread while llama_decode runs, but not concurrently with other calls on the same sampler
+    LLAMA_API void llama_sampler_prefetch(const struct llama_sampler * smpl);
+
+    // Initialize cur_p with the candidates of a row of n_logits logits
+    // ids are the tokens of the logits, NULL if the logits are the whole vocab in order
+    // If 0 < k < n_logits, only the k largest logits are kept, sorted in descending order. They are selected with a
+    // few vectorized passes over the logits instead of building and sorting the candidates of the whole vocab
+    // cur_p->data must have room for n_logits candidates
+    LLAMA_API void llama_token_data_array_from_logits(
+            llama_token_data_array * cur_p,
+                       const float * logits,
+                 const llama_token * ids,
+                           int32_t   n_logits,
+                           int32_t   k);
+
     /// @details Sample and accept a token from the idx-th output of the last evaluation
     //
     // Shorthand for:
@@ -1356,6 +1454,20 @@ extern "C" {
     // Returns the sampled token
     LLAMA_API llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_context * ctx, int32_t idx);
 
+    /// @details Sample and accept a token for each of n (sampler, output index) pairs of the last evaluation
+    // The pairs are sampled in parallel, using up to llama_n_threads(ctx) threads that are kept by the context between the calls
+    // Equivalent to:
+    //    for (int32_t i = 0; i < n; ++i) {
+    //        tokens[i] = llama_sampler_sample(smpls[i], ctx, idxs[i]);
+    //    }
+    // Each sampler must appear at most once in smpls
+    LLAMA_API void llama_sampler_sample_batch(
+               struct llama_sampler ** smpls,
+               struct llama_context  * ctx,
+                      const int32_t  * idxs,
+                        llama_token  * tokens,
+                            int32_t    n);
+
     // TODO: extend in the future
     //LLAMA_API void llama_decode_with_sampler(struct llama_context * ctx, struct llama_sampler * smpl, struct llama_batch batch, ...);
 
@@ -46,6 +46,7 @@ llama_context::llama_context(
     cparams.no_perf          = params.no_perf;
     cparams.pooling_type     = params.pooling_type;
     cparams.warmup           = false;
+    cparams.n_logits_top_k   = 0;
 
     cparams.n_ctx            = params.n_ctx           == 0    ? hparams.n_ctx_train           : params.n_ctx;
     cparams.rope_freq_base   = params.rope_freq_base  == 0.0f ? hparams.rope_freq_base_train  : params.rope_freq_base;
@@ -200,9 +201,10 @@ llama_context::llama_context(
     // init the memory module
     if (!hparams.vocab_only) {
         llama_memory_params params_mem = {
-            /*.type_k   =*/ params.type_k,
-            /*.type_v   =*/ params.type_v,
-            /*.swa_full =*/ params.swa_full,
+            /*.type_k        =*/ params.type_k,
+            /*.type_v        =*/ params.type_v,
+            /*.swa_full      =*/ params.swa_full,
+            /*.kv_block_size =*/ params.kv_block_size,
         };
 
         memory.reset(model.create_memory(params_mem, cparams));
@@ -538,7 +540,7 @@ float * llama_context::get_logits_ith(int32_t i) {
             throw std::runtime_error(format("corrupt output buffer (j=%" PRId64 ", n_outputs=%d)", j, n_outputs));
         }
 
-        return logits + j*model.vocab.n_tokens();
+        return logits + j*n_logits();
     } catch (const std::exception & err) {
         LLAMA_LOG_ERROR("%s: invalid logits id %d, reason: %s\n", __func__, i, err.what());
 #ifndef NDEBUG
@@ -549,6 +551,23 @@ float * llama_context::get_logits_ith(int32_t i) {
     }
 }
 
+const llama_token * llama_context::get_logits_ids_ith(int32_t i) {
+    if (logits_top_k == 0) {
+        return nullptr;
+    }
+
+    const float * logits_ith = get_logits_ith(i);
+    if (logits_ith == nullptr) {
+        return nullptr;
+    }
+
+    return logits_ids.data() + (logits_ith - logits);
+}
+
+int32_t llama_context::n_logits() const {
+    return logits_top_k > 0 ? logits_top_k : model.vocab.n_tokens();
+}
+
 float * llama_context::get_embeddings() {
     return embd;
 }
@@ -616,6 +635,10 @@ void llama_context::detach_threadpool() {
     this->threadpool_batch = nullptr;
 }
 
+llama_thread_pool & llama_context::get_sampling_pool() {
+    return sampling_pool;
+}
+
 void llama_context::set_n_threads(int32_t n_threads, int32_t n_threads_batch) {
     LLAMA_LOG_DEBUG("%s: n_threads = %d, n_threads_batch = %d\n", __func__, n_threads, n_threads_batch);
 
@@ -656,6 +679,13 @@ void llama_context::set_warmup(bool value) {
     cparams.warmup = value;
 }
 
+void llama_context::set_logits_top_k(int32_t k) {
+    LLAMA_LOG_DEBUG("%s: k = %d\n", __func__, k);
+
+    // selecting the whole vocab is the same as outputting the full logits
+    cparams.n_logits_top_k = k > 0 && (uint32_t) k < model.vocab.n_tokens() ? k : 0;
+}
+
 void llama_context::set_adapter_lora(
             llama_adapter_lora * adapter,
             float scale) {
@@ -807,6 +837,9 @@ int llama_context::encode(const llama_batch & batch_inp) {
 
     n_outputs = n_tokens;
 
+    // the top k logits are selected only in decoder graphs
+    logits_top_k = 0;
+
     const auto causal_attn_org = cparams.causal_attn;
 
     // always use non-causal attention for encoder graphs
@@ -936,7 +969,6 @@ int llama_context::decode(const llama_batch & batch_inp) {
     const auto & vocab   = model.vocab;
     const auto & hparams = model.hparams;
 
-    const int32_t n_vocab = vocab.n_tokens();
     const int64_t n_embd  = hparams.n_embd;
 
     // when computing embeddings, all tokens are output
@@ -1027,6 +1059,12 @@ int llama_context::decode(const llama_batch & batch_inp) {
         return -2;
     };
 
+    // when only the top k logits are output, each output row holds k logits and their token ids
+    logits_top_k = cparams.n_logits_top_k;
+    logits_ids.resize(logits_top_k*n_outputs_all);
+
+    const int64_t n_logits = this->n_logits();
+
     int64_t n_outputs_prev = 0;
 
     do {
@@ -1087,8 +1125,9 @@ int llama_context::decode(const llama_batch & batch_inp) {
         //    ggml_graph_dump_dot(gf, NULL, "llama.dot");
         //}
 
-        auto * t_logits = res->get_logits();
-        auto * t_embd   = cparams.embeddings ? res->get_embd() : nullptr;
+        auto * t_logits     = res->get_logits();
+        auto * t_logits_ids = res->get_logits_ids();
+        auto * t_embd       = cparams.embeddings ? res->get_embd() : nullptr;
 
         if (t_embd && res->get_embd_pooled()) {
             t_embd = res->get_embd_pooled();
@@ -1100,12 +1139,23 @@ int llama_context::decode(const llama_batch & batch_inp) {
             GGML_ASSERT(backend_res != nullptr);
             GGML_ASSERT(logits != nullptr);
 
-            float * logits_out = logits + n_outputs_prev*n_vocab;
+            GGML_ASSERT(t_logits->ne[0] == n_logits);
+
+            float * logits_out = logits + n_outputs_prev*n_logits;
 
             if (n_outputs) {
                 GGML_ASSERT( n_outputs_prev + n_outputs <= n_outputs_all);
-                GGML_ASSERT((n_outputs_prev + n_outputs)*n_vocab <= (int64_t) logits_size);
-                ggml_backend_tensor_get_async(backend_res, t_logits, logits_out, 0, n_outputs*n_vocab*sizeof(float));
+                GGML_ASSERT((n_outputs_prev + n_outputs)*n_logits <= (int64_t) logits_size);
+                ggml_backend_tensor_get_async(backend_res, t_logits, logits_out, 0, n_outputs*n_logits*sizeof(float));
+            }
+
+            if (t_logits_ids) {
+                ggml_backend_t backend_ids = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits_ids);
+                GGML_ASSERT(backend_ids != nullptr);
+
+                llama_token * ids_out = logits_ids.data() + n_outputs_prev*n_logits;
+
+                ggml_backend_tensor_get_async(backend_ids, t_logits_ids, ids_out, 0, n_outputs*n_logits*sizeof(llama_token));
             }
         }
 
@@ -1189,7 +1239,6 @@ int llama_context::decode(const llama_batch & batch_inp) {
         // make the outputs have the same order they had in the user-provided batch
         // note: this is mostly relevant for recurrent models atm
         if (!sorted_output) {
-            const uint32_t n_vocab = model.vocab.n_tokens();
             const uint64_t n_embd  = model.hparams.n_embd;
 
             GGML_ASSERT((size_t) n_outputs == out_ids.size());
@@ -1208,8 +1257,13 @@ int llama_context::decode(const llama_batch & batch_inp) {
                 }
                 std::swap(out_ids[i], out_ids[j_min]);
                 if (logits_size > 0) {
-                    for (uint32_t k = 0; k < n_vocab; k++) {
-                        std::swap(logits[i*n_vocab + k], logits[j_min*n_vocab + k]);
+                    for (uint32_t k = 0; k < n_logits; k++) {
+                        std::swap(logits[i*n_logits + k], logits[j_min*n_logits + k]);
+                    }
+                }
+                if (!logits_ids.empty()) {
+                    for (uint32_t k = 0; k < n_logits; k++) {
+                        std::swap(logits_ids[i*n_logits + k], logits_ids[j_min*n_logits + k]);
                     }
                 }
                 if (embd_size > 0) {
@@ -1703,6 +1757,16 @@ bool llama_context::state_save_file(const char * filepath, const llama_token * t
     return true;
 }
 
+// header of the sequence state files: magic, version and the tokens of the sequence, followed by the state
+static void llama_state_seq_write_file_header(const llama_file & file, const llama_token * tokens, size_t n_token_count) {
+    file.write_u32(LLAMA_STATE_SEQ_MAGIC);
+    file.write_u32(LLAMA_STATE_SEQ_VERSION);
+
+    // save the prompt
+    file.write_u32((uint32_t) n_token_count);
+    file.write_raw(tokens, sizeof(llama_token) * n_token_count);
+}
+
 size_t llama_context::state_seq_load_file(llama_seq_id seq_id, const char * filepath, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out) {
     llama_file file(filepath, "rb");
 
@@ -1746,15 +1810,60 @@ size_t llama_context::state_seq_load_file(llama_seq_id seq_id, const char * file
     return file.tell();
 }
 
+size_t llama_context::state_seq_load_file_mmap(llama_seq_id seq_id, const char * filepath, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out) {
+    if (!llama_mmap::SUPPORTED) {
+        return state_seq_load_file(seq_id, filepath, tokens_out, n_token_capacity, n_token_count_out);
+    }
+
+    llama_file file(filepath, "rb");
+    llama_mmap mapping(&file, 0);
+
+    llama_io_read_buffer io((const uint8_t *) mapping.addr(), mapping.size());
+
+    // version checks
+    {
+        uint32_t magic;
+        uint32_t version;
+        io.read_to(&magic,   sizeof(magic));
+        io.read_to(&version, sizeof(version));
+
+        if (magic != LLAMA_STATE_SEQ_MAGIC || version != LLAMA_STATE_SEQ_VERSION) {
+            LLAMA_LOG_ERROR("%s: unknown (magic, version) for sequence state file: %08x, %08x\n", __func__, magic, version);
+            return 0;
+        }
+    }
+
+    // load the prompt
+    {
+        uint32_t n_token_count;
+        io.read_to(&n_token_count, sizeof(n_token_count));
+
+        if (n_token_count > n_token_capacity) {
+            LLAMA_LOG_ERROR("%s: token count in sequence state file exceeded capacity! %u > %zu\n", __func__, n_token_count, n_token_capacity);
+            return 0;
+        }
+
+        io.read_to(tokens_out, sizeof(llama_token) * n_token_count);
+        *n_token_count_out = n_token_count;
+    }
+
+    // restore the context state directly from the mapping
+    {
+        const size_t n_header = io.n_bytes();
+        const size_t nread    = state_seq_read_data(io, seq_id);
+        if (nread == n_header) {
+            LLAMA_LOG_ERROR("%s: failed to restore sequence state\n", __func__);
+            return 0;
+        }
+    }
+
+    return io.n_bytes();
+}
+
 size_t llama_context::state_seq_save_file(llama_seq_id seq_id, const char * filepath, const llama_token * tokens, size_t n_token_count) {
     llama_file file(filepath, "wb");
 
-    file.write_u32(LLAMA_STATE_SEQ_MAGIC);
-    file.write_u32(LLAMA_STATE_SEQ_VERSION);
-
-    // save the prompt
-    file.write_u32((uint32_t) n_token_count);
-    file.write_raw(tokens, sizeof(llama_token) * n_token_count);
+    llama_state_seq_write_file_header(file, tokens, n_token_count);
 
     // save the context state using stream saving
     llama_io_write_file io(&file);
@@ -1810,12 +1919,21 @@ size_t llama_context::state_write_data(llama_io_write_i & io) {
     {
         LLAMA_LOG_DEBUG("%s: - writing logits\n", __func__);
 
-        const uint64_t logits_size = std::min((uint64_t) this->logits_size, (uint64_t) n_outputs * model.vocab.n_tokens());
+        const uint32_t logits_top_k = this->logits_top_k;
+
+        io.write(&logits_top_k, sizeof(logits_top_k));
+
+        const uint64_t logits_size = std::min((uint64_t) this->logits_size, (uint64_t) n_outputs * n_logits());
 
         io.write(&logits_size, sizeof(logits_size));
 
         if (logits_size) {
             io.write(logits, logits_size * sizeof(float));
+
+            // the token ids of the top k logits, same layout as the logits
+            if (logits_top_k > 0) {
+                io.write(logits_ids.data(), logits_size * sizeof(llama_token));
+            }
         }
     }
 
@@ -1890,6 +2008,13 @@ size_t llama_context::state_read_data(llama_io_read_i & io) {
     {
         LLAMA_LOG_DEBUG("%s: - reading logits\n", __func__);
 
+        uint32_t logits_top_k;
+        io.read_to(&logits_top_k, sizeof(logits_top_k));
+
+        if (logits_top_k >= model.vocab.n_tokens()) {
+            throw std::runtime_error(format("invalid number of top logits: %u", logits_top_k));
+        }
+
         uint64_t logits_size;
         io.read_to(&logits_size, sizeof(logits_size));
 
@@ -1897,8 +2022,15 @@ size_t llama_context::state_read_data(llama_io_read_i & io) {
             throw std::runtime_error("logits buffer too small");
         }
 
+        this->logits_top_k = logits_top_k;
+
         if (logits_size) {
             io.read_to(this->logits, logits_size * sizeof(float));
+
+            if (logits_top_k > 0) {
+                logits_ids.resize(logits_size);
+                io.read_to(logits_ids.data(), logits_size * sizeof(llama_token));
+            }
         }
     }
 
@@ -2225,6 +2357,7 @@ llama_context_params llama_context_default_params() {
         /*.op_offload                  =*/ true,
         /*.swa_full                    =*/ true,
         /*.kv_unified                  =*/ false,
+        /*.kv_block_size               =*/ 0,
     };
 
     return result;
@@ -2352,6 +2485,10 @@ void llama_set_warmup(llama_context * ctx, bool warmup) {
     ctx->set_warmup(warmup);
 }
 
+void llama_set_logits_top_k(llama_context * ctx, int32_t k) {
+    ctx->set_logits_top_k(k);
+}
+
 void llama_synchronize(llama_context * ctx) {
     ctx->synchronize();
 }
@@ -2368,6 +2505,16 @@ float * llama_get_logits_ith(llama_context * ctx, int32_t i) {
     return ctx->get_logits_ith(i);
 }
 
+const llama_token * llama_get_logits_ids_ith(llama_context * ctx, int32_t i) {
+    ctx->synchronize();
+
+    return ctx->get_logits_ids_ith(i);
+}
+
+int32_t llama_n_logits(const llama_context * ctx) {
+    return ctx->n_logits();
+}
+
 float * llama_get_embeddings(llama_context * ctx) {
     ctx->synchronize();
 
@@ -2794,6 +2941,32 @@ size_t llama_state_seq_load_file(llama_context * ctx, const char * filepath, lla
     }
 }
 
+size_t llama_state_seq_load_file_mmap(llama_context * ctx, const char * filepath, llama_seq_id dest_seq_id, llama_token * tokens_out, size_t n_token_capacity, size_t * n_token_count_out) {
+    ctx->synchronize();
+
+    try {
+        return ctx->state_seq_load_file_mmap(dest_seq_id, filepath, tokens_out, n_token_capacity, n_token_count_out);
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error loading sequence state file: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
+size_t llama_state_seq_save_file_data(const char * filepath, const uint8_t * src, size_t size, const llama_token * tokens, size_t n_token_count) {
+    try {
+        llama_file file(filepath, "wb");
+
+        llama_state_seq_write_file_header(file, tokens, n_token_count);
+
+        file.write_raw(src, size);
+
+        return file.tell();
+    } catch (const std::exception & err) {
+        LLAMA_LOG_ERROR("%s: error saving sequence state file: %s\n", __func__, err.what());
+        return 0;
+    }
+}
+
 ///
 
 int32_t llama_encode(
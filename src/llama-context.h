@@ -4,6 +4,7 @@
 #include "llama-cparams.h"
 #include "llama-graph.h"
 #include "llama-adapter.h"
+#include "llama-thread-pool.h"
 
 #include "ggml-cpp.h"
 #include "ggml-opt.h"
@@ -56,6 +57,11 @@ struct llama_context {
     float * get_logits();
     float * get_logits_ith(int32_t i);
 
+    const llama_token * get_logits_ids_ith(int32_t i);
+
+    // number of logits per output in the logits buffer
+    int32_t n_logits() const;
+
     float * get_embeddings();
     float * get_embeddings_ith(int32_t i);
     float * get_embeddings_seq(llama_seq_id seq_id);
@@ -66,6 +72,9 @@ struct llama_context {
 
     void detach_threadpool();
 
+    // threads used to sample the outputs of several sequences in parallel, see llama_sampler_sample_batch
+    llama_thread_pool & get_sampling_pool();
+
     void set_n_threads(int32_t n_threads, int32_t n_threads_batch);
 
     void set_abort_callback(bool (*abort_callback)(void * data), void * abort_callback_data);
@@ -73,6 +82,7 @@ struct llama_context {
     void set_embeddings (bool value);
     void set_causal_attn(bool value);
     void set_warmup(bool value);
+    void set_logits_top_k(int32_t k);
 
     void set_adapter_lora(
             llama_adapter_lora * adapter,
@@ -139,6 +149,14 @@ struct llama_context {
      const llama_token * tokens,
                 size_t   n_token_count);
 
+    // same as state_seq_load_file(), but the state is read from a read-only mapping of the file
+    size_t state_seq_load_file_mmap(
+          llama_seq_id   seq_id,
+            const char * filepath,
+           llama_token * tokens_out,
+                size_t   n_token_capacity,
+                size_t * n_token_count_out);
+
     //
     // perf
     //
@@ -234,6 +252,12 @@ private:
     size_t  logits_size = 0; // capacity (of floats) for logits
     float * logits      = nullptr;
 
+    // when only the top k logits are output, the rows of the logits buffer are [n_outputs][k]
+    // and the token ids of the logits are stored in logits_ids with the same layout
+    uint32_t logits_top_k = 0;
+
+    std::vector<llama_token> logits_ids;
+
     // embeddings output (2-dimensional array: [n_outputs][n_embd])
     // populated only when pooling_type == LLAMA_POOLING_TYPE_NONE
     size_t  embd_size = 0; // capacity (of floats) for embeddings
@@ -261,6 +285,8 @@ private:
     ggml_threadpool_t threadpool       = nullptr;
     ggml_threadpool_t threadpool_batch = nullptr;
 
+    llama_thread_pool sampling_pool;
+
     ggml_abort_callback abort_callback      = nullptr;
     void *              abort_callback_data = nullptr;
 
@@ -7,6 +7,7 @@
 #include <cmath>
 #include <algorithm>
 #include <stdexcept>
+#include <unordered_map>
 
 //
 // helpers
@@ -823,11 +824,15 @@ llama_grammar_stacks & llama_grammar_get_stacks(struct llama_grammar * grammar)
     return grammar->stacks;
 }
 
-void llama_grammar_accept(struct llama_grammar * grammar, uint32_t chr) {
+// the stacks reached from the given stacks after accepting chr
+static llama_grammar_stacks llama_grammar_accept_stacks(
+        const llama_grammar_rules  & rules,
+        const llama_grammar_stacks & stacks,
+        uint32_t                     chr) {
     llama_grammar_stacks stacks_new;
-    stacks_new.reserve(grammar->stacks.size());
+    stacks_new.reserve(stacks.size());
 
-    for (const auto & stack : grammar->stacks) {
+    for (const auto & stack : stacks) {
         if (stack.empty()) {
             continue;
         }
@@ -841,11 +846,15 @@ void llama_grammar_accept(struct llama_grammar * grammar, uint32_t chr) {
             if (!llama_grammar_is_end_of_sequence(pos)) {
                 new_stack.push_back(pos);
             }
-            llama_grammar_advance_stack(grammar->rules, new_stack, stacks_new);
+            llama_grammar_advance_stack(rules, new_stack, stacks_new);
         }
     }
 
-    grammar->stacks = std::move(stacks_new);
+    return stacks_new;
+}
+
+void llama_grammar_accept(struct llama_grammar * grammar, uint32_t chr) {
+    grammar->stacks = llama_grammar_accept_stacks(grammar->rules, grammar->stacks, chr);
 }
 
 llama_grammar_candidates llama_grammar_reject_candidates_for_stack(
@@ -903,6 +912,278 @@ llama_grammar_candidates llama_grammar_reject_candidates_for_stack(
     return rejects;
 }
 
+//
+// automaton
+//
+
+// the states of the automaton are the distinct sets of stacks that a grammar reaches, and its transitions are the
+// code points accepted by at least one of the stacks of a state. both are created on first use and then reused, so
+// after a few steps most of the grammar is compiled. the tokens allowed in a state are computed once, by walking the
+// token trie of the vocab byte by byte, and stored as a bitmask over the vocab.
+//
+// all the grammars with the same rules and vocab share one automaton, kept in the grammar cache of the vocab, so
+// concurrent and successive requests with the same grammar (e.g. the same JSON schema) reuse each other's states and
+// masks. each grammar has its own copy of the rules, so its stacks are mapped to the rules of the automaton by their
+// offsets.
+//
+// the mask of a state applies only when the previous tokens did not end inside a UTF-8 sequence, other cases are
+// handled by llama_grammar_reject_candidates
+
+// the compiled states are discarded when there are more than this, to bound the memory of deeply nested grammars
+#define LLAMA_GRAMMAR_MAX_STATES     65536
+
+// the least recently used masks and automatons are evicted when there are more than this
+#define LLAMA_GRAMMAR_MAX_MASKS      256
+#define LLAMA_GRAMMAR_MAX_AUTOMATONS 8
+
+using llama_grammar_mask = std::vector<uint64_t>;
+
+struct llama_grammar_automaton {
+    struct state {
+        llama_grammar_stacks stacks;
+
+        // code point -> next state, -1 if no stack accepts the code point
+        std::unordered_map<uint32_t, int32_t> next;
+
+        // bitmask of the allowed tokens, null until computed or after eviction
+        std::shared_ptr<const llama_grammar_mask> mask;
+
+        // position in the LRU list, if the mask is set
+        std::list<int32_t>::iterator lru;
+    };
+
+    const llama_vocab & vocab;
+
+    // the stacks of the states point to the elements of these rules
+    const llama_grammar_rules rules;
+
+    // end-of-generation tokens, allowed in the states with an empty stack
+    std::vector<llama_token> eog;
+
+    std::mutex mutex;
+
+    std::vector<state>                      states;
+    std::map<llama_grammar_stacks, int32_t> ids;
+
+    // the states with a mask, most recently used first
+    std::list<int32_t> lru;
+
+    llama_grammar_automaton(const llama_vocab & vocab, const llama_grammar_rules & rules) : vocab(vocab), rules(rules) {
+        for (uint32_t id = 0; id < vocab.n_tokens(); ++id) {
+            if (vocab.is_eog(id)) {
+                eog.push_back(id);
+            }
+        }
+    }
+
+    // the mask of the tokens allowed by the stacks of a grammar with the same rules as the automaton
+    std::shared_ptr<const llama_grammar_mask> get_mask(const llama_grammar_rules & rules_src, const llama_grammar_stacks & stacks_src) {
+        const auto stacks = map_stacks(rules_src, stacks_src);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (states.size() > LLAMA_GRAMMAR_MAX_STATES) {
+            states.clear();
+            ids.clear();
+            lru.clear();
+        }
+
+        const int32_t id = get_state(stacks);
+
+        if (states[id].mask) {
+            lru.splice(lru.begin(), lru, states[id].lru);
+
+            return states[id].mask;
+        }
+
+        auto mask = std::make_shared<const llama_grammar_mask>(compute_mask(id));
+
+        states[id].mask = mask;
+        states[id].lru  = lru.insert(lru.begin(), id);
+
+        if (lru.size() > LLAMA_GRAMMAR_MAX_MASKS) {
+            states[lru.back()].mask.reset();
+            lru.pop_back();
+        }
+
+        return mask;
+    }
+
+    llama_grammar_stacks map_stacks(const llama_grammar_rules & rules_src, const llama_grammar_stacks & stacks_src) const {
+        llama_grammar_stacks stacks = stacks_src;
+
+        for (auto & stack : stacks) {
+            for (auto & pos : stack) {
+                size_t ir = 0;
+                while (pos < rules_src[ir].data() || pos >= rules_src[ir].data() + rules_src[ir].size()) {
+                    ir++;
+                }
+                pos = rules[ir].data() + (pos - rules_src[ir].data());
+            }
+        }
+
+        return stacks;
+    }
+
+    int32_t get_state(const llama_grammar_stacks & stacks) {
+        const auto it = ids.find(stacks);
+        if (it != ids.end()) {
+            return it->second;
+        }
+
+        const int32_t id = states.size();
+
+        states.push_back({ stacks, {}, nullptr, {} });
+        ids.emplace(stacks, id);
+
+        return id;
+    }
+
+    int32_t get_next(int32_t id, uint32_t chr) {
+        const auto it = states[id].next.find(chr);
+        if (it != states[id].next.end()) {
+            return it->second;
+        }
+
+        const auto stacks_new = llama_grammar_accept_stacks(rules, states[id].stacks, chr);
+
+        const int32_t next = stacks_new.empty() ? -1 : get_state(stacks_new);
+
+        states[id].next.emplace(chr, next);
+
+        return next;
+    }
+
+    // walk the trie from the given state, skipping the subtrees of the prefixes that the grammar rejects
+    llama_grammar_mask compute_mask(int32_t id) {
+        static const int lookup[] = { 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 2, 2, 3, 4 };
+
+        const auto & trie = vocab.get_token_trie();
+
+        // the state of the automaton and of the UTF-8 decoder after each byte of the current path
+        struct frame {
+            int32_t            state;
+            llama_partial_utf8 partial;
+        };
+
+        std::vector<frame> frames(trie.max_depth + 1);
+        frames[0] = { id, { 0, 0 } };
+
+        // a token is allowed if it ends after a code point, or inside a UTF-8 sequence that some stack can match
+        auto is_allowed = [&](const frame & cur) {
+            if (cur.partial.n_remain == 0) {
+                return true;
+            }
+            for (const auto & stack : states[cur.state].stacks) {
+                if (!stack.empty() && llama_grammar_match_partial_char(stack.back(), cur.partial)) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        llama_grammar_mask mask((vocab.n_tokens() + 63)/64, 0);
+
+        auto allow = [&](uint32_t tok_begin, uint32_t tok_end) {
+            for (uint32_t j = tok_begin; j < tok_end; ++j) {
+                const llama_token token = trie.tokens[j];
+                mask[token/64] |= 1ull << (token%64);
+            }
+        };
+
+        const auto & nodes = trie.nodes;
+
+        for (uint32_t i = 0; i < nodes.size(); ) {
+            const auto & node = nodes[i];
+
+            frame cur = frames[node.depth - 1];
+
+            if (node.byte == 0) {
+                // the grammar decodes a piece up to its first null byte
+                if (node.depth > 1 && is_allowed(cur)) {
+                    allow(node.tok_begin, nodes[node.end - 1].tok_end);
+                }
+                i = node.end;
+                continue;
+            }
+
+            if (cur.partial.n_remain > 0) {
+                cur.partial.value = (cur.partial.value << 6) + (node.byte & 0x3F);
+                cur.partial.n_remain--;
+            } else {
+                cur.partial.n_remain = lookup[node.byte >> 4] - 1;
+                if (cur.partial.n_remain < 0) {
+                    // invalid sequence, rejects the token
+                    i = node.end;
+                    continue;
+                }
+                cur.partial.value = node.byte & ((1 << (7 - cur.partial.n_remain)) - 1);
+            }
+
+            if (cur.partial.n_remain == 0) {
+                cur.state = get_next(cur.state, cur.partial.value);
+                if (cur.state < 0) {
+                    i = node.end;
+                    continue;
+                }
+            }
+
+            frames[node.depth] = cur;
+
+            if (node.tok_begin < node.tok_end && is_allowed(cur)) {
+                allow(node.tok_begin, node.tok_end);
+            }
+
+            i++;
+        }
+
+        bool allow_eog = false;
+        for (const auto & stack : states[id].stacks) {
+            allow_eog = allow_eog || stack.empty();
+        }
+
+        for (const llama_token token : eog) {
+            if (allow_eog) {
+                mask[token/64] |=   1ull << (token%64);
+            } else {
+                mask[token/64] &= ~(1ull << (token%64));
+            }
+        }
+
+        return mask;
+    }
+};
+
+// the automaton shared by the grammars with the given rules and vocab
+static std::shared_ptr<llama_grammar_automaton> llama_grammar_automaton_get(const llama_vocab & vocab, const llama_grammar_rules & rules) {
+    auto & cache = vocab.get_grammar_cache();
+
+    std::string key;
+    for (const auto & rule : rules) {
+        key.append((const char *) rule.data(), rule.size()*sizeof(llama_grammar_element));
+    }
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.automatons.begin(); it != cache.automatons.end(); ++it) {
+        if (it->first == key) {
+            cache.automatons.splice(cache.automatons.begin(), cache.automatons, it);
+            return it->second;
+        }
+    }
+
+    auto result = std::make_shared<llama_grammar_automaton>(vocab, rules);
+
+    cache.automatons.emplace_front(std::move(key), result);
+
+    // the grammars that use an evicted automaton keep it alive
+    if (cache.automatons.size() > LLAMA_GRAMMAR_MAX_AUTOMATONS) {
+        cache.automatons.pop_back();
+    }
+
+    return result;
+}
+
 ////////////////////
 
 struct llama_grammar * llama_grammar_init_impl(
@@ -960,7 +1241,7 @@ struct llama_grammar * llama_grammar_init_impl(
     // Important: vec_rules has to be moved here, not copied, because stacks contains
     // pointers to elements of vec_rules. If vec_rules were copied into llama_grammar
     // then the pointers would be invalidated when the local vec_rules goes out of scope.
-    return new llama_grammar {
+    auto * result = new llama_grammar {
         vocab,
         std::move(vec_rules),
         std::move(stacks),
@@ -970,7 +1251,14 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer = */   "",
         /* .trigger_tokens   = */ {},
         /* .trigger_patterns    = */ {},
+        /* .automaton = */        nullptr,
     };
+
+    if (vocab != nullptr) {
+        result->automaton = llama_grammar_automaton_get(*vocab, result->rules);
+    }
+
+    return result;
 }
 
 struct llama_grammar * llama_grammar_init_impl(
@@ -1065,7 +1353,7 @@ struct llama_grammar * llama_grammar_init_impl(
     // Important: vec_rules has to be moved here, not copied, because stacks contains
     // pointers to elements of vec_rules. If vec_rules were copied into llama_grammar
     // then the pointers would be invalidated when the local vec_rules goes out of scope.
-    return new llama_grammar {
+    auto * result = new llama_grammar {
         vocab,
         std::move(vec_rules),
         std::move(stacks),
@@ -1075,7 +1363,14 @@ struct llama_grammar * llama_grammar_init_impl(
         /* .trigger_buffer = */   "",
         std::move(vec_trigger_tokens),
         std::move(vec_trigger_patterns),
+        /* .automaton = */        nullptr,
     };
+
+    if (vocab != nullptr) {
+        result->automaton = llama_grammar_automaton_get(*vocab, result->rules);
+    }
+
+    return result;
 }
 
 void llama_grammar_free_impl(struct llama_grammar * grammar) {
@@ -1097,6 +1392,7 @@ struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & gra
         grammar.trigger_buffer,
         grammar.trigger_tokens,
         grammar.trigger_patterns,
+        grammar.automaton,
     };
 
     // redirect elements in stacks to point to new rules
@@ -1122,6 +1418,22 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
         return;
     }
 
+    if (grammar.automaton && grammar.partial_utf8.n_remain <= 0) {
+        // the mask includes the end-of-generation tokens
+        const auto mask_ptr = grammar.automaton->get_mask(grammar.rules, grammar.stacks);
+        const auto & mask   = *mask_ptr;
+
+        for (size_t i = 0; i < cur_p->size; ++i) {
+            const llama_token id = cur_p->data[i].id;
+
+            if (!(mask[id/64] & (1ull << (id%64)))) {
+                cur_p->data[i].logit = -INFINITY;
+            }
+        }
+
+        return;
+    }
+
     bool allow_eog = false;
     for (const auto & stack : grammar.stacks) {
         if (stack.empty()) {
@@ -1158,6 +1470,12 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
     }
 }
 
+void llama_grammar_prefetch_impl(const struct llama_grammar & grammar) {
+    if (grammar.automaton && !grammar.awaiting_trigger && grammar.partial_utf8.n_remain <= 0) {
+        grammar.automaton->get_mask(grammar.rules, grammar.stacks);
+    }
+}
+
 void llama_grammar_accept_impl(struct llama_grammar & grammar, llama_token token) {
     GGML_ASSERT(grammar.vocab != nullptr);
 
@@ -2,12 +2,16 @@
 
 #include "llama.h"
 
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <vector>
 
 struct llama_vocab;
+struct llama_grammar_automaton;
 
 // grammar element type
 enum llama_gretype {
@@ -106,6 +110,15 @@ struct llama_grammar_parser {
     void print(FILE * file);
 };
 
+// the grammar automatons compiled for a vocab, shared by all the grammars with the same rules
+// owned by the vocab, so that they are reused by the next requests with the same grammar
+struct llama_grammar_cache {
+    std::mutex mutex;
+
+    // rules -> automaton, most recently used first
+    std::list<std::pair<std::string, std::shared_ptr<llama_grammar_automaton>>> automatons;
+};
+
 struct llama_grammar_trigger_pattern {
     std::string pattern;
     std::regex  regex;
@@ -132,6 +145,9 @@ struct llama_grammar {
                              trigger_patterns;         // Regular expressions that trigger a lazy grammar. Must be a full match of the entire generated
                                                        // string, and the grammar will be given the string from the first match group onwards.
 
+    // token-level automaton compiled lazily from the rules, used to compute the allowed tokens with a bitmask
+    // null if there is no vocab
+    std::shared_ptr<llama_grammar_automaton> automaton;
 };
 
 //
@@ -164,6 +180,9 @@ void llama_grammar_apply_impl(
         const struct llama_grammar & grammar,
             llama_token_data_array * cur_p);
 
+// compute the tokens allowed in the current state of the grammar, so that the next apply finds them in the cache
+void llama_grammar_prefetch_impl(const struct llama_grammar & grammar);
+
 void llama_grammar_accept_impl(
               struct llama_grammar & grammar,
                        llama_token   token);
@@ -425,6 +425,7 @@ int64_t llm_graph_result::get_max_nodes() const {
 void llm_graph_result::reset() {
     t_tokens      = nullptr;
     t_logits      = nullptr;
+    t_logits_ids  = nullptr;
     t_embd        = nullptr;
     t_embd_pooled = nullptr;
 
@@ -1790,3 +1791,39 @@ int32_t llama_relative_position_bucket(llama_pos x, llama_pos y, uint64_t n_buck
 
     return relative_bucket;
 }
+
+void llm_graph_context::build_logits_top_k() const {
+    const int64_t k = cparams.n_logits_top_k;
+
+    ggml_tensor * logits = res->t_logits;
+
+    if (k == 0 || logits == nullptr || logits->ne[0] <= k) {
+        return;
+    }
+
+    const int64_t n_vocab   = logits->ne[0];
+    const int64_t n_outputs = logits->ne[1];
+
+    ggml_tensor * ids;
+
+    if (k == 1) {
+        // greedy - no need to sort
+        ids = ggml_argmax(ctx0, logits);
+        ids = ggml_reshape_2d(ctx0, ids, 1, n_outputs);
+    } else {
+        ids = ggml_argsort_top_k(ctx0, logits, k);
+    }
+    cb(ids, "result_output_ids", -1);
+
+    ggml_tensor * cur = ggml_get_rows(ctx0, ggml_reshape_3d(ctx0, logits, 1, n_vocab, n_outputs), ids); // [1, k, n_outputs]
+    cur = ggml_reshape_2d(ctx0, cur, k, n_outputs);
+    cb(cur, "result_output_top_k", -1);
+
+    // the ids are read back together with the logits, so they must not be overwritten
+    ggml_set_output(ids);
+
+    res->t_logits     = cur;
+    res->t_logits_ids = ids;
+
+    ggml_build_forward_expand(gf, cur);
+}
@@ -432,8 +432,9 @@ struct llm_graph_params {
         }
 
         return
-            cparams.embeddings  == other.cparams.embeddings  &&
-            cparams.causal_attn == other.cparams.causal_attn &&
+            cparams.embeddings     == other.cparams.embeddings     &&
+            cparams.causal_attn    == other.cparams.causal_attn    &&
+            cparams.n_logits_top_k == other.cparams.n_logits_top_k &&
             arch      == other.arch  &&
             gtype     == other.gtype &&
             cvec      == other.cvec  &&
@@ -451,6 +452,7 @@ public:
 
     ggml_tensor * get_tokens()      const { return t_tokens; }
     ggml_tensor * get_logits()      const { return t_logits; }
+    ggml_tensor * get_logits_ids()  const { return t_logits_ids; }
     ggml_tensor * get_embd()        const { return t_embd; }
     ggml_tensor * get_embd_pooled() const { return t_embd_pooled; }
 
@@ -477,6 +479,7 @@ public:
     // important graph nodes
     ggml_tensor * t_tokens      = nullptr;
     ggml_tensor * t_logits      = nullptr;
+    ggml_tensor * t_logits_ids  = nullptr; // token ids of t_logits when only the top k logits are output
     ggml_tensor * t_embd        = nullptr;
     ggml_tensor * t_embd_pooled = nullptr;
 
@@ -765,6 +768,13 @@ struct llm_graph_context {
             ggml_tensor * cls_b,
             ggml_tensor * cls_out,
             ggml_tensor * cls_out_b) const;
+
+    //
+    // output
+    //
+
+    // replace the logits with the top k logits of each output and their token ids
+    void build_logits_top_k() const;
 };
 
 // TODO: better name
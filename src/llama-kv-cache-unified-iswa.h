@@ -24,7 +24,8 @@ public:
                      uint32_t   kv_size,
                      uint32_t   n_seq_max,
                      uint32_t   n_ubatch,
-                     uint32_t   n_pad);
+                     uint32_t   n_pad,
+                     uint32_t   n_block);
 
     ~llama_kv_cache_unified_iswa() = default;
 
@@ -28,9 +28,10 @@ llama_kv_cache_unified::llama_kv_cache_unified(
                  uint32_t    n_seq_max,
                  uint32_t    n_pad,
                  uint32_t    n_swa,
-           llama_swa_type    swa_type) :
+           llama_swa_type    swa_type,
+                 uint32_t    n_block) :
     model(model), hparams(model.hparams), v_trans(v_trans),
-    n_seq_max(n_seq_max), n_stream(unified ? 1 : n_seq_max), n_pad(n_pad), n_swa(n_swa), swa_type(swa_type) {
+    n_seq_max(n_seq_max), n_stream(unified ? 1 : n_seq_max), n_pad(n_pad), n_swa(n_swa), n_block(n_block), swa_type(swa_type) {
 
     GGML_ASSERT(kv_size % n_pad == 0);
 
@@ -195,6 +196,15 @@ llama_kv_cache_unified::llama_kv_cache_unified(
     const char * LLAMA_SET_ROWS = getenv("LLAMA_SET_ROWS");
     supports_set_rows = LLAMA_SET_ROWS ? atoi(LLAMA_SET_ROWS) != 0 : 0;
 
+    // the cells of a ubatch are scattered over the blocks, so the paged mode always stores them with ggml_set_rows()
+    if (n_block > 0) {
+        this->n_block = std::min(n_block, kv_size);
+
+        supports_set_rows = true;
+
+        LLAMA_LOG_INFO("%s: paged KV cache, block size = %u cells\n", __func__, this->n_block);
+    }
+
     if (!supports_set_rows) {
         // ref: https://github.com/ggml-org/llama.cpp/pull/14363
         GGML_ASSERT(unified && "cannot use non-unified KV cache without ggml_set_rows() support");
@@ -514,6 +524,8 @@ llama_memory_context_ptr llama_kv_cache_unified::init_update(llama_context * lct
     defrag_info dinfo;
 
     // see if we need to defrag
+    // note : in paged mode the compaction mixes the sequences in the blocks at the beginning of the cache, the block
+    //        table is rebuilt from the cells by find_slot_paged(), so the new tokens then claim the empty blocks after them
     if (n_stream == 1) {
         // note : for now do not consider defrag for n_stream > 1
         const auto & cells = v_cells[seq_to_stream[0]];
@@ -527,7 +539,16 @@ llama_memory_context_ptr llama_kv_cache_unified::init_update(llama_context * lct
 
             // - do not defrag small contexts (i.e. < 2048 tokens)
             // - count the padding towards the number of used tokens
-            const float fragmentation = n_kv >= 2048 ? std::max(0.0f, 1.0f - (float(cells.get_used() + n_pad)/n_kv)) : 0.0f;
+            // - in paged mode, count the unfilled part of the last block of each sequence towards the number of used
+            //   tokens, otherwise the blocks that the sequences are filling would request a defrag at every step
+            uint32_t n_used = cells.get_used() + n_pad;
+            if (n_block > 0) {
+                for (llama_seq_id s = 0; s < LLAMA_MAX_SEQ; ++s) {
+                    n_used += cells.seq_pos_min(s) >= 0 ? n_block - 1 : 0;
+                }
+            }
+
+            const float fragmentation = n_kv >= 2048 ? std::max(0.0f, 1.0f - (float(n_used)/n_kv)) : 0.0f;
 
             if (fragmentation > thold) {
                 LLAMA_LOG_DEBUG("%s: fragmentation: %.2f - requesting defrag\n", __func__, fragmentation);
@@ -565,7 +586,7 @@ llama_kv_cache_unified::slot_info_vec_t llama_kv_cache_unified::prepare(const st
         const bool cont = supports_set_rows ? false : true;
 
         // only find a suitable slot for the ubatch. don't modify the cells yet
-        const auto sinfo_new = find_slot(ubatch, cont);
+        const auto sinfo_new = n_block > 0 ? find_slot_paged(ubatch) : find_slot(ubatch, cont);
         if (sinfo_new.empty()) {
             success = false;
             break;
@@ -928,6 +949,164 @@ llama_kv_cache_unified::slot_info llama_kv_cache_unified::find_slot(const llama_
     return res;
 }
 
+llama_kv_cache_unified::slot_info llama_kv_cache_unified::find_slot_paged(const llama_ubatch & ubatch) const {
+    uint32_t n_tokens = ubatch.n_tokens;
+    uint32_t n_seqs   = 1;
+
+    if (n_stream > 1) {
+        GGML_ASSERT(n_tokens % ubatch.n_seqs_unq == 0);
+
+        n_seqs   = ubatch.n_seqs_unq;
+        n_tokens = n_tokens / n_seqs;
+    }
+
+    slot_info res = {
+        /*.s0   =*/ LLAMA_MAX_SEQ,
+        /*.s1   =*/ 0,
+        /*.strm =*/ { },
+        /*.idxs =*/ { },
+    };
+
+    res.resize(n_seqs);
+
+    // special block owners
+    const llama_seq_id owner_none   = -1; // the block is empty
+    const llama_seq_id owner_shared = -2; // the block holds cells of several sequences - append new tokens elsewhere
+
+    for (uint32_t s = 0; s < n_seqs; ++s) {
+        const uint32_t strm = seq_to_stream[ubatch.seq_id_unq[s]];
+
+        res.s0 = std::min<llama_seq_id>(res.s0, strm);
+        res.s1 = std::max<llama_seq_id>(res.s1, strm);
+
+        res.strm[s] = strm;
+        res.idxs[s].reserve(n_tokens);
+
+        const auto & cells = v_cells[strm];
+
+        if (n_tokens > cells.size()) {
+            LLAMA_LOG_ERROR("%s: n_tokens = %d > size = %u\n", __func__, n_tokens, cells.size());
+            return { };
+        }
+
+        // same rules as in find_slot(): empty cells and cells that are masked by the SWA can be reused
+        const auto can_use = [&](uint32_t idx) {
+            if (cells.is_empty(idx)) {
+                return true;
+            }
+
+            if (cells.seq_count(idx) == 1) {
+                return is_masked_swa(cells.pos_get(idx), cells.seq_pos_max(cells.seq_get(idx)) + 1);
+            }
+
+            return false;
+        };
+
+        const uint32_t n_blocks = (cells.size() + n_block - 1)/n_block;
+
+        // block table of the stream: the owner and the number of usable cells of each block
+        std::vector<llama_seq_id> owner (n_blocks, owner_none);
+        std::vector<uint32_t>     n_free(n_blocks, 0);
+
+        for (uint32_t i = 0; i < cells.size(); ++i) {
+            const uint32_t b = i/n_block;
+
+            if (can_use(i)) {
+                n_free[b]++;
+                continue;
+            }
+
+            const llama_seq_id seq_id = cells.seq_count(i) == 1 ? cells.seq_get(i) : owner_shared;
+
+            if (owner[b] == owner_none) {
+                owner[b] = seq_id;
+            } else if (owner[b] != seq_id) {
+                owner[b] = owner_shared;
+            }
+        }
+
+        // cells that have already been picked for this ubatch
+        std::vector<bool> taken(cells.size(), false);
+
+        // the block that is currently being filled by each sequence and the next cell to test in each block
+        std::vector<int32_t>  tail(LLAMA_MAX_SEQ, -1);
+        std::vector<uint32_t> next(n_blocks);
+
+        for (uint32_t b = 0; b < n_blocks; ++b) {
+            next[b] = b*n_block;
+        }
+
+        // cursor for the fallback when no block is available
+        uint32_t next_any = 0;
+
+        for (uint32_t ii = 0; ii < n_tokens; ++ii) {
+            const uint32_t i = s*n_tokens + ii;
+
+            const llama_seq_id seq_id = ubatch.seq_id[i][0];
+
+            int32_t & b = tail[seq_id];
+
+            if (b < 0 || n_free[b] == 0) {
+                b = -1;
+
+                // prefer the partially filled blocks of the sequence, then claim an empty block
+                for (uint32_t j = 0; j < n_blocks && b < 0; ++j) {
+                    if (owner[j] == seq_id && n_free[j] > 0) {
+                        b = j;
+                    }
+                }
+
+                for (uint32_t j = 0; j < n_blocks && b < 0; ++j) {
+                    if (owner[j] == owner_none && n_free[j] > 0) {
+                        b = j;
+                        owner[j] = seq_id;
+                    }
+                }
+            }
+
+            uint32_t idx = cells.size();
+
+            if (b >= 0) {
+                const uint32_t end = std::min<uint32_t>(cells.size(), (b + 1)*n_block);
+
+                for (uint32_t & k = next[b]; k < end; ++k) {
+                    if (!taken[k] && can_use(k)) {
+                        idx = k;
+                        break;
+                    }
+                }
+
+                GGML_ASSERT(idx < cells.size());
+
+                n_free[b]--;
+            } else {
+                // all blocks are in use - fall back to any free cell, so that the capacity of the cache is the same
+                //   as in the non-paged mode
+                for (; next_any < cells.size(); ++next_any) {
+                    if (!taken[next_any] && can_use(next_any)) {
+                        idx = next_any;
+                        break;
+                    }
+                }
+
+                if (idx == cells.size()) {
+                    return { };
+                }
+
+                n_free[idx/n_block]--;
+            }
+
+            taken[idx] = true;
+
+            res.idxs[s].push_back(idx);
+        }
+    }
+
+    assert(res.s1 >= res.s0);
+
+    return res;
+}
+
 void llama_kv_cache_unified::apply_ubatch(const slot_info & sinfo, const llama_ubatch & ubatch) {
     // keep track of the max sequence position that we would overwrite with this ubatch
     // for non-SWA cache, this would be always empty
@@ -104,7 +104,8 @@ public:
                      uint32_t    n_seq_max,
                      uint32_t    n_pad,
                      uint32_t    n_swa,
-               llama_swa_type    swa_type);
+               llama_swa_type    swa_type,
+                     uint32_t    n_block);
 
     ~llama_kv_cache_unified() = default;
 
@@ -180,6 +181,11 @@ public:
     // return empty slot_info on failure
     slot_info find_slot(const llama_ubatch & ubatch, bool cont) const;
 
+    // paged variant of find_slot(), used when n_block > 0
+    // the cells are split into blocks of n_block cells and each block is owned by a single sequence, so that the
+    //   tokens of a sequence are placed only in its own blocks or in newly claimed empty ones
+    slot_info find_slot_paged(const llama_ubatch & ubatch) const;
+
     // emplace the ubatch context into slot: [sinfo.idxs[0...ubatch.n_tokens - 1]]
     void apply_ubatch(const slot_info & sinfo, const llama_ubatch & ubatch);
 
@@ -232,6 +238,10 @@ private:
     // ref: https://github.com/ggml-org/llama.cpp/pull/14285
     bool supports_set_rows = false;
 
+    // number of cells per block in paged mode (0 - disabled)
+    // see llama_context_params::kv_block_size
+    uint32_t n_block = 0;
+
     const llama_swa_type swa_type = LLAMA_SWA_TYPE_NONE;
 
     std::vector<ggml_context_ptr>        ctxs;
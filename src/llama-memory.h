@@ -18,6 +18,9 @@ struct llama_memory_params {
 
     // use full-size SWA cache
     bool swa_full;
+
+    // number of cells per block of the paged KV cache (0 - disabled)
+    uint32_t kv_block_size;
 };
 
 enum llama_memory_status {
@@ -5283,6 +5283,19 @@ bool llama_model::load_tensors(llama_model_loader & ml) {
         }
     }
 
+    // with --numa split, move the rows of the weights to the NUMA nodes of the threads that multiply them
+    if (auto * dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU)) {
+        auto * reg = ggml_backend_dev_backend_reg(dev);
+        auto * numa_place_tensor_fn = (decltype(ggml_numa_place_tensor) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_numa_place_tensor");
+        if (numa_place_tensor_fn) {
+            for (auto & it : tensors_by_name) {
+                if (it.second->buffer && ggml_backend_buffer_is_host(it.second->buffer)) {
+                    numa_place_tensor_fn(it.second);
+                }
+            }
+        }
+    }
+
     if (use_mmap_buffer) {
         for (auto & mapping : ml.mappings) {
             pimpl->mappings.emplace_back(std::move(mapping));
@@ -17075,7 +17088,8 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 n_ctx_per_stream,
                                 cparams.n_seq_max,
                                 cparams.n_ubatch,
-                                padding);
+                                padding,
+                                params.kv_block_size);
                     } else {
                         GGML_ASSERT(!hparams.is_swa_any());
 
@@ -17091,7 +17105,8 @@ llama_memory_i * llama_model::create_memory(const llama_memory_params & params,
                                 cparams.n_seq_max,
                                 padding,
                                 hparams.n_swa,
-                                hparams.swa_type);
+                                hparams.swa_type,
+                                params.kv_block_size);
                     }
                 }
             }
@@ -17438,6 +17453,11 @@ ggml_cgraph * llama_model::build_graph(const llm_graph_params & params) const {
     // add on pooling layer
     llm->build_pooling(cls, cls_b, cls_out, cls_out_b);
 
+    // optionally reduce the logits to the top k candidates of each output
+    if (params.gtype != LLM_GRAPH_TYPE_ENCODER) {
+        llm->build_logits_top_k();
+    }
+
     return llm->res->get_gf();
 }
 
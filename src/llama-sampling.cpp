@@ -3,6 +3,8 @@
 #include "llama-impl.h"
 #include "llama-vocab.h"
 #include "llama-grammar.h"
+#include "llama-context.h"
+#include "llama-thread-pool.h"
 
 #include <algorithm>
 #include <cassert>
@@ -17,6 +19,14 @@
 #include <unordered_map>
 #include <stdexcept>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LLAMA_SAMPLING_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define LLAMA_SAMPLING_NEON
+#include <arm_neon.h>
+#endif
+
 // the ring buffer works similarly to std::deque, but with a fixed capacity
 template<typename T>
 struct ring_buffer {
@@ -128,6 +138,288 @@ struct ring_buffer {
     std::vector<T> data;
 };
 
+//
+// vectorized kernels over the raw logits of an output
+//
+// used to select the top-k candidates without building and sorting the llama_token_data of the whole vocab
+// the x86 variants are compiled with target attributes and selected at runtime, since libllama is built for the baseline ISA
+//
+
+// number of cut-off logits tested in a single pass when searching the smallest set that contains the top-k candidates
+#define LLAMA_LOGITS_N_THR 8
+
+struct llama_logits_kernels {
+    // max and min of x[0..n)
+    void   (*max_min)  (const float * x, size_t n, float * vmax, float * vmin);
+    // cnt[j] = number of x[i] >= thr[j], for LLAMA_LOGITS_N_THR thresholds
+    void   (*count_ge) (const float * x, size_t n, const float * thr, size_t * cnt);
+    // write the candidates with x[i] >= thr to out, returns their number
+    size_t (*filter_ge)(const float * x, const llama_token * ids, size_t n, float thr, llama_token_data * out);
+};
+
+static void llama_logits_max_min_scalar(const float * x, size_t n, float * vmax, float * vmin) {
+    float mx = -INFINITY;
+    float mn =  INFINITY;
+    for (size_t i = 0; i < n; ++i) {
+        mx = std::max(mx, x[i]);
+        mn = std::min(mn, x[i]);
+    }
+    *vmax = mx;
+    *vmin = mn;
+}
+
+static void llama_logits_count_ge_scalar(const float * x, size_t n, const float * thr, size_t * cnt) {
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        cnt[j] = 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+            cnt[j] += x[i] >= thr[j];
+        }
+    }
+}
+
+static size_t llama_logits_filter_ge_scalar(const float * x, const llama_token * ids, size_t n, float thr, llama_token_data * out) {
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (x[i] >= thr) {
+            out[m++] = llama_token_data{ids ? ids[i] : (llama_token) i, x[i], 0.0f};
+        }
+    }
+    return m;
+}
+
+#if defined(LLAMA_SAMPLING_X86)
+
+__attribute__((target("avx2")))
+static void llama_logits_max_min_avx2(const float * x, size_t n, float * vmax, float * vmin) {
+    __m256 mx = _mm256_set1_ps(-INFINITY);
+    __m256 mn = _mm256_set1_ps( INFINITY);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(x + i);
+        mx = _mm256_max_ps(mx, v);
+        mn = _mm256_min_ps(mn, v);
+    }
+
+    float bmx[8];
+    float bmn[8];
+    _mm256_storeu_ps(bmx, mx);
+    _mm256_storeu_ps(bmn, mn);
+
+    llama_logits_max_min_scalar(x + i, n - i, vmax, vmin);
+    for (int j = 0; j < 8; ++j) {
+        *vmax = std::max(*vmax, bmx[j]);
+        *vmin = std::min(*vmin, bmn[j]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void llama_logits_count_ge_avx2(const float * x, size_t n, const float * thr, size_t * cnt) {
+    __m256  vthr[LLAMA_LOGITS_N_THR];
+    __m256i vcnt[LLAMA_LOGITS_N_THR];
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        vthr[j] = _mm256_set1_ps(thr[j]);
+        vcnt[j] = _mm256_setzero_si256();
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(x + i);
+        for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+            // the lanes of the mask are -1 where the logit passes the threshold
+            vcnt[j] = _mm256_sub_epi32(vcnt[j], _mm256_castps_si256(_mm256_cmp_ps(v, vthr[j], _CMP_GE_OQ)));
+        }
+    }
+
+    llama_logits_count_ge_scalar(x + i, n - i, thr, cnt);
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        int32_t c[8];
+        _mm256_storeu_si256((__m256i *) c, vcnt[j]);
+        for (int l = 0; l < 8; ++l) {
+            cnt[j] += c[l];
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t llama_logits_filter_ge_avx2(const float * x, const llama_token * ids, size_t n, float thr, llama_token_data * out) {
+    const __m256 vthr = _mm256_set1_ps(thr);
+
+    size_t m = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), vthr, _CMP_GE_OQ));
+        while (mask) {
+            const size_t l = i + __builtin_ctz(mask);
+            out[m++] = llama_token_data{ids ? ids[l] : (llama_token) l, x[l], 0.0f};
+            mask &= mask - 1;
+        }
+    }
+
+    for (; i < n; ++i) {
+        if (x[i] >= thr) {
+            out[m++] = llama_token_data{ids ? ids[i] : (llama_token) i, x[i], 0.0f};
+        }
+    }
+
+    return m;
+}
+
+__attribute__((target("avx512f")))
+static void llama_logits_max_min_avx512(const float * x, size_t n, float * vmax, float * vmin) {
+    __m512 mx = _mm512_set1_ps(-INFINITY);
+    __m512 mn = _mm512_set1_ps( INFINITY);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 v = _mm512_loadu_ps(x + i);
+        mx = _mm512_max_ps(mx, v);
+        mn = _mm512_min_ps(mn, v);
+    }
+
+    llama_logits_max_min_scalar(x + i, n - i, vmax, vmin);
+    *vmax = std::max(*vmax, _mm512_reduce_max_ps(mx));
+    *vmin = std::min(*vmin, _mm512_reduce_min_ps(mn));
+}
+
+__attribute__((target("avx512f")))
+static void llama_logits_count_ge_avx512(const float * x, size_t n, const float * thr, size_t * cnt) {
+    const __m512i one = _mm512_set1_epi32(1);
+
+    __m512  vthr[LLAMA_LOGITS_N_THR];
+    __m512i vcnt[LLAMA_LOGITS_N_THR];
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        vthr[j] = _mm512_set1_ps(thr[j]);
+        vcnt[j] = _mm512_setzero_si512();
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 v = _mm512_loadu_ps(x + i);
+        for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+            vcnt[j] = _mm512_mask_add_epi32(vcnt[j], _mm512_cmp_ps_mask(v, vthr[j], _CMP_GE_OQ), vcnt[j], one);
+        }
+    }
+
+    llama_logits_count_ge_scalar(x + i, n - i, thr, cnt);
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        cnt[j] += _mm512_reduce_add_epi32(vcnt[j]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static size_t llama_logits_filter_ge_avx512(const float * x, const llama_token * ids, size_t n, float thr, llama_token_data * out) {
+    const __m512 vthr = _mm512_set1_ps(thr);
+
+    size_t m = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint32_t mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), vthr, _CMP_GE_OQ);
+        while (mask) {
+            const size_t l = i + __builtin_ctz(mask);
+            out[m++] = llama_token_data{ids ? ids[l] : (llama_token) l, x[l], 0.0f};
+            mask &= mask - 1;
+        }
+    }
+
+    for (; i < n; ++i) {
+        if (x[i] >= thr) {
+            out[m++] = llama_token_data{ids ? ids[i] : (llama_token) i, x[i], 0.0f};
+        }
+    }
+
+    return m;
+}
+
+#elif defined(LLAMA_SAMPLING_NEON)
+
+static void llama_logits_max_min_neon(const float * x, size_t n, float * vmax, float * vmin) {
+    float32x4_t mx = vdupq_n_f32(-INFINITY);
+    float32x4_t mn = vdupq_n_f32( INFINITY);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vld1q_f32(x + i);
+        mx = vmaxq_f32(mx, v);
+        mn = vminq_f32(mn, v);
+    }
+
+    llama_logits_max_min_scalar(x + i, n - i, vmax, vmin);
+    *vmax = std::max(*vmax, vmaxvq_f32(mx));
+    *vmin = std::min(*vmin, vminvq_f32(mn));
+}
+
+static void llama_logits_count_ge_neon(const float * x, size_t n, const float * thr, size_t * cnt) {
+    float32x4_t vthr[LLAMA_LOGITS_N_THR];
+    uint32x4_t  vcnt[LLAMA_LOGITS_N_THR];
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        vthr[j] = vdupq_n_f32(thr[j]);
+        vcnt[j] = vdupq_n_u32(0);
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vld1q_f32(x + i);
+        for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+            // the lanes of the mask are all ones (-1) where the logit passes the threshold
+            vcnt[j] = vsubq_u32(vcnt[j], vcgeq_f32(v, vthr[j]));
+        }
+    }
+
+    llama_logits_count_ge_scalar(x + i, n - i, thr, cnt);
+    for (int j = 0; j < LLAMA_LOGITS_N_THR; ++j) {
+        cnt[j] += vaddvq_u32(vcnt[j]);
+    }
+}
+
+static size_t llama_logits_filter_ge_neon(const float * x, const llama_token * ids, size_t n, float thr, llama_token_data * out) {
+    const float32x4_t vthr = vdupq_n_f32(thr);
+
+    size_t m = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (vmaxvq_u32(vcgeq_f32(vld1q_f32(x + i), vthr)) == 0) {
+            continue;
+        }
+        for (size_t l = i; l < i + 4; ++l) {
+            if (x[l] >= thr) {
+                out[m++] = llama_token_data{ids ? ids[l] : (llama_token) l, x[l], 0.0f};
+            }
+        }
+    }
+
+    for (; i < n; ++i) {
+        if (x[i] >= thr) {
+            out[m++] = llama_token_data{ids ? ids[i] : (llama_token) i, x[i], 0.0f};
+        }
+    }
+
+    return m;
+}
+
+#endif
+
+static const llama_logits_kernels & llama_logits_kernels_get() {
+    static const llama_logits_kernels kernels = []() -> llama_logits_kernels {
+#if defined(LLAMA_SAMPLING_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return { llama_logits_max_min_avx512, llama_logits_count_ge_avx512, llama_logits_filter_ge_avx512 };
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return { llama_logits_max_min_avx2, llama_logits_count_ge_avx2, llama_logits_filter_ge_avx2 };
+        }
+#elif defined(LLAMA_SAMPLING_NEON)
+        return { llama_logits_max_min_neon, llama_logits_count_ge_neon, llama_logits_filter_ge_neon };
+#endif
+        return { llama_logits_max_min_scalar, llama_logits_count_ge_scalar, llama_logits_filter_ge_scalar };
+    }();
+
+    return kernels;
+}
+
 static int llama_sample_dist(llama_token_data_array * cur_p, std::mt19937 & rng) {
     // iterator for the probabilities
 #ifdef __GNUC__
@@ -376,20 +668,8 @@ void llama_sampler_free(struct llama_sampler * smpl) {
     delete smpl;
 }
 
-llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_context * ctx, int32_t idx) {
-    const auto * logits = llama_get_logits_ith(ctx, idx);
-
-    const llama_model * model = llama_get_model(ctx);
-    const llama_vocab * vocab = llama_model_get_vocab(model);
-
-    const int n_vocab = llama_vocab_n_tokens(vocab);
-
-    // TODO: do not allocate each time
-    std::vector<llama_token_data> cur;
-    cur.reserve(n_vocab);
-    for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-        cur.emplace_back(llama_token_data{token_id, logits[token_id], 0.0f});
-    }
+static llama_token llama_sampler_sample_impl(struct llama_sampler * smpl, std::vector<llama_token_data> & cur, const float * logits, const llama_token * ids, int32_t n_logits) {
+    cur.resize(n_logits);
 
     llama_token_data_array cur_p = {
         /* .data       = */ cur.data(),
@@ -398,6 +678,12 @@ llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_conte
         /* .sorted     = */ false,
     };
 
+    // build only the candidates that the sampler can select
+    // when only the top k logits were output, the candidates are the k tokens, sorted by descending logit
+    llama_token_data_array_from_logits(&cur_p, logits, ids, n_logits, ids ? 0 : llama_sampler_n_logits(smpl));
+
+    cur_p.sorted = cur_p.sorted || ids != nullptr;
+
     llama_sampler_apply(smpl, &cur_p);
 
     GGML_ASSERT(cur_p.selected >= 0 && cur_p.selected < (int32_t) cur_p.size);
@@ -409,6 +695,53 @@ llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_conte
     return token;
 }
 
+llama_token llama_sampler_sample(struct llama_sampler * smpl, struct llama_context * ctx, int32_t idx) {
+    const auto * logits = llama_get_logits_ith(ctx, idx);
+    const auto * ids    = llama_get_logits_ids_ith(ctx, idx);
+
+    // TODO: do not allocate each time
+    std::vector<llama_token_data> cur;
+
+    return llama_sampler_sample_impl(smpl, cur, logits, ids, llama_n_logits(ctx));
+}
+
+static void llama_sampler_sample_batch_impl(
+        llama_thread_pool & pool, int32_t n_threads, struct llama_sampler ** smpls,
+        const float ** logits, const llama_token ** ids, int32_t n_logits, llama_token * tokens, int32_t n) {
+    // the candidates of each thread
+    std::vector<std::vector<llama_token_data>> cur(std::max(1, std::min(n_threads, n)));
+
+    pool.parallel_for(n_threads, n, [&](int32_t i, int32_t ith) {
+        tokens[i] = llama_sampler_sample_impl(smpls[i], cur[ith], logits[i], ids[i], n_logits);
+    });
+}
+
+void llama_sampler_sample_batch(struct llama_sampler ** smpls, struct llama_context * ctx, const int32_t * idxs, llama_token * tokens, int32_t n) {
+    if (n <= 0) {
+        return;
+    }
+
+    // the outputs are read on this thread, so that the context is synchronized only once
+    std::vector<const float *>       logits(n);
+    std::vector<const llama_token *> ids(n);
+
+    for (int32_t i = 0; i < n; ++i) {
+        logits[i] = llama_get_logits_ith(ctx, idxs[i]);
+        ids[i]    = llama_get_logits_ids_ith(ctx, idxs[i]);
+    }
+
+    llama_sampler_sample_batch_impl(ctx->get_sampling_pool(), llama_n_threads(ctx), smpls, logits.data(), ids.data(), llama_n_logits(ctx), tokens, n);
+}
+
+// wrapper for test-sampling.cpp, with the logits of each pair instead of a context
+void llama_sampler_sample_batch_testing(struct llama_sampler ** smpls, const float ** logits, int32_t n_logits, llama_token * tokens, int32_t n, int32_t n_threads) {
+    llama_thread_pool pool;
+
+    std::vector<const llama_token *> ids(n, nullptr);
+
+    llama_sampler_sample_batch_impl(pool, n_threads, smpls, logits, ids.data(), n_logits, tokens, n);
+}
+
 // sampler chain
 
 static const char * llama_sampler_chain_name(const struct llama_sampler * /*smpl*/) {
@@ -1655,29 +1988,44 @@ static void llama_sampler_penalties_apply(struct llama_sampler * smpl, llama_tok
         return;
     }
 
-    // Apply frequency and presence penalties to the cur_p
-    for (size_t i = 0; i < cur_p->size; ++i) {
-        const auto token_iter = ctx->token_count.find(cur_p->data[i].id);
-        if (token_iter == ctx->token_count.end()) {
-            continue;
-        }
-
-        const int count = token_iter->second;
-
+    const auto apply = [&](llama_token_data & cur, int count) {
         assert(count > 0 && count <= ctx->penalty_last_n);
 
         // The academic publication that described this technique actually just only divided, but that would cause tokens with negative logits to become more likely, which is obviously wrong.
         // This is common fix for this problem, which is to multiply by the penalty instead of dividing.
-        if (cur_p->data[i].logit <= 0) {
-            cur_p->data[i].logit *= ctx->penalty_repeat;
+        if (cur.logit <= 0) {
+            cur.logit *= ctx->penalty_repeat;
         } else {
-            cur_p->data[i].logit /= ctx->penalty_repeat;
+            cur.logit /= ctx->penalty_repeat;
         }
 
-        cur_p->data[i].logit -= float(count) * ctx->penalty_freq + float(count > 0) * ctx->penalty_present;
-    }
+        cur.logit -= float(count) * ctx->penalty_freq + float(count > 0) * ctx->penalty_present;
+    };
 
     cur_p->sorted = false;
+
+    // the penalized tokens are usually far fewer than the candidates - if the candidates have not been
+    // shuffled in the vocabulary (i.e. idx == id), look them up directly instead of scanning all the candidates
+    const bool in_place = std::all_of(ctx->token_count.begin(), ctx->token_count.end(), [cur_p](const auto & tc) {
+        return tc.first >= 0 && cur_p->size > (size_t) tc.first && cur_p->data[tc.first].id == tc.first;
+    });
+
+    if (in_place) {
+        for (const auto & [token, count] : ctx->token_count) {
+            apply(cur_p->data[token], count);
+        }
+        return;
+    }
+
+    // Apply frequency and presence penalties to the cur_p
+    for (size_t i = 0; i < cur_p->size; ++i) {
+        const auto token_iter = ctx->token_count.find(cur_p->data[i].id);
+        if (token_iter == ctx->token_count.end()) {
+            continue;
+        }
+
+        apply(cur_p->data[i], token_iter->second);
+    }
 }
 
 static void llama_sampler_penalties_reset(struct llama_sampler * smpl) {
@@ -2540,6 +2888,166 @@ uint32_t llama_sampler_get_seed(const struct llama_sampler * smpl) {
     return LLAMA_DEFAULT_SEED;
 }
 
+// how many top logits a single sampler depends on: -1 if it keeps the order of the candidates and does not look
+// at their distribution, 0 if it needs all the candidates, k > 0 if it keeps at most the top k candidates
+static int32_t llama_sampler_n_logits_impl(const struct llama_sampler * smpl) {
+    const auto * iface = smpl->iface;
+
+    if (iface == &llama_sampler_greedy_i) {
+        return 1;
+    }
+    if (iface == &llama_sampler_top_k_i) {
+        const auto * ctx = (const llama_sampler_top_k *) smpl->ctx;
+        return ctx->k > 0 ? ctx->k : -1;
+    }
+    if (iface == &llama_sampler_temp_i) {
+        const auto * ctx = (const llama_sampler_temp *) smpl->ctx;
+        return ctx->temp <= 0.0f ? 1 : -1;
+    }
+    if (iface == &llama_sampler_temp_ext_i) {
+        const auto * ctx = (const llama_sampler_temp_ext *) smpl->ctx;
+        if (ctx->delta > 0.0f) {
+            return 0; // the dynamic temperature depends on the entropy of the whole distribution
+        }
+        return ctx->temp <= 0.0f ? 1 : -1;
+    }
+    if (iface == &llama_sampler_top_p_i) {
+        return ((const llama_sampler_top_p *) smpl->ctx)->p >= 1.0f ? -1 : 0;
+    }
+    if (iface == &llama_sampler_min_p_i) {
+        return ((const llama_sampler_min_p *) smpl->ctx)->p <= 0.0f ? -1 : 0;
+    }
+    if (iface == &llama_sampler_typical_i) {
+        return ((const llama_sampler_typical *) smpl->ctx)->p >= 1.0f ? -1 : 0;
+    }
+    if (iface == &llama_sampler_top_n_sigma_i) {
+        return ((const llama_sampler_top_n_sigma *) smpl->ctx)->n <= 0.0f ? -1 : 0;
+    }
+    if (iface == &llama_sampler_xtc_i) {
+        const auto * ctx = (const llama_sampler_xtc *) smpl->ctx;
+        return ctx->probability <= 0.0f || ctx->threshold > 0.5f ? -1 : 0;
+    }
+    if (iface == &llama_sampler_logit_bias_i) {
+        return ((const llama_sampler_logit_bias *) smpl->ctx)->logit_bias.empty() ? -1 : 0;
+    }
+    if (iface == &llama_sampler_penalties_i) {
+        const auto * ctx = (const llama_sampler_penalties *) smpl->ctx;
+        const bool disabled = ctx->penalty_last_n == 0 ||
+            (ctx->penalty_repeat == 1.0f && ctx->penalty_freq == 0.0f && ctx->penalty_present == 0.0f);
+        return disabled ? -1 : 0;
+    }
+    if (iface == &llama_sampler_dry_i) {
+        const auto * ctx = (const llama_sampler_dry *) smpl->ctx;
+        const bool disabled = ctx->dry_multiplier == 0.0f || ctx->dry_base < 1.0f || ctx->dry_penalty_last_n == 0;
+        return disabled ? -1 : 0;
+    }
+    if (iface == &llama_sampler_grammar_i) {
+        return ((const llama_sampler_grammar *) smpl->ctx)->grammar == nullptr ? -1 : 0;
+    }
+    if (iface == &llama_sampler_chain_i) {
+        const auto * ctx = (const llama_sampler_chain *) smpl->ctx;
+        for (const auto * s : ctx->samplers) {
+            const int32_t n = llama_sampler_n_logits_impl(s);
+            if (n >= 0) {
+                return n;
+            }
+        }
+        return -1;
+    }
+
+    // dist, softmax, mirostat, infill, user samplers, ...
+    return 0;
+}
+
+int32_t llama_sampler_n_logits(const struct llama_sampler * smpl) {
+    return std::max(0, llama_sampler_n_logits_impl(smpl));
+}
+
+void llama_sampler_prefetch(const struct llama_sampler * smpl) {
+    if (smpl->iface == &llama_sampler_grammar_i) {
+        const auto * ctx = (const llama_sampler_grammar *) smpl->ctx;
+        if (ctx->grammar) {
+            llama_grammar_prefetch_impl(*ctx->grammar);
+        }
+        return;
+    }
+
+    if (smpl->iface == &llama_sampler_chain_i) {
+        const auto * ctx = (const llama_sampler_chain *) smpl->ctx;
+        for (const auto * smpl_i : ctx->samplers) {
+            llama_sampler_prefetch(smpl_i);
+        }
+    }
+}
+
+void llama_token_data_array_from_logits(llama_token_data_array * cur_p, const float * logits, const llama_token * ids, int32_t n_logits, int32_t k) {
+    const size_t n = n_logits;
+
+    cur_p->selected = -1;
+
+    const auto fill_all = [&]() {
+        for (size_t i = 0; i < n; ++i) {
+            cur_p->data[i] = llama_token_data{ids ? ids[i] : (llama_token) i, logits[i], 0.0f};
+        }
+        cur_p->size   = n;
+        cur_p->sorted = false;
+    };
+
+    if (k <= 0 || (size_t) k >= n) {
+        fill_all();
+        return;
+    }
+
+    const auto & kernels = llama_logits_kernels_get();
+
+    // pass 1: range of the logits
+    float vmax;
+    float vmin;
+    kernels.max_min(logits, n, &vmax, &vmin);
+
+    if (!std::isfinite(vmax)) {
+        fill_all();
+        llama_sampler_top_k_impl(cur_p, k);
+        return;
+    }
+
+    // the masked logits (-inf) do not say anything about the spread of the distribution
+    const float range = std::isfinite(vmin) ? vmax - vmin : 64.0f;
+
+    // pass 2: count the candidates above cut-offs that get exponentially farther from the max
+    // the last cut-off keeps all the candidates, so that one of them always contains the top k
+    float  thr[LLAMA_LOGITS_N_THR];
+    size_t cnt[LLAMA_LOGITS_N_THR];
+    for (int j = 0; j < LLAMA_LOGITS_N_THR - 1; ++j) {
+        thr[j] = vmax - range / (1 << (LLAMA_LOGITS_N_THR - 1 - j));
+    }
+    thr[LLAMA_LOGITS_N_THR - 1] = -INFINITY;
+
+    kernels.count_ge(logits, n, thr, cnt);
+
+    int j = 0;
+    while (j < LLAMA_LOGITS_N_THR && cnt[j] < (size_t) k) {
+        ++j;
+    }
+
+    if (j == LLAMA_LOGITS_N_THR) {
+        // NaN logits
+        fill_all();
+        llama_sampler_top_k_impl(cur_p, k);
+        return;
+    }
+
+    // pass 3: gather the candidates above the cut-off and sort the top k of them
+    const size_t m = kernels.filter_ge(logits, ids, n, thr[j], cur_p->data);
+
+    std::partial_sort(cur_p->data, cur_p->data + k, cur_p->data + m, [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    });
+
+    cur_p->size   = k;
+    cur_p->sorted = true;
+}
+
 // perf
 
 struct llama_perf_sampler_data llama_perf_sampler(const struct llama_sampler * chain) {
@@ -30,3 +30,11 @@ struct llama_sampler * llama_sampler_init_dry_testing(
                          int32_t   dry_allowed_length,
                          int32_t   dry_penalty_last_n,
   const std::vector<std::vector<llama_token>>& seq_breakers);
+
+void llama_sampler_sample_batch_testing(
+        struct llama_sampler ** smpls,
+                 const float ** logits,
+                       int32_t  n_logits,
+                   llama_token * tokens,
+                       int32_t  n,
+                       int32_t  n_threads);
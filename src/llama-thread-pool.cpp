@@ -0,0 +1,103 @@
+#include "llama-thread-pool.h"
+
+#include <algorithm>
+
+llama_thread_pool::~llama_thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv_start.notify_all();
+
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
+void llama_thread_pool::parallel_for(int32_t n_threads, int32_t n, const std::function<void(int32_t, int32_t)> & fn) {
+    n_threads = std::max(1, std::min(n_threads, n));
+
+    if (n_threads == 1) {
+        for (int32_t i = 0; i < n; ++i) {
+            fn(i, 0);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock_loop(mutex_loop);
+
+    while ((int32_t) workers.size() < n_threads - 1) {
+        workers.emplace_back(&llama_thread_pool::worker, this, (int32_t) workers.size());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        this->fn = &fn;
+        this->n  = n;
+
+        n_workers = n_threads - 1;
+        n_running = n_workers;
+        error     = nullptr;
+        next      = 0;
+
+        generation++;
+    }
+    cv_start.notify_all();
+
+    run(0);
+
+    std::exception_ptr err;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_done.wait(lock, [&]() { return n_running == 0; });
+
+        this->fn = nullptr;
+
+        std::swap(err, error);
+    }
+
+    if (err) {
+        std::rethrow_exception(err);
+    }
+}
+
+void llama_thread_pool::worker(int32_t iw) {
+    uint64_t seen = 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv_start.wait(lock, [&]() { return stop || generation != seen; });
+        if (stop) {
+            return;
+        }
+        seen = generation;
+
+        if (iw >= n_workers) {
+            continue;
+        }
+
+        lock.unlock();
+        run(iw + 1);
+        lock.lock();
+
+        if (--n_running == 0) {
+            cv_done.notify_one();
+        }
+    }
+}
+
+void llama_thread_pool::run(int32_t ith) {
+    try {
+        for (int32_t i = next++; i < n; i = next++) {
+            (*fn)(i, ith);
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+        // skip the remaining iterations
+        next = n;
+    }
+}
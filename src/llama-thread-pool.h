@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// threads that are kept between short parallel loops, e.g. the sampling of the outputs of several sequences,
+// so that the loops do not create and join threads each time
+struct llama_thread_pool {
+    llama_thread_pool() = default;
+    ~llama_thread_pool();
+
+    llama_thread_pool(const llama_thread_pool &) = delete;
+    llama_thread_pool & operator=(const llama_thread_pool &) = delete;
+
+    // call fn(i, ith) for each i in [0, n), on up to n_threads threads including the calling thread
+    // ith is the index of the thread that runs the iteration, the calling thread is 0
+    // the threads are started on the first loop that needs them
+    // if fn throws, the remaining iterations are skipped and the first exception is rethrown on the calling thread
+    void parallel_for(int32_t n_threads, int32_t n, const std::function<void(int32_t, int32_t)> & fn);
+
+private:
+    void worker(int32_t iw);
+
+    // run the iterations of the current loop until there are none left
+    void run(int32_t ith);
+
+    std::vector<std::thread> workers;
+
+    // one loop at a time
+    std::mutex mutex_loop;
+
+    std::mutex              mutex;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+
+    // the current loop, protected by mutex
+    const std::function<void(int32_t, int32_t)> * fn = nullptr;
+
+    int32_t  n          = 0;
+    int32_t  n_workers  = 0; // the workers that take part in the loop
+    int32_t  n_running  = 0; // the workers that have not finished the loop yet
+    uint64_t generation = 0;
+    bool     stop       = false;
+
+    std::exception_ptr error;
+
+    std::atomic<int32_t> next { 0 };
+};
@@ -2,12 +2,14 @@
 
 #include "ggml.h"
 #include "gguf.h"
+#include "llama-grammar.h"
 #include "llama-impl.h"
 #include "llama-model-loader.h"
 
 #include "unicode.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
@@ -16,9 +18,12 @@
 #include <cstring>
 #include <forward_list>
 #include <limits>
+#include <list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <thread>
 #include <unordered_map>
 
 //
@@ -258,6 +263,10 @@ public:
     }
 
     void pop() =  delete;
+
+    void clear() {
+        this->c.clear();
+    }
 };
 
 struct llm_bigram_bpe {
@@ -271,7 +280,7 @@ struct llm_bigram_bpe {
     using queue = llama_priority_queue<llm_bigram_bpe, queue_storage, comparator>;
     llm_symbol::index left;
     llm_symbol::index right;
-    std::string text;
+    llama_token token; // the token of the merged text
     int rank;
     size_t size;
 };
@@ -443,9 +452,201 @@ struct llm_tokenizer_bpe : llm_tokenizer {
                 };
                 break;
         }
+
+        // with these pre-tokenizers, a word always ends after a new line that is preceded by a character that is not whitespace and followed
+        // by a letter, so the text can be split there and the chunks tokenized independently
+        switch (vocab.get_pre_type()) {
+            case LLAMA_VOCAB_PRE_TYPE_LLAMA3:
+            case LLAMA_VOCAB_PRE_TYPE_DBRX:
+            case LLAMA_VOCAB_PRE_TYPE_SMAUG:
+            case LLAMA_VOCAB_PRE_TYPE_GPT2:
+            case LLAMA_VOCAB_PRE_TYPE_MPT:
+            case LLAMA_VOCAB_PRE_TYPE_OLMO:
+            case LLAMA_VOCAB_PRE_TYPE_JAIS:
+            case LLAMA_VOCAB_PRE_TYPE_TRILLION:
+            case LLAMA_VOCAB_PRE_TYPE_STABLELM2:
+            case LLAMA_VOCAB_PRE_TYPE_QWEN2:
+            case LLAMA_VOCAB_PRE_TYPE_HUNYUAN:
+            case LLAMA_VOCAB_PRE_TYPE_CHATGLM4:
+            case LLAMA_VOCAB_PRE_TYPE_BAILINGMOE:
+            case LLAMA_VOCAB_PRE_TYPE_SEED_CODER:
+                split_lines = true;
+                break;
+            default:
+                break;
+        }
+
+        init_merges(vocab);
+    }
+
+    // rank of the merge of two tokens and the token of the merged text, or -1 if the tokens are not merged
+    int find_merge(llama_token left, llama_token right, llama_token & merged) const {
+        const uint64_t key = merge_key(left, right);
+        for (uint64_t i = merge_hash(key) & merges_mask; ; i = (i + 1) & merges_mask) {
+            const auto & merge = merges[i];
+            if (merge.rank < 0) {
+                return -1;
+            }
+            if (merge.key == key) {
+                merged = merge.token;
+                return merge.rank;
+            }
+        }
+    }
+
+    // token of a character of a byte-encoded word
+    llama_token char_to_token(const llama_vocab & vocab, const char * text, size_t n) const {
+        const uint8_t c0 = text[0];
+        if (n == 1 && c0 < 0x80) {
+            return char_tokens[c0];
+        }
+        if (n == 2 && (c0 & 0xe0) == 0xc0 && (text[1] & 0xc0) == 0x80) {
+            const uint32_t cpt = ((c0 & 0x1f) << 6) | (text[1] & 0x3f);
+            if (cpt >= 0x80 && cpt < char_tokens.size()) {
+                return char_tokens[cpt];
+            }
+        }
+        return vocab.text_to_token(std::string(text, n));
+    }
+
+    // the tokens of recently seen words, split in shards to reduce the contention between threads
+    bool cache_get(const std::string & word, std::vector<llama_token> & output) const {
+        if (word.size() > CACHE_MAX_WORD_SIZE) {
+            return false;
+        }
+
+        auto & shard = cache[std::hash<std::string>{}(word) % CACHE_SHARDS];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        const auto it = shard.words.find(word);
+        if (it == shard.words.end()) {
+            return false;
+        }
+
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        output.insert(output.end(), it->second->second.begin(), it->second->second.end());
+
+        return true;
+    }
+
+    void cache_set(const std::string & word, const llama_token * tokens, size_t n_tokens) const {
+        if (word.size() > CACHE_MAX_WORD_SIZE) {
+            return;
+        }
+
+        auto & shard = cache[std::hash<std::string>{}(word) % CACHE_SHARDS];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        if (shard.words.find(word) != shard.words.end()) {
+            return;
+        }
+
+        if (shard.words.size() >= CACHE_SIZE / CACHE_SHARDS) {
+            shard.words.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+        }
+
+        shard.lru.emplace_front(word, std::vector<llama_token>(tokens, tokens + n_tokens));
+        shard.words.emplace(word, shard.lru.begin());
     }
 
     std::vector<std::string> regex_exprs;
+
+    // the merges with a side or a result that is not a token are only found by text, with llama_vocab::find_bpe_rank
+    bool merges_by_text = false;
+
+    // long texts can be split after new lines and tokenized in parallel
+    bool split_lines = false;
+
+private:
+    static constexpr size_t CACHE_SIZE          = 16384;
+    static constexpr size_t CACHE_SHARDS        = 16;
+    static constexpr size_t CACHE_MAX_WORD_SIZE = 128;
+
+    static uint64_t merge_key(llama_token left, llama_token right) {
+        return ((uint64_t) (uint32_t) left << 32) | (uint32_t) right;
+    }
+
+    static uint64_t merge_hash(uint64_t key) {
+        return (key * 0x9e3779b97f4a7c15ull) >> 32;
+    }
+
+    void init_merges(const llama_vocab & vocab) {
+        const auto bpe_merges = vocab.get_bpe_merges();
+
+        size_t n_merges = 1;
+        while (n_merges < 2*bpe_merges.size()) {
+            n_merges *= 2;
+        }
+
+        merges.assign(n_merges, { 0, -1, LLAMA_TOKEN_NULL });
+        merges_mask = n_merges - 1;
+
+        for (int rank = 0; rank < (int) bpe_merges.size(); ++rank) {
+            const auto & merge = bpe_merges[rank];
+
+            const size_t pos = merge.find(' ', 1);
+            if (pos == std::string::npos) {
+                continue;
+            }
+
+            const std::string first  = merge.substr(0, pos);
+            const std::string second = merge.substr(pos + 1);
+
+            const llama_token left  = vocab.text_to_token(first);
+            const llama_token right = vocab.text_to_token(second);
+
+            if (left == LLAMA_TOKEN_NULL || right == LLAMA_TOKEN_NULL) {
+                merges_by_text = true;
+                continue;
+            }
+
+            const uint64_t key = merge_key(left, right);
+
+            uint64_t i = merge_hash(key) & merges_mask;
+            while (merges[i].rank >= 0) {
+                i = (i + 1) & merges_mask;
+            }
+
+            const llama_token token = vocab.text_to_token(first + second);
+
+            // the merged symbol has no token, so its own merges can only be found by text
+            if (token == LLAMA_TOKEN_NULL) {
+                merges_by_text = true;
+            }
+
+            merges[i] = { key, rank, token };
+        }
+
+        // the characters of the byte-level encoding are the codepoints below 512
+        char_tokens.resize(512);
+        for (uint32_t cpt = 0; cpt < char_tokens.size(); ++cpt) {
+            char_tokens[cpt] = vocab.text_to_token(unicode_cpt_to_utf8(cpt));
+        }
+    }
+
+    struct merge_data {
+        uint64_t    key;
+        int32_t     rank;
+        llama_token token;
+    };
+
+    // the merges of two tokens, in an open-addressing hash table with linear probing
+    std::vector<merge_data> merges;
+    uint64_t                merges_mask = 0;
+
+    std::vector<llama_token> char_tokens;
+
+    struct cache_shard {
+        std::mutex mutex;
+
+        std::list<std::pair<std::string, std::vector<llama_token>>> lru;
+        std::unordered_map<std::string, std::list<std::pair<std::string, std::vector<llama_token>>>::iterator> words;
+    };
+
+    mutable std::array<cache_shard, CACHE_SHARDS> cache;
 };
 
 struct llm_tokenizer_bpe_session {
@@ -489,121 +690,203 @@ struct llm_tokenizer_bpe_session {
     }
 
     void tokenize(const std::string & text, std::vector<llama_token> & output) {
-        int final_prev_index = -1;
         const auto word_collection = unicode_regex_split(text, tokenizer.regex_exprs);
 
-        symbols_final.clear();
-
         for (const auto & word : word_collection) {
-            work_queue = llm_bigram_bpe::queue();
-            symbols.clear();
+            if (tokenizer.cache_get(word, output)) {
+                continue;
+            }
 
-            int index = 0;
-            size_t offset = 0;
+            const size_t n_output = output.size();
 
-            //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
-            if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
-                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
-                offset = word.size();
-            }
+            tokenize_word(word, output);
 
-            while (offset < word.size()) {
-                llm_symbol sym;
-                size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
-                sym.text = word.c_str() + offset;
-                sym.n = char_len;
-                offset += sym.n;
-                sym.prev = index - 1;
-                sym.next = offset == word.size() ? -1 : index + 1;
-                index++;
-                symbols.emplace_back(sym);
-            }
-            for (int i = 1; i < (int) symbols.size(); ++i) {
-                add_new_bigram(i - 1, i);
+            tokenizer.cache_set(word, output.data() + n_output, output.size() - n_output);
+        }
+    }
+
+    // tokenize a long text in chunks on multiple threads, with the same result as a single session
+    // there are at most n_threads chunks of at least n_chunk_min bytes, the first one is tokenized on the calling thread
+    void tokenize(const std::string & text, std::vector<llama_token> & output, int32_t n_threads, int32_t n_chunk_min) {
+        if (n_threads <= 0) {
+            n_threads = std::thread::hardware_concurrency();
+        }
+
+        const size_t chunk_min = n_chunk_min > 0 ? n_chunk_min : PARALLEL_MIN_CHUNK_SIZE;
+
+        if (!tokenizer.split_lines || n_threads <= 1 || text.size() < 2*chunk_min) {
+            tokenize(text, output);
+            return;
+        }
+
+        // round up, so that the last chunk is not a small remainder and there are no more than n_threads chunks
+        const size_t chunk_size = std::max(chunk_min, (text.size() + n_threads - 1) / n_threads);
+
+        std::vector<size_t> chunks = { 0 };
+        for (size_t pos = chunk_size; pos < text.size(); ) {
+            pos = find_line_split(text, pos);
+            if (pos >= text.size()) {
+                break;
             }
+            chunks.push_back(pos);
+            pos += chunk_size;
+        }
+        chunks.push_back(text.size());
 
-            // build token(s)
-            while (!work_queue.empty()) {
-                auto bigram = work_queue.pop_move();
+        const size_t n_chunks = chunks.size() - 1;
+        if (n_chunks == 1) {
+            tokenize(text, output);
+            return;
+        }
 
-                auto & left_symbol = symbols[bigram.left];
-                auto & right_symbol = symbols[bigram.right];
+        std::vector<std::vector<llama_token>> outputs(n_chunks);
 
-                if (left_symbol.n == 0 || right_symbol.n == 0) {
-                    continue;
-                }
-                std::string left_token = std::string(left_symbol.text, left_symbol.n);
-                std::string right_token = std::string(right_symbol.text, right_symbol.n);
-                if (left_token + right_token != bigram.text) {
-                    continue;  // Skip this bigram if it's outdated
-                }
+        auto worker = [&](size_t i) {
+            llm_tokenizer_bpe_session session(vocab, tokenizer);
+            session.tokenize(text.substr(chunks[i], chunks[i + 1] - chunks[i]), outputs[i]);
+        };
 
-                // merge the right sym into the left one
-                left_symbol.n += right_symbol.n;
-                right_symbol.n = 0;
+        std::vector<std::thread> workers;
+        workers.reserve(n_chunks - 1);
+        for (size_t i = 1; i < n_chunks; ++i) {
+            workers.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto & w : workers) {
+            w.join();
+        }
 
-                // remove the right sym from the chain
-                left_symbol.next = right_symbol.next;
-                if (right_symbol.next >= 0) {
-                    symbols[right_symbol.next].prev = bigram.left;
-                }
+        for (const auto & out : outputs) {
+            output.insert(output.end(), out.begin(), out.end());
+        }
+    }
 
-                add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
-                add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+private:
+    static constexpr size_t PARALLEL_MIN_CHUNK_SIZE = 32*1024;
+
+    // first position from pos that follows a new line preceded by an ASCII character that is not whitespace, and that is an ASCII letter
+    // with the pre-tokenizers that support splitting the text (llm_tokenizer_bpe::split_lines), a word always ends there
+    static size_t find_line_split(const std::string & text, size_t pos) {
+        while (pos < text.size()) {
+            const char * nl = (const char *) memchr(text.data() + pos, '\n', text.size() - pos);
+            if (nl == nullptr) {
+                return text.size();
             }
-
-            // add the finished tokens to the final list keeping correct order for next and prev
-            for (auto & sym : symbols) {
-                if (sym.n > 0) {
-                    sym.prev = final_prev_index;
-                    sym.next = -1;
-                    if (final_prev_index != -1) {
-                        symbols_final[final_prev_index].next = symbols_final.size();
-                    }
-                    symbols_final.emplace_back(sym);
-                    final_prev_index = symbols_final.size() - 1;
+            const size_t i = nl - text.data() + 1;
+            if (i >= 2 && i < text.size()) {
+                const uint8_t prev = text[i - 2];
+                const uint8_t next = text[i];
+                if (prev < 0x80 && !isspace(prev) && isalpha(next)) {
+                    return i;
                 }
             }
+            pos = i;
         }
+        return text.size();
+    }
 
-        symbols = symbols_final;
+    void tokenize_word(const std::string & word, std::vector<llama_token> & output) {
+        work_queue.clear();
+        symbols.clear();
+        tokens.clear();
 
-        if (!symbols.empty()) {
-            for (int i = 0; i != -1; i = symbols[i].next) {
-                auto & symbol = symbols[i];
-                if (symbol.n == 0) {
-                    continue;
-                }
+        int index = 0;
+        size_t offset = 0;
 
-                const std::string str = std::string(symbol.text, symbol.n);
-                const auto token = vocab.text_to_token(str);
+        //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
+        if (vocab.get_ignore_merges()) {
+            const llama_token token = vocab.text_to_token(word);
+            if (token != LLAMA_TOKEN_NULL) {
+                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
+                tokens.push_back(token);
+                offset = word.size();
+            }
+        }
 
-                if (token == LLAMA_TOKEN_NULL) {
-                    for (auto j = str.begin(); j != str.end(); ++j) {
-                        std::string byte_str(1, *j);
-                        auto token_multibyte = vocab.text_to_token(byte_str);
-                        if (token_multibyte != LLAMA_TOKEN_NULL) {
-                            output.push_back(token_multibyte);
-                        }
+        while (offset < word.size()) {
+            llm_symbol sym;
+            size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
+            sym.text = word.c_str() + offset;
+            sym.n = char_len;
+            offset += sym.n;
+            sym.prev = index - 1;
+            sym.next = offset == word.size() ? -1 : index + 1;
+            index++;
+            symbols.emplace_back(sym);
+            tokens.push_back(tokenizer.char_to_token(vocab, sym.text, sym.n));
+        }
+        for (int i = 1; i < (int) symbols.size(); ++i) {
+            add_new_bigram(i - 1, i);
+        }
+
+        // build token(s)
+        while (!work_queue.empty()) {
+            auto bigram = work_queue.pop_move();
+
+            auto & left_symbol = symbols[bigram.left];
+            auto & right_symbol = symbols[bigram.right];
+
+            if (left_symbol.n == 0 || right_symbol.n == 0) {
+                continue;
+            }
+            // the left symbol only grows by merging the right one, so a bigram is outdated when the right symbol grew
+            if (left_symbol.n + right_symbol.n != bigram.size) {
+                continue;
+            }
+
+            // merge the right sym into the left one
+            left_symbol.n += right_symbol.n;
+            right_symbol.n = 0;
+            tokens[bigram.left] = bigram.token;
+
+            // remove the right sym from the chain
+            left_symbol.next = right_symbol.next;
+            if (right_symbol.next >= 0) {
+                symbols[right_symbol.next].prev = bigram.left;
+            }
+
+            add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
+            add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        }
+
+        for (int i = 0; i < (int) symbols.size(); ++i) {
+            const auto & symbol = symbols[i];
+            if (symbol.n == 0) {
+                continue;
+            }
+
+            if (tokens[i] == LLAMA_TOKEN_NULL) {
+                for (size_t j = 0; j < symbol.n; ++j) {
+                    std::string byte_str(1, symbol.text[j]);
+                    auto token_multibyte = vocab.text_to_token(byte_str);
+                    if (token_multibyte != LLAMA_TOKEN_NULL) {
+                        output.push_back(token_multibyte);
                     }
-                } else {
-                    output.push_back(token);
                 }
+            } else {
+                output.push_back(tokens[i]);
             }
         }
     }
 
-private:
     void add_new_bigram(int left, int right) {
         if (left == -1 || right == -1) {
             return;
         }
-        std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
-        std::string right_token = std::string(symbols[right].text, symbols[right].n);
 
         int rank_found = -1;
 
-        rank_found = vocab.find_bpe_rank(left_token, right_token);
+        llama_token token = LLAMA_TOKEN_NULL;
+
+        if (tokens[left] != LLAMA_TOKEN_NULL && tokens[right] != LLAMA_TOKEN_NULL) {
+            rank_found = tokenizer.find_merge(tokens[left], tokens[right], token);
+        } else if (tokenizer.merges_by_text) {
+            std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
+            std::string right_token = std::string(symbols[right].text, symbols[right].n);
+
+            rank_found = vocab.find_bpe_rank(left_token, right_token);
+            token = vocab.text_to_token(left_token + right_token);
+        }
 
         if (rank_found < 0) {
             return;
@@ -613,8 +896,8 @@ private:
 
         bigram.left  = left;
         bigram.right = right;
-        bigram.text  = left_token + right_token;
-        bigram.size  = left_token.size() + right_token.size();
+        bigram.token = token;
+        bigram.size  = symbols[left].n + symbols[right].n;
         bigram.rank  = rank_found;
 
         work_queue.push(bigram);
@@ -623,8 +906,8 @@ private:
     const llama_vocab & vocab;
     const llm_tokenizer_bpe & tokenizer;
 
-    std::vector<llm_symbol> symbols;
-    std::vector<llm_symbol> symbols_final;
+    std::vector<llm_symbol>  symbols;
+    std::vector<llama_token> tokens; // the token of each symbol, LLAMA_TOKEN_NULL if its text is not a token
     llm_bigram_bpe::queue work_queue;
 };
 
@@ -1583,6 +1866,11 @@ struct llama_vocab::impl {
 
     std::vector<char> precompiled_charsmap;
 
+    mutable std::once_flag                    token_trie_once;
+    mutable std::unique_ptr<llama_token_trie> token_trie;
+
+    mutable llama_grammar_cache grammar_cache;
+
     impl(const llama_vocab & vocab) : vocab(vocab) {
     }
 
@@ -1618,7 +1906,9 @@ struct llama_vocab::impl {
     std::vector<llama_token> tokenize(
             const std::string & raw_text,
                          bool   add_special,
-                         bool   parse_special = false) const;
+                         bool   parse_special = false,
+                      int32_t   n_threads     = 1,
+                      int32_t   n_chunk_min   = 0) const;
 
     int32_t tokenize(
                    const char * text,
@@ -2567,7 +2857,9 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
         }
 
         // for each text fragment
-        std::forward_list<fragment_buffer_variant>::iterator it = buffer.begin();
+        // prev is the fragment before it, so that the fragments are replaced without walking the list from the beginning
+        std::forward_list<fragment_buffer_variant>::iterator prev = buffer.before_begin();
+        std::forward_list<fragment_buffer_variant>::iterator it   = buffer.begin();
         while (it != buffer.end()) {
             auto & fragment = (*it);
 
@@ -2592,7 +2884,7 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
 #ifdef PRETOKENIZERDEBUG
                     LLAMA_LOG_WARN("FF: (%ld %ld %ld) '%s'\n", raw_text->length(), raw_text_base_offset, raw_text_base_length, raw_text->substr(raw_text_base_offset, raw_text_base_length).c_str());
 #endif
-                    auto source = std::distance(buffer.begin(), it);
+                    auto source_prev = prev;
 
                     // if match is further than base offset
                     //  then we have some text to the left of it
@@ -2609,7 +2901,7 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
 
                         if (left_reminder_length > 0) {
                             buffer.emplace_after(it, raw_text, left_reminder_offset, left_reminder_length);
-                            it++;
+                            prev = it++;
                         }
 
 #ifdef PRETOKENIZERDEBUG
@@ -2619,7 +2911,7 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
 
                     // special token
                     buffer.emplace_after(it, special_id);
-                    it++;
+                    prev = it++;
 
                     // right
                     if (match + text.length() < raw_text_base_offset + raw_text_base_length) {
@@ -2635,18 +2927,14 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
 
                         if (right_reminder_length > 0) {
                             buffer.emplace_after(it, raw_text, right_reminder_offset, right_reminder_length);
-                            it++;
+                            prev = it++;
                         }
 
 #ifdef PRETOKENIZERDEBUG
                         LLAMA_LOG_WARN("FR: (%ld %ld) '%s'\n", right_reminder_offset, right_reminder_length, raw_text->substr(right_reminder_offset, right_reminder_length).c_str());
 #endif
 
-                        if (source == 0) {
-                            buffer.erase_after(buffer.before_begin());
-                        } else {
-                            buffer.erase_after(std::next(buffer.begin(), (source - 1)));
-                        }
+                        buffer.erase_after(source_prev);
 
                         // repeat for the right side
                         raw_text_base_offset = right_reminder_offset;
@@ -2656,16 +2944,12 @@ void llama_vocab::impl::tokenizer_st_partition(std::forward_list<fragment_buffer
                         LLAMA_LOG_WARN("RR: (%ld %ld) '%s'\n", raw_text_base_offset, raw_text_base_length, raw_text->substr(raw_text_base_offset, raw_text_base_length).c_str());
 #endif
                     } else {
-                        if (source == 0) {
-                            buffer.erase_after(buffer.before_begin());
-                        } else {
-                            buffer.erase_after(std::next(buffer.begin(), (source - 1)));
-                        }
+                        buffer.erase_after(source_prev);
                         break;
                     }
                 }
             }
-            it++;
+            prev = it++;
         }
     }
 }
@@ -2718,7 +3002,9 @@ static std::string llama_decode_text(const std::string & text) {
 std::vector<llama_token> llama_vocab::impl::tokenize(
         const std::string & raw_text,
         bool add_special,
-        bool parse_special) const {
+        bool parse_special,
+        int32_t n_threads,
+        int32_t n_chunk_min) const {
     GGML_ASSERT(tokenizer && "Tokenizer not initialized. Call llama_vocab::init_tokenizer() first.");
 
     std::vector<llama_token> output;
@@ -2796,7 +3082,7 @@ std::vector<llama_token> llama_vocab::impl::tokenize(
 #ifdef PRETOKENIZERDEBUG
                         LLAMA_LOG_WARN("TT: (%ld %ld %ld) '%s'\n", text.length(), fragment.offset, fragment.length, text.c_str());
 #endif
-                        session.tokenize(text, output);
+                        session.tokenize(text, output, n_threads, n_chunk_min);
                     } else { // if (fragment.type == FRAGMENT_BUFFER_VARIANT_TYPE_TOKEN)
                         session.append(fragment.token, output);
                     }
@@ -3435,8 +3721,10 @@ int32_t llama_vocab::tokenize(
                  llama_token * tokens,
                      int32_t   n_tokens_max,
                         bool   add_special,
-                        bool   parse_special) const {
-    auto res = tokenize(std::string(text, text_len), add_special, parse_special);
+                        bool   parse_special,
+                     int32_t   n_threads,
+                     int32_t   n_chunk_min) const {
+    auto res = tokenize(std::string(text, text_len), add_special, parse_special, n_threads, n_chunk_min);
     if (res.size() >= static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
         LLAMA_LOG_ERROR("%s: tokenization result size %zu exceeds int32_t limit\n", __func__, res.size());
         return std::numeric_limits<int32_t>::min();
@@ -3457,14 +3745,86 @@ int32_t llama_vocab::tokenize(
 std::vector<llama_token> llama_vocab::tokenize(
         const std::string & raw_text,
         bool add_special,
-        bool parse_special) const {
-    return pimpl->tokenize(raw_text, add_special, parse_special);
+        bool parse_special,
+        int32_t n_threads,
+        int32_t n_chunk_min) const {
+    return pimpl->tokenize(raw_text, add_special, parse_special, n_threads, n_chunk_min);
 }
 
 const std::string & llama_vocab::token_to_piece(llama_token token) const {
     return pimpl->token_to_piece(token);
 }
 
+const llama_token_trie & llama_vocab::get_token_trie() const {
+    std::call_once(pimpl->token_trie_once, [this]() {
+        auto trie = std::make_unique<llama_token_trie>();
+
+        const uint32_t n_vocab = n_tokens();
+
+        for (uint32_t id = 0; id < n_vocab; ++id) {
+            if (!token_to_piece(id).empty()) {
+                trie->tokens.push_back(id);
+            }
+        }
+
+        std::sort(trie->tokens.begin(), trie->tokens.end(), [&](llama_token a, llama_token b) {
+            const auto & piece_a = token_to_piece(a);
+            const auto & piece_b = token_to_piece(b);
+            return piece_a != piece_b ? piece_a < piece_b : a < b;
+        });
+
+        auto & nodes = trie->nodes;
+
+        // the nodes on the path to the previous piece
+        std::vector<uint32_t> path;
+
+        const std::string * prev = nullptr;
+
+        for (uint32_t i = 0; i < trie->tokens.size(); ++i) {
+            const std::string & piece = token_to_piece(trie->tokens[i]);
+
+            size_t n_common = 0;
+            if (prev) {
+                while (n_common < prev->size() && n_common < piece.size() && (*prev)[n_common] == piece[n_common]) {
+                    n_common++;
+                }
+            }
+
+            // close the subtrees that are not a prefix of this piece
+            while (path.size() > n_common) {
+                nodes[path.back()].end = nodes.size();
+                path.pop_back();
+            }
+
+            for (size_t j = n_common; j < piece.size(); ++j) {
+                path.push_back(nodes.size());
+                nodes.push_back({ (uint8_t) piece[j], (uint32_t) j + 1, 0, i, i });
+            }
+
+            nodes[path.back()].tok_end = i + 1;
+
+            trie->max_depth = std::max<uint32_t>(trie->max_depth, piece.size());
+
+            prev = &piece;
+        }
+
+        while (!path.empty()) {
+            nodes[path.back()].end = nodes.size();
+            path.pop_back();
+        }
+
+        LLAMA_LOG_DEBUG("%s: token trie: %zu nodes, max depth = %u\n", __func__, nodes.size(), trie->max_depth);
+
+        pimpl->token_trie = std::move(trie);
+    });
+
+    return *pimpl->token_trie;
+}
+
+llama_grammar_cache & llama_vocab::get_grammar_cache() const {
+    return pimpl->grammar_cache;
+}
+
 int32_t llama_vocab::token_to_piece(llama_token token, char * buf, int32_t length, int32_t lstrip, bool special) const {
     return pimpl->token_to_piece(token, buf, length, lstrip, special);
 }
@@ -3499,6 +3859,46 @@ void llama_vocab::print_info() const {
     pimpl->print_info();
 }
 
+//
+// llama_detokenizer
+//
+
+void llama_detokenizer::push(llama_token token, bool special, std::string & out) {
+    const size_t n_out = out.size();
+
+    out += pending;
+
+    const size_t n_piece = out.size();
+
+    out.resize(n_piece + 16);
+    int32_t n_chars = vocab.token_to_piece(token, &out[n_piece], 16, 0, special);
+    if (n_chars < 0) {
+        out.resize(n_piece - n_chars);
+        n_chars = vocab.token_to_piece(token, &out[n_piece], -n_chars, 0, special);
+    }
+    out.resize(n_piece + n_chars);
+
+    // hold back the last code point if its first byte announces more bytes than there are
+    size_t n_complete = out.size();
+    for (size_t i = 1; i <= 4 && i <= out.size() - n_out; ++i) {
+        const char c = out[out.size() - i];
+        if ((c & 0xC0) != 0x80) {
+            if (unicode_len_utf8(c) > i) {
+                n_complete = out.size() - i;
+            }
+            break;
+        }
+    }
+
+    pending.assign(out, n_complete, std::string::npos);
+    out.resize(n_complete);
+}
+
+void llama_detokenizer::flush(std::string & out) {
+    out += pending;
+    pending.clear();
+}
+
 //
 // interface implementation
 //
@@ -3721,6 +4121,19 @@ int32_t llama_tokenize(
     return vocab->tokenize(text, text_len, tokens, n_tokens_max, add_special, parse_special);
 }
 
+int32_t llama_tokenize_parallel(
+    const struct llama_vocab * vocab,
+                  const char * text,
+                     int32_t   text_len,
+                 llama_token * tokens,
+                     int32_t   n_tokens_max,
+                        bool   add_special,
+                        bool   parse_special,
+                     int32_t   n_threads,
+                     int32_t   n_chunk_min) {
+    return vocab->tokenize(text, text_len, tokens, n_tokens_max, add_special, parse_special, n_threads, n_chunk_min);
+}
+
 int32_t llama_token_to_piece(
     const struct llama_vocab * vocab,
                  llama_token   token,
@@ -3741,3 +4154,48 @@ int32_t llama_detokenize(
                         bool   unparse_special) {
     return vocab->detokenize(tokens, n_tokens, text, text_len_max, remove_special, unparse_special);
 }
+
+struct llama_detokenizer * llama_detokenizer_init(const struct llama_vocab * vocab) {
+    return new llama_detokenizer(*vocab);
+}
+
+void llama_detokenizer_free(struct llama_detokenizer * detok) {
+    delete detok;
+}
+
+int32_t llama_detokenizer_push(
+    struct llama_detokenizer * detok,
+                 llama_token   token,
+                        char * text,
+                     int32_t   text_len_max,
+                        bool   special) {
+    std::string out;
+    const std::string pending = detok->pending;
+    detok->push(token, special, out);
+
+    if ((int32_t) out.size() > text_len_max) {
+        detok->pending = pending;
+        return -(int32_t) out.size();
+    }
+
+    memcpy(text, out.data(), out.size());
+    return (int32_t) out.size();
+}
+
+int32_t llama_detokenizer_flush(
+    struct llama_detokenizer * detok,
+                        char * text,
+                     int32_t   text_len_max) {
+    const int32_t n_chars = (int32_t) detok->pending.size();
+    if (n_chars > text_len_max) {
+        return -n_chars;
+    }
+
+    memcpy(text, detok->pending.data(), n_chars);
+    detok->pending.clear();
+    return n_chars;
+}
+
+int32_t llama_detokenizer_n_pending(const struct llama_detokenizer * detok) {
+    return (int32_t) detok->pending.size();
+}
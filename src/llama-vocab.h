@@ -50,6 +50,23 @@ enum llama_vocab_pre_type {
 
 struct LLM_KV;
 struct llama_model_loader;
+struct llama_grammar_cache;
+
+// prefix trie of the token pieces (llama_vocab::token_to_piece), with the nodes in depth-first order
+struct llama_token_trie {
+    struct node {
+        uint8_t  byte;
+        uint32_t depth;     // 1 for the first byte of a piece
+        uint32_t end;       // index of the first node after the subtree of this node
+        uint32_t tok_begin; // tokens whose piece ends at this node: tokens[tok_begin, tok_end)
+        uint32_t tok_end;
+    };
+
+    std::vector<node>        nodes;
+    std::vector<llama_token> tokens; // the tokens with a non-empty piece, in the order of their nodes
+
+    uint32_t max_depth = 0;
+};
 
 struct llama_vocab {
     struct token_data {
@@ -131,18 +148,25 @@ struct llama_vocab {
 
     std::vector<char> get_precompiled_charsmap() const;
 
+    // n_threads: max number of threads used to tokenize long texts in chunks, when the tokenizer supports it
+    // (1 = serial, 0 = hardware concurrency)
+    // n_chunk_min: min size of the chunks in bytes, shorter texts are not split (0 = default)
     int32_t tokenize(
                    const char * text,
                       int32_t   text_len,
                   llama_token * tokens,
                       int32_t   n_tokens_max,
                          bool   add_special,
-                         bool   parse_special) const;
+                         bool   parse_special,
+                      int32_t   n_threads   = 1,
+                      int32_t   n_chunk_min = 0) const;
 
     std::vector<llama_token> tokenize(
             const std::string & raw_text,
                          bool   add_special,
-                         bool   parse_special = false) const;
+                         bool   parse_special = false,
+                      int32_t   n_threads     = 1,
+                      int32_t   n_chunk_min   = 0) const;
 
     // does not write null-terminator to buf
     int32_t token_to_piece(
@@ -155,6 +179,11 @@ struct llama_vocab {
     // use cached data
     const std::string & token_to_piece(llama_token token) const;
 
+    // built on first use, then shared
+    const llama_token_trie & get_token_trie() const;
+
+    llama_grammar_cache & get_grammar_cache() const;
+
     int32_t detokenize(
             const llama_token * tokens,
                       int32_t   n_tokens,
@@ -173,3 +202,19 @@ private:
     struct impl;
     std::unique_ptr<impl> pimpl;
 };
+
+// converts the generated tokens one at a time, and outputs the text only up to the last complete UTF-8 code point:
+// the bytes of a code point that is split between tokens are held back until the next tokens complete it
+struct llama_detokenizer {
+    llama_detokenizer(const llama_vocab & vocab) : vocab(vocab) {}
+
+    // appends the text of the token to the held back bytes, and moves them to out up to the last complete code point
+    void push(llama_token token, bool special, std::string & out);
+
+    // moves the held back bytes to out, even if they do not form a complete code point
+    void flush(std::string & out);
+
+    const llama_vocab & vocab;
+
+    std::string pending;
+};
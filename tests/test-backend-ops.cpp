@@ -102,7 +102,7 @@ static void init_tensor_uniform(ggml_tensor * tensor, float min = -1.0f, float m
             };
 
             const size_t min_blocks_per_thread = 1;
-            const size_t n_threads = std::min<size_t>(std::thread::hardware_concurrency()/2,
+            const size_t n_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()/2),
                                                       std::max<size_t>(1, n_blocks / min_blocks_per_thread));
             std::vector<std::future<void>> tasks;
             tasks.reserve(n_threads);
@@ -903,6 +903,47 @@ static std::unique_ptr<printer> create_printer(output_formats format) {
     GGML_ABORT("invalid output format");
 }
 
+// allocates the tensor in the extra buffer type of the device of the backend with the given name, e.g. the CPU buffer type
+// that repacks the weights, returns NULL if there is no such buffer type or if the backend does not support op with it
+static ggml_backend_buffer_t alloc_tensor_extra_buft(ggml_backend_t backend, ggml_tensor * tensor, ggml_tensor * op, const std::string & buft_name) {
+    ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto ggml_backend_dev_get_extra_bufts_fn = (ggml_backend_dev_get_extra_bufts_t)
+        ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!ggml_backend_dev_get_extra_bufts_fn) {
+        return NULL;
+    }
+
+    for (ggml_backend_buffer_type_t * buft = ggml_backend_dev_get_extra_bufts_fn(dev); buft && *buft; ++buft) {
+        if (buft_name != ggml_backend_buft_name(*buft)) {
+            continue;
+        }
+
+        // a temporary empty buffer so that supports_op can check the buffer type of the tensor
+        tensor->buffer = ggml_backend_buft_alloc_buffer(*buft, 0);
+        const bool supported = ggml_backend_supports_op(backend, op);
+        ggml_backend_buffer_free(tensor->buffer);
+        tensor->buffer = NULL;
+
+        if (!supported) {
+            return NULL;
+        }
+
+        ggml_backend_buffer_t buf = ggml_backend_buft_alloc_buffer(*buft, ggml_backend_buft_get_alloc_size(*buft, tensor));
+        if (buf == NULL) {
+            return NULL;
+        }
+        if (ggml_backend_tensor_alloc(buf, tensor, ggml_backend_buffer_get_base(buf)) != GGML_STATUS_SUCCESS) {
+            ggml_backend_buffer_free(buf);
+            return NULL;
+        }
+        return buf;
+    }
+
+    return NULL;
+}
+
 struct test_case {
     virtual ~test_case() {}
 
@@ -970,6 +1011,22 @@ struct test_case {
 
     virtual bool run_whole_graph() { return false; }
 
+    // The extra buffer type of the backend, e.g. the CPU buffer type that repacks the weights, in which the perf mode
+    // and eval_extra_buft allocate the tensors returned by extra_buft_tensors. No effect if empty.
+    virtual std::string extra_buft() {
+        return "";
+    }
+
+    virtual std::vector<ggml_tensor *> extra_buft_tensors(ggml_tensor * out) {
+        GGML_UNUSED(out);
+        return {};
+    }
+
+    // The number of threads of the backend in eval_extra_buft, 0 to keep the current one.
+    virtual int n_threads() {
+        return 0;
+    }
+
     ggml_cgraph * gf = nullptr;
     ggml_cgraph * gb = nullptr;
 
@@ -1185,6 +1242,104 @@ struct test_case {
         return test_passed;
     }
 
+    // compares the output of the graph with the tensors of extra_buft_tensors in the extra buffer type with the output
+    // of the same graph with all the tensors in the default buffer type, on the same backend
+    bool eval_extra_buft(ggml_backend_t backend, const char * op_name, printer * output_printer) {
+        mode = MODE_TEST;
+
+        ggml_init_params params = {
+            /* .mem_size = */ ggml_tensor_overhead()*128 + ggml_graph_overhead(),
+            /* .mem_base = */ NULL,
+            /* .no_alloc = */ true,
+        };
+        ggml_context_ptr ctx_ref(ggml_init(params));
+        ggml_context_ptr ctx_buft(ggml_init(params));
+        GGML_ASSERT(ctx_ref && ctx_buft);
+
+        ggml_tensor * out_ref  = build_graph(ctx_ref.get());
+        ggml_tensor * out_buft = build_graph(ctx_buft.get());
+
+        // the outputs are compared directly
+        sentinels.clear();
+
+        std::string current_op_name = op_desc(out_ref);
+        if (op_name != nullptr && current_op_name != op_name) {
+            return true;
+        }
+
+        if (n_threads() > 0) {
+            ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend));
+            auto ggml_backend_set_n_threads_fn = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+            if (ggml_backend_set_n_threads_fn) {
+                ggml_backend_set_n_threads_fn(backend, n_threads());
+            }
+        }
+
+        std::vector<ggml_backend_buffer_ptr> extra_bufs;
+        for (ggml_tensor * t : extra_buft_tensors(out_buft)) {
+            ggml_backend_buffer_t extra_buf = alloc_tensor_extra_buft(backend, t, out_buft, extra_buft());
+            if (extra_buf == NULL) {
+                test_result result(ggml_backend_name(backend), current_op_name, vars(), "test", false, false,
+                                   "not supported");
+
+                output_printer->print_test_result(result);
+
+                return true;
+            }
+            extra_bufs.emplace_back(extra_buf);
+        }
+
+        ggml_backend_buffer_ptr buf_ref(ggml_backend_alloc_ctx_tensors(ctx_ref.get(), backend));
+        ggml_backend_buffer_ptr buf_buft(ggml_backend_alloc_ctx_tensors(ctx_buft.get(), backend));
+
+        if (buf_ref == NULL || buf_buft == NULL) {
+            printf("failed to allocate tensors [%s] ", ggml_backend_name(backend));
+            return false;
+        }
+
+        // both graphs get the same data, the tensors in the extra buffer type are converted when they are set
+        initialize_tensors(ctx_ref.get());
+
+        for (ggml_tensor * t_ref = ggml_get_first_tensor(ctx_ref.get()), * t_buft = ggml_get_first_tensor(ctx_buft.get());
+             t_ref != NULL && t_buft != NULL;
+             t_ref = ggml_get_next_tensor(ctx_ref.get(), t_ref), t_buft = ggml_get_next_tensor(ctx_buft.get(), t_buft)) {
+            if (t_ref->view_src != NULL) {
+                continue;
+            }
+            std::vector<uint8_t> data(ggml_nbytes(t_ref));
+            ggml_backend_tensor_get(t_ref, data.data(), 0, data.size());
+            ggml_backend_tensor_set(t_buft, data.data(), 0, data.size());
+        }
+
+        ggml_cgraph * gf_ref  = ggml_new_graph(ctx_ref.get());
+        ggml_cgraph * gf_buft = ggml_new_graph(ctx_buft.get());
+        ggml_build_forward_expand(gf_ref,  out_ref);
+        ggml_build_forward_expand(gf_buft, out_buft);
+
+        bool test_passed = ggml_backend_graph_compute(backend, gf_ref)  == GGML_STATUS_SUCCESS &&
+                           ggml_backend_graph_compute(backend, gf_buft) == GGML_STATUS_SUCCESS;
+
+        if (test_passed) {
+            const std::vector<float> f_ref  = tensor_to_float(out_ref);
+            const std::vector<float> f_buft = tensor_to_float(out_buft);
+
+            const double err = nmse(f_ref.data(), f_buft.data(), f_ref.size());
+            if (!(err <= max_nmse_err())) {
+                printf("[%s] NMSE = %.9f > %.9f ", ggml_op_desc(out_ref), err, max_nmse_err());
+                test_passed = false;
+            }
+        }
+
+        test_result result(ggml_backend_name(backend), current_op_name, vars(), "test", true, test_passed,
+                           test_passed ? "" : "test failed");
+
+        if (output_printer) {
+            output_printer->print_test_result(result);
+        }
+
+        return test_passed;
+    }
+
     bool eval_perf(ggml_backend_t backend, const char * op_name, printer * output_printer) {
         mode = MODE_PERF;
 
@@ -1215,6 +1370,21 @@ struct test_case {
             return true;
         }
 
+        // allocate the tensors in the extra buffer types first, ggml_backend_alloc_ctx_tensors skips them
+        std::vector<ggml_backend_buffer_ptr> extra_bufs;
+        for (ggml_tensor * t : extra_buft_tensors(out)) {
+            ggml_backend_buffer_t extra_buf = alloc_tensor_extra_buft(backend, t, out, extra_buft());
+            if (extra_buf == NULL) {
+                test_result result(ggml_backend_name(backend), current_op_name, vars(), "perf", false, false,
+                                   "not supported");
+
+                output_printer->print_test_result(result);
+
+                return true;
+            }
+            extra_bufs.emplace_back(extra_buf);
+        }
+
         // allocate
         ggml_backend_buffer_ptr buf(ggml_backend_alloc_ctx_tensors(ctx.get(), backend)); // smart ptr
 
@@ -2971,6 +3141,37 @@ struct test_mul_mat : public test_case {
     }
 };
 
+// GGML_OP_MUL_MAT with the weights in an extra buffer type of the backend, as they are loaded in a model (e.g. repacked by the CPU backend)
+struct test_mul_mat_extra_buft : public test_mul_mat {
+    const std::string buft;
+    const int nt; // number of threads in eval mode, 0 = default
+
+    std::string vars() override {
+        std::string res = test_mul_mat::vars() + ",buft=" + buft;
+        if (nt > 0) {
+            res += ",n_threads=" + std::to_string(nt);
+        }
+        return res;
+    }
+
+    std::string extra_buft() override {
+        return buft;
+    }
+
+    std::vector<ggml_tensor *> extra_buft_tensors(ggml_tensor * out) override {
+        return { out->src[0] };
+    }
+
+    int n_threads() override {
+        return nt;
+    }
+
+    test_mul_mat_extra_buft(const std::string & buft = "CPU_REPACK",
+            ggml_type type_a = GGML_TYPE_Q4_0, ggml_type type_b = GGML_TYPE_F32,
+            int64_t m = 32, int64_t n = 32, int64_t k = 32, int nt = 0)
+        : test_mul_mat(type_a, type_b, m, n, k, {1, 1}, {1, 1}), buft(buft), nt(nt) {}
+};
+
 // GGML_OP_MUL_MAT_ID
 struct test_mul_mat_id : public test_case {
     const ggml_type type_a;
@@ -3935,6 +4136,48 @@ struct test_argsort : public test_case {
     }
 };
 
+// GGML_OP_ARGSORT_TOP_K
+struct test_argsort_top_k : public test_case {
+    const ggml_type type;
+    const std::array<int64_t, 4> ne;
+    const int k;
+
+    std::string vars() override {
+        return VARS_TO_STR3(type, ne, k);
+    }
+
+    test_argsort_top_k(ggml_type type = GGML_TYPE_F32,
+            std::array<int64_t, 4> ne = {16, 10, 10, 10},
+            int k = 4)
+        : type(type), ne(ne), k(k) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor(ctx, type, 4, ne.data());
+        ggml_set_name(a, "a");
+
+        ggml_tensor * out = ggml_argsort_top_k(ctx, a, k);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        std::random_device rd;
+        std::default_random_engine rng(rd());
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            // initialize with unique values to avoid ties
+            for (int64_t r = 0; r < ggml_nrows(t); r++) {
+                std::vector<float> data(t->ne[0]);
+                for (int i = 0; i < t->ne[0]; i++) {
+                    data[i] = i;
+                }
+                std::shuffle(data.begin(), data.end(), rng);
+                ggml_backend_tensor_set(t, data.data(), r * t->nb[1], t->ne[0] * sizeof(float));
+            }
+        }
+    }
+};
+
 // GGML_OP_SUM
 struct test_sum : public test_case {
     const ggml_type type;
@@ -5685,6 +5928,11 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         test_cases.emplace_back(new test_argsort(GGML_TYPE_F32, {60, 10, 10, 10}, order)); // qwen
     }
 
+    for (int k : {1, 4, 40}) {
+        test_cases.emplace_back(new test_argsort_top_k(GGML_TYPE_F32, {60, 10, 1, 1}, k));
+        test_cases.emplace_back(new test_argsort_top_k(GGML_TYPE_F32, {32000, 4, 1, 1}, k)); // vocab
+    }
+
     for (ggml_scale_mode mode : {GGML_SCALE_MODE_NEAREST, GGML_SCALE_MODE_BILINEAR}) {
         test_cases.emplace_back(new test_upscale(GGML_TYPE_F32, {512, 512, 3, 2}, 2, mode));
         test_cases.emplace_back(new test_upscale(GGML_TYPE_F32, {512, 512, 3, 2}, 2, mode, true));
@@ -5768,6 +6016,23 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
 }
 
 // Test cases for performance evaluation: should be representative of real-world use cases
+// checks the extra buffer types of the CPU backend against its default buffer type
+static std::vector<std::unique_ptr<test_case>> make_test_cases_extra_buft() {
+    std::vector<std::unique_ptr<test_case>> test_cases;
+
+    // the repacked kernels handle the rows of the activations in blocks of 4, with a tail handled one row at a time,
+    // and the work is split across the threads in chunks of the repacked weights
+    for (int nt : {1, 8}) {
+        for (int n : {1, 2, 3, 4, 5, 8, 13}) {
+            for (ggml_type type_a : {GGML_TYPE_Q4_0, GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_Q8_0, GGML_TYPE_IQ4_NL, GGML_TYPE_IQ4_XS}) {
+                test_cases.emplace_back(new test_mul_mat_extra_buft("CPU_REPACK", type_a, GGML_TYPE_F32, 128, n, 512, nt));
+            }
+        }
+    }
+
+    return test_cases;
+}
+
 static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
     std::vector<std::unique_ptr<test_case>> test_cases;
 
@@ -5839,6 +6104,13 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
         }
     }
 
+    // the types that the CPU backend repacks, with the weights in the repacked buffer type
+    for (int bs : {1, 2, 3, 4, 5, 8, 512}) {
+        for (ggml_type type_a : {GGML_TYPE_Q4_0, GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_Q8_0, GGML_TYPE_IQ4_NL, GGML_TYPE_IQ4_XS}) {
+            test_cases.emplace_back(new test_mul_mat_extra_buft("CPU_REPACK", type_a, GGML_TYPE_F32, 4096, bs, 14336));
+        }
+    }
+
     for (int K : {3, 5}) {
         for (int IC : {256, 2560}) {
             for (int IW_IH : {32, 64, 256}) {
@@ -5859,6 +6131,18 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
         }
     }
 
+    // long contexts with the quantized KV cache types, for a single token and for a batch of the prompt
+    for (int kv : { 4096, 32768, }) {
+        for (int nb : { 1, 512, }) {
+            for (ggml_type type_KV : { GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0, }) {
+                if (nb == 1 && type_KV == GGML_TYPE_F16 && kv == 4096) {
+                    continue; // above
+                }
+                test_cases.emplace_back(new test_flash_attn_ext(128, 128, 8, {4, 1}, kv, nb, true, 0, 0, GGML_PREC_F32, type_KV));
+            }
+        }
+    }
+
     test_cases.emplace_back(new test_conv_2d_dw({512, 512, 256, 1}, {3, 3, 1, 256}, 1, 1, 1, false));
     test_cases.emplace_back(new test_conv_2d_dw({512, 512, 256, 1}, {3, 3, 1, 256}, 1, 1, 1, true));
 
@@ -5888,6 +6172,22 @@ static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op
         }
     };
 
+    // the CPU backend is the reference of the other backends, only its extra buffer types are checked
+    if (mode == MODE_TEST && ggml_backend_dev_type(ggml_backend_get_device(backend)) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+        auto test_cases = make_test_cases_extra_buft();
+        filter_test_cases(test_cases, params_filter);
+
+        size_t n_ok = 0;
+        for (auto & test : test_cases) {
+            if (test->eval_extra_buft(backend, op_name, output_printer)) {
+                n_ok++;
+            }
+        }
+        output_printer->print_summary(test_summary_info(n_ok, test_cases.size(), false));
+
+        return n_ok == test_cases.size();
+    }
+
     if (mode == MODE_TEST) {
         auto test_cases = make_test_cases_eval();
         filter_test_cases(test_cases, params_filter);
@@ -6034,7 +6334,7 @@ int main(int argc, char ** argv) {
             continue;
         }
 
-        if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode != MODE_GRAD) {
+        if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode != MODE_GRAD && mode != MODE_TEST) {
             output_printer->print_backend_init(backend_init_info(
                 i, ggml_backend_dev_count(), ggml_backend_dev_name(dev), true, "Skipping CPU backend"));
             n_ok++;
@@ -6,11 +6,98 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
+#include <random>
 #include <vector>
 
 #define MAX_NARGS 2
 
+static void fill_random(struct ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    if (t->type == GGML_TYPE_F32) {
+        float * data = (float *) t->data;
+        for (int64_t i = 0; i < ggml_nelements(t); i++) {
+            data[i] = dist(rng);
+        }
+    } else if (t->type == GGML_TYPE_Q4_0) {
+        std::vector<float> tmp(ggml_nelements(t));
+        for (auto & v : tmp) {
+            v = dist(rng);
+        }
+        ggml_quantize_chunk(t->type, tmp.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+static double graph_compute(struct ggml_cgraph * gf, struct ggml_threadpool * threadpool, int n_threads, int n_rounds) {
+    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    // Warmup
+    ggml_graph_compute(gf, &cplan);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < n_rounds; i++) {
+        ggml_graph_compute(gf, &cplan);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+// the layers of a decoder for a single token: lots of small ops, with independent branches that the scheduler can
+// run concurrently instead of separating every node with a barrier
+static struct ggml_tensor * build_decoder(struct ggml_context * ctx, std::mt19937 & rng, struct ggml_tensor ** cache, int n_layers) {
+    const int n_embd    = 256;
+    const int n_head    = 8;
+    const int head_dim  = n_embd/n_head;
+
+    struct ggml_tensor * x = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+    fill_random(x, rng);
+
+    struct ggml_tensor * pos = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, 1);
+    ((int32_t *) pos->data)[0] = 7;
+
+    *cache = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_embd, n_layers);
+
+    for (int il = 0; il < n_layers; il++) {
+        struct ggml_tensor * w_norm = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+        struct ggml_tensor * b      = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, n_embd);
+        struct ggml_tensor * w      = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, n_embd, n_embd);
+        fill_random(w_norm, rng);
+        fill_random(b, rng);
+        fill_random(w, rng);
+
+        struct ggml_tensor * cur = ggml_mul(ctx, ggml_rms_norm(ctx, x, 1e-5f), w_norm);
+
+        struct ggml_tensor * q = ggml_reshape_3d(ctx, ggml_scale(ctx, cur, 0.5f), head_dim, n_head, 1);
+        struct ggml_tensor * k = ggml_reshape_3d(ctx, ggml_add(ctx, cur, b), head_dim, n_head, 1);
+        struct ggml_tensor * v = ggml_silu(ctx, cur);
+
+        q = ggml_rope_ext(ctx, q, pos, nullptr, head_dim, 0, 4096, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+        k = ggml_rope_ext(ctx, k, pos, nullptr, head_dim, 0, 4096, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+
+        // store k in the cache, like the KV cache
+        struct ggml_tensor * k_view = ggml_view_1d(ctx, *cache, n_embd, il*(*cache)->nb[1]);
+        struct ggml_tensor * k_cpy  = ggml_cpy(ctx, ggml_reshape_1d(ctx, k, n_embd), k_view);
+
+        struct ggml_tensor * kq = ggml_soft_max(ctx, ggml_reshape_2d(ctx, ggml_mul(ctx, q, k), head_dim, n_head));
+
+        cur = ggml_mul(ctx, ggml_reshape_1d(ctx, kq, n_embd), v);
+        cur = ggml_mul_mat(ctx, w, cur);
+
+        x = ggml_add(ctx, x, cur);
+        x = ggml_add(ctx, x, ggml_scale(ctx, ggml_reshape_1d(ctx, ggml_cast(ctx, k_cpy, GGML_TYPE_F32), n_embd), 0.0f));
+    }
+
+    return x;
+}
+
 int main(int argc, char *argv[]) {
 
     int n_threads = 4;
@@ -56,12 +143,6 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    // Create compute plan
-    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
-
-    std::vector<uint8_t> work_data(cplan.work_size);
-    cplan.work_data = work_data.data();
-
     std::cerr << "graph-compute with"
               << "\n n_threads: " << n_threads
               << "\n   n_nodes: " << n_nodes
@@ -69,23 +150,49 @@ int main(int argc, char *argv[]) {
               << "\n";
     // ggml_graph_print(gf);
 
-    // Warmup
-    ggml_graph_compute(gf, &cplan);
-
-    auto t0 = std::chrono::high_resolution_clock::now();
+    {
+        const double nsec = graph_compute(gf, threadpool, n_threads, n_rounds);
 
-    for (int i=0; i < n_rounds; i++) {
-        ggml_graph_compute(gf, &cplan);
+        std::cerr << "graph-compute took " << (int64_t) (nsec / 1000) << " usec "
+                  << "\n " << (float) nsec / (1000 * n_rounds) << " usec per-iter"
+                  << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
+                  << "\n";
     }
 
-    auto t1 = std::chrono::high_resolution_clock::now();
+    // scheduling of independent nodes, the result must not depend on the number of threads
+    {
+        std::mt19937 rng(1234);
 
-    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count();
-    auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count();
-    std::cerr << "graph-compute took " << usec << " usec "
-              << "\n " << (float) usec / n_rounds << " usec per-iter"
-              << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
-              << "\n";
+        struct ggml_tensor * cache = nullptr;
+        struct ggml_tensor * x     = build_decoder(ctx, rng, &cache, 32);
+
+        struct ggml_cgraph * gd = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gd, x);
+
+        const int n_nodes_dec = ggml_graph_n_nodes(gd);
+
+        const double nsec_1 = graph_compute(gd, nullptr, 1, 1);
+
+        const std::vector<float>   x_ref((float *) x->data, (float *) x->data + ggml_nelements(x));
+        const std::vector<uint8_t> cache_ref((uint8_t *) cache->data, (uint8_t *) cache->data + ggml_nbytes(cache));
+
+        memset(x->data, 0, ggml_nbytes(x));
+        memset(cache->data, 0, ggml_nbytes(cache));
+
+        const double nsec = graph_compute(gd, threadpool, n_threads, n_rounds);
+
+        if (memcmp(x_ref.data(), x->data, ggml_nbytes(x)) != 0 || memcmp(cache_ref.data(), cache->data, ggml_nbytes(cache)) != 0) {
+            fprintf(stderr, "decoder graph: the result with %d threads differs from the result with 1 thread\n", n_threads);
+            exit(1);
+        }
+
+        std::cerr << "decoder graph-compute with"
+                  << "\n   n_nodes: " << n_nodes_dec
+                  << "\n 1 thread:  " << (float) nsec_1 / 1000 << " usec per-iter"
+                  << "\n " << (float) nsec / (1000 * n_rounds) << " usec per-iter"
+                  << "\n " << (float) nsec / (n_rounds * n_nodes_dec) << " nsec per-node"
+                  << "\n";
+    }
 
     ggml_threadpool_free(threadpool);
     ggml_free(ctx);
@@ -0,0 +1,173 @@
+// checks that the sequences of nodes that the CPU backend computes with a single kernel (see ggml_graph_fuse) give
+// exactly the same results as the nodes computed one at a time
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include "../ggml/src/ggml-impl.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void fill_random(struct ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> tmp(ggml_nelements(t));
+    for (auto & v : tmp) {
+        v = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, tmp.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, tmp.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+static void graph_compute(struct ggml_cgraph * gf, int n_threads) {
+    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, nullptr);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    if (ggml_graph_compute(gf, &cplan) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "%s: ggml_graph_compute failed\n", __func__);
+        exit(1);
+    }
+}
+
+struct fusion_outputs {
+    std::vector<struct ggml_tensor *> tensors;
+
+    std::vector<std::vector<uint8_t>> read() const {
+        std::vector<std::vector<uint8_t>> data;
+        for (const auto * t : tensors) {
+            data.emplace_back((const uint8_t *) t->data, (const uint8_t *) t->data + ggml_nbytes(t));
+        }
+        return data;
+    }
+
+    void clear() const {
+        for (auto * t : tensors) {
+            memset(t->data, 0, ggml_nbytes(t));
+        }
+    }
+};
+
+// the patterns of a transformer layer: ADD -> RMS_NORM -> MUL, MUL_MAT -> ADD of a bias, ROPE -> CPY to the F16 cache
+// with an unrelated node in between, UNARY(SILU) -> MUL and RMS_NORM -> MUL
+static struct ggml_cgraph * build_graph(struct ggml_context * ctx, std::mt19937 & rng, int n_tokens, fusion_outputs & outputs) {
+    const int n_embd   = 256;
+    const int n_head   = 4;
+    const int head_dim = n_embd/n_head;
+
+    auto new_tensor = [&](enum ggml_type type, int64_t ne0, int64_t ne1) {
+        struct ggml_tensor * t = ggml_new_tensor_2d(ctx, type, ne0, ne1);
+        fill_random(t, rng);
+        return t;
+    };
+
+    struct ggml_tensor * x  = new_tensor(GGML_TYPE_F32,  n_embd, n_tokens);
+    struct ggml_tensor * r  = new_tensor(GGML_TYPE_F32,  n_embd, n_tokens);
+    struct ggml_tensor * w0 = new_tensor(GGML_TYPE_F32,  n_embd, 1);
+    struct ggml_tensor * w1 = new_tensor(GGML_TYPE_F32,  n_embd, 1);
+    struct ggml_tensor * wq = new_tensor(GGML_TYPE_Q4_0, n_embd, n_embd);
+    struct ggml_tensor * wk = new_tensor(GGML_TYPE_F32,  n_embd, n_embd);
+    struct ggml_tensor * wv = new_tensor(GGML_TYPE_Q8_0, n_embd, n_embd);
+    struct ggml_tensor * bq = new_tensor(GGML_TYPE_F32,  n_embd, 1);
+    struct ggml_tensor * bk = new_tensor(GGML_TYPE_F32,  n_embd, 1);
+
+    struct ggml_tensor * pos = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_tokens);
+    for (int i = 0; i < n_tokens; i++) {
+        ((int32_t *) pos->data)[i] = 3 + i;
+    }
+
+    struct ggml_tensor * cache = ggml_new_tensor_1d(ctx, GGML_TYPE_F16, 2*n_embd*n_tokens);
+    memset(cache->data, 0, ggml_nbytes(cache));
+
+    struct ggml_tensor * h   = ggml_add(ctx, x, r);
+    struct ggml_tensor * cur = ggml_mul(ctx, ggml_rms_norm(ctx, h, 1e-5f), w0);
+
+    struct ggml_tensor * q = ggml_add(ctx, ggml_mul_mat(ctx, wq, cur), bq);
+    struct ggml_tensor * k = ggml_add(ctx, ggml_mul_mat(ctx, wk, cur), bk);
+
+    k = ggml_rope_ext(ctx, ggml_reshape_3d(ctx, k, head_dim, n_head, n_tokens), pos, nullptr,
+            head_dim, 0, 4096, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+
+    struct ggml_tensor * v = ggml_mul_mat(ctx, wv, cur);
+
+    struct ggml_tensor * k_view = ggml_view_1d(ctx, cache, n_embd*n_tokens, n_embd*n_tokens*ggml_element_size(cache));
+    struct ggml_tensor * k_cpy  = ggml_cpy(ctx, ggml_reshape_1d(ctx, k, n_embd*n_tokens), k_view);
+
+    struct ggml_tensor * g = ggml_mul(ctx, ggml_silu(ctx, q), v);
+
+    struct ggml_tensor * out = ggml_mul(ctx, ggml_rms_norm(ctx, ggml_add(ctx, h, g), 1e-6f), w1);
+    out = ggml_add(ctx, out, ggml_mul(ctx, ggml_rms_norm(ctx, r, 1e-5f), w1));
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+
+    ggml_build_forward_expand(gf, k);
+    ggml_build_forward_expand(gf, v);
+    ggml_build_forward_expand(gf, k_cpy);
+    ggml_build_forward_expand(gf, out);
+
+    outputs.tensors = { h, out, cache };
+
+    return gf;
+}
+
+int main(void) {
+    struct ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    int n_failed = 0;
+
+    for (int n_tokens : { 1, 2, 7 }) {
+        for (int n_threads : { 1, 2, 4 }) {
+            struct ggml_context * ctx = ggml_init(params);
+
+            std::mt19937 rng(1234);
+
+            fusion_outputs outputs;
+            struct ggml_cgraph * gf = build_graph(ctx, rng, n_tokens, outputs);
+
+            graph_compute(gf, n_threads);
+
+            const auto fused = outputs.read();
+
+            outputs.clear();
+
+            // a graph with a single node cannot fuse anything
+            for (int i = 0; i < ggml_graph_n_nodes(gf); i++) {
+                struct ggml_cgraph gv = ggml_graph_view(gf, i, i + 1);
+                graph_compute(&gv, n_threads);
+            }
+
+            const auto ref = outputs.read();
+
+            for (size_t j = 0; j < ref.size(); j++) {
+                if (fused[j] != ref[j]) {
+                    fprintf(stderr, "%s: n_tokens = %d, n_threads = %d: output %zu of the fused graph differs from the reference\n",
+                            __func__, n_tokens, n_threads, j);
+                    n_failed++;
+                }
+            }
+
+            ggml_free(ctx);
+        }
+    }
+
+    if (n_failed > 0) {
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
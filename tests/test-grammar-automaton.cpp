@@ -0,0 +1,156 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "llama.h"
+
+#include "../src/llama-grammar.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// checks that the tokens allowed by the compiled automaton of a grammar are exactly the tokens allowed by
+// llama_grammar_reject_candidates, along random walks through the grammar
+
+static const char * grammars[] = {
+    // JSON
+    R"""(
+root   ::= object
+value  ::= object | array | string | number | ("true" | "false" | "null") ws
+object ::= "{" ws ( string ":" ws value ("," ws string ":" ws value)* )? "}" ws
+array  ::= "[" ws ( value ("," ws value)* )? "]" ws
+string ::= "\"" ( [^"\\\x7F\x00-\x1F] | "\\" (["\\bfnrt] | "u" [0-9a-fA-F]{4}) )* "\"" ws
+number ::= ("-"? ([0-9] | [1-9] [0-9]{0,15})) ("." [0-9]+)? ([eE] [-+]? [0-9] [1-9]{0,15})? ws
+ws     ::= | " " | "\n" [ \t]{0,20}
+)""",
+    // non-ASCII ranges, that tokens can end in the middle of
+    R"""(
+root ::= ([α-ω] | [一-龥] | "é" | [😀-🙏] | " ")+ "."
+)""",
+    // any char and negated ranges
+    R"""(
+root ::= "<" [^<>]* ">" (. | "\n")* "</end>"
+)""",
+    // alternatives sharing prefixes
+    R"""(
+root ::= ("hello" | "help" | "helium" | "hel" [0-9]+)+ " " ("yes" | "no")
+)""",
+};
+
+static std::vector<float> apply(const llama_grammar & grammar, int n_vocab) {
+    std::vector<llama_token_data> cur(n_vocab);
+    for (llama_token id = 0; id < n_vocab; ++id) {
+        cur[id] = { id, 0.0f, 0.0f };
+    }
+
+    llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+    llama_grammar_apply_impl(grammar, &cur_p);
+
+    std::vector<float> result(n_vocab);
+    for (llama_token id = 0; id < n_vocab; ++id) {
+        result[id] = cur[id].logit;
+    }
+
+    return result;
+}
+
+static void test_grammar(const llama_vocab * vocab, const char * grammar_str, int n_steps, uint32_t seed) {
+    llama_grammar * grammar   = llama_grammar_init_impl(vocab, grammar_str, "root", false, nullptr, 0, nullptr, 0);
+    llama_grammar * reference = llama_grammar_init_impl(vocab, grammar_str, "root", false, nullptr, 0, nullptr, 0);
+
+    assert(grammar != nullptr && reference != nullptr);
+    assert(grammar->automaton != nullptr);
+
+    // the grammars with the same rules and their clones share the automaton
+    assert(reference->automaton == grammar->automaton);
+    {
+        llama_grammar * clone = llama_grammar_clone_impl(*grammar);
+        assert(clone->automaton == grammar->automaton);
+        llama_grammar_free_impl(clone);
+    }
+
+    reference->automaton = nullptr;
+
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+
+    std::mt19937 rng(seed);
+
+    for (int step = 0; step < n_steps; ++step) {
+        if (step % 2 == 1) {
+            // the next apply uses the mask computed by the prefetch
+            llama_grammar_prefetch_impl(*grammar);
+        }
+
+        const auto logits     = apply(*grammar,   n_vocab);
+        const auto logits_ref = apply(*reference, n_vocab);
+
+        std::vector<llama_token> allowed;
+
+        for (llama_token id = 0; id < n_vocab; ++id) {
+            if (std::isinf(logits[id]) != std::isinf(logits_ref[id])) {
+                fprintf(stderr, "%s: step %d: token %d ('%s') is %s by the automaton but %s by the reference\n",
+                        __func__, step, id, llama_vocab_get_text(vocab, id),
+                        std::isinf(logits[id]) ? "rejected" : "allowed", std::isinf(logits_ref[id]) ? "rejected" : "allowed");
+                assert(false);
+            }
+            if (!std::isinf(logits[id]) && !llama_vocab_is_eog(vocab, id)) {
+                allowed.push_back(id);
+            }
+        }
+
+        if (allowed.empty()) {
+            break;
+        }
+
+        const llama_token id = allowed[std::uniform_int_distribution<size_t>(0, allowed.size() - 1)(rng)];
+
+        llama_grammar_accept_impl(*grammar,   id);
+        llama_grammar_accept_impl(*reference, id);
+    }
+
+    llama_grammar_free_impl(grammar);
+    llama_grammar_free_impl(reference);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <vocab-file> [<vocab-file> ...]\n", argv[0]);
+        return 1;
+    }
+
+    llama_backend_init();
+
+    for (int i = 1; i < argc; ++i) {
+        auto mparams = llama_model_default_params();
+        mparams.vocab_only = true;
+
+        llama_model * model = llama_model_load_from_file(argv[i], mparams);
+        if (model == nullptr) {
+            fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, argv[i]);
+            return 1;
+        }
+
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        for (size_t j = 0; j < sizeof(grammars)/sizeof(grammars[0]); ++j) {
+            fprintf(stderr, "%s: vocab '%s', grammar %zu\n", __func__, argv[i], j);
+
+            for (uint32_t seed = 0; seed < 4; ++seed) {
+                test_grammar(vocab, grammars[j], 24, seed);
+            }
+        }
+
+        llama_model_free(model);
+    }
+
+    llama_backend_free();
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+// checks the cell allocation of the paged KV cache (see llama_kv_cache_unified::find_slot_paged): the tokens of each
+// sequence are placed in the blocks owned by the sequence, the blocks freed by a sequence are reused, shared blocks are
+// not appended to, and the capacity of the cache is the same as in the non-paged mode
+
+#include "llama.h"
+
+#include "../src/llama-batch.h"
+#include "../src/llama-kv-cache-unified.h"
+#include "../src/llama-model.h"
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+static const uint32_t n_block = 8;
+static const uint32_t kv_size = 64;
+
+// a ubatch with one sequence id per token
+struct test_ubatch {
+    std::vector<llama_token>    token;
+    std::vector<llama_pos>      pos;
+    std::vector<int32_t>        n_seq_id;
+    std::vector<llama_seq_id>   seq_id_data;
+    std::vector<llama_seq_id *> seq_id;
+    std::vector<llama_seq_id>   seq_id_unq;
+    std::vector<int8_t>         output;
+
+    void add(llama_seq_id s, llama_pos p) {
+        token.push_back(0);
+        pos.push_back(p);
+        n_seq_id.push_back(1);
+        seq_id_data.push_back(s);
+        output.push_back(0);
+
+        if (std::find(seq_id_unq.begin(), seq_id_unq.end(), s) == seq_id_unq.end()) {
+            seq_id_unq.push_back(s);
+        }
+    }
+
+    llama_ubatch get() {
+        seq_id.resize(seq_id_data.size());
+        for (size_t i = 0; i < seq_id_data.size(); ++i) {
+            seq_id[i] = &seq_id_data[i];
+        }
+
+        llama_ubatch ubatch = {};
+
+        ubatch.n_tokens     = token.size();
+        ubatch.n_seq_tokens = token.size();
+        ubatch.n_seqs       = 1;
+        ubatch.n_seqs_unq   = seq_id_unq.size();
+        ubatch.token        = token.data();
+        ubatch.pos          = pos.data();
+        ubatch.n_seq_id     = n_seq_id.data();
+        ubatch.seq_id       = seq_id.data();
+        ubatch.seq_id_unq   = seq_id_unq.data();
+        ubatch.output       = output.data();
+
+        return ubatch;
+    }
+};
+
+// place the next n tokens of each of the given sequences, interleaved, and return the cells of each token
+static std::vector<uint32_t> place(llama_kv_cache_unified & kv, const std::vector<llama_seq_id> & seqs, int n) {
+    test_ubatch tb;
+    for (int i = 0; i < n; ++i) {
+        for (const llama_seq_id s : seqs) {
+            tb.add(s, kv.seq_pos_max(s) + 1 + i);
+        }
+    }
+
+    const llama_ubatch ubatch = tb.get();
+
+    const auto sinfo = kv.find_slot_paged(ubatch);
+    if (sinfo.empty()) {
+        return {};
+    }
+
+    kv.apply_ubatch(sinfo, ubatch);
+
+    return sinfo.idxs[0];
+}
+
+static void check(const std::vector<uint32_t> & idxs, const std::vector<uint32_t> & expected, const char * what) {
+    if (idxs != expected) {
+        fprintf(stderr, "%s: %s: got [", __func__, what);
+        for (const auto idx : idxs) {
+            fprintf(stderr, " %u", idx);
+        }
+        fprintf(stderr, " ]\n");
+        assert(false);
+    }
+}
+
+int main(void) {
+    llama_model model(llama_model_default_params());
+
+    model.hparams.n_layer          = 1;
+    model.hparams.n_embd           = 4;
+    model.hparams.n_embd_head_k    = 4;
+    model.hparams.n_embd_head_v    = 4;
+    model.hparams.n_head_kv_arr[0] = 1;
+
+    llama_kv_cache_unified kv(model, nullptr, GGML_TYPE_F32, GGML_TYPE_F32, false, false, true,
+            kv_size, LLAMA_MAX_SEQ, 1, 0, LLAMA_SWA_TYPE_NONE, n_block);
+
+    // the sequences claim their own blocks and fill them before claiming new ones
+    check(place(kv, { 0 }, 5), { 0, 1, 2, 3, 4 },        "seq 0 claims block 0");
+    check(place(kv, { 1 }, 3), { 8, 9, 10 },             "seq 1 claims block 1");
+    check(place(kv, { 0 }, 5), { 5, 6, 7, 16, 17 },      "seq 0 fills block 0 and claims block 2");
+
+    // the interleaved tokens of several sequences are not mixed in the same block
+    check(place(kv, { 1, 2 }, 2), { 11, 24, 12, 25 },    "seq 1 continues in block 1, seq 2 claims block 3");
+
+    // the blocks freed by a sequence are reused by the next one
+    kv.seq_rm(1, -1, -1);
+    check(place(kv, { 3 }, 4), { 8, 9, 10, 11 },         "seq 3 reuses block 1");
+
+    // after a copy the cells of the blocks of seq 0 are shared, the continuations of both sequences go to new blocks
+    kv.seq_cp(0, 4, -1, -1);
+    check(place(kv, { 0 }, 1), { 32 },                   "seq 0 continues in a new block after seq_cp()");
+    check(place(kv, { 4 }, 1), { 40 },                   "seq 4 continues in a new block after seq_cp()");
+
+    // once all blocks are in use, the remaining free cells are still used
+    kv.clear(true);
+    for (llama_seq_id s = 0; s < (llama_seq_id) (kv_size/n_block); ++s) {
+        check(place(kv, { s }, 1), { s*n_block },        "each sequence claims a block");
+    }
+
+    test_ubatch tb;
+    for (uint32_t i = 0; i < kv_size - kv_size/n_block + 1; ++i) {
+        tb.add(kv_size/n_block, i);
+    }
+    assert(kv.find_slot_paged(tb.get()).empty() && "the cache cannot hold more tokens than it has free cells");
+
+    const auto idxs = place(kv, { (llama_seq_id) (kv_size/n_block) }, kv_size - kv_size/n_block);
+    assert(idxs.size() == kv_size - kv_size/n_block && "the remaining free cells are used once all blocks are in use");
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+// checks the row split of GGML_NUMA_STRATEGY_SPLIT (ggml_numa_split_rows, ggml_numa_split_thread_rows): the threads
+// compute all the rows of the matrix exactly once, like the non-split path, and each thread only computes rows that
+// ggml_numa_place_tensor placed on the node of the thread
+
+#include "ggml-cpu/ggml-cpu-impl.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+static bool test_split(int64_t nr, int n_nodes, int nth) {
+    std::vector<int> n_computed(nr, 0);
+
+    for (int ith = 0; ith < nth; ++ith) {
+        int64_t ir0;
+        int64_t ir1;
+        ggml_numa_split_thread_rows(nr, n_nodes, ith, nth, &ir0, &ir1);
+
+        int64_t ir0_node;
+        int64_t ir1_node;
+        ggml_numa_split_rows(nr, n_nodes, ith % n_nodes, &ir0_node, &ir1_node);
+
+        if (ir0 > ir1 || ((ir0 < ir0_node || ir1 > ir1_node) && ir0 < ir1)) {
+            fprintf(stderr, "%s: nr = %" PRId64 ", n_nodes = %d, nth = %d: thread %d computes the rows [%" PRId64 ", %" PRId64 ") "
+                    "outside of the rows [%" PRId64 ", %" PRId64 ") of its node\n",
+                    __func__, nr, n_nodes, nth, ith, ir0, ir1, ir0_node, ir1_node);
+            return false;
+        }
+
+        for (int64_t ir = ir0; ir < ir1; ++ir) {
+            n_computed[ir]++;
+        }
+    }
+
+    // the non-split path computes each row of [0, nr) once
+    for (int64_t ir = 0; ir < nr; ++ir) {
+        if (n_computed[ir] != 1) {
+            fprintf(stderr, "%s: nr = %" PRId64 ", n_nodes = %d, nth = %d: row %" PRId64 " is computed %d times\n",
+                    __func__, nr, n_nodes, nth, ir, n_computed[ir]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(void) {
+    int n_failed = 0;
+
+    for (int n_nodes = 1; n_nodes <= 8; ++n_nodes) {
+        for (int nth = n_nodes; nth <= 4*n_nodes + 3; ++nth) {
+            for (const int64_t nr : { (int64_t) n_nodes, (int64_t) n_nodes + 1, (int64_t) 7, (int64_t) 64, (int64_t) 4096, (int64_t) 4099, (int64_t) 32001 }) {
+                if (nr < n_nodes) {
+                    continue;
+                }
+                if (!test_split(nr, n_nodes, nth)) {
+                    n_failed++;
+                }
+            }
+        }
+    }
+
+    if (n_failed > 0) {
+        fprintf(stderr, "%d tests failed\n", n_failed);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
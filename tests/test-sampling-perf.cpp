@@ -0,0 +1,175 @@
+// Benchmark the sampler chain on synthetic logits
+//
+// compares building the candidates of the whole vocab and applying the chain to them (full)
+// with building only the candidates that the chain can select (fused), and checks that both sample the same tokens
+
+#include "llama.h"
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#define ITERATIONS 20
+
+struct sampling_perf_chain {
+    std::string name;
+
+    llama_sampler * (*init)(uint32_t seed);
+};
+
+static llama_sampler * chain_init(const std::vector<llama_sampler *> & samplers) {
+    llama_sampler * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    for (auto * smpl : samplers) {
+        llama_sampler_chain_add(chain, smpl);
+    }
+    return chain;
+}
+
+static const sampling_perf_chain chains[] = {
+    {
+        "greedy",
+        [](uint32_t /*seed*/) {
+            return chain_init({ llama_sampler_init_greedy() });
+        },
+    },
+    {
+        "penalties 1.0 -> top-k 40 -> top-p 0.95 -> min-p 0.05 -> temp 0.8 -> dist",
+        [](uint32_t seed) {
+            return chain_init({
+                llama_sampler_init_penalties(64, 1.0f, 0.0f, 0.0f),
+                llama_sampler_init_top_k(40),
+                llama_sampler_init_top_p(0.95f, 1),
+                llama_sampler_init_min_p(0.05f, 1),
+                llama_sampler_init_temp(0.8f),
+                llama_sampler_init_dist(seed),
+            });
+        },
+    },
+    {
+        "penalties 1.1 -> top-k 40 -> top-p 0.95 -> min-p 0.05 -> temp 0.8 -> dist",
+        [](uint32_t seed) {
+            return chain_init({
+                llama_sampler_init_penalties(64, 1.1f, 0.0f, 0.0f),
+                llama_sampler_init_top_k(40),
+                llama_sampler_init_top_p(0.95f, 1),
+                llama_sampler_init_min_p(0.05f, 1),
+                llama_sampler_init_temp(0.8f),
+                llama_sampler_init_dist(seed),
+            });
+        },
+    },
+};
+
+// logits with a long tail and a few likely tokens, roughly like the output of a language model
+static void generate_logits(std::mt19937 & rng, std::vector<float> & logits) {
+    std::normal_distribution<float> tail(0.0f, 2.0f);
+    std::uniform_int_distribution<size_t> pick(0, logits.size() - 1);
+
+    for (auto & l : logits) {
+        l = tail(rng);
+    }
+    for (int i = 0; i < 8; ++i) {
+        logits[pick(rng)] += 10.0f + i;
+    }
+}
+
+static llama_token sample(llama_sampler * smpl, std::vector<llama_token_data> & cur, const std::vector<float> & logits, bool fused) {
+    llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+    llama_token_data_array_from_logits(&cur_p, logits.data(), nullptr, logits.size(), fused ? llama_sampler_n_logits(smpl) : 0);
+
+    llama_sampler_apply(smpl, &cur_p);
+
+    assert(cur_p.selected >= 0 && cur_p.selected < (int64_t) cur_p.size);
+
+    const llama_token token = cur_p.data[cur_p.selected].id;
+
+    llama_sampler_accept(smpl, token);
+
+    return token;
+}
+
+static void usage(char * argv[]) {
+    printf("Benchmark the sampler chain on synthetic logits\n");
+    printf("\n");
+    printf("usage: %s [options]\n", argv[0]);
+    printf("\n");
+    printf("options: (default)\n");
+    printf("  -h, --help            show this help message and exit\n");
+    printf("  -i, --iterations N    number of sampled tokens per test (%d)\n", ITERATIONS);
+    printf("  -v, --n-vocab N       test only this vocab size (32000, 128256, 262144)\n");
+}
+
+int main(int argc, char * argv[]) {
+    int iterations = ITERATIONS;
+
+    std::vector<int> n_vocabs = { 32000, 128256, 262144 };
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-i" || arg == "--iterations") && i + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if ((arg == "-v" || arg == "--n-vocab") && i + 1 < argc) {
+            n_vocabs = { std::max(1, atoi(argv[++i])) };
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv);
+            return 0;
+        } else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            usage(argv);
+            return 1;
+        }
+    }
+
+    for (const int n_vocab : n_vocabs) {
+        printf("n_vocab = %d\n", n_vocab);
+
+        std::vector<float> logits(n_vocab);
+        std::vector<llama_token_data> cur(n_vocab);
+
+        for (const auto & chain : chains) {
+            llama_sampler * smpl_full  = chain.init(42);
+            llama_sampler * smpl_fused = chain.init(42);
+
+            std::mt19937 rng(1234);
+
+            int64_t t_full_us  = 0;
+            int64_t t_fused_us = 0;
+
+            for (int it = 0; it < iterations; ++it) {
+                generate_logits(rng, logits);
+
+                const auto t0 = std::chrono::high_resolution_clock::now();
+                const llama_token token_full = sample(smpl_full, cur, logits, false);
+                const auto t1 = std::chrono::high_resolution_clock::now();
+                const llama_token token_fused = sample(smpl_fused, cur, logits, true);
+                const auto t2 = std::chrono::high_resolution_clock::now();
+
+                t_full_us  += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+                t_fused_us += std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+
+                if (token_full != token_fused) {
+                    fprintf(stderr, "%s: n_vocab = %d, '%s': the fused chain sampled %d instead of %d\n",
+                            __func__, n_vocab, chain.name.c_str(), token_fused, token_full);
+                    return 1;
+                }
+            }
+
+            printf("  %-76s k = %3d, full: %8.1f us/token, fused: %8.1f us/token, speedup: %5.1fx\n",
+                    chain.name.c_str(), llama_sampler_n_logits(smpl_fused),
+                    (double) t_full_us / iterations, (double) t_fused_us / iterations,
+                    (double) t_full_us / std::max<int64_t>(1, t_fused_us));
+
+            llama_sampler_free(smpl_full);
+            llama_sampler_free(smpl_fused);
+        }
+    }
+
+    return 0;
+}
@@ -7,10 +7,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 extern struct llama_sampler * llama_sampler_init_dry_testing(int32_t context_size, float dry_multiplier, float dry_base, int32_t dry_allowed_length, int32_t dry_penalty_last_n, const std::vector<std::vector<llama_token>>& seq_breakers);
+extern void llama_sampler_sample_batch_testing(struct llama_sampler ** smpls, const float ** logits, int32_t n_logits, llama_token * tokens, int32_t n, int32_t n_threads);
 
 static void dump(const llama_token_data_array * cur_p) {
     for (size_t i = 0; i < cur_p->size; i++) {
@@ -267,6 +270,116 @@ static void test_sampler_queue(const size_t n_vocab, const std::string & sampler
            samplers_sequence.c_str(), n_vocab, top_k, top_p, min_p);
 }
 
+static llama_sampler * make_batch_sampler(int i_slot) {
+    llama_sampler * chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+
+    // the even slots only need the top k candidates, the odd slots need all of them
+    if (i_slot % 2 == 0) {
+        llama_sampler_chain_add(chain, llama_sampler_init_top_k(40));
+    } else {
+        llama_sampler_chain_add(chain, llama_sampler_init_penalties(64, 1.1f, 0.0f, 0.0f));
+    }
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(0.8f));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(1234 + i_slot));
+
+    return chain;
+}
+
+// llama_sampler_sample_batch must give the same tokens as llama_sampler_sample for each slot, over several steps
+static void test_sample_batch(int n_slots, int n_threads) {
+    const int n_vocab = 1000;
+    const int n_steps = 8;
+
+    std::vector<llama_sampler *> smpls;
+    std::vector<llama_sampler *> smpls_ref;
+    for (int i = 0; i < n_slots; ++i) {
+        smpls.push_back(make_batch_sampler(i));
+        smpls_ref.push_back(make_batch_sampler(i));
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+
+    std::vector<std::vector<float>> logits(n_slots, std::vector<float>(n_vocab));
+    std::vector<const float *>      logits_ptr(n_slots);
+    std::vector<llama_token>        tokens(n_slots);
+
+    for (int step = 0; step < n_steps; ++step) {
+        for (int i = 0; i < n_slots; ++i) {
+            for (auto & l : logits[i]) {
+                l = dist(rng);
+            }
+            logits_ptr[i] = logits[i].data();
+        }
+
+        llama_sampler_sample_batch_testing(smpls.data(), logits_ptr.data(), n_vocab, tokens.data(), n_slots, n_threads);
+
+        for (int i = 0; i < n_slots; ++i) {
+            std::vector<llama_token_data> cur;
+            for (llama_token id = 0; id < n_vocab; ++id) {
+                cur.push_back(llama_token_data{id, logits[i][id], 0.0f});
+            }
+            llama_token_data_array cur_p = { cur.data(), cur.size(), -1, false };
+
+            llama_sampler_apply(smpls_ref[i], &cur_p);
+            GGML_ASSERT(cur_p.selected >= 0 && cur_p.selected < (int64_t) cur_p.size);
+
+            const llama_token token = cur_p.data[cur_p.selected].id;
+            llama_sampler_accept(smpls_ref[i], token);
+
+            GGML_ASSERT(tokens[i] == token);
+        }
+    }
+
+    for (int i = 0; i < n_slots; ++i) {
+        llama_sampler_free(smpls[i]);
+        llama_sampler_free(smpls_ref[i]);
+    }
+
+    printf("test_sample_batch: n_slots = %d, n_threads = %d OK\n", n_slots, n_threads);
+}
+
+static void sampler_throw_apply(struct llama_sampler * /*smpl*/, llama_token_data_array * /*cur_p*/) {
+    throw std::runtime_error("sampler error");
+}
+
+// an exception thrown by a sampler on a worker thread is rethrown on the calling thread
+static void test_sample_batch_exception(int n_threads) {
+    static llama_sampler_i iface = {
+        /* .name   = */ nullptr,
+        /* .accept = */ nullptr,
+        /* .apply  = */ sampler_throw_apply,
+        /* .reset  = */ nullptr,
+        /* .clone  = */ nullptr,
+        /* .free   = */ nullptr,
+    };
+
+    const int n_slots = 8;
+    const int n_vocab = 16;
+
+    std::vector<float>           logits(n_vocab, 0.0f);
+    std::vector<const float *>   logits_ptr(n_slots, logits.data());
+    std::vector<llama_token>     tokens(n_slots);
+    std::vector<llama_sampler *> smpls;
+    for (int i = 0; i < n_slots; ++i) {
+        smpls.push_back(i == n_slots - 1 ? llama_sampler_init(&iface, nullptr) : llama_sampler_init_greedy());
+    }
+
+    bool thrown = false;
+    try {
+        llama_sampler_sample_batch_testing(smpls.data(), logits_ptr.data(), n_vocab, tokens.data(), n_slots, n_threads);
+    } catch (const std::runtime_error & e) {
+        thrown = std::string(e.what()) == "sampler error";
+    }
+    GGML_ASSERT(thrown);
+
+    for (auto * smpl : smpls) {
+        llama_sampler_free(smpl);
+    }
+
+    printf("test_sample_batch_exception: n_threads = %d OK\n", n_threads);
+}
+
 static void bench(llama_sampler * cnstr, const char * cnstr_name, const std::vector<llama_token_data> & data, int n_iter) {
     std::vector<llama_token_data> cur(data.size());
     std::copy(data.begin(), data.end(), cur.begin());
@@ -392,6 +505,14 @@ int main(void) {
     test_sampler_queue(10000, "mkp", 100, 0.8f, 0.1f);
     test_sampler_queue(10000, "mpk", 100, 0.8f, 0.1f);
 
+    test_sample_batch(1, 1);
+    test_sample_batch(7, 1);
+    test_sample_batch(7, 4);
+    test_sample_batch(16, 8);
+
+    test_sample_batch_exception(1);
+    test_sample_batch_exception(4);
+
     printf("OK\n");
 
     test_perf();
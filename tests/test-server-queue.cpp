@@ -0,0 +1,99 @@
+// stress test of the task queue of the server (tools/server/queue.hpp): many producers push items in bursts while the
+// consumer goes to sleep whenever the queue is empty, so that a lost wakeup shows up as a consumer that never wakes up
+// the ring is small, so that the overflow path is exercised too - the items of each producer must still be received
+// in order, e.g. a cancel task must not overtake the task it cancels
+
+#include "queue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+int main(int argc, char ** argv) {
+    const int n_producers = argc > 1 ? atoi(argv[1]) : 8;
+    const int n_items     = argc > 2 ? atoi(argv[2]) : 20000;
+
+    server_mpsc_queue<int> queue(16);
+
+    std::atomic<int64_t> n_received = 0;
+    std::atomic<bool>    done       = false;
+
+    // if the consumer sleeps while items are pending, it only wakes up on the next push - the last burst of the
+    // producers is followed by no push at all, so a lost wakeup makes the consumer hang
+    std::thread watchdog([&]() {
+        int64_t n_last = -1;
+        auto    t_last = std::chrono::steady_clock::now();
+
+        while (!done.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            const int64_t n = n_received.load();
+            if (n != n_last) {
+                n_last = n;
+                t_last = std::chrono::steady_clock::now();
+            } else if (std::chrono::steady_clock::now() - t_last > std::chrono::seconds(30)) {
+                fprintf(stderr, "%s: the consumer is stuck after %lld of %lld items\n", __func__,
+                        (long long) n, (long long) n_producers*n_items);
+                std::_Exit(1);
+            }
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < n_producers; ++p) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < n_items; ++i) {
+                queue.push(p*n_items + i);
+
+                // bursts of a few items, with pauses that let the consumer go to sleep
+                if (i % 7 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(i % 3 == 0 ? 0 : 20));
+                }
+            }
+        });
+    }
+
+    const int64_t n_total = (int64_t) n_producers*n_items;
+
+    std::vector<int>  items;
+    std::vector<bool> seen(n_total, false);
+    std::vector<int>  last(n_producers, -1); // the last item received from each producer
+
+    while (n_received.load() < n_total) {
+        queue.wait([]() { return false; });
+
+        items.clear();
+        queue.drain(items);
+
+        for (int id : items) {
+            if (id < 0 || id >= n_total || seen[id]) {
+                fprintf(stderr, "%s: unexpected item %d\n", __func__, id);
+                return 1;
+            }
+            seen[id] = true;
+
+            const int p = id / n_items;
+            if (id % n_items != last[p] + 1) {
+                fprintf(stderr, "%s: item %d of producer %d received after item %d\n", __func__, id % n_items, p, last[p]);
+                return 1;
+            }
+            last[p] = id % n_items;
+        }
+
+        n_received += items.size();
+    }
+
+    for (auto & t : producers) {
+        t.join();
+    }
+
+    done = true;
+    watchdog.join();
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+// checks the choice of the draft length by common_speculative_stats on synthetic timings: the drafts are kept when
+// they are accepted often and cheap compared to a step of the target model, and paused when they are rejected
+
+#include "speculative.h"
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <random>
+
+// run n_steps drafts of the proposed length, each draft token being accepted with probability p_accept
+// t_* are the times in microseconds of a step of the target model without draft, and of one draft token
+static common_speculative_stats simulate(float p_accept, double t_step, double t_draft, double t_verify, int n_steps) {
+    const int32_t n_min = 0;
+    const int32_t n_max = 16;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+    common_speculative_stats stats;
+
+    for (int i = 0; i < n_steps; ++i) {
+        const int32_t n_draft = stats.next(n_min, n_max);
+        if (n_draft == 0) {
+            continue;
+        }
+
+        int32_t n_accepted = 0;
+        while (n_accepted < n_draft && dist(rng) < p_accept) {
+            n_accepted++;
+        }
+
+        stats.update_accept(n_draft, n_accepted);
+        stats.update_cost(t_draft, t_verify, t_step);
+    }
+
+    return stats;
+}
+
+int main(void) {
+    // a single slot with a 7B target and a small draft model: a step takes 20 ms, a draft token costs 1.5 ms to draft
+    // and 0.3 ms more to verify, because the verification of a few more tokens is almost free for the target model
+    {
+        auto stats = simulate(0.8f, 20000.0, 1500.0, 300.0, 200);
+
+        const int32_t n = stats.next(0, 16);
+        fprintf(stderr, "high acceptance: p_accept = %.3f, cost = %.3f, n_draft = %d\n", stats.p_accept(), stats.cost, n);
+        assert(n > 0 && "drafting must be kept when the drafts are cheap and mostly accepted");
+        assert(stats.cost < 0.2f);
+    }
+
+    // the same timings with drafts that are rarely accepted
+    {
+        auto stats = simulate(0.05f, 20000.0, 1500.0, 300.0, 200);
+
+        const int32_t n = stats.next(0, 16);
+        fprintf(stderr, "low acceptance: p_accept = %.3f, cost = %.3f, n_draft = %d\n", stats.p_accept(), stats.cost, n);
+        assert(stats.n_draft == 0 && "drafting must be paused when the drafts are mostly rejected");
+    }
+
+    // drafts that are as expensive as a step of the target model are never worth it
+    {
+        auto stats = simulate(0.8f, 20000.0, 20000.0, 300.0, 200);
+
+        stats.next(0, 16);
+        fprintf(stderr, "expensive drafts: p_accept = %.3f, cost = %.3f\n", stats.p_accept(), stats.cost);
+        assert(stats.n_draft == 0);
+    }
+
+    // a paused slot still probes a draft from time to time
+    {
+        auto stats = simulate(0.05f, 20000.0, 1500.0, 300.0, 200);
+
+        int n_probes = 0;
+        for (int i = 0; i < common_speculative_stats::n_probe; ++i) {
+            n_probes += stats.next(1, 16) > 0;
+        }
+        assert(n_probes == 1);
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
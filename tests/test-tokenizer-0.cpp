@@ -2,6 +2,7 @@
 #include "common.h"
 #include "console.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <string>
 #include <map>
@@ -252,6 +253,34 @@ int main(int argc, char **argv) {
         threads[i].join();
     }
 
+    // chunked tokenization: small chunks so that the texts are split, the result must match the serial tokenizer
+    {
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        const auto check_chunked = [&](const std::string & text) {
+            const std::vector<llama_token> res = common_tokenize(vocab, text, add_special, false);
+
+            std::vector<llama_token> res_chunked(text.size() + 2);
+            const int32_t n = llama_tokenize_parallel(vocab, text.data(), text.size(), res_chunked.data(), res_chunked.size(), add_special, false, 4, 1);
+            res_chunked.resize(std::max(n, 0));
+
+            if (n < 0 || res_chunked != res) {
+                fprintf(stderr, "%s : failed chunked test: '%s'\n", __func__, text.c_str());
+                fprintf(stderr, "%s : got %d tokens instead of %zu\n", __func__, n, res.size());
+                success = false;
+            }
+        };
+
+        std::string text_all;
+        for (const auto & test_kv : k_tests) {
+            check_chunked(test_kv.first);
+
+            text_all += test_kv.first;
+            text_all += "\n";
+        }
+        check_chunked(text_all);
+    }
+
     // single threaded tokenization
     if (!fname_text.empty()) {
         fprintf(stderr, "%s : tokenizing: '%s'\n", __func__, fname_text.c_str());
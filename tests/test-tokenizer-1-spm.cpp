@@ -1,4 +1,5 @@
 #include "llama.h"
+#include "llama-cpp.h"
 #include "common.h"
 #include "console.h"
 
@@ -88,7 +89,9 @@ int main(int argc, char ** argv) {
         std::atomic_int errcode = {};
 
         for (int i = 0; i < nthread; ++i) {
-            threads[i] = std::thread([i, nthread, ctx, &errcode]() {
+            threads[i] = std::thread([i, nthread, ctx, vocab, &errcode]() {
+                llama_detokenizer_ptr detok(llama_detokenizer_init(vocab));
+
                 for (uint32_t cp = i; !errcode && cp < 0x00110000; cp += nthread) {
                     if ((0x0000D800 <= cp && cp <= 0x0000DFFF) ||  // surrogates \p{Cs}
                         (0x00040000 <= cp && cp <= 0x000E0000)) {  // undefined \p{Cn}
@@ -103,6 +106,26 @@ int main(int argc, char ** argv) {
                                 cp, check.c_str(), check.length(), str.c_str(), str.length());
                         errcode = 3;
                     }
+
+                    // the incremental detokenizer outputs the code point only once all its bytes are there
+                    std::string pieces;
+                    std::string text;
+                    for (const llama_token token : tokens) {
+                        pieces += common_token_to_piece(ctx, token);
+                        text   += common_detokenizer_push(detok.get(), token);
+                        try {
+                            unicode_cpts_from_utf8(text);
+                        } catch (const std::invalid_argument &) {
+                            fprintf(stderr, "error: codepoint 0x%x is incrementally detokenized to incomplete '%s'(%zu)\n",
+                                    cp, text.c_str(), text.length());
+                            errcode = 4;
+                        }
+                    }
+                    if (text != pieces || llama_detokenizer_n_pending(detok.get()) != 0) {
+                        fprintf(stderr, "error: codepoint 0x%x is incrementally detokenized to '%s'(%zu) instead of '%s'(%zu)\n",
+                                cp, text.c_str(), text.length(), pieces.c_str(), pieces.length());
+                        errcode = 4;
+                    }
                 }
             });
         }
@@ -0,0 +1,90 @@
+// checks the BPE tokenizer on a vocab in which some merges produce a text that is not a token
+// the tokens must be the same as with the text-based merges: the symbols without token are still merged, and fall
+// back to the tokens of their bytes if they are not merged further into a token
+
+#include "llama.h"
+#include "gguf.h"
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const char * fname = "test-tokenizer-bpe-merges.gguf";
+
+static void write_vocab() {
+    const char * tokens[] = { "a", "b", "c", "d", "x", "y", "cd", "abcd", "<s>" };
+    const int32_t types[] = { 1, 1, 1, 1, 1, 1, 1, 1, 3 };
+
+    // "ab" and "xy" are not tokens, "ab" is merged further into "abcd"
+    const char * merges[] = { "a b", "c d", "ab cd", "x y" };
+
+    gguf_context * ctx = gguf_init_empty();
+
+    gguf_set_val_str(ctx, "general.architecture", "llama");
+    gguf_set_val_str(ctx, "tokenizer.ggml.model", "gpt2");
+    gguf_set_val_str(ctx, "tokenizer.ggml.pre",   "default");
+    gguf_set_arr_str(ctx, "tokenizer.ggml.tokens", tokens, sizeof(tokens)/sizeof(tokens[0]));
+    gguf_set_arr_data(ctx, "tokenizer.ggml.token_type", GGUF_TYPE_INT32, types, sizeof(types)/sizeof(types[0]));
+    gguf_set_arr_str(ctx, "tokenizer.ggml.merges", merges, sizeof(merges)/sizeof(merges[0]));
+    gguf_set_val_u32(ctx, "tokenizer.ggml.bos_token_id", 8);
+    gguf_set_val_u32(ctx, "tokenizer.ggml.eos_token_id", 8);
+
+    const bool ok = gguf_write_to_file(ctx, fname, false);
+    assert(ok);
+
+    gguf_free(ctx);
+}
+
+static void check(const llama_vocab * vocab, const std::string & text, const std::vector<llama_token> & expected) {
+    std::vector<llama_token> res(text.size() + 1);
+
+    const int n = llama_tokenize(vocab, text.c_str(), text.size(), res.data(), res.size(), false, false);
+    assert(n >= 0);
+    res.resize(n);
+
+    if (res != expected) {
+        fprintf(stderr, "%s: '%s': got [", __func__, text.c_str());
+        for (const auto t : res) {
+            fprintf(stderr, " %d", t);
+        }
+        fprintf(stderr, " ]\n");
+        assert(false);
+    }
+}
+
+int main(void) {
+    write_vocab();
+
+    llama_backend_init();
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(fname, mparams);
+    assert(model != nullptr);
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    // a b -> ab (no token), c d -> cd, ab cd -> abcd
+    check(vocab, "abcd", { 7 });
+
+    // x y -> xy (no token), which falls back to the tokens of its bytes
+    check(vocab, "xy", { 4, 5 });
+
+    // ab and xy are not merged together
+    check(vocab, "abxy", { 0, 1, 4, 5 });
+
+    // both kinds of merges in the same word
+    check(vocab, "abcdxy", { 7, 4, 5 });
+
+    llama_model_free(model);
+    llama_backend_free();
+
+    std::remove(fname);
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
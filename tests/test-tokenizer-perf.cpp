@@ -0,0 +1,248 @@
+// Benchmark the pre-tokenizers and the tokenizers on synthetic text
+//
+// measures the throughput of unicode_regex_split for the regexes of the known pre-tokenizers, checks that the
+// custom implementations split the text exactly like the general-purpose std::regex fallback, and measures the
+// throughput of llama_tokenize for the vocab files given on the command line, on a single thread and in parallel
+
+#include "llama.h"
+
+#include "../src/llama-vocab.h"
+#include "../src/unicode.h"
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define ITERATIONS 4
+#define TEXT_SIZE  (256*1024)
+
+struct tokenizer_perf_pre {
+    std::string name;
+
+    std::vector<std::string> regex_exprs;
+};
+
+// ref: llm_tokenizer_bpe::llm_tokenizer_bpe
+static const tokenizer_perf_pre pres[] = {
+    {
+        "gpt2",
+        {
+            "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+        },
+    },
+    {
+        "llama3",
+        {
+            "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+        },
+    },
+    {
+        "qwen2",
+        {
+            "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+        },
+    },
+    {
+        "bailingmoe",
+        {
+            "'(?:[sSdDmMtT]|[lL][lL]|[vV][eE]|[rR][eE])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]|\\s+(?!\\S)|\\s+",
+        },
+    },
+    {
+        "seed-coder",
+        {
+            "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1}| ?[^\\s\\p{L}\\p{N}\\r\\n]+|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+        },
+    },
+    {
+        "starcoder",
+        {
+            "\\p{N}",
+            "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+        },
+    },
+    {
+        "deepseek-coder",
+        {
+            "[\r\n]",
+            "\\s?\\p{L}+",
+            "\\s?\\p{P}+",
+            "[一-龥ࠀ-一가-퟿]+",
+            "\\p{N}",
+        },
+    },
+    {
+        "gpt-4o",
+        {
+            "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+        },
+    },
+};
+
+// text, code, numbers and whitespace in a few scripts, with the corner cases of the pre-tokenizer regexes
+static std::string generate_text(std::mt19937 & rng, size_t size) {
+    static const char * pieces[] = {
+        "the", "The", "HELLO", "world", "tokenizer", "don't", "I'M", "we'll", "they've", "she'd", "you're", "it's",
+        "'s", "'", "''", "'ll", "'Re", "naïve", "Ünïcödé", "ſ", "İstanbul", "ǅ", "привет", "Мир", "日本語", "中文",
+        "한국어", "ελληνικά", "😀", "🚀", "١٢٣", "²", "3.14159", "12345678", "0x1F", "1,000", "int", "main()", "{", "}",
+        "std::vector<int>", "//", "->", "==", "!=", "...", "«»", "—", "$", "#", "\t", "\n", "\r\n", "\n\n", " \n ",
+        " ", "　", " ", "  ", "   ", "/", "/\n", "\xff",
+    };
+
+    static const char * separators[] = { " ", " ", " ", "", "", "\n", "  " };
+
+    std::uniform_int_distribution<size_t> pick_piece(0, sizeof(pieces)/sizeof(pieces[0]) - 1);
+    std::uniform_int_distribution<size_t> pick_separator(0, sizeof(separators)/sizeof(separators[0]) - 1);
+
+    std::string text;
+    while (text.size() < size) {
+        text += pieces[pick_piece(rng)];
+        text += separators[pick_separator(rng)];
+    }
+
+    return text;
+}
+
+static void usage(char * argv[]) {
+    printf("Benchmark the pre-tokenizers and the tokenizers on synthetic text\n");
+    printf("\n");
+    printf("usage: %s [options] [<vocab-file> ...]\n", argv[0]);
+    printf("\n");
+    printf("options: (default)\n");
+    printf("  -h, --help            show this help message and exit\n");
+    printf("  -i, --iterations N    number of runs per test (%d)\n", ITERATIONS);
+    printf("  -s, --size N          size of the text in bytes (%d)\n", TEXT_SIZE);
+}
+
+int main(int argc, char * argv[]) {
+    int    iterations = ITERATIONS;
+    size_t text_size  = TEXT_SIZE;
+
+    std::vector<std::string> fnames;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-i" || arg == "--iterations") && i + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if ((arg == "-s" || arg == "--size") && i + 1 < argc) {
+            text_size = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv);
+            return 0;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            usage(argv);
+            return 1;
+        } else {
+            fnames.push_back(arg);
+        }
+    }
+
+    std::mt19937 rng(1234);
+
+    const std::string text = generate_text(rng, text_size);
+
+    const double mb = text.size() / (1024.0*1024.0);
+
+    printf("pre-tokenizers, %zu bytes:\n", text.size());
+
+    for (const auto & pre : pres) {
+        // the same regexes in a group do not match the custom implementations, so they use std::regex
+        std::vector<std::string> regex_exprs_ref;
+        for (const auto & regex_expr : pre.regex_exprs) {
+            regex_exprs_ref.push_back("(?:" + regex_expr + ")");
+        }
+
+        std::vector<std::string> words;
+
+        int64_t t_us = 0;
+        for (int it = 0; it < iterations; ++it) {
+            const auto t0 = std::chrono::high_resolution_clock::now();
+            words = unicode_regex_split(text, pre.regex_exprs);
+            const auto t1 = std::chrono::high_resolution_clock::now();
+
+            t_us += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+        }
+
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        const auto words_ref = unicode_regex_split(text, regex_exprs_ref);
+        const auto t1 = std::chrono::high_resolution_clock::now();
+
+        const int64_t t_ref_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+
+        if (words != words_ref) {
+            size_t i = 0;
+            while (i < std::min(words.size(), words_ref.size()) && words[i] == words_ref[i]) {
+                i++;
+            }
+            fprintf(stderr, "%s: '%s': word %zu is '%s' instead of '%s'\n", __func__, pre.name.c_str(), i,
+                    i < words.size()     ? words[i].c_str()     : "<end>",
+                    i < words_ref.size() ? words_ref[i].c_str() : "<end>");
+            return 1;
+        }
+
+        printf("  %-16s %8zu words, %8.2f MB/s, std::regex: %8.2f MB/s\n", pre.name.c_str(), words.size(),
+                mb / (std::max<int64_t>(1, t_us) * 1e-6 / iterations), mb / (std::max<int64_t>(1, t_ref_us) * 1e-6));
+    }
+
+    if (fnames.empty()) {
+        return 0;
+    }
+
+    llama_backend_init();
+
+    printf("tokenizers, %zu bytes:\n", text.size());
+
+    for (const auto & fname : fnames) {
+        auto mparams = llama_model_default_params();
+        mparams.vocab_only = true;
+
+        llama_model * model = llama_model_load_from_file(fname.c_str(), mparams);
+        if (model == nullptr) {
+            fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, fname.c_str());
+            return 1;
+        }
+
+        const llama_vocab * vocab = llama_model_get_vocab(model);
+
+        // at least a few threads, so that the chunks are checked even on a single core
+        const int32_t n_threads = std::max(4u, std::thread::hardware_concurrency());
+
+        std::vector<llama_token> tokens;
+        std::vector<llama_token> tokens_serial;
+
+        int64_t t_us        = 0;
+        int64_t t_serial_us = 0;
+        for (int it = 0; it < iterations; ++it) {
+            const auto t0 = std::chrono::high_resolution_clock::now();
+            tokens = vocab->tokenize(text, false, false, n_threads);
+            const auto t1 = std::chrono::high_resolution_clock::now();
+            tokens_serial = vocab->tokenize(text, false, false, 1);
+            const auto t2 = std::chrono::high_resolution_clock::now();
+
+            t_us        += std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+            t_serial_us += std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+        }
+
+        if (tokens != tokens_serial) {
+            fprintf(stderr, "%s: '%s': the parallel tokenization differs from the serial one\n", __func__, fname.c_str());
+            return 1;
+        }
+
+        printf("  %-48s %8zu tokens, serial: %8.2f MB/s, parallel: %8.2f MB/s\n", fname.c_str(), tokens.size(),
+                mb / (std::max<int64_t>(1, t_serial_us) * 1e-6 / iterations), mb / (std::max<int64_t>(1, t_us) * 1e-6 / iterations));
+
+        llama_model_free(model);
+    }
+
+    llama_backend_free();
+
+    return 0;
+}
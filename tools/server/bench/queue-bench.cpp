@@ -0,0 +1,284 @@
+// micro-benchmark of the task and result queues of the server
+//
+// simulates the HTTP threads posting tasks and waiting for streamed results, and the main loop producing one result per
+// active task and per iteration, like the generation of one token per slot
+//
+// compares the queues of the server (queue.hpp) against the previous design: a single mutex-protected deque for the
+// tasks, and a single mutex-protected vector for the results, that each waiter scans linearly on every notify_all()
+//
+// usage: llama-server-queue-bench [-p n_producers] [-n n_requests] [-r n_results]
+
+#include "queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+static int64_t t_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// request posted by a producer: the id of the task and the time it was posted at
+struct bench_task {
+    int     id;
+    int64_t t_post;
+};
+
+// result: the time it was sent at
+using bench_result = int64_t;
+
+//
+// previous design
+//
+
+template <typename T>
+struct baseline_queue {
+    void push(T && item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        items.push_back(std::move(item));
+        cv.notify_one();
+    }
+
+    size_t drain(std::vector<T> & out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        const size_t n = items.size();
+        for (auto & it : items) {
+            out.push_back(std::move(it));
+        }
+        items.clear();
+        return n;
+    }
+
+    template <typename F>
+    void wait(F && stop) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !items.empty() || stop(); });
+    }
+
+    void notify() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.notify_all();
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<T>           items;
+};
+
+template <typename T>
+struct baseline_router {
+    void add(const std::vector<int> & ids) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting.insert(ids.begin(), ids.end());
+    }
+
+    void remove(int id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting.erase(id);
+        items.erase(std::remove_if(items.begin(), items.end(), [id](const auto & it) { return it.first == id; }), items.end());
+    }
+
+    bool send(int id, T && item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (waiting.count(id) == 0) {
+            return false;
+        }
+        items.emplace_back(id, std::move(item));
+        cv.notify_all();
+        return true;
+    }
+
+    template <typename F>
+    bool recv(const std::unordered_set<int> & ids, T & item, std::chrono::milliseconds timeout, F && stop) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            for (size_t i = 0; i < items.size(); i++) {
+                if (ids.count(items[i].first)) {
+                    item = std::move(items[i].second);
+                    items.erase(items.begin() + i);
+                    return true;
+                }
+            }
+            if (stop() || cv.wait_for(lock, timeout) == std::cv_status::timeout) {
+                return false;
+            }
+        }
+    }
+
+    void notify_all() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.notify_all();
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::unordered_set<int> waiting;
+
+    std::vector<std::pair<int, T>> items;
+};
+
+//
+// driver
+//
+
+struct bench_params {
+    int n_producers = 32;
+    int n_requests  = 200; // per producer
+    int n_results   = 16;  // per request
+};
+
+template <typename Q, typename R>
+static void bench_run(const char * name, const bench_params & params, Q & queue, R & router) {
+    const int n_total = params.n_producers*params.n_requests;
+
+    std::atomic<int>  n_done  = 0;
+    std::atomic<bool> running = true;
+
+    std::vector<std::vector<int64_t>> lat_post(params.n_producers); // post -> first result
+    std::vector<std::vector<int64_t>> lat_res (params.n_producers); // send -> recv of each result
+
+    // main loop
+    std::thread consumer([&] {
+        std::vector<bench_task> incoming;
+        std::vector<std::pair<int, int>> active; // id, number of results sent
+
+        while (running) {
+            incoming.clear();
+            queue.drain(incoming);
+
+            for (const auto & task : incoming) {
+                active.emplace_back(task.id, 0);
+            }
+
+            for (auto & [id, n_sent] : active) {
+                router.send(id, t_now_us());
+                n_sent++;
+            }
+
+            active.erase(std::remove_if(active.begin(), active.end(), [&](const auto & it) {
+                return it.second >= params.n_results;
+            }), active.end());
+
+            if (active.empty()) {
+                queue.wait([&] { return !running; });
+            }
+        }
+    });
+
+    const int64_t t_start = t_now_us();
+
+    // HTTP threads
+    std::vector<std::thread> producers;
+    for (int p = 0; p < params.n_producers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < params.n_requests; ++i) {
+                const int id = p*params.n_requests + i;
+
+                router.add({ id });
+
+                const int64_t t_post = t_now_us();
+                queue.push({ id, t_post });
+
+                const std::unordered_set<int> ids = { id };
+                for (int k = 0; k < params.n_results; ++k) {
+                    bench_result t_send;
+                    if (!router.recv(ids, t_send, std::chrono::milliseconds(1000), [] { return false; })) {
+                        fprintf(stderr, "%s: timeout waiting for task %d\n", name, id);
+                        exit(1);
+                    }
+
+                    const int64_t t_recv = t_now_us();
+                    if (k == 0) {
+                        lat_post[p].push_back(t_recv - t_post);
+                    }
+                    lat_res[p].push_back(t_recv - t_send);
+                }
+
+                router.remove(id);
+                n_done++;
+            }
+        });
+    }
+
+    for (auto & th : producers) {
+        th.join();
+    }
+
+    const int64_t t_end = t_now_us();
+
+    running = false;
+    queue.notify();
+    consumer.join();
+
+    const auto stats = [](std::vector<std::vector<int64_t>> & lat, double & p50, double & p99) {
+        std::vector<int64_t> all;
+        for (auto & v : lat) {
+            all.insert(all.end(), v.begin(), v.end());
+        }
+        std::sort(all.begin(), all.end());
+        p50 = all.empty() ? 0.0 : all[all.size()*50/100];
+        p99 = all.empty() ? 0.0 : all[all.size()*99/100];
+    };
+
+    double post_p50, post_p99, res_p50, res_p99;
+    stats(lat_post, post_p50, post_p99);
+    stats(lat_res,  res_p50,  res_p99);
+
+    const double t_s = (t_end - t_start)/1e6;
+
+    printf("| %-8s | %9.0f | %9.0f | %10.0f | %10.0f | %10.0f | %10.0f |\n", name,
+            n_done/t_s, (double) n_total*params.n_results/t_s, post_p50, post_p99, res_p50, res_p99);
+}
+
+int main(int argc, char ** argv) {
+    bench_params params;
+
+    for (int i = 1; i < argc; ++i) {
+        const char * arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "usage: %s [-p n_producers] [-n n_requests] [-r n_results]\n", argv[0]);
+            return 1;
+        }
+        if (strcmp(arg, "-p") == 0) {
+            params.n_producers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "-n") == 0) {
+            params.n_requests  = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(arg, "-r") == 0) {
+            params.n_results   = std::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg);
+            return 1;
+        }
+    }
+
+    printf("producers = %d, requests per producer = %d, results per request = %d\n\n",
+            params.n_producers, params.n_requests, params.n_results);
+
+    printf("| %-8s | %9s | %9s | %10s | %10s | %10s | %10s |\n", "queue", "req/s", "res/s", "post p50", "post p99", "res p50", "res p99");
+    printf("| %-8s | %9s | %9s | %10s | %10s | %10s | %10s |\n", "", "", "", "us", "us", "us", "us");
+    printf("|----------|-----------|-----------|------------|------------|------------|------------|\n");
+
+    {
+        baseline_queue<bench_task>    queue;
+        baseline_router<bench_result> router;
+        bench_run("baseline", params, queue, router);
+    }
+
+    {
+        server_mpsc_queue<bench_task>    queue(4096);
+        server_result_router<bench_result> router;
+        bench_run("server", params, queue, router);
+    }
+
+    return 0;
+}
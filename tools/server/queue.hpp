@@ -0,0 +1,304 @@
+#pragma once
+
+// building blocks for the task and result queues of the server
+// kept free of any llama/server types, so that they can be benchmarked in isolation (see bench/queue-bench.cpp)
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// bounded lock-free multi-producer single-consumer ring buffer
+// each cell carries a sequence number that tells whether it is free for the producer of the current lap or holds an
+// item ready for the consumer, so producers only contend on the CAS of the tail
+// ref: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+template <typename T>
+struct server_mpsc_ring {
+    explicit server_mpsc_ring(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+
+        mask  = n - 1;
+        cells = std::vector<cell>(n);
+
+        for (size_t i = 0; i < n; ++i) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // returns false if the ring is full
+    bool try_push(T && item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+
+        while (true) {
+            cell & c = cells[pos & mask];
+
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = (std::ptrdiff_t) seq - (std::ptrdiff_t) pos;
+
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.data.emplace(std::move(item));
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer only - returns std::nullopt if there is no item ready
+    std::optional<T> try_pop() {
+        cell & c = cells[head & mask];
+
+        if (c.seq.load(std::memory_order_acquire) != head + 1) {
+            return std::nullopt;
+        }
+
+        std::optional<T> item = std::move(c.data);
+        c.data.reset();
+        c.seq.store(head + mask + 1, std::memory_order_release);
+
+        head++;
+
+        return item;
+    }
+
+    // consumer only
+    bool empty() const {
+        return cells[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+    }
+
+private:
+    struct cell {
+        std::atomic<size_t> seq;
+        std::optional<T>    data;
+
+        cell() = default;
+        cell(cell && other) noexcept : seq(other.seq.load()), data(std::move(other.data)) {}
+    };
+
+    std::vector<cell> cells;
+    size_t mask = 0;
+
+    alignas(64) std::atomic<size_t> tail = 0; // producers
+    alignas(64) size_t              head = 0; // consumer
+};
+
+// multi-producer single-consumer queue on top of server_mpsc_ring
+// producers never take a lock unless the ring is full or the consumer is sleeping
+// the items of a producer are drained in the order they were pushed, also when the ring overflows
+template <typename T>
+struct server_mpsc_queue {
+    explicit server_mpsc_queue(size_t capacity) : ring(capacity) {}
+
+    void push(T && item) {
+        // once the ring is full, the next items go to the overflow queue until the consumer drained it, so that they
+        // cannot be drained before the items that overflowed first
+        if (n_overflow.load() > 0 || !ring.try_push(std::move(item))) {
+            std::unique_lock<std::mutex> lock(mutex);
+            overflow.push_back(std::move(item));
+            n_overflow.fetch_add(1);
+        }
+
+        // the item is published with a release store, which may be reordered after the load of `sleeping` below
+        // the fence pairs with the one in wait(): either the consumer sees the item, or the producer sees it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (sleeping.load()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.notify_one();
+        }
+    }
+
+    // consumer only - move all pending items to `out`, returns the number of items
+    size_t drain(std::vector<T> & out) {
+        size_t n = 0;
+
+        while (auto item = ring.try_pop()) {
+            out.push_back(std::move(*item));
+            n++;
+        }
+
+        if (n_overflow.load() > 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (auto & it : overflow) {
+                out.push_back(std::move(it));
+                n++;
+            }
+            n_overflow.fetch_sub(overflow.size());
+            overflow.clear();
+        }
+
+        return n;
+    }
+
+    // consumer only - block until there is a pending item or stop() returns true
+    template <typename F>
+    void wait(F && stop) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        sleeping.store(true);
+
+        // pairs with the fence in push(), so that the check of the ring below cannot be reordered before the store
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        cv.wait(lock, [&] {
+            return !ring.empty() || n_overflow.load() > 0 || stop();
+        });
+        sleeping.store(false);
+    }
+
+    // wake up the consumer, e.g. after changing the state checked by the stop() callback of wait()
+    void notify() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.notify_all();
+    }
+
+private:
+    server_mpsc_ring<T> ring;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::deque<T>       overflow;
+    std::atomic<size_t> n_overflow = 0;
+
+    std::atomic<bool> sleeping = false;
+};
+
+// routes results to the threads waiting for them
+// the tasks registered together share a channel, so a waiter only ever looks at its own results and the threads
+// waiting for different requests never block each other
+template <typename T>
+struct server_result_router {
+    // register the ids of the tasks of one request
+    void add(const std::vector<int> & ids) {
+        auto ch = std::make_shared<channel>();
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (int id : ids) {
+            channels[id] = ch;
+        }
+    }
+
+    // unregister a task, the pending results of the task are dropped
+    void remove(int id) {
+        std::shared_ptr<channel> ch;
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            auto it = channels.find(id);
+            if (it == channels.end()) {
+                return;
+            }
+            ch = std::move(it->second);
+            channels.erase(it);
+        }
+
+        std::unique_lock<std::mutex> lock(ch->mutex);
+        for (auto it = ch->items.begin(); it != ch->items.end();) {
+            it = it->first == id ? ch->items.erase(it) : std::next(it);
+        }
+    }
+
+    // returns false if no one is waiting for the task
+    bool send(int id, T && item) {
+        std::shared_ptr<channel> ch = find(id);
+        if (!ch) {
+            return false;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(ch->mutex);
+            ch->items.emplace_back(id, std::move(item));
+        }
+        ch->cv.notify_one();
+
+        return true;
+    }
+
+    // wait for a result of one of the tasks, which must have been registered with the same add() call
+    // a negative timeout waits forever - returns false on timeout, or when stop() returns true
+    template <typename F>
+    bool recv(const std::unordered_set<int> & ids, T & item, std::chrono::milliseconds timeout, F && stop) {
+        std::shared_ptr<channel> ch;
+        for (int id : ids) {
+            if ((ch = find(id))) {
+                break;
+            }
+        }
+
+        if (!ch) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(ch->mutex);
+
+        const auto t_end = std::chrono::steady_clock::now() + timeout;
+
+        while (true) {
+            for (auto it = ch->items.begin(); it != ch->items.end(); ++it) {
+                if (ids.count(it->first)) {
+                    item = std::move(it->second);
+                    ch->items.erase(it);
+                    return true;
+                }
+            }
+
+            if (stop()) {
+                return false;
+            }
+
+            if (timeout.count() < 0) {
+                ch->cv.wait(lock);
+            } else if (ch->cv.wait_until(lock, t_end) == std::cv_status::timeout) {
+                return false;
+            }
+        }
+    }
+
+    // wake up all waiters, e.g. after changing the state checked by the stop() callback of recv()
+    void notify_all() {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        for (auto & it : channels) {
+            std::unique_lock<std::mutex> lock_ch(it.second->mutex);
+            it.second->cv.notify_all();
+        }
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return channels.size();
+    }
+
+private:
+    struct channel {
+        std::mutex              mutex;
+        std::condition_variable cv;
+
+        std::deque<std::pair<int, T>> items;
+    };
+
+    std::shared_ptr<channel> find(int id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = channels.find(id);
+        return it == channels.end() ? nullptr : it->second;
+    }
+
+    mutable std::shared_mutex mutex;
+
+    std::unordered_map<int, std::shared_ptr<channel>> channels;
+};
@@ -1,11 +1,14 @@
 #include "chat.h"
 #include "utils.hpp"
+#include "queue.hpp"
 
 #include "arg.h"
 #include "common.h"
 #include "json-schema-to-grammar.h"
 #include "llama.h"
+#include "llama-cpp.h"
 #include "log.h"
+#include "ngram-cache.h"
 #include "sampling.h"
 #include "speculative.h"
 #include "mtmd.h"
@@ -24,8 +27,13 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <signal.h>
 #include <thread>
 #include <unordered_map>
@@ -121,6 +129,8 @@ struct slot_params {
     int64_t t_max_prompt_ms  = -1; // TODO: implement
     int64_t t_max_predict_ms = -1; // if positive, limit the generation phase to this time limit
 
+    int32_t priority = 0; // tasks with higher priority are scheduled first and can preempt generating slots
+
     std::vector<common_adapter_lora_info> lora;
 
     std::vector<std::string> antiprompt;
@@ -185,6 +195,7 @@ struct slot_params {
             {"max_tokens",                n_predict}, // User configured n_predict
             {"n_keep",                    n_keep},
             {"n_discard",                 n_discard},
+            {"priority",                  priority},
             {"ignore_eos",                sampling.ignore_eos},
             {"stream",                    stream},
             {"logit_bias",                format_logit_bias(sampling.logit_bias)},
@@ -202,6 +213,8 @@ struct slot_params {
             {"speculative.n_max",         speculative.n_max},
             {"speculative.n_min",         speculative.n_min},
             {"speculative.p_min",         speculative.p_min},
+            {"speculative.adaptive",      speculative.adaptive},
+            {"speculative.lookup",        speculative.lookup},
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
             {"lora",                      lora},
@@ -223,6 +236,12 @@ struct server_task {
     server_tokens prompt_tokens;
     int id_selected_slot = -1;
 
+    // the API key of the request, used for fair-share scheduling of the deferred tasks
+    std::string tenant;
+
+    // set when the task resumes the generation of a preempted slot
+    std::shared_ptr<struct server_task_resume> resume;
+
     // used by SERVER_TASK_TYPE_SLOT_SAVE, SERVER_TASK_TYPE_SLOT_RESTORE, SERVER_TASK_TYPE_SLOT_ERASE
     struct slot_action {
         int slot_id;
@@ -267,6 +286,8 @@ struct server_task {
         params.n_discard        = json_value(data, "n_discard",          defaults.n_discard);
       //params.t_max_prompt_ms  = json_value(data, "t_max_prompt_ms",    defaults.t_max_prompt_ms); // TODO: implement
         params.t_max_predict_ms = json_value(data, "t_max_predict_ms",   defaults.t_max_predict_ms);
+        params.priority         = json_value(data, "priority",           defaults.priority);
+        params.priority         = std::min(params.priority, params_base.priority_max);
         params.response_fields  = json_value(data, "response_fields",   std::vector<std::string>());
 
         params.sampling.top_k              = json_value(data, "top_k",              defaults.sampling.top_k);
@@ -299,6 +320,9 @@ struct server_task {
         params.speculative.n_max = json_value(data, "speculative.n_max", defaults.speculative.n_max);
         params.speculative.p_min = json_value(data, "speculative.p_min", defaults.speculative.p_min);
 
+        params.speculative.adaptive = json_value(data, "speculative.adaptive", defaults.speculative.adaptive);
+        params.speculative.lookup   = json_value(data, "speculative.lookup",   defaults.speculative.lookup);
+
         params.speculative.n_min = std::min(params.speculative.n_max, params.speculative.n_min);
         params.speculative.n_min = std::max(params.speculative.n_min, 0);
         params.speculative.n_max = std::max(params.speculative.n_max, 0);
@@ -536,6 +560,11 @@ struct result_timings {
     int32_t draft_n = 0;
     int32_t draft_n_accepted = 0;
 
+    // Optional adaptive draft length metrics - only included when draft_len >= 0
+    float   draft_p_accept = 0.0f;
+    float   draft_cost     = 0.0f;
+    int32_t draft_len      = -1;
+
     json to_json() const {
         json base = {
             {"prompt_n",               prompt_n},
@@ -554,6 +583,12 @@ struct result_timings {
             base["draft_n_accepted"] = draft_n_accepted;
         }
 
+        if (draft_len >= 0) {
+            base["draft_p_accept"] = draft_p_accept;
+            base["draft_cost"]     = draft_cost;
+            base["draft_len"]      = draft_len;
+        }
+
         return base;
     }
 };
@@ -653,6 +688,26 @@ struct completion_token_output {
     }
 };
 
+// generation state of a preempted slot, carried by the task that resumes it
+struct server_task_resume {
+    std::string  generated_text;
+    llama_tokens generated_tokens;
+    std::vector<completion_token_output> generated_token_probs;
+
+    common_chat_msg          chat_msg;
+    std::vector<std::string> generated_tool_call_ids;
+
+    // the bytes of the last code point, if it is incomplete
+    llama_detokenizer_ptr detokenizer;
+    int32_t               stop_state = 0;
+
+    size_t n_sent_text  = 0;
+    size_t last_nl_pos  = 0;
+    bool   has_new_line = false;
+
+    int32_t n_decoded = 0;
+};
+
 struct server_task_result_cmpl_final : server_task_result {
     int index = 0;
 
@@ -1164,6 +1219,29 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_batch_steps_total          = 0;
+    uint64_t n_batch_prefill_tokens_total = 0;
+    uint64_t n_batch_decode_tokens_total  = 0;
+
+    uint64_t n_batch_mixed_steps_total          = 0;
+    uint64_t n_batch_mixed_prefill_tokens_total = 0;
+
+    uint64_t n_preempt_total                = 0;
+    uint64_t n_resume_prompt_tokens_total   = 0;
+    uint64_t n_resume_restored_tokens_total = 0;
+
+    uint64_t n_kv_spill_total    = 0;
+    uint64_t n_kv_restore_total  = 0;
+    uint64_t n_kv_drop_total     = 0;
+    uint64_t n_kv_bytes_host     = 0;
+    uint64_t n_kv_bytes_disk     = 0;
+    uint64_t n_kv_entries_host   = 0;
+    uint64_t n_kv_entries_disk   = 0;
+
+    uint64_t n_prompt_store_save_total = 0;
+    uint64_t n_prompt_store_load_total = 0;
+    uint64_t n_prompt_store_bytes      = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1188,6 +1266,29 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_batch_steps_total",             n_batch_steps_total },
+            { "n_batch_prefill_tokens_total",    n_batch_prefill_tokens_total },
+            { "n_batch_decode_tokens_total",     n_batch_decode_tokens_total },
+
+            { "n_batch_mixed_steps_total",          n_batch_mixed_steps_total },
+            { "n_batch_mixed_prefill_tokens_total", n_batch_mixed_prefill_tokens_total },
+
+            { "n_preempt_total",                 n_preempt_total },
+            { "n_resume_prompt_tokens_total",    n_resume_prompt_tokens_total },
+            { "n_resume_restored_tokens_total",  n_resume_restored_tokens_total },
+
+            { "n_kv_spill_total",                n_kv_spill_total },
+            { "n_kv_restore_total",              n_kv_restore_total },
+            { "n_kv_drop_total",                 n_kv_drop_total },
+            { "n_kv_bytes_host",                 n_kv_bytes_host },
+            { "n_kv_bytes_disk",                 n_kv_bytes_disk },
+            { "n_kv_entries_host",               n_kv_entries_host },
+            { "n_kv_entries_disk",               n_kv_entries_disk },
+
+            { "n_prompt_store_save_total",       n_prompt_store_save_total },
+            { "n_prompt_store_load_total",       n_prompt_store_load_total },
+            { "n_prompt_store_bytes",            n_prompt_store_bytes },
+
             { "slots",                           slots_data },
         };
     }
@@ -1250,21 +1351,33 @@ struct server_slot {
     // only used for completion/embedding/infill/rerank
     server_task_type task_type = SERVER_TASK_TYPE_COMPLETION;
 
-    llama_batch batch_spec = {};
-
     llama_context * ctx = nullptr;
-    llama_context * ctx_dft = nullptr;
+    llama_context * ctx_dft = nullptr; // shared by all slots, the slot uses the sequence slot.id
+
 
     // multimodal
     mtmd_context * mctx = nullptr;
 
     common_speculative * spec = nullptr;
 
+    // the draft tokens evaluated in the current batch, after the sampled token
+    llama_tokens drafted;
+
+    double t_draft = 0.0; // time in microseconds spent per token of the last draft
+
+    common_speculative_stats draft_stats;
+
+    // prompt lookup decoding: the n-grams of the tokens of the slot, and the tokens they were extracted from
+    common_ngram_cache lookup_cache;
+    llama_tokens       lookup_tokens;
+
     std::vector<common_adapter_lora_info> lora;
 
     // the index relative to completion multi-task request
     size_t index = 0;
 
+    std::string tenant;
+
     struct slot_params params;
 
     slot_state state = SLOT_STATE_IDLE;
@@ -1277,6 +1390,9 @@ struct server_slot {
     int32_t n_past      = 0;
     int32_t n_decoded   = 0;
     int32_t n_remaining = -1;
+    int32_t n_resumed   = 0;  // number of tokens generated before the slot was preempted
+    bool    resumed     = false; // the slot continues the generation of a preempted request
+    int32_t n_store     = 0;  // number of prompt tokens to persist in the prompt store once computed (0 = none)
     int32_t i_batch     = -1;
     int32_t n_predict   = -1; // TODO: disambiguate from params.n_predict
 
@@ -1304,6 +1420,12 @@ struct server_slot {
 
     std::string stopping_word;
 
+    // converts the sampled tokens into text, up to the last complete UTF-8 code point
+    llama_detokenizer_ptr detokenizer;
+
+    // matches the stop strings in the generated text as it is produced
+    server_stop_matcher stop_matcher;
+
     // sampling
     json json_schema;
 
@@ -1341,18 +1463,26 @@ struct server_slot {
         stopping_word      = "";
         n_past             = 0;
         n_sent_text        = 0;
+        n_resumed          = 0;
+        resumed            = false;
+        n_store            = 0;
         task_type          = SERVER_TASK_TYPE_COMPLETION;
         chat_format        = COMMON_CHAT_FORMAT_CONTENT_ONLY;
 
         generated_tokens.clear();
         generated_token_probs.clear();
         chat_msg = {};
+        if (detokenizer) {
+            common_detokenizer_flush(detokenizer.get());
+        }
         json_schema = json();
         generated_tool_call_ids.clear();
 
         // clear speculative decoding stats
         n_draft_total = 0;
         n_draft_accepted = 0;
+        drafted.clear();
+        draft_stats.reset();
     }
 
     bool need_embd() const {
@@ -1396,7 +1526,7 @@ struct server_slot {
     }
 
     bool can_speculate() const {
-        return ctx_dft && params.speculative.n_max > 0 && params.cache_prompt;
+        return (ctx_dft || params.speculative.lookup) && params.speculative.n_max > 0 && params.cache_prompt && !mctx;
     }
 
     void add_token(const completion_token_output & token) {
@@ -1436,6 +1566,12 @@ struct server_slot {
             timings.draft_n_accepted = n_draft_accepted;
         }
 
+        if (n_draft_total > 0 && params.speculative.adaptive) {
+            timings.draft_p_accept = draft_stats.p_accept();
+            timings.draft_cost     = draft_stats.cost;
+            timings.draft_len      = draft_stats.n_draft < 0 ? params.speculative.n_max : draft_stats.n_draft;
+        }
+
         return timings;
     }
 
@@ -1454,35 +1590,6 @@ struct server_slot {
         return chat_msg;
     }
 
-    size_t find_stopping_strings(const std::string & text, const size_t last_token_size, bool is_full_stop) {
-        size_t stop_pos = std::string::npos;
-
-        for (const std::string & word : params.antiprompt) {
-            size_t pos;
-
-            if (is_full_stop) {
-                const size_t tmp      = word.size() + last_token_size;
-                const size_t from_pos = text.size() > tmp ? text.size() - tmp : 0;
-
-                pos = text.find(word, from_pos);
-            } else {
-                // otherwise, partial stop
-                pos = string_find_partial_stop(text, word);
-            }
-
-            if (pos != std::string::npos && (stop_pos == std::string::npos || pos < stop_pos)) {
-                if (is_full_stop) {
-                    stop           = STOP_TYPE_WORD;
-                    stopping_word  = word;
-                    has_next_token = false;
-                }
-                stop_pos = pos;
-            }
-        }
-
-        return stop_pos;
-    }
-
     void print_timings() const {
         const double t_prompt        =       t_prompt_processing / n_prompt_tokens_processed;
         const double n_prompt_second = 1e3 / t_prompt_processing * n_prompt_tokens_processed;
@@ -1548,6 +1655,23 @@ struct server_metrics {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    // composition of the batches built by update_slots()
+    uint64_t n_batch_steps_total          = 0;
+    uint64_t n_batch_prefill_tokens_total = 0;
+    uint64_t n_batch_decode_tokens_total  = 0;
+
+    // batches that hold both prompt tokens and generated tokens, see --prefill-chunk
+    uint64_t n_batch_mixed_steps_total          = 0;
+    uint64_t n_batch_mixed_prefill_tokens_total = 0;
+
+    uint64_t n_preempt_total = 0;
+
+    // prompt tokens that were processed again to resume preempted requests, because their KV cells were not spilled
+    uint64_t n_resume_prompt_tokens_total = 0;
+
+    // prompt tokens of the resumed requests whose KV cells were restored instead
+    uint64_t n_resume_restored_tokens_total = 0;
+
     void init() {
         t_start = ggml_time_us();
     }
@@ -1557,6 +1681,11 @@ struct server_metrics {
         n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
         t_prompt_processing             += slot.t_prompt_processing;
         t_prompt_processing_total       += slot.t_prompt_processing;
+
+        if (slot.resumed) {
+            n_resume_prompt_tokens_total   += slot.n_prompt_tokens_processed;
+            n_resume_restored_tokens_total += slot.n_prompt_tokens - slot.n_prompt_tokens_processed;
+        }
     }
 
     void on_prediction(const server_slot & slot) {
@@ -1575,6 +1704,21 @@ struct server_metrics {
         }
     }
 
+    void on_preempted() {
+        n_preempt_total++;
+    }
+
+    void on_batch(int32_t n_prefill, int32_t n_decode) {
+        n_batch_steps_total++;
+        n_batch_prefill_tokens_total += n_prefill;
+        n_batch_decode_tokens_total  += n_decode;
+
+        if (n_prefill > 0 && n_decode > 0) {
+            n_batch_mixed_steps_total++;
+            n_batch_mixed_prefill_tokens_total += n_prefill;
+        }
+    }
+
     void reset_bucket() {
         n_prompt_tokens_processed = 0;
         t_prompt_processing       = 0;
@@ -1583,302 +1727,997 @@ struct server_metrics {
     }
 };
 
-struct server_queue {
-    int id = 0;
-    bool running;
+// runs file writes on a background thread, so that saving large states does not stall the slots in the main loop
+// also used for the work that overlaps with llama_decode(), e.g. the grammar prefetch, so that no thread is created
+// per step
+// the jobs are run in the order they were pushed, the thread is started on the first push
+struct server_io_worker {
+    std::thread thread;
 
-    // queues
-    std::deque<server_task> queue_tasks;
-    std::deque<server_task> queue_tasks_deferred;
+    std::mutex              mutex;
+    std::condition_variable cv;
 
-    std::mutex mutex_tasks;
-    std::condition_variable condition_tasks;
+    std::deque<std::packaged_task<bool()>> jobs;
 
-    // callback functions
-    std::function<void(server_task &&)> callback_new_task;
-    std::function<void(void)>           callback_update_slots;
+    bool running = false;
 
-    // Add a new task to the end of the queue
-    int post(server_task && task, bool front = false) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        GGML_ASSERT(task.id != -1);
-        // if this is cancel task make sure to clean up pending tasks
-        if (task.type == SERVER_TASK_TYPE_CANCEL) {
-            cleanup_pending_task(task.id_target);
+    ~server_io_worker() {
+        if (!thread.joinable()) {
+            return;
         }
-        const int task_id = task.id;
-        QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
-        if (front) {
-            queue_tasks.push_front(std::move(task));
-        } else {
-            queue_tasks.push_back(std::move(task));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
         }
-        condition_tasks.notify_one();
-        return task_id;
+        cv.notify_one();
+
+        thread.join();
     }
 
-    // multi-task version of post()
-    int post(std::vector<server_task> && tasks, bool front = false) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        for (auto & task : tasks) {
-            if (task.id == -1) {
-                task.id = id++;
-            }
-            // if this is cancel task make sure to clean up pending tasks
-            if (task.type == SERVER_TASK_TYPE_CANCEL) {
-                cleanup_pending_task(task.id_target);
-            }
-            QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
-            if (front) {
-                queue_tasks.push_front(std::move(task));
-            } else {
-                queue_tasks.push_back(std::move(task));
+    template <typename F>
+    std::future<bool> push(F && f) {
+        std::packaged_task<bool()> job(std::forward<F>(f));
+        std::future<bool> res = job.get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!thread.joinable()) {
+                running = true;
+                thread  = std::thread([this]() { loop(); });
             }
+            jobs.push_back(std::move(job));
         }
-        condition_tasks.notify_one();
-        return 0;
-    }
+        cv.notify_one();
 
-    // Add a new task, but defer until one slot is available
-    void defer(server_task && task) {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        QUE_DBG("defer task, id = %d\n", task.id);
-        queue_tasks_deferred.push_back(std::move(task));
-        condition_tasks.notify_one();
+        return res;
     }
 
-    // Get the next id for creating a new task
-    int get_new_id() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        int new_id = id++;
-        return new_id;
+private:
+    void loop() {
+        while (true) {
+            std::packaged_task<bool()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return !jobs.empty() || !running; });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
     }
+};
 
-    // Register function to process a new task
-    void on_new_task(std::function<void(server_task &&)> callback) {
-        callback_new_task = std::move(callback);
-    }
+// states of sequences that were evicted from the KV cache, so they can be restored when the session returns
+// the states are kept in host memory first and spilled to files once the host budget is exceeded
+// the least recently used states are dropped once the disk budget is exceeded
+struct server_kv_tiers {
+    struct entry {
+        llama_tokens tokens;
+        std::vector<common_adapter_lora_info> lora;
 
-    // Register the function to be called when all slots data is ready to be processed
-    void on_update_slots(std::function<void(void)> callback) {
-        callback_update_slots = std::move(callback);
-    }
+        std::vector<uint8_t> data; // host tier
+        std::string          path; // disk tier, empty if the state is in host memory
 
-    // Call when the state of one slot is changed, it will move one task from deferred to main queue
-    void pop_deferred_task() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        if (!queue_tasks_deferred.empty()) {
-            queue_tasks.emplace_back(std::move(queue_tasks_deferred.front()));
-            queue_tasks_deferred.pop_front();
-        }
-        condition_tasks.notify_one();
-    }
+        std::future<bool> written; // valid until the write of the file by the I/O worker is collected
 
-    // end the start_loop routine
-    void terminate() {
-        std::unique_lock<std::mutex> lock(mutex_tasks);
-        running = false;
-        condition_tasks.notify_all();
-    }
+        size_t  n_bytes     = 0;
+        int64_t t_last_used = 0;
+    };
 
-    /**
-     * Main loop consists of these steps:
-     * - Wait until a new task arrives
-     * - Process the task (i.e. maybe copy data into slot)
-     * - Check if multitask is finished
-     * - Update all slots
-     */
-    void start_loop() {
-        running = true;
+    std::vector<entry> entries;
 
-        while (true) {
-            QUE_DBG("%s", "processing new tasks\n");
+    size_t n_bytes_host_max = 0;
+    size_t n_bytes_disk_max = 0;
 
-            while (true) {
-                std::unique_lock<std::mutex> lock(mutex_tasks);
-                if (!running) {
-                    QUE_DBG("%s", "terminate\n");
-                    return;
-                }
-                if (queue_tasks.empty()) {
-                    lock.unlock();
-                    break;
-                }
-                server_task task = std::move(queue_tasks.front());
-                queue_tasks.pop_front();
-                lock.unlock();
+    std::string path_disk; // directory for the disk tier
 
-                QUE_DBG("processing task, id = %d\n", task.id);
-                callback_new_task(std::move(task));
-            }
+    size_t n_bytes_host = 0;
+    size_t n_bytes_disk = 0;
 
-            // all tasks in the current loop is processed, slots data is now ready
-            QUE_DBG("%s", "update slots\n");
+    uint64_t n_spill_total   = 0;
+    uint64_t n_restore_total = 0;
+    uint64_t n_drop_total    = 0;
 
-            callback_update_slots();
+    uint64_t n_files = 0;
 
-            QUE_DBG("%s", "waiting for new tasks\n");
-            {
-                std::unique_lock<std::mutex> lock(mutex_tasks);
-                if (!running) {
-                    QUE_DBG("%s", "terminate\n");
-                    return;
-                }
-                if (queue_tasks.empty()) {
-                    condition_tasks.wait(lock, [&]{
-                        return (!queue_tasks.empty() || !running);
-                    });
-                }
+    server_io_worker io;
+
+    ~server_kv_tiers() {
+        for (auto & e : entries) {
+            if (e.written.valid()) {
+                e.written.wait();
+            }
+            if (!e.path.empty()) {
+                std::remove(e.path.c_str());
             }
         }
     }
 
-private:
-    void cleanup_pending_task(int id_target) {
-        // no need lock because this is called exclusively by post()
-        auto rm_func = [id_target](const server_task & task) {
-            return task.id_target == id_target;
-        };
-        queue_tasks.erase(
-            std::remove_if(queue_tasks.begin(),          queue_tasks.end(),          rm_func),
-            queue_tasks.end());
-        queue_tasks_deferred.erase(
-            std::remove_if(queue_tasks_deferred.begin(), queue_tasks_deferred.end(), rm_func),
-            queue_tasks_deferred.end());
+    bool enabled() const {
+        return n_bytes_host_max > 0 || disk_enabled();
     }
-};
 
-struct server_response {
-    bool running = true;
+    bool disk_enabled() const {
+        return n_bytes_disk_max > 0 && !path_disk.empty();
+    }
 
-    // for keeping track of all tasks waiting for the result
-    std::unordered_set<int> waiting_task_ids;
+    // copy the state of seq_id out of the KV cache
+    bool spill(llama_context * ctx, llama_seq_id seq_id, const llama_tokens & tokens, const std::vector<common_adapter_lora_info> & lora) {
+        const size_t n_bytes = llama_state_seq_get_size(ctx, seq_id);
+        if (n_bytes == 0 || (n_bytes > n_bytes_host_max && (!disk_enabled() || n_bytes > n_bytes_disk_max))) {
+            return false;
+        }
 
-    // the main result queue (using ptr for polymorphism)
-    std::vector<server_task_result_ptr> queue_results;
+        collect();
 
-    std::mutex mutex_results;
-    std::condition_variable condition_results;
+        // any state that is a prefix of the new one is now redundant
+        for (size_t i = 0; i < entries.size(); ) {
+            const auto & e = entries[i];
+            if (e.tokens.size() <= tokens.size() && are_lora_equal(e.lora, lora) &&
+                std::equal(e.tokens.begin(), e.tokens.end(), tokens.begin())) {
+                erase(i);
+            } else {
+                i++;
+            }
+        }
 
-    // add the id_task to the list of tasks waiting for response
-    void add_waiting_task_id(int id_task) {
-        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) waiting_task_ids.size());
+        entry e;
+        e.tokens      = tokens;
+        e.lora        = lora;
+        e.n_bytes     = n_bytes;
+        e.t_last_used = ggml_time_us();
+        e.data.resize(n_bytes);
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.insert(id_task);
-    }
+        if (llama_state_seq_get_data(ctx, e.data.data(), n_bytes, seq_id) != n_bytes) {
+            return false;
+        }
 
-    void add_waiting_tasks(const std::vector<server_task> & tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+        n_bytes_host += n_bytes;
+        n_spill_total++;
 
-        for (const auto & task : tasks) {
-            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) waiting_task_ids.size());
-            waiting_task_ids.insert(task.id);
-        }
-    }
+        entries.push_back(std::move(e));
 
-    // when the request is finished, we can remove task associated with it
-    void remove_waiting_task_id(int id_task) {
-        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
+        shrink();
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.erase(id_task);
-        // make sure to clean up all pending results
-        queue_results.erase(
-            std::remove_if(queue_results.begin(), queue_results.end(), [id_task](const server_task_result_ptr & res) {
-                return res->id == id_task;
-            }),
-            queue_results.end());
+        return true;
     }
 
-    void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
-        std::unique_lock<std::mutex> lock(mutex_results);
+    // find the state with the longest common prefix with the prompt
+    // returns the index of the entry (-1 if none) and the length of the common prefix
+    std::pair<int, size_t> find(const llama_tokens & prompt, const std::vector<common_adapter_lora_info> & lora) const {
+        int    i_best = -1;
+        size_t n_best = 0;
 
-        for (const auto & id_task : id_tasks) {
-            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
-            waiting_task_ids.erase(id_task);
-        }
-    }
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const auto & e = entries[i];
+            if (!are_lora_equal(e.lora, lora)) {
+                continue;
+            }
 
-    // This function blocks the thread until there is a response for one of the id_tasks
-    server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-            condition_results.wait(lock, [&]{
-                if (!running) {
-                    SRV_DBG("%s : queue result stop\n", __func__);
-                    std::terminate(); // we cannot return here since the caller is HTTP code
-                }
-                return !queue_results.empty();
-            });
+            const size_t n_max = std::min(e.tokens.size(), prompt.size());
 
-            for (size_t i = 0; i < queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
+            size_t n = 0;
+            while (n < n_max && e.tokens[n] == prompt[n]) {
+                n++;
+            }
+
+            if (n > n_best) {
+                i_best = i;
+                n_best = n;
             }
         }
 
-        // should never reach here
+        return { i_best, n_best };
     }
 
-    // same as recv(), but have timeout in seconds
-    // if timeout is reached, nullptr is returned
-    server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
+    // copy the state of entry i back into seq_id and forget it
+    // returns the restored tokens, empty on failure
+    llama_tokens restore(llama_context * ctx, llama_seq_id seq_id, int i) {
+        entry & e = entries[i];
 
-            for (int i = 0; i < (int) queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
-                }
-            }
+        // the file may still be written by the I/O worker
+        if (e.written.valid() && !e.written.get()) {
+            n_drop_total++;
+            erase(i);
+            return {};
+        }
 
-            std::cv_status cr_res = condition_results.wait_for(lock, std::chrono::seconds(timeout));
-            if (!running) {
-                SRV_DBG("%s : queue result stop\n", __func__);
-                std::terminate(); // we cannot return here since the caller is HTTP code
-            }
-            if (cr_res == std::cv_status::timeout) {
-                return nullptr;
-            }
+        if (!e.path.empty() && !read_file(e)) {
+            erase(i);
+            return {};
         }
 
-        // should never reach here
-    }
+        llama_tokens tokens;
 
-    // single-task version of recv()
-    server_task_result_ptr recv(int id_task) {
-        std::unordered_set<int> id_tasks = {id_task};
-        return recv(id_tasks);
+        llama_memory_seq_rm(llama_get_memory(ctx), seq_id, -1, -1);
+        if (llama_state_seq_set_data(ctx, e.data.data(), e.data.size(), seq_id) == e.data.size()) {
+            tokens = std::move(e.tokens);
+            n_restore_total++;
+        } else {
+            llama_memory_seq_rm(llama_get_memory(ctx), seq_id, -1, -1);
+        }
+
+        erase(i);
+
+        return tokens;
     }
 
-    // Send a new result to a waiting id_task
-    void send(server_task_result_ptr && result) {
-        SRV_DBG("sending result for task id = %d\n", result->id);
+    size_t n_entries_host() const {
+        size_t n = 0;
+        for (const auto & e : entries) {
+            n += e.path.empty();
+        }
+        return n;
+    }
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        for (const auto & id_task : waiting_task_ids) {
-            if (result->id == id_task) {
-                SRV_DBG("task id = %d pushed to result queue\n", result->id);
+    size_t n_entries_disk() const {
+        return entries.size() - n_entries_host();
+    }
 
-                queue_results.emplace_back(std::move(result));
-                condition_results.notify_all();
-                return;
+    // drop the states whose file could not be written by the I/O worker
+    void collect() {
+        for (size_t i = 0; i < entries.size(); ) {
+            auto & e = entries[i];
+            if (e.written.valid() && e.written.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !e.written.get()) {
+                n_drop_total++;
+                erase(i);
+            } else {
+                i++;
             }
         }
     }
 
-    // terminate the waiting loop
-    void terminate() {
-        running = false;
-        condition_results.notify_all();
+private:
+    void erase(size_t i) {
+        entry & e = entries[i];
+
+        if (e.path.empty()) {
+            n_bytes_host -= e.n_bytes;
+        } else {
+            n_bytes_disk -= e.n_bytes;
+            if (e.written.valid()) {
+                e.written.wait();
+            }
+            std::remove(e.path.c_str());
+        }
+
+        entries.erase(entries.begin() + i);
     }
-};
+
+    // index of the least recently used entry in the given tier, -1 if none
+    int lru(bool on_disk) const {
+        int i_lru = -1;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].path.empty() == on_disk) {
+                continue;
+            }
+            if (i_lru == -1 || entries[i].t_last_used < entries[i_lru].t_last_used) {
+                i_lru = i;
+            }
+        }
+        return i_lru;
+    }
+
+    // move the least recently used states down the tiers until the budgets are met
+    void shrink() {
+        while (n_bytes_host > n_bytes_host_max) {
+            const int i = lru(false);
+            GGML_ASSERT(i >= 0);
+
+            entry & e = entries[i];
+
+            if (!disk_enabled() || e.n_bytes > n_bytes_disk_max) {
+                SRV_DBG("dropping KV state, n_tokens = %zu, n_bytes = %zu\n", e.tokens.size(), e.n_bytes);
+                n_drop_total++;
+                erase(i);
+                continue;
+            }
+
+            write_file(e);
+
+            n_bytes_host -= e.n_bytes;
+            n_bytes_disk += e.n_bytes;
+        }
+
+        while (n_bytes_disk > n_bytes_disk_max) {
+            const int i = lru(true);
+            GGML_ASSERT(i >= 0);
+
+            SRV_DBG("dropping KV state file '%s'\n", entries[i].path.c_str());
+            n_drop_total++;
+            erase(i);
+        }
+    }
+
+    // hand the state over to the I/O worker, the entry counts as on disk from now on
+    // if the write fails, the entry is dropped by collect() or restore()
+    void write_file(entry & e) {
+        const std::string path = path_disk + "kv-spill-" + std::to_string(n_files++) + ".bin";
+
+        e.path    = path;
+        e.written = io.push([path, data = std::move(e.data), n_tokens = e.tokens.size()]() {
+            std::ofstream file(path, std::ios::binary);
+            if (!file || !file.write((const char *) data.data(), data.size())) {
+                SRV_WRN("failed to write KV state file '%s'\n", path.c_str());
+                file.close();
+                std::remove(path.c_str());
+                return false;
+            }
+
+            SRV_DBG("spilled KV state to '%s', n_tokens = %zu, n_bytes = %zu\n", path.c_str(), n_tokens, data.size());
+
+            return true;
+        });
+
+        e.data = {};
+    }
+
+    // note: the read blocks the main loop, but the state is needed before the prompt of the slot can be processed
+    bool read_file(entry & e) {
+        const int64_t t_start = ggml_time_us();
+
+        std::ifstream file(e.path, std::ios::binary);
+
+        e.data.resize(e.n_bytes);
+        if (!file || !file.read((char *) e.data.data(), e.data.size())) {
+            SRV_WRN("failed to read KV state file '%s'\n", e.path.c_str());
+            return false;
+        }
+
+        SRV_INF("read KV state file '%s', n_bytes = %zu, t = %.2f ms\n", e.path.c_str(), e.n_bytes, (ggml_time_us() - t_start) / 1e3);
+
+        return true;
+    }
+};
+
+// persistent store of the KV states of frequently used prompt prefixes (e.g. system prompts shared by many requests)
+// the states are saved in the format of llama_state_seq_save_file() to files named after a hash of the prefix tokens and
+// of the model fingerprint, so they survive restarts of the server and are reloaded on a cache miss instead of
+// re-processed, with llama_state_seq_load_file_mmap() unless --no-mmap is set
+// the prefixes are aligned to multiples of n_block tokens, so a prompt only needs to be hashed at the block boundaries
+// the files are written by a background thread, so that saving a prefix does not stall the other slots
+struct server_prompt_store {
+    struct file_info {
+        size_t   n_tokens = 0;
+        size_t   n_bytes  = 0;
+        uint64_t t_used   = 0; // logical clock, for LRU eviction
+
+        std::future<bool> written; // valid until the write of the file by the I/O worker is collected
+    };
+
+    std::string path; // empty = disabled
+
+    uint64_t fingerprint = 0;
+
+    size_t  n_block     = 256;
+    int32_t n_hits_min  = 2;
+    size_t  n_bytes_max = 0; // 0 = unlimited
+    bool    use_mmap    = true;
+
+    std::unordered_map<uint64_t, file_info> files;
+    std::unordered_map<uint64_t, int32_t>   hits; // number of prompts seen per block-aligned prefix
+
+    size_t   n_bytes = 0;
+    uint64_t t_now   = 0;
+
+    uint64_t n_save_total = 0;
+    uint64_t n_load_total = 0;
+
+    server_io_worker io;
+
+    ~server_prompt_store() {
+        for (auto & [key, info] : files) {
+            if (info.written.valid()) {
+                info.written.wait();
+            }
+        }
+    }
+
+    bool enabled() const {
+        return !path.empty();
+    }
+
+    // index the files already present in the directory, e.g. from a previous run
+    void init(const std::string & dir, const std::string & model_fingerprint) {
+        path        = dir;
+        fingerprint = hash(0xcbf29ce484222325ULL, (const uint8_t *) model_fingerprint.data(), model_fingerprint.size());
+
+        std::vector<std::pair<std::filesystem::file_time_type, uint64_t>> by_time;
+
+        std::error_code ec;
+        for (const auto & it : std::filesystem::directory_iterator(path, ec)) {
+            const std::string name = it.path().filename().string();
+
+            uint64_t key = 0;
+
+            file_info info;
+            if (!it.is_regular_file(ec) || !parse_file_name(name, key, info.n_tokens)) {
+                continue;
+            }
+
+            info.n_bytes = it.file_size(ec);
+            if (ec) {
+                continue;
+            }
+
+            n_bytes += info.n_bytes;
+            files[key] = std::move(info);
+
+            by_time.emplace_back(it.last_write_time(ec), key);
+        }
+
+        // the modification time of a file is updated when it is loaded, so the LRU order survives restarts
+        std::sort(by_time.begin(), by_time.end());
+        for (const auto & [t, key] : by_time) {
+            files[key].t_used = ++t_now;
+        }
+
+        shrink();
+
+        SRV_INF("prompt store: path = '%s', n_files = %zu, n_bytes = %zu\n", path.c_str(), files.size(), n_bytes);
+    }
+
+    // find the longest stored prefix of the prompt
+    // returns the key of the file (0 if none) and the number of tokens of the prefix
+    std::pair<uint64_t, size_t> find(const llama_tokens & prompt) const {
+        const auto ks = keys(prompt);
+
+        for (size_t i = ks.size(); i-- > 0;) {
+            const auto it = files.find(ks[i]);
+            if (it != files.end() && it->second.n_tokens == (i + 1)*n_block) {
+                return { ks[i], it->second.n_tokens };
+            }
+        }
+
+        return { 0, 0 };
+    }
+
+    // count the prompt towards the hits of its prefixes
+    // returns the length of the longest prefix that is used frequently enough but is not stored yet (0 if none)
+    size_t hit(const llama_tokens & prompt) {
+        // bound the memory used by prefixes that are seen only once
+        if (hits.size() > 65536) {
+            hits.clear();
+        }
+
+        const auto ks = keys(prompt);
+
+        size_t n_store = 0;
+
+        for (size_t i = 0; i < ks.size(); ++i) {
+            if (++hits[ks[i]] >= n_hits_min && files.find(ks[i]) == files.end()) {
+                n_store = (i + 1)*n_block;
+            }
+        }
+
+        return n_store;
+    }
+
+    // copy the state of seq_id, which must hold exactly the tokens, and hand it over to the I/O worker
+    // the file counts as stored from now on, if the write fails it is dropped by collect() or load()
+    bool save(llama_context * ctx, llama_seq_id seq_id, const llama_tokens & tokens) {
+        GGML_ASSERT(!tokens.empty() && tokens.size() % n_block == 0);
+
+        collect();
+
+        const uint64_t key = keys(tokens).back();
+
+        // the state is copied here, while the context is not decoding, the I/O worker writes it with the tokens in the
+        // format of llama_state_seq_save_file()
+        const size_t n_state = llama_state_seq_get_size(ctx, seq_id);
+
+        std::vector<uint8_t> data(n_state);
+
+        if (n_state == 0 || llama_state_seq_get_data(ctx, data.data(), n_state, seq_id) != n_state) {
+            SRV_WRN("%s", "failed to copy the KV state for the prompt store\n");
+            return false;
+        }
+
+        erase(key);
+
+        const std::string fname = path + file_name(key, tokens.size());
+
+        file_info info;
+        info.n_tokens = tokens.size();
+        info.n_bytes  = n_state + tokens.size()*sizeof(llama_token); // the size of the file, up to the few bytes of the header
+        info.t_used   = ++t_now;
+        info.written  = io.push([fname, tokens, data = std::move(data)]() {
+            const std::string fname_tmp = fname + ".tmp";
+
+            // write to a temporary file first, so that other servers sharing the directory never see a partial file
+            const size_t n_written = llama_state_seq_save_file_data(fname_tmp.c_str(), data.data(), data.size(), tokens.data(), tokens.size());
+
+            if (n_written == 0 || std::rename(fname_tmp.c_str(), fname.c_str()) != 0) {
+                SRV_WRN("failed to write prompt store file '%s'\n", fname.c_str());
+                std::remove(fname_tmp.c_str());
+                return false;
+            }
+
+            return true;
+        });
+
+        n_bytes += info.n_bytes;
+        n_save_total++;
+
+        files[key] = std::move(info);
+
+        shrink();
+
+        return true;
+    }
+
+    // load the state of the file into seq_id, the tokens of the file must be a prefix of the prompt
+    // returns the loaded tokens, empty on failure
+    llama_tokens load(llama_context * ctx, llama_seq_id seq_id, uint64_t key, const llama_tokens & prompt) {
+        collect();
+
+        const auto it = files.find(key);
+        if (it == files.end()) {
+            return {};
+        }
+
+        const std::string fname = path + file_name(key, it->second.n_tokens);
+
+        // the file may still be written by the I/O worker
+        if (it->second.written.valid() && !it->second.written.get()) {
+            erase(key);
+            return {};
+        }
+
+        auto * mem = llama_get_memory(ctx);
+
+        llama_tokens tokens;
+
+        llama_memory_seq_rm(mem, seq_id, -1, -1);
+
+        tokens.resize(it->second.n_tokens);
+
+        size_t n_tokens = 0;
+        const size_t n_read = use_mmap ?
+            llama_state_seq_load_file_mmap(ctx, fname.c_str(), seq_id, tokens.data(), tokens.size(), &n_tokens) :
+            llama_state_seq_load_file     (ctx, fname.c_str(), seq_id, tokens.data(), tokens.size(), &n_tokens);
+        tokens.resize(n_tokens);
+
+        // the hash of the prefix may collide, or the file may have been replaced by another server
+        const bool ok = n_read > 0 && tokens.size() <= prompt.size() && std::equal(tokens.begin(), tokens.end(), prompt.begin());
+
+        if (!ok) {
+            SRV_WRN("failed to load prompt store file '%s'\n", fname.c_str());
+            llama_memory_seq_rm(mem, seq_id, -1, -1);
+            erase(key);
+            return {};
+        }
+
+        it->second.t_used = ++t_now;
+        n_load_total++;
+
+        std::error_code ec;
+        std::filesystem::last_write_time(fname, std::filesystem::file_time_type::clock::now(), ec);
+
+        return tokens;
+    }
+
+private:
+    static uint64_t hash(uint64_t h, const uint8_t * data, size_t len) {
+        // FNV-1a
+        for (size_t i = 0; i < len; ++i) {
+            h ^= data[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    // the keys of the block-aligned prefixes of the prompt, keys[i] is the key of the first (i + 1)*n_block tokens
+    std::vector<uint64_t> keys(const llama_tokens & prompt) const {
+        std::vector<uint64_t> res;
+        res.reserve(prompt.size() / n_block);
+
+        uint64_t h = fingerprint;
+        for (size_t i = 0; i + n_block <= prompt.size(); i += n_block) {
+            h = hash(h, (const uint8_t *) (prompt.data() + i), n_block*sizeof(llama_token));
+            res.push_back(h ? h : 1); // 0 is reserved for "not found"
+        }
+
+        return res;
+    }
+
+    // the number of tokens is part of the name, so that the files can be indexed without reading them
+    static std::string file_name(uint64_t key, size_t n_tokens) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "prompt-%016" PRIx64 "-%zu.bin", key, n_tokens);
+        return buf;
+    }
+
+    static bool parse_file_name(const std::string & name, uint64_t & key, size_t & n_tokens) {
+        if (name.size() < 7 + 16 + 2 + 4 || name.rfind("prompt-", 0) != 0 || name[23] != '-' ||
+            name.compare(name.size() - 4, 4, ".bin") != 0) {
+            return false;
+        }
+
+        char * end = nullptr;
+        key = std::strtoull(name.c_str() + 7, &end, 16);
+        if (end != name.c_str() + 23) {
+            return false;
+        }
+
+        n_tokens = std::strtoull(name.c_str() + 24, &end, 10);
+
+        return end == name.c_str() + name.size() - 4 && n_tokens > 0;
+    }
+
+    // drop the files that could not be written by the I/O worker
+    void collect() {
+        for (auto it = files.begin(); it != files.end(); ) {
+            auto & info = it->second;
+            if (info.written.valid() && info.written.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !info.written.get()) {
+                n_bytes -= info.n_bytes;
+                it = files.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void erase(uint64_t key) {
+        auto it = files.find(key);
+        if (it == files.end()) {
+            return;
+        }
+
+        if (it->second.written.valid()) {
+            it->second.written.wait();
+        }
+
+        n_bytes -= it->second.n_bytes;
+        std::remove((path + file_name(key, it->second.n_tokens)).c_str());
+
+        files.erase(it);
+    }
+
+    // delete the least recently used files until the budget is met
+    void shrink() {
+        while (n_bytes_max > 0 && n_bytes > n_bytes_max && !files.empty()) {
+            auto it_lru = files.begin();
+            for (auto it = files.begin(); it != files.end(); ++it) {
+                if (it->second.t_used < it_lru->second.t_used) {
+                    it_lru = it;
+                }
+            }
+
+            SRV_DBG("deleting prompt store file '%s'\n", file_name(it_lru->first, it_lru->second.n_tokens).c_str());
+            erase(it_lru->first);
+        }
+    }
+};
+
+struct server_queue {
+    std::atomic<int>  id      = 0;
+    std::atomic<bool> running = false;
+
+    // tasks posted by the HTTP threads, lock-free on the producer side
+    server_mpsc_queue<std::pair<server_task, bool>> queue_incoming { 4096 };
+
+    // queues - owned by the thread running start_loop()
+    std::deque<server_task> queue_tasks;
+    std::deque<server_task> queue_tasks_deferred;
+
+    // fair-share scheduling of the deferred tasks across tenants (API keys)
+    std::map<std::string, int32_t> tenant_weights; // default weight is 1
+    std::map<std::string, int64_t> tenant_deficit; // in prompt tokens
+    std::string                    tenant_last;    // the tenant that was served last
+
+    int64_t n_quantum = 256; // prompt tokens credited to a tenant of weight 1 per round
+
+    // callback functions
+    std::function<void(server_task &&)> callback_new_task;
+    std::function<void(void)>           callback_update_slots;
+
+    // Add a new task to the end of the queue
+    int post(server_task && task, bool front = false) {
+        GGML_ASSERT(task.id != -1);
+        const int task_id = task.id;
+        QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
+        queue_incoming.push({ std::move(task), front });
+        return task_id;
+    }
+
+    // multi-task version of post()
+    int post(std::vector<server_task> && tasks, bool front = false) {
+        for (auto & task : tasks) {
+            if (task.id == -1) {
+                task.id = id++;
+            }
+            QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
+            queue_incoming.push({ std::move(task), front });
+        }
+        return 0;
+    }
+
+    // Add a new task, but defer until one slot is available
+    // note: must be called from the thread running start_loop()
+    void defer(server_task && task) {
+        QUE_DBG("defer task, id = %d\n", task.id);
+        queue_tasks_deferred.push_back(std::move(task));
+    }
+
+    // Get the next id for creating a new task
+    int get_new_id() {
+        return id++;
+    }
+
+    // Register function to process a new task
+    void on_new_task(std::function<void(server_task &&)> callback) {
+        callback_new_task = std::move(callback);
+    }
+
+    // Register the function to be called when all slots data is ready to be processed
+    void on_update_slots(std::function<void(void)> callback) {
+        callback_update_slots = std::move(callback);
+    }
+
+    // Call when the state of one slot is changed, it will move one task from deferred to main queue
+    // note: must be called from the thread running start_loop()
+    void pop_deferred_task() {
+        if (!queue_tasks_deferred.empty()) {
+            auto it = next_deferred_task();
+            QUE_DBG("pop deferred task, id = %d, priority = %d\n", it->id, it->params.priority);
+            queue_tasks.emplace_back(std::move(*it));
+            queue_tasks_deferred.erase(it);
+        }
+    }
+
+    // end the start_loop routine
+    void terminate() {
+        running = false;
+        queue_incoming.notify();
+    }
+
+    /**
+     * Main loop consists of these steps:
+     * - Wait until a new task arrives
+     * - Process the task (i.e. maybe copy data into slot)
+     * - Check if multitask is finished
+     * - Update all slots
+     */
+    void start_loop() {
+        running = true;
+
+        std::vector<std::pair<server_task, bool>> incoming;
+
+        while (true) {
+            QUE_DBG("%s", "processing new tasks\n");
+
+            while (true) {
+                if (!running) {
+                    QUE_DBG("%s", "terminate\n");
+                    return;
+                }
+                recv_incoming(incoming);
+                if (queue_tasks.empty()) {
+                    break;
+                }
+                server_task task = std::move(queue_tasks.front());
+                queue_tasks.pop_front();
+
+                QUE_DBG("processing task, id = %d\n", task.id);
+                callback_new_task(std::move(task));
+            }
+
+            // all tasks in the current loop is processed, slots data is now ready
+            QUE_DBG("%s", "update slots\n");
+
+            callback_update_slots();
+
+            QUE_DBG("%s", "waiting for new tasks\n");
+            {
+                if (!running) {
+                    QUE_DBG("%s", "terminate\n");
+                    return;
+                }
+                if (queue_tasks.empty()) {
+                    queue_incoming.wait([&]{
+                        return !running;
+                    });
+                }
+            }
+        }
+    }
+
+private:
+    // move the tasks posted since the last call to the main queue
+    void recv_incoming(std::vector<std::pair<server_task, bool>> & incoming) {
+        incoming.clear();
+        queue_incoming.drain(incoming);
+
+        for (auto & [task, front] : incoming) {
+            // if this is cancel task make sure to clean up pending tasks
+            if (task.type == SERVER_TASK_TYPE_CANCEL) {
+                cleanup_pending_task(task.id_target);
+            }
+            if (front) {
+                queue_tasks.push_front(std::move(task));
+            } else {
+                queue_tasks.push_back(std::move(task));
+            }
+        }
+    }
+
+    // select the deferred task to run next:
+    //  - tasks with the highest priority go first
+    //  - ties are broken by weighted deficit round-robin across tenants, the cost of a task is its number of prompt
+    //    tokens, so that a tenant with many long prompts cannot starve the others
+    //  - within a tenant, tasks are served in FIFO order
+    std::deque<server_task>::iterator next_deferred_task() {
+        int32_t priority = queue_tasks_deferred.front().params.priority;
+        for (const auto & task : queue_tasks_deferred) {
+            priority = std::max(priority, task.params.priority);
+        }
+
+        // the oldest task of each tenant at this priority
+        std::map<std::string, std::deque<server_task>::iterator> heads;
+        for (auto it = queue_tasks_deferred.begin(); it != queue_tasks_deferred.end(); ++it) {
+            if (it->params.priority == priority && heads.find(it->tenant) == heads.end()) {
+                heads[it->tenant] = it;
+            }
+        }
+
+        // idle tenants do not accumulate credit
+        for (auto it = tenant_deficit.begin(); it != tenant_deficit.end();) {
+            if (heads.find(it->first) == heads.end()) {
+                it = tenant_deficit.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        const auto cost = [](const server_task & task) {
+            return std::max<int64_t>(1, task.prompt_tokens.size());
+        };
+
+        // the last served tenant keeps going while it has credit left
+        {
+            auto it = heads.find(tenant_last);
+            if (it != heads.end() && tenant_deficit[tenant_last] >= cost(*it->second)) {
+                tenant_deficit[tenant_last] -= cost(*it->second);
+                return it->second;
+            }
+        }
+
+        while (true) {
+            auto it = heads.upper_bound(tenant_last);
+            for (size_t i = 0; i < heads.size(); ++i, ++it) {
+                if (it == heads.end()) {
+                    it = heads.begin();
+                }
+
+                const auto it_w = tenant_weights.find(it->first);
+                const int32_t weight = it_w != tenant_weights.end() ? it_w->second : 1;
+
+                int64_t & deficit = tenant_deficit[it->first];
+
+                deficit += n_quantum*weight;
+                tenant_last = it->first;
+
+                if (deficit >= cost(*it->second)) {
+                    deficit -= cost(*it->second);
+                    return it->second;
+                }
+            }
+        }
+    }
+
+    // remove the target of a cancel task if it is still pending, so that it is not launched after the cancel task has
+    // been handled, and the previous cancel tasks of the same target
+    // the tasks of a producer are received in order, so the target is already queued or deferred (see server_mpsc_queue)
+    void cleanup_pending_task(int id_target) {
+        // no need lock because this is called exclusively by the thread running start_loop()
+        auto rm_func = [id_target](const server_task & task) {
+            return task.id == id_target || task.id_target == id_target;
+        };
+        queue_tasks.erase(
+            std::remove_if(queue_tasks.begin(),          queue_tasks.end(),          rm_func),
+            queue_tasks.end());
+        queue_tasks_deferred.erase(
+            std::remove_if(queue_tasks_deferred.begin(), queue_tasks_deferred.end(), rm_func),
+            queue_tasks_deferred.end());
+    }
+};
+
+struct server_response {
+    std::atomic<bool> running = true;
+
+    // the results are routed to a channel per request, so that the HTTP threads only wake up for their own results
+    server_result_router<server_task_result_ptr> router;
+
+    // add the id_task to the list of tasks waiting for response
+    void add_waiting_task_id(int id_task) {
+        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) router.size());
+
+        router.add({ id_task });
+    }
+
+    void add_waiting_tasks(const std::vector<server_task> & tasks) {
+        std::vector<int> id_tasks;
+        id_tasks.reserve(tasks.size());
+
+        for (const auto & task : tasks) {
+            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) router.size());
+            id_tasks.push_back(task.id);
+        }
+
+        router.add(id_tasks);
+    }
+
+    // when the request is finished, we can remove task associated with it
+    void remove_waiting_task_id(int id_task) {
+        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) router.size());
+
+        // note: this also cleans up all pending results
+        router.remove(id_task);
+    }
+
+    void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
+        for (const auto & id_task : id_tasks) {
+            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) router.size());
+            router.remove(id_task);
+        }
+    }
+
+    // This function blocks the thread until there is a response for one of the id_tasks
+    // note: the id_tasks must have been added with the same call to add_waiting_task_id() or add_waiting_tasks()
+    server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
+        server_task_result_ptr res;
+        if (!router.recv(id_tasks, res, std::chrono::milliseconds(-1), [&]{ return !running; })) {
+            if (!running) {
+                SRV_DBG("%s : queue result stop\n", __func__);
+                std::terminate(); // we cannot return here since the caller is HTTP code
+            }
+            GGML_ABORT("no waiting task for the results");
+        }
+
+        return res;
+    }
+
+    // same as recv(), but have timeout in seconds
+    // if timeout is reached, nullptr is returned
+    server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
+        server_task_result_ptr res;
+        router.recv(id_tasks, res, std::chrono::seconds(timeout), [&]{ return !running; });
+
+        if (!running) {
+            SRV_DBG("%s : queue result stop\n", __func__);
+            std::terminate(); // we cannot return here since the caller is HTTP code
+        }
+
+        return res;
+    }
+
+    // single-task version of recv()
+    server_task_result_ptr recv(int id_task) {
+        std::unordered_set<int> id_tasks = {id_task};
+        return recv(id_tasks);
+    }
+
+    // Send a new result to a waiting id_task
+    void send(server_task_result_ptr && result) {
+        SRV_DBG("sending result for task id = %d\n", result->id);
+
+        const int id_task = result->id;
+        if (router.send(id_task, std::move(result))) {
+            SRV_DBG("task id = %d pushed to result queue\n", id_task);
+        }
+    }
+
+    // terminate the waiting loop
+    void terminate() {
+        running = false;
+        router.notify_all();
+    }
+};
 
 struct server_context {
     common_params params_base;
@@ -1897,7 +2736,21 @@ struct server_context {
 
     llama_model * model_dft = nullptr;
 
-    llama_context_params cparams_dft;
+    // a single draft context with one sequence per slot, so that the drafts of all slots are generated together
+    llama_context * ctx_dft = nullptr;
+
+    // n-grams used by prompt lookup decoding besides the ones of the slot: the static cache is read-only, the dynamic
+    // cache is extended with the tokens of the finished requests and saved back to --lookup-cache-dynamic
+    common_ngram_cache lookup_cache_static;
+    common_ngram_cache lookup_cache_dynamic;
+
+    bool    lookup_cache_dirty   = false; // the dynamic cache has changed since it was last saved
+    int64_t t_lookup_cache_saved = 0;     // time of the last save of the dynamic cache
+
+    server_io_worker lookup_cache_io;
+
+    // computes the allowed tokens of the grammars while the batch is evaluated
+    server_io_worker grammar_worker;
 
     llama_batch batch {};
 
@@ -1918,10 +2771,29 @@ struct server_context {
     // Necessary similarity of prompt for slot selection
     float slot_prompt_similarity = 0.0f;
 
+    // index of the prompt prefixes held in the KV cache, shared across all slots
+    server_prefix_cache prefix_cache;
+
+    // states of the sequences evicted from the KV cache
+    server_kv_tiers kv_tiers;
+
+    // states of the frequently used prompt prefixes, persisted across restarts
+    server_prompt_store prompt_store;
+
+    // time in microseconds of a step of the target model without draft, indexed by the number of generating slots
+    std::vector<double> t_step_base;
+
+    // number of steps with draft since the last step without draft
+    int32_t n_step_drafted = 0;
+
     common_chat_templates_ptr chat_templates;
     oaicompat_parser_options  oai_parser_opt;
 
     ~server_context() {
+        if (lookup_cache_dirty) {
+            lookup_cache_save();
+        }
+
         mtmd_free(mctx);
 
         // Clear any sampling context
@@ -1929,13 +2801,8 @@ struct server_context {
             common_sampler_free(slot.smpl);
             slot.smpl = nullptr;
 
-            llama_free(slot.ctx_dft);
-            slot.ctx_dft = nullptr;
-
             common_speculative_free(slot.spec);
             slot.spec = nullptr;
-
-            llama_batch_free(slot.batch_spec);
         }
 
         llama_batch_free(batch);
@@ -1969,34 +2836,53 @@ struct server_context {
 
             params_dft.devices      = params_base.speculative.devices;
             params_dft.model        = params_base.speculative.model;
-            params_dft.n_ctx        = params_base.speculative.n_ctx == 0 ? params_base.n_ctx / params_base.n_parallel : params_base.speculative.n_ctx;
             params_dft.n_gpu_layers = params_base.speculative.n_gpu_layers;
-            params_dft.n_parallel   = 1;
+            params_dft.n_parallel   = params_base.n_parallel;
             params_dft.cache_type_k = params_base.speculative.cache_type_k;
             params_dft.cache_type_v = params_base.speculative.cache_type_v;
 
+            // the context of each slot in the draft model, the whole prompt of a slot can be evaluated in a single batch
+            const int n_ctx_dft = params_base.speculative.n_ctx == 0 ? params_base.n_ctx / params_base.n_parallel : params_base.speculative.n_ctx;
+
+            params_dft.n_ctx   = n_ctx_dft * params_base.n_parallel;
+            params_dft.n_batch = n_ctx_dft;
+
             llama_init_dft = common_init_from_params(params_dft);
 
             model_dft = llama_init_dft.model.get();
+            ctx_dft   = llama_init_dft.context.get();
 
             if (model_dft == nullptr) {
                 SRV_ERR("failed to load draft model, '%s'\n", params_base.speculative.model.path.c_str());
                 return false;
             }
 
-            if (!common_speculative_are_compatible(ctx, llama_init_dft.context.get())) {
+            if (!common_speculative_are_compatible(ctx, ctx_dft)) {
                 SRV_ERR("the draft model '%s' is not compatible with the target model '%s'\n", params_base.speculative.model.path.c_str(), params_base.model.path.c_str());
 
                 return false;
             }
+        }
+
+        if (!params_base.lookup_cache_static.empty()) {
+            try {
+                lookup_cache_static = common_ngram_cache_load(params_base.lookup_cache_static);
+            } catch (const std::ifstream::failure &) {
+                SRV_ERR("failed to open static lookup cache: %s\n", params_base.lookup_cache_static.c_str());
+                return false;
+            }
 
-            const int n_ctx_dft = llama_n_ctx(llama_init_dft.context.get());
+            SRV_INF("loaded static lookup cache, n_ngrams = %zu\n", lookup_cache_static.size());
+        }
 
-            cparams_dft = common_context_params_to_llama(params_dft);
-            cparams_dft.n_batch = n_ctx_dft;
+        if (!params_base.lookup_cache_dynamic.empty()) {
+            try {
+                lookup_cache_dynamic = common_ngram_cache_load(params_base.lookup_cache_dynamic);
+            } catch (const std::ifstream::failure &) {
+                // the file is created once the first request has finished
+            }
 
-            // the context is not needed - we will create one for each slot
-            llama_init_dft.context.reset();
+            SRV_INF("loaded dynamic lookup cache, n_ngrams = %zu\n", lookup_cache_dynamic.size());
         }
 
         chat_templates = common_chat_templates_init(model, params_base.chat_template);
@@ -2032,6 +2918,22 @@ struct server_context {
                 SRV_WRN("%s\n", "cache_reuse is not supported by multimodal, it will be disabled");
             }
 
+            if (params_base.prefix_cache_min) {
+                params_base.prefix_cache_min = 0;
+                SRV_WRN("%s\n", "prefix_cache is not supported by multimodal, it will be disabled");
+            }
+
+            if (params_base.kv_spill_ram || params_base.kv_spill_disk) {
+                params_base.kv_spill_ram  = 0;
+                params_base.kv_spill_disk = 0;
+                SRV_WRN("%s\n", "kv_spill is not supported by multimodal, it will be disabled");
+            }
+
+            if (!params_base.prompt_store_path.empty()) {
+                params_base.prompt_store_path.clear();
+                SRV_WRN("%s\n", "prompt_store is not supported by multimodal, it will be disabled");
+            }
+
             if (!params_base.speculative.model.path.empty()) {
                 SRV_ERR("%s\n", "err: speculative decode is not supported by multimodal");
                 return false;
@@ -2048,6 +2950,11 @@ struct server_context {
                 params_base.n_cache_reuse = 0;
                 SRV_WRN("%s\n", "cache_reuse is not supported by this context, it will be disabled");
             }
+
+            if (params_base.prefix_cache_min) {
+                params_base.prefix_cache_min = 0;
+                SRV_WRN("%s\n", "prefix_cache is not supported by this context, it will be disabled");
+            }
         }
 
         return true;
@@ -2067,17 +2974,12 @@ struct server_context {
             slot.n_predict = params_base.n_predict;
             slot.mctx = mctx;
             slot.cache_tokens.has_mtmd = mctx != nullptr;
+            slot.detokenizer.reset(llama_detokenizer_init(vocab));
 
-            if (model_dft) {
-                slot.batch_spec = llama_batch_init(params_base.speculative.n_max + 1, 0, 1);
+            if (ctx_dft) {
+                slot.ctx_dft = ctx_dft;
 
-                slot.ctx_dft = llama_init_from_model(model_dft, cparams_dft);
-                if (slot.ctx_dft == nullptr) {
-                    SRV_ERR("%s", "failed to create draft context\n");
-                    return;
-                }
-
-                slot.spec = common_speculative_init(slot.ctx_dft);
+                slot.spec = common_speculative_init(slot.ctx_dft, slot.id);
                 if (slot.spec == nullptr) {
                     SRV_ERR("%s", "failed to create speculator\n");
                     return;
@@ -2089,7 +2991,8 @@ struct server_context {
             slot.params.sampling = params_base.sampling;
             slot.params.n_keep = params_base.n_keep;
 
-            slot.callback_on_release = [this](int) {
+            slot.callback_on_release = [this](int id_slot) {
+                lookup_cache_update(slots[id_slot]);
                 queue_tasks.pop_deferred_task();
             };
 
@@ -2098,6 +3001,8 @@ struct server_context {
             slots.push_back(std::move(slot));
         }
 
+        t_step_base.assign(slots.size() + 1, 0.0);
+
         default_generation_settings_for_props = slots[0].to_json();
 
         // the update_slots() logic will always submit a maximum of n_batch or n_parallel tokens
@@ -2109,6 +3014,38 @@ struct server_context {
 
         metrics.init();
 
+        prefix_cache.n_tokens_max = params_base.prefix_cache_size;
+
+        queue_tasks.tenant_weights = params_base.api_key_weights;
+
+        kv_tiers.n_bytes_host_max = (size_t) params_base.kv_spill_ram  * 1024 * 1024;
+        kv_tiers.n_bytes_disk_max = (size_t) params_base.kv_spill_disk * 1024 * 1024;
+        kv_tiers.path_disk        = params_base.kv_spill_path;
+
+        if (kv_tiers.n_bytes_disk_max > 0) {
+            if (kv_tiers.path_disk.empty() || !fs_create_directory_with_parents(kv_tiers.path_disk)) {
+                SRV_WRN("%s\n", "invalid kv_spill_path, the disk tier will be disabled");
+                kv_tiers.n_bytes_disk_max = 0;
+            }
+        }
+
+        if (params_base.preempt && !kv_tiers.enabled()) {
+            SRV_WRN("%s\n", "--preempt without --kv-spill-ram or --kv-spill-disk: the preempted requests will process their prompt and generated tokens again when they are resumed");
+        }
+
+        if (!params_base.prompt_store_path.empty()) {
+            if (!fs_create_directory_with_parents(params_base.prompt_store_path)) {
+                SRV_WRN("%s\n", "invalid prompt_store path, the prompt store will be disabled");
+            } else {
+                prompt_store.n_block     = params_base.prompt_store_block;
+                prompt_store.n_hits_min  = params_base.prompt_store_hits;
+                prompt_store.n_bytes_max = (size_t) params_base.prompt_store_size * 1024 * 1024;
+                prompt_store.use_mmap    = params_base.use_mmap;
+
+                prompt_store.init(params_base.prompt_store_path, model_fingerprint());
+            }
+        }
+
         oai_parser_opt = {
             /* use_jinja             */ params_base.use_jinja,
             /* prefill_assistant     */ params_base.prefill_assistant,
@@ -2194,14 +3131,124 @@ struct server_context {
         return ret;
     }
 
+    // suspend the generating slot with the lowest priority in favor of a task with a higher priority
+    // the request of the slot is deferred as a new task that resumes the generation from the tokens produced so far
+    // the KV cells of the slot are spilled to the KV state tiers if they are enabled, otherwise the resumed task
+    //   processes the prompt and the generated tokens again
+    server_slot * preempt_slot(const server_task & task) {
+        if (task.type != SERVER_TASK_TYPE_COMPLETION && task.type != SERVER_TASK_TYPE_INFILL) {
+            return nullptr;
+        }
+
+        server_slot * ret = nullptr;
+
+        for (server_slot & slot : slots) {
+            if (slot.state != SLOT_STATE_GENERATING || slot.params.priority >= task.params.priority) {
+                continue;
+            }
+
+            // the state of the grammar cannot be recovered from the generated tokens
+            if (!slot.params.sampling.grammar.empty()) {
+                continue;
+            }
+
+            // the resumed prompt must fit in the context without truncation
+            if (slot.n_past + 1 >= slot.n_ctx || mctx) {
+                continue;
+            }
+
+            // prefer the lowest priority, then the slot that started generating last
+            if (ret == nullptr || slot.params.priority < ret->params.priority ||
+                (slot.params.priority == ret->params.priority && slot.t_start_generation > ret->t_start_generation)) {
+                ret = &slot;
+            }
+        }
+
+        if (ret == nullptr) {
+            return nullptr;
+        }
+
+        server_slot & slot = *ret;
+
+        auto resume = std::make_shared<server_task_resume>();
+
+        resume->generated_text          = slot.generated_text;
+        resume->generated_tokens        = slot.generated_tokens;
+        resume->generated_token_probs   = slot.generated_token_probs;
+        resume->chat_msg                = slot.chat_msg;
+        resume->generated_tool_call_ids = slot.generated_tool_call_ids;
+        resume->detokenizer             = std::move(slot.detokenizer);
+        resume->stop_state              = slot.stop_matcher.state;
+        resume->n_sent_text             = slot.n_sent_text;
+        resume->last_nl_pos             = slot.last_nl_pos;
+        resume->has_new_line            = slot.has_new_line;
+        resume->n_decoded               = slot.n_decoded;
+
+        // the last sampled token has not been evaluated yet
+        llama_tokens prompt = slot.cache_tokens.get_text_tokens();
+        prompt.push_back(slot.sampled);
+
+        server_task task_resume(slot.task_type);
+
+        task_resume.id            = slot.id_task;
+        task_resume.index         = slot.index;
+        task_resume.tenant        = slot.tenant;
+        task_resume.params        = slot.params;
+        task_resume.prompt_tokens = server_tokens(prompt, false);
+        task_resume.resume        = std::move(resume);
+
+        // reuse the spilled KV cells when the generation is resumed
+        task_resume.params.cache_prompt = true;
+
+        SLT_INF(slot, "preempted by task %d, priority = %d < %d, n_decoded = %d\n",
+                task.id, slot.params.priority, task.params.priority, slot.n_decoded);
+
+        metrics.on_preempted();
+
+        if (kv_tiers.enabled()) {
+            kv_tiers_spill(slot, true);
+        }
+
+        queue_tasks.defer(std::move(task_resume));
+
+        slot.detokenizer.reset(llama_detokenizer_init(vocab));
+
+        // note: do not call release(), so that no other deferred task is scheduled in place of the new task
+        slot.t_last_used = ggml_time_us();
+        slot.state       = SLOT_STATE_IDLE;
+
+        return &slot;
+    }
+
     bool launch_slot_with_task(server_slot & slot, server_task && task) {
         slot.reset();
         slot.id_task       = task.id;
         slot.index         = task.index;
+        slot.tenant        = task.tenant;
         slot.task_type     = task.type;
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
 
+        slot.stop_matcher.init(slot.params.antiprompt);
+
+        if (task.resume) {
+            // continue the generation of a preempted slot - the prompt already includes the generated tokens
+            auto & resume = *task.resume;
+
+            slot.generated_text          = resume.generated_text;
+            slot.generated_tokens        = resume.generated_tokens;
+            slot.generated_token_probs   = resume.generated_token_probs;
+            slot.chat_msg                = resume.chat_msg;
+            slot.generated_tool_call_ids = resume.generated_tool_call_ids;
+            slot.detokenizer             = std::move(resume.detokenizer);
+            slot.stop_matcher.state      = resume.stop_state;
+            slot.n_sent_text             = resume.n_sent_text;
+            slot.last_nl_pos             = resume.last_nl_pos;
+            slot.has_new_line            = resume.has_new_line;
+            slot.n_resumed               = resume.n_decoded;
+            slot.resumed                 = true;
+        }
+
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora is changed, we cannot reuse cached tokens
             slot.cache_tokens.clear();
@@ -2214,6 +3261,39 @@ struct server_context {
         }
         SLT_DBG(slot, "launching slot : %s\n", safe_json_to_str(slot.to_json()).c_str());
 
+        if (kv_tiers.enabled()) {
+            kv_tiers_spill(slot);
+        }
+
+        if (params_base.prefix_cache_min > 0) {
+            if (slot.params.cache_prompt) {
+                prefix_cache_attach(slot);
+            }
+
+            // the slot is about to modify its KV cells, they will be indexed again once the new prompt is processed
+            prefix_cache.remove(slot.id);
+        }
+
+        if (kv_tiers.enabled() && slot.params.cache_prompt) {
+            kv_tiers_restore(slot);
+        }
+
+        // note: the stored states are computed without adapters
+        const bool has_lora = std::any_of(slot.lora.begin(), slot.lora.end(), [](const common_adapter_lora_info & la) {
+            return la.scale != 0.0f;
+        });
+
+        const bool is_completion = slot.task_type == SERVER_TASK_TYPE_COMPLETION || slot.task_type == SERVER_TASK_TYPE_INFILL;
+
+        if (prompt_store.enabled() && slot.params.cache_prompt && is_completion && !has_lora) {
+            prompt_store_load(slot);
+
+            // a resumed generation was already counted when it was first launched
+            if (slot.n_resumed == 0) {
+                slot.n_store = prompt_store.hit(slot.prompt_tokens.get_text_tokens());
+            }
+        }
+
         if (slot.n_predict > 0 && slot.params.n_predict > slot.n_predict) {
             // Might be better to reject the request with a 400 ?
             SLT_WRN(slot, "n_predict = %d exceeds server configuration, setting to %d\n", slot.params.n_predict, slot.n_predict);
@@ -2233,12 +3313,6 @@ struct server_context {
             }
         }
 
-        if (slot.ctx_dft) {
-            llama_batch_free(slot.batch_spec);
-
-            slot.batch_spec = llama_batch_init(slot.params.speculative.n_max + 1, 0, 1);
-        }
-
         slot.state = SLOT_STATE_STARTED;
 
         SLT_INF(slot, "%s", "processing task\n");
@@ -2246,11 +3320,156 @@ struct server_context {
         return true;
     }
 
+    // reuse the longest prompt prefix that is already computed in the KV cells of another slot
+    void prefix_cache_attach(server_slot & slot) {
+        const auto [n_match, id_src] = prefix_cache.find(slot.prompt_tokens.get_text_tokens(), slot.id);
+
+        if (id_src < 0 || n_match < (size_t) params_base.prefix_cache_min) {
+            return;
+        }
+
+        server_slot * slot_src = get_slot_by_id(id_src);
+
+        // the KV cells can only be shared if they were computed with the same adapters
+        if (slot_src == nullptr || !are_lora_equal(slot_src->lora, slot.lora)) {
+            return;
+        }
+
+        auto * mem = llama_get_memory(ctx);
+
+        // the beginning of the source sequence may have been evicted (e.g. SWA)
+        if (llama_memory_seq_pos_min(mem, slot_src->id) > 0) {
+            return;
+        }
+
+        // the index may be stale - verify against the actual tokens of the source slot
+        const size_t n_src = std::min(n_match, slot_src->cache_tokens.get_common_prefix(slot.prompt_tokens));
+        const size_t n_own = slot.cache_tokens.get_common_prefix(slot.prompt_tokens);
+
+        if (n_src < (size_t) params_base.prefix_cache_min || n_src <= n_own) {
+            return;
+        }
+
+        llama_memory_seq_rm(mem, slot.id, -1, -1);
+        llama_memory_seq_cp(mem, slot_src->id, slot.id, -1, -1);
+
+        if (!llama_memory_seq_rm(mem, slot.id, n_src, -1)) {
+            // could not partially delete (likely using a non-Transformer model)
+            llama_memory_seq_rm(mem, slot.id, -1, -1);
+            slot.cache_tokens.clear();
+            return;
+        }
+
+        const llama_tokens & tokens_src = slot_src->cache_tokens.get_text_tokens();
+
+        slot.cache_tokens.clear();
+        slot.cache_tokens.insert({ tokens_src.begin(), tokens_src.begin() + n_src });
+
+        SLT_INF(slot, "attached to prefix cache of slot %d, n_tokens = %zu (own cache: %zu)\n", slot_src->id, n_src, n_own);
+    }
+
+    // save the cached state of the slot before it is overwritten by a prompt that shares little of it
+    // with force, the state is saved whatever the prompt (e.g. when the slot is preempted)
+    void kv_tiers_spill(server_slot & slot, bool force = false) {
+        const size_t n_cached = slot.cache_tokens.size();
+        const size_t n_common = slot.cache_tokens.get_common_prefix(slot.prompt_tokens);
+
+        if (n_cached == 0 || (!force && 2*n_common >= n_cached)) {
+            return;
+        }
+
+        // the state may already be saved, e.g. when the slot was preempted before the new task was launched
+        {
+            const auto [i, n_match] = kv_tiers.find(slot.cache_tokens.get_text_tokens(), slot.lora);
+            if (i >= 0 && n_match == n_cached && kv_tiers.entries[i].tokens.size() == n_cached) {
+                return;
+            }
+        }
+
+        const int64_t t_start = ggml_time_us();
+
+        if (kv_tiers.spill(ctx, slot.id, slot.cache_tokens.get_text_tokens(), slot.lora)) {
+            SLT_INF(slot, "spilled KV state, n_tokens = %zu, t = %.2f ms\n", n_cached, (ggml_time_us() - t_start) / 1e3);
+        }
+    }
+
+    // restore a previously evicted state if it matches the new prompt better than the current cache
+    void kv_tiers_restore(server_slot & slot) {
+        const auto [i, n_match] = kv_tiers.find(slot.prompt_tokens.get_text_tokens(), slot.lora);
+
+        if (i < 0 || n_match <= slot.cache_tokens.get_common_prefix(slot.prompt_tokens)) {
+            return;
+        }
+
+        const int64_t t_start = ggml_time_us();
+
+        llama_tokens tokens = kv_tiers.restore(ctx, slot.id, i);
+
+        slot.cache_tokens.clear();
+        slot.cache_tokens.insert(tokens);
+
+        if (tokens.empty()) {
+            SLT_WRN(slot, "%s", "failed to restore KV state\n");
+            return;
+        }
+
+        SLT_INF(slot, "restored KV state, n_tokens = %zu, n_match = %zu, t = %.2f ms\n", tokens.size(), n_match, (ggml_time_us() - t_start) / 1e3);
+    }
+
+    // reload the longest stored prefix of the prompt if it matches better than the current cache
+    void prompt_store_load(server_slot & slot) {
+        const llama_tokens & prompt = slot.prompt_tokens.get_text_tokens();
+
+        const auto [key, n_match] = prompt_store.find(prompt);
+
+        if (n_match == 0 || n_match <= slot.cache_tokens.get_common_prefix(slot.prompt_tokens)) {
+            return;
+        }
+
+        const int64_t t_start = ggml_time_us();
+
+        llama_tokens tokens = prompt_store.load(ctx, slot.id, key, prompt);
+
+        slot.cache_tokens.clear();
+        slot.cache_tokens.insert(tokens);
+
+        if (tokens.empty()) {
+            return;
+        }
+
+        SLT_INF(slot, "loaded prompt prefix from the prompt store, n_tokens = %zu, t = %.2f ms\n", tokens.size(), (ggml_time_us() - t_start) / 1e3);
+    }
+
+    // persist the prompt prefix of the slot, which has just been computed
+    void prompt_store_save(server_slot & slot) {
+        const int64_t t_start = ggml_time_us();
+
+        const llama_tokens & tokens = slot.cache_tokens.get_text_tokens();
+
+        if (prompt_store.save(ctx, slot.id, { tokens.begin(), tokens.begin() + slot.n_store })) {
+            SLT_INF(slot, "copied prompt prefix to the prompt store, n_tokens = %d, t = %.2f ms\n", slot.n_store, (ggml_time_us() - t_start) / 1e3);
+        }
+
+        slot.n_store = 0;
+    }
+
+    // identifies the model and the layout of its KV cache, the stored states can only be loaded if it matches
+    std::string model_fingerprint() const {
+        char desc[256];
+        llama_model_desc(model, desc, sizeof(desc));
+
+        return string_format("%s|%" PRIu64 "|%" PRIu64 "|%d|%d|%d|%d|%d|%f|%f", desc,
+                llama_model_size(model), llama_model_n_params(model), llama_model_n_layer(model), llama_model_n_embd(model),
+                (int) params_base.cache_type_k, (int) params_base.cache_type_v, (int) params_base.flash_attn,
+                params_base.rope_freq_base, params_base.rope_freq_scale);
+    }
+
     void kv_cache_clear() {
         SRV_DBG("%s", "clearing KV cache\n");
 
         // clear the entire KV cache
         llama_memory_clear(llama_get_memory(ctx), true);
+        prefix_cache.clear();
         clean_kv_cache = false;
     }
 
@@ -2265,25 +3484,27 @@ struct server_context {
         }
         slot.has_next_token = true;
 
-        // check if there is incomplete UTF-8 character at the end
-        bool incomplete = validate_utf8(slot.generated_text) < slot.generated_text.size();
+        // the token is only the beginning of an incomplete UTF-8 character
+        const bool incomplete = token_str.empty() && llama_detokenizer_n_pending(slot.detokenizer.get()) > 0;
 
         // search stop word and delete it
         if (!incomplete) {
             size_t pos = std::min(slot.n_sent_text, slot.generated_text.size());
 
-            const std::string str_test = slot.generated_text.substr(pos);
             bool send_text = true;
 
-            size_t stop_pos = slot.find_stopping_strings(str_test, token_str.size(), true);
+            int32_t stop_word = -1;
+            const size_t stop_pos = slot.stop_matcher.feed(slot.generated_text, slot.generated_text.size() - token_str.size(), stop_word);
             if (stop_pos != std::string::npos) {
-                slot.generated_text.erase(
-                    slot.generated_text.begin() + pos + stop_pos,
-                    slot.generated_text.end());
+                slot.stop           = STOP_TYPE_WORD;
+                slot.stopping_word  = slot.params.antiprompt[stop_word];
+                slot.has_next_token = false;
+
+                slot.generated_text.erase(stop_pos);
                 pos = std::min(slot.n_sent_text, slot.generated_text.size());
-            } else if (slot.has_next_token) {
-                stop_pos = slot.find_stopping_strings(str_test, token_str.size(), false);
-                send_text = stop_pos == std::string::npos;
+            } else {
+                // hold back the text that could be the beginning of a stop word
+                send_text = !slot.stop_matcher.partial();
             }
 
             // check if there is any token to predict
@@ -2302,10 +3523,6 @@ struct server_context {
             }
         }
 
-        if (incomplete) {
-            slot.has_next_token = true;
-        }
-
         // if context shifting is disabled, make sure that we don't run out of context
         if (!params_base.ctx_shift && slot.n_past + 1 >= slot.n_ctx) {
             slot.stop           = STOP_TYPE_LIMIT;
@@ -2401,6 +3618,11 @@ struct server_context {
                     slot.params.n_predict, n_ctx_train);
         }
 
+        if (!slot.has_next_token && slot.stop != STOP_TYPE_WORD) {
+            // the bytes of an incomplete UTF-8 character at the end of the generation
+            slot.generated_text += common_detokenizer_flush(slot.detokenizer.get());
+        }
+
         SLT_DBG(slot, "n_decoded = %d, n_remaining = %d, next token: %5d '%s'\n", slot.n_decoded, slot.n_remaining, result.tok, token_str.c_str());
 
         return slot.has_next_token; // continue
@@ -2754,6 +3976,10 @@ struct server_context {
 
                     server_slot * slot = id_slot != -1 ? get_slot_by_id(id_slot) : get_available_slot(task);
 
+                    if (slot == nullptr && id_slot == -1 && params_base.preempt) {
+                        slot = preempt_slot(task);
+                    }
+
                     if (slot == nullptr) {
                         // if no slot is available, we defer this task for processing later
                         SRV_DBG("no slot is available, defer task, id_task = %d\n", task.id);
@@ -2828,6 +4054,29 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    res->n_batch_steps_total          = metrics.n_batch_steps_total;
+                    res->n_batch_prefill_tokens_total = metrics.n_batch_prefill_tokens_total;
+                    res->n_batch_decode_tokens_total  = metrics.n_batch_decode_tokens_total;
+
+                    res->n_batch_mixed_steps_total          = metrics.n_batch_mixed_steps_total;
+                    res->n_batch_mixed_prefill_tokens_total = metrics.n_batch_mixed_prefill_tokens_total;
+
+                    res->n_preempt_total                = metrics.n_preempt_total;
+                    res->n_resume_prompt_tokens_total   = metrics.n_resume_prompt_tokens_total;
+                    res->n_resume_restored_tokens_total = metrics.n_resume_restored_tokens_total;
+
+                    res->n_kv_spill_total   = kv_tiers.n_spill_total;
+                    res->n_kv_restore_total = kv_tiers.n_restore_total;
+                    res->n_kv_drop_total    = kv_tiers.n_drop_total;
+                    res->n_kv_bytes_host    = kv_tiers.n_bytes_host;
+                    res->n_kv_bytes_disk    = kv_tiers.n_bytes_disk;
+                    res->n_kv_entries_host  = kv_tiers.n_entries_host();
+                    res->n_kv_entries_disk  = kv_tiers.n_entries_disk();
+
+                    res->n_prompt_store_save_total = prompt_store.n_save_total;
+                    res->n_prompt_store_load_total = prompt_store.n_load_total;
+                    res->n_prompt_store_bytes      = prompt_store.n_bytes;
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -2895,6 +4144,9 @@ struct server_context {
                     std::string filename = task.slot_action.filename;
                     std::string filepath = task.slot_action.filepath;
 
+                    // the KV cells of the slot are about to be overwritten
+                    prefix_cache.remove(slot->id);
+
                     llama_tokens tokens;
                     tokens.resize(slot->n_ctx);
                     size_t token_count = 0;
@@ -2941,6 +4193,7 @@ struct server_context {
                     const size_t n_erased = slot->cache_tokens.size();
                     llama_memory_seq_rm(llama_get_memory(ctx), slot->id, -1, -1);
                     slot->cache_tokens.clear();
+                    prefix_cache.remove(slot->id);
 
                     auto res = std::make_unique<server_task_result_slot_erase>();
                     res->id       = task.id;
@@ -2959,6 +4212,209 @@ struct server_context {
         }
     }
 
+    // draft the continuation of the slot from the n-grams of its own tokens (prompt lookup decoding)
+    llama_tokens gen_draft_lookup(server_slot & slot, int n_draft_max) {
+        const llama_tokens & tokens = slot.cache_tokens.get_text_tokens();
+
+        auto & inp = slot.lookup_tokens;
+
+        // the n-gram cache can only be extended, it is rebuilt if the tokens of the slot changed
+        size_t n_keep = inp.size();
+        if (n_keep > tokens.size() || !std::equal(inp.begin(), inp.end(), tokens.begin())) {
+            slot.lookup_cache.clear();
+            inp.clear();
+
+            n_keep = 0;
+        }
+
+        // the sampled token is kept in the indexed tokens, it is always the next token of the slot
+        inp.insert(inp.end(), tokens.begin() + n_keep, tokens.end());
+        inp.push_back(slot.sampled);
+
+        common_ngram_cache_update(slot.lookup_cache, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, inp, inp.size() - n_keep, false);
+
+        llama_tokens draft = { slot.sampled };
+
+        common_ngram_cache_draft(inp, draft, n_draft_max, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, slot.lookup_cache, lookup_cache_dynamic, lookup_cache_static);
+
+        return { draft.begin() + 1, draft.end() };
+    }
+
+    // add the n-grams of the slot to the dynamic lookup cache, and save it at most once per minute
+    // the n-grams of the slot are rebuilt by its next request, so that they are not merged twice
+    void lookup_cache_update(server_slot & slot) {
+        if (params_base.lookup_cache_dynamic.empty() || slot.lookup_tokens.empty()) {
+            return;
+        }
+
+        common_ngram_cache_merge(lookup_cache_dynamic, slot.lookup_cache);
+
+        slot.lookup_cache.clear();
+        slot.lookup_tokens.clear();
+
+        lookup_cache_dirty = true;
+
+        if (ggml_time_us() - t_lookup_cache_saved >= 60ll*1000*1000) {
+            lookup_cache_save();
+        }
+    }
+
+    // the cache is copied and written by a background thread
+    void lookup_cache_save() {
+        lookup_cache_dirty   = false;
+        t_lookup_cache_saved = ggml_time_us();
+
+        lookup_cache_io.push([cache = lookup_cache_dynamic, fname = params_base.lookup_cache_dynamic]() mutable {
+            std::string fname_tmp = fname + ".tmp";
+
+            common_ngram_cache_save(cache, fname_tmp);
+
+            if (std::rename(fname_tmp.c_str(), fname.c_str()) != 0) {
+                SRV_WRN("failed to write dynamic lookup cache '%s'\n", fname.c_str());
+                std::remove(fname_tmp.c_str());
+                return false;
+            }
+
+            SRV_DBG("saved dynamic lookup cache '%s', n_ngrams = %zu\n", fname.c_str(), cache.size());
+
+            return true;
+        });
+    }
+
+    // generate the drafts of the speculating slots among the generating ones, with a single pass of the draft model
+    // for the slots that use it, or from the n-grams of their tokens for the slots that use prompt lookup decoding
+    // the drafts are capped so that the sampled and draft tokens of all generating slots fit in a single batch
+    void gen_drafts(const std::vector<server_slot *> & slots_generating) {
+        std::vector<common_speculative_draft> drafts;
+        std::vector<server_slot *>            slots_spec;
+
+        const auto set_draft = [](server_slot & slot, llama_tokens & draft) {
+            // ignore small drafts
+            if (slot.params.speculative.n_min > (int) draft.size()) {
+                SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) draft.size(), slot.params.speculative.n_min);
+
+                return;
+            }
+
+            // keep track of total number of drafted tokens tested
+            slot.n_draft_total += draft.size();
+
+            slot.drafted = std::move(draft);
+        };
+
+        int32_t n_draft_budget = llama_n_batch(ctx) - (int32_t) slots_generating.size();
+
+        // the adaptive drafts need the time of a step without draft, which is measured first and then refreshed from
+        // time to time by skipping all drafts of a step
+        const bool measure_step = t_step_base[slots_generating.size()] <= 0.0 || n_step_drafted >= common_speculative_stats::n_refresh;
+
+        bool any_adaptive = false;
+        for (const auto * slot : slots_generating) {
+            any_adaptive |= slot->can_speculate() && slot->params.speculative.adaptive;
+        }
+
+        if (any_adaptive && measure_step) {
+            SRV_DBG("%s", "measuring the time of a step without draft\n");
+
+            for (auto * slot : slots_generating) {
+                slot->drafted.clear();
+            }
+
+            return;
+        }
+
+        for (auto * slot_ptr : slots_generating) {
+            auto & slot = *slot_ptr;
+
+            slot.drafted.clear();
+
+            if (!slot.can_speculate()) {
+                continue;
+            }
+
+            if (mctx) {
+                // we should never reach this, as speculative is automatically disabled if mmproj is loaded
+                GGML_ABORT("not supported by multimodal");
+            }
+
+            // determine the max draft that fits the current slot state
+            int n_draft_max = slot.params.speculative.n_max;
+
+            if (slot.params.speculative.adaptive) {
+                n_draft_max = slot.draft_stats.next(slot.params.speculative.n_min, n_draft_max);
+
+                if (n_draft_max == 0) {
+                    SLT_DBG(slot, "drafting is not profitable, p_accept = %.3f, cost = %.3f - skipping speculative decoding\n", slot.draft_stats.p_accept(), slot.draft_stats.cost);
+
+                    continue;
+                }
+            }
+
+            // note: n_past is not yet increased for the sampled token
+            //       also, need to leave space for 1 extra token to allow context shifts
+            n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_past - 2);
+
+            if (slot.n_remaining > 0) {
+                n_draft_max = std::min(n_draft_max, slot.n_remaining - 1);
+            }
+
+            n_draft_max = std::min(n_draft_max, n_draft_budget);
+
+            SLT_DBG(slot, "max possible draft: %d\n", n_draft_max);
+
+            if (n_draft_max < slot.params.speculative.n_min) {
+                SLT_DBG(slot, "the max possible draft is too small: %d < %d - skipping speculative decoding\n", n_draft_max, slot.params.speculative.n_min);
+
+                continue;
+            }
+
+            n_draft_budget -= n_draft_max;
+
+            if (slot.params.speculative.lookup || slot.ctx_dft == nullptr) {
+                const int64_t t_start = ggml_time_us();
+
+                llama_tokens draft = gen_draft_lookup(slot, n_draft_max);
+
+                slot.t_draft = draft.empty() ? 0.0 : (double) (ggml_time_us() - t_start) / draft.size();
+
+                set_draft(slot, draft);
+
+                continue;
+            }
+
+            struct common_speculative_params params_spec;
+            params_spec.n_draft   = n_draft_max;
+            params_spec.n_reuse   = llama_n_ctx(slot.ctx_dft) / llama_n_seq_max(slot.ctx_dft) - slot.params.speculative.n_max;
+            params_spec.p_min     = slot.params.speculative.p_min;
+
+            drafts.push_back({ slot.spec, params_spec, &slot.cache_tokens.get_text_tokens(), slot.sampled, {} });
+            slots_spec.push_back(&slot);
+        }
+
+        if (drafts.empty()) {
+            return;
+        }
+
+        const int64_t t_start = ggml_time_us();
+
+        common_speculative_gen_drafts(drafts);
+
+        const int64_t t_draft = ggml_time_us() - t_start;
+
+        size_t n_drafted = 0;
+        for (const auto & draft : drafts) {
+            n_drafted += draft.result.size();
+        }
+
+        for (size_t i = 0; i < drafts.size(); ++i) {
+            auto & slot = *slots_spec[i];
+
+            slot.t_draft = n_drafted > 0 ? (double) t_draft / n_drafted : 0.0;
+
+            set_draft(slot, drafts[i].result);
+        }
+    }
+
     void update_slots() {
         // check if all slots are idle
         {
@@ -3014,6 +4470,9 @@ struct server_context {
 
                 SLT_WRN(slot, "slot context shift, n_keep = %d, n_left = %d, n_discard = %d\n", n_keep, n_left, n_discard);
 
+                // the positions of the cached prompt are about to change
+                prefix_cache.remove(slot.id);
+
                 llama_memory_seq_rm (llama_get_memory(ctx), slot.id, n_keep            , n_keep + n_discard);
                 llama_memory_seq_add(llama_get_memory(ctx), slot.id, n_keep + n_discard, slot.n_past,        -n_discard);
 
@@ -3045,7 +4504,57 @@ struct server_context {
             return params_base.special || slot.params.sampling.preserved_tokens.find(token) != slot.params.sampling.preserved_tokens.end();
         };
 
+        // verify the draft of the slot, its sampled and draft tokens have their logits at [idx, idx + n_draft]
+        auto accept_draft = [&](server_slot & slot, int idx) {
+            std::vector<int> idxs(slot.drafted.size() + 1);
+            std::iota(idxs.begin(), idxs.end(), idx);
+
+            // the accepted tokens from the speculation
+            const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, idxs, slot.drafted);
+
+            const int n_draft = slot.drafted.size();
+
+            slot.drafted.clear();
+
+            slot.n_past    += ids.size() - 1;
+            slot.n_decoded += ids.size();
+
+            slot.t_token_generation = (ggml_time_us() - slot.t_start_generation) / 1e3;
+
+            // update how many tokens out of those tested were accepted
+            slot.n_draft_accepted += ids.size() - 1;
+
+            slot.draft_stats.update_accept(n_draft, ids.size() - 1);
+
+            slot.cache_tokens.insert({ids.begin(), ids.end() - 1});
+
+            llama_memory_seq_rm(llama_get_memory(ctx), slot.id, slot.n_past, -1);
+
+            for (size_t i = 0; i < ids.size(); ++i) {
+                completion_token_output result;
+
+                result.tok          = ids[i];
+                result.text_to_send = common_detokenizer_push(slot.detokenizer.get(), result.tok, accept_special_token(slot, result.tok));
+                result.prob         = 1.0f; // set later
+
+                // TODO: set result.probs
+
+                if (!process_token(result, slot)) {
+                    // release slot because of stop condition
+                    slot.release();
+                    slot.print_timings();
+                    send_final_response(slot);
+                    metrics.on_prediction(slot);
+                    break;
+                }
+            }
+
+            SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", (int) ids.size() - 1, n_draft, slot.n_past);
+        };
+
         // frist, add sampled tokens from any ongoing sequences
+        std::vector<server_slot *> slots_generating;
+
         for (auto & slot : slots) {
             if (slot.state != SLOT_STATE_GENERATING) {
                 continue;
@@ -3058,10 +4567,33 @@ struct server_context {
                 continue;
             }
 
+            slots_generating.push_back(&slot);
+        }
+
+        // draft the continuations of all speculating slots in a single pass of the draft model
+        gen_drafts(slots_generating);
+
+        // the slots with a draft in this batch, and their total number of draft tokens
+        std::vector<server_slot *> slots_drafted;
+        int32_t n_drafted = 0;
+
+        for (auto * slot_ptr : slots_generating) {
+            auto & slot = *slot_ptr;
+
             slot.i_batch = batch.n_tokens;
 
             common_batch_add(batch, slot.sampled, slot.n_past, { slot.id }, true);
 
+            // the draft is verified by the target model in the same batch as the tokens of the other slots
+            for (size_t i = 0; i < slot.drafted.size(); ++i) {
+                common_batch_add(batch, slot.drafted[i], slot.n_past + 1 + i, { slot.id }, true);
+            }
+
+            if (!slot.drafted.empty()) {
+                slots_drafted.push_back(&slot);
+                n_drafted += slot.drafted.size();
+            }
+
             slot.n_past += 1;
             slot.cache_tokens.push_back(slot.sampled);
 
@@ -3073,6 +4605,16 @@ struct server_context {
         int32_t n_batch  = llama_n_batch(ctx);
         int32_t n_ubatch = llama_n_ubatch(ctx);
 
+        // the sampled tokens of the generating slots have already been added to the batch
+        const int32_t n_decode = batch.n_tokens;
+
+        // while some slots are generating, cap the number of prompt tokens in the batch so that long prompts are
+        // ingested in chunks across several iterations instead of stalling the generation of the other slots
+        int32_t n_batch_prompt = n_batch;
+        if (n_decode > 0 && params_base.n_prefill_chunk > 0) {
+            n_batch_prompt = std::min(n_batch, n_decode + params_base.n_prefill_chunk);
+        }
+
         // next, batch any pending prompts without exceeding n_batch
         if (params_base.cont_batching || batch.n_tokens == 0) {
             for (auto & slot : slots) {
@@ -3271,6 +4813,11 @@ struct server_context {
                         }
 
                         slot.n_prompt_tokens_processed = 0;
+
+                        // nothing to store if the prefix is already cached
+                        if (slot.n_store <= slot.n_past || slot.n_store > slot.n_prompt_tokens) {
+                            slot.n_store = 0;
+                        }
                     }
 
                     if (!slot.can_split()) {
@@ -3319,7 +4866,8 @@ struct server_context {
                     }
 
                     // add prompt tokens for processing in the current batch
-                    while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch) {
+                    // stop at the end of the prefix to store, so that its state can be saved after the batch is decoded
+                    while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch_prompt && (slot.n_store == 0 || slot.n_past != slot.n_store)) {
                         // get next token to process
                         llama_token cur_tok = slot.prompt_tokens[slot.n_past];
                         if (cur_tok == LLAMA_TOKEN_NULL) {
@@ -3360,14 +4908,14 @@ struct server_context {
                         // extract the logits only for the last token
                         batch.logits[batch.n_tokens - 1] = true;
 
-                        slot.n_decoded = 0;
+                        slot.n_decoded = slot.n_resumed;
                         slot.i_batch   = batch.n_tokens - 1;
 
                         SLT_INF(slot, "prompt done, n_past = %d, n_tokens = %d\n", slot.n_past, batch.n_tokens);
                     }
                 }
 
-                if (batch.n_tokens >= n_batch) {
+                if (batch.n_tokens >= n_batch_prompt) {
                     break;
                 }
             }
@@ -3378,6 +4926,8 @@ struct server_context {
             return;
         }
 
+        metrics.on_batch(batch.n_tokens - n_decode, n_decode);
+
         SRV_DBG("decoding batch, n_tokens = %d\n", batch.n_tokens);
 
         if (slot_batched) {
@@ -3387,11 +4937,64 @@ struct server_context {
             llama_set_embeddings(ctx, slot_batched->need_embd());
         }
 
+        if (params_base.logits_top_k) {
+            // the largest number of top logits needed by the slots sampling from this batch (0 = full logits)
+            int32_t n_logits = -1;
+
+            for (const auto & slot : slots) {
+                if (slot.i_batch < 0 || slot.need_embd()) {
+                    continue;
+                }
+
+                const int32_t n = slot.smpl ? common_sampler_n_logits(slot.smpl) : 0;
+
+                n_logits = n == 0 || n_logits == 0 ? 0 : std::max(n_logits, n);
+            }
+
+            if (n_logits >= 0) {
+                llama_set_logits_top_k(ctx, n_logits);
+            }
+        }
+
+        // the next sample of a grammar depends only on the accepted tokens, so the allowed tokens are computed
+        // on another thread while the batch is evaluated
+        std::future<bool> grammar_prefetch;
+        {
+            std::vector<const common_sampler *> smpls;
+
+            for (const auto & slot : slots) {
+                if (slot.i_batch >= 0 && slot.smpl && !slot.need_embd() && !slot.params.sampling.grammar.empty()) {
+                    smpls.push_back(slot.smpl);
+                }
+            }
+
+            if (!smpls.empty()) {
+                grammar_prefetch = grammar_worker.push([smpls]() {
+                    for (const auto * smpl : smpls) {
+                        common_sampler_prefetch(smpl);
+                    }
+                    return true;
+                });
+            }
+        }
+
         int32_t i_next = 0;
 
+        // the slots whose draft tokens were decoded without being verified
+        std::vector<server_slot *> slots_unverified;
+
+        int64_t t_decode = 0;
+
         // process the created batch of tokens
         for (int32_t i = 0; i < batch.n_tokens; i = i_next) {
-            const int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
+            int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
+
+            // the logits of the sampled and draft tokens of a slot are needed together, do not split them across batches
+            for (const auto & slot : slots) {
+                if (!slot.drafted.empty() && slot.i_batch > i && slot.i_batch < i + n_tokens && slot.i_batch + (int32_t) slot.drafted.size() >= i + n_tokens) {
+                    n_tokens = slot.i_batch - i;
+                }
+            }
 
             llama_batch batch_view = {
                 n_tokens,
@@ -3403,8 +5006,17 @@ struct server_context {
                 batch.logits   + i,
             };
 
+            const int64_t t_decode_start = ggml_time_us();
+
             const int ret = llama_decode(ctx, batch_view);
 
+            t_decode += ggml_time_us() - t_decode_start;
+
+            // the samplers are used below
+            if (grammar_prefetch.valid()) {
+                grammar_prefetch.wait();
+            }
+
             metrics.on_decoded(slots);
 
             if (ret != 0) {
@@ -3450,6 +5062,19 @@ struct server_context {
             // on successful decode, restore the original batch size
             n_batch = llama_n_batch(ctx);
 
+            // the KV cells of the slots that reached the end of their prefix to store hold exactly that prefix
+            for (auto & slot : slots) {
+                if (slot.n_store > 0 && (int) slot.cache_tokens.size() == slot.n_store &&
+                    llama_memory_seq_pos_max(llama_get_memory(ctx), slot.id) + 1 == slot.n_store) {
+                    prompt_store_save(slot);
+                }
+            }
+
+            // the slots that sample their next token from this batch
+            std::vector<server_slot *>    slots_sample;
+            std::vector<common_sampler *> smpls_sample;
+            std::vector<int>              idxs_sample;
+
             for (auto & slot : slots) {
                 if (slot.i_batch < (int) i || slot.i_batch >= (int) (i + n_tokens)) {
                     continue; // continue loop of slots
@@ -3479,9 +5104,35 @@ struct server_context {
 
                 const int tok_idx = slot.i_batch - i;
 
-                llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
+                if (!slot.drafted.empty()) {
+                    if (slot.i_batch + (int32_t) slot.drafted.size() < i + n_tokens) {
+                        accept_draft(slot, tok_idx);
+                        slot.i_batch = -1;
+                        continue; // continue loop of slots
+                    }
+
+                    // the batch size was reduced below the size of the draft, only the sampled token is used
+                    SLT_DBG(slot, "the draft was split across batches, ignoring %d draft tokens\n", (int) slot.drafted.size());
+
+                    slot.drafted.clear();
+                    slots_unverified.push_back(&slot);
+                }
+
+                slots_sample.push_back(&slot);
+                smpls_sample.push_back(slot.smpl);
+                idxs_sample.push_back(tok_idx);
 
                 slot.i_batch = -1;
+            }
+
+            // sample the slots in parallel, their samplers are independent
+            const auto ids = common_sampler_sample_batch(smpls_sample, ctx, idxs_sample);
+
+            for (size_t k = 0; k < slots_sample.size(); ++k) {
+                auto & slot = *slots_sample[k];
+
+                const llama_token id      = ids[k];
+                const int         tok_idx = idxs_sample[k];
 
                 common_sampler_accept(slot.smpl, id, true);
 
@@ -3489,17 +5140,22 @@ struct server_context {
 
                 const int64_t t_current = ggml_time_us();
 
-                if (slot.n_decoded == 1) {
+                if (slot.n_decoded == slot.n_resumed + 1) {
                     slot.t_start_generation = t_current;
                     slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
                     metrics.on_prompt_eval(slot);
+
+                    // the KV cells of the prompt are now computed and can be shared with other slots
+                    if (params_base.prefix_cache_min > 0 && slot.params.cache_prompt) {
+                        prefix_cache.insert(slot.id, slot.cache_tokens.get_text_tokens(), slot.cache_tokens.size());
+                    }
                 }
 
                 slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
 
                 completion_token_output result;
                 result.tok          = id;
-                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
+                result.text_to_send = common_detokenizer_push(slot.detokenizer.get(), result.tok, accept_special_token(slot, result.tok));
                 result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
 
                 if (slot.params.sampling.n_probs > 0) {
@@ -3515,110 +5171,34 @@ struct server_context {
                     continue;
                 }
             }
+        }
 
-            // do speculative decoding
-            for (auto & slot : slots) {
-                if (!slot.is_processing() || !slot.can_speculate()) {
-                    continue;
-                }
-
-                if (slot.state != SLOT_STATE_GENERATING) {
-                    continue;
-                }
-
-                if (mctx) {
-                    // we should never reach this, as speculative is automatically disabled if mmproj is loaded
-                    GGML_ABORT("not supported by multimodal");
-                }
-
-                // determine the max draft that fits the current slot state
-                int n_draft_max = slot.params.speculative.n_max;
-
-                // note: n_past is not yet increased for the `id` token sampled above
-                //       also, need to leave space for 1 extra token to allow context shifts
-                n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_past - 2);
-
-                if (slot.n_remaining > 0) {
-                    n_draft_max = std::min(n_draft_max, slot.n_remaining - 1);
-                }
-
-                SLT_DBG(slot, "max possible draft: %d\n", n_draft_max);
-
-                if (n_draft_max < slot.params.speculative.n_min) {
-                    SLT_DBG(slot, "the max possible draft is too small: %d < %d - skipping speculative decoding\n", n_draft_max, slot.params.speculative.n_min);
-
-                    continue;
-                }
-
-                llama_token id = slot.sampled;
-
-                struct common_speculative_params params_spec;
-                params_spec.n_draft   = n_draft_max;
-                params_spec.n_reuse   = llama_n_ctx(slot.ctx_dft) - slot.params.speculative.n_max;
-                params_spec.p_min     = slot.params.speculative.p_min;
-
-                const llama_tokens & cached_text_tokens = slot.cache_tokens.get_text_tokens();
-                llama_tokens draft = common_speculative_gen_draft(slot.spec, params_spec, cached_text_tokens, id);
-
-                // ignore small drafts
-                if (slot.params.speculative.n_min > (int) draft.size()) {
-                    SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) draft.size(), slot.params.speculative.n_min);
-
-                    continue;
-                }
-
-                // keep track of total number of drafted tokens tested
-                slot.n_draft_total += draft.size();
-
-                // construct the speculation batch
-                common_batch_clear(slot.batch_spec);
-                common_batch_add  (slot.batch_spec, id, slot.n_past, { slot.id }, true);
-
-                for (size_t i = 0; i < draft.size(); ++i) {
-                    common_batch_add(slot.batch_spec, draft[i], slot.n_past + 1 + i, { slot.id }, true);
-                }
-
-                SLT_DBG(slot, "decoding speculative batch, size = %d\n", slot.batch_spec.n_tokens);
-
-                llama_decode(ctx, slot.batch_spec);
-
-                // the accepted tokens from the speculation
-                const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, draft);
-
-                slot.n_past    += ids.size();
-                slot.n_decoded += ids.size();
-
-                // update how many tokens out of those tested were accepted
-                slot.n_draft_accepted += ids.size() - 1;
-
-                slot.cache_tokens.push_back(id);
-                slot.cache_tokens.insert({ids.begin(), ids.end() - 1});
-
-                llama_memory_seq_rm(llama_get_memory(ctx), slot.id, slot.n_past, -1);
-
-                for (size_t i = 0; i < ids.size(); ++i) {
-                    completion_token_output result;
+        for (auto * slot : slots_unverified) {
+            llama_memory_seq_rm(llama_get_memory(ctx), slot->id, slot->n_past, -1);
+        }
 
-                    result.tok          = ids[i];
-                    result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
-                    result.prob         = 1.0f; // set later
+        // the cost of the draft tokens is measured on the steps that only decode the tokens of the generating slots:
+        // the steps without draft give the time of a step, the additional time of the steps with draft is shared by
+        // their draft tokens
+        if (!slots_generating.empty() && batch.n_tokens == n_decode) {
+            double & t_step = t_step_base[slots_generating.size()];
 
-                    // TODO: set result.probs
+            if (n_drafted == 0) {
+                t_step = t_step > 0.0 ? common_speculative_stats::decay*t_step + (1.0 - common_speculative_stats::decay)*t_decode : t_decode;
+                n_step_drafted = 0;
+            } else if (t_step > 0.0) {
+                const double t_verify = std::max(0.0, t_decode - t_step) / n_drafted;
 
-                    if (!process_token(result, slot)) {
-                        // release slot because of stop condition
-                        slot.release();
-                        slot.print_timings();
-                        send_final_response(slot);
-                        metrics.on_prediction(slot);
-                        break;
-                    }
+                for (auto * slot : slots_drafted) {
+                    slot->draft_stats.update_cost(slot->t_draft, t_verify, t_step);
                 }
-
-                SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", (int) ids.size() - 1, (int) draft.size(), slot.n_past);
             }
         }
 
+        if (n_drafted > 0) {
+            n_step_drafted++;
+        }
+
         SRV_DBG("%s", "run slots completed\n");
     }
 
@@ -3786,11 +5366,8 @@ int main(int argc, char ** argv) {
         }
 
         // Check for API key in the header
-        auto auth_header = req.get_header_value("Authorization");
-
-        std::string prefix = "Bearer ";
-        if (auth_header.substr(0, prefix.size()) == prefix) {
-            std::string received_api_key = auth_header.substr(prefix.size());
+        const std::string received_api_key = get_api_key(req);
+        if (!received_api_key.empty()) {
             if (std::find(params.api_keys.begin(), params.api_keys.end(), received_api_key) != params.api_keys.end()) {
                 return true; // API key is valid
             }
@@ -3945,6 +5522,58 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "batch_steps_total"},
+                    {"help",  "Number of batches submitted by the server loop."},
+                    {"value",  res_metrics->n_batch_steps_total}
+            }, {
+                    {"name",  "batch_prefill_tokens_total"},
+                    {"help",  "Number of prompt tokens submitted in batches."},
+                    {"value",  res_metrics->n_batch_prefill_tokens_total}
+            }, {
+                    {"name",  "batch_decode_tokens_total"},
+                    {"help",  "Number of generated tokens submitted in batches."},
+                    {"value",  res_metrics->n_batch_decode_tokens_total}
+            }, {
+                    {"name",  "batch_mixed_steps_total"},
+                    {"help",  "Number of batches with both prompt tokens and generated tokens."},
+                    {"value",  res_metrics->n_batch_mixed_steps_total}
+            }, {
+                    {"name",  "batch_mixed_prefill_tokens_total"},
+                    {"help",  "Number of prompt tokens submitted in batches with generated tokens."},
+                    {"value",  res_metrics->n_batch_mixed_prefill_tokens_total}
+            }, {
+                    {"name",  "requests_preempted_total"},
+                    {"help",  "Number of generating requests preempted by requests with a higher priority."},
+                    {"value",  res_metrics->n_preempt_total}
+            }, {
+                    {"name",  "resume_prompt_tokens_total"},
+                    {"help",  "Number of prompt tokens processed again to resume preempted requests."},
+                    {"value",  res_metrics->n_resume_prompt_tokens_total}
+            }, {
+                    {"name",  "resume_restored_tokens_total"},
+                    {"help",  "Number of prompt tokens of resumed requests whose KV cache was restored instead of processed again."},
+                    {"value",  res_metrics->n_resume_restored_tokens_total}
+            }, {
+                    {"name",  "kv_spill_total"},
+                    {"help",  "Number of sequence states evicted from the KV cache to host memory."},
+                    {"value",  res_metrics->n_kv_spill_total}
+            }, {
+                    {"name",  "kv_restore_total"},
+                    {"help",  "Number of evicted sequence states restored into the KV cache."},
+                    {"value",  res_metrics->n_kv_restore_total}
+            }, {
+                    {"name",  "kv_drop_total"},
+                    {"help",  "Number of evicted sequence states dropped because the budgets were exceeded."},
+                    {"value",  res_metrics->n_kv_drop_total}
+            }, {
+                    {"name",  "prompt_store_save_total"},
+                    {"help",  "Number of prompt prefixes saved to the prompt store."},
+                    {"value",  res_metrics->n_prompt_store_save_total}
+            }, {
+                    {"name",  "prompt_store_load_total"},
+                    {"help",  "Number of prompt prefixes loaded from the prompt store."},
+                    {"value",  res_metrics->n_prompt_store_load_total}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -3962,6 +5591,34 @@ int main(int argc, char ** argv) {
                     {"name",  "requests_deferred"},
                     {"help",  "Number of requests deferred."},
                     {"value",  (uint64_t) res_metrics->n_tasks_deferred}
+            },{
+                    {"name",  "batch_prefill_tokens_per_step"},
+                    {"help",  "Average number of prompt tokens per batch."},
+                    {"value",  (float) res_metrics->n_batch_prefill_tokens_total / std::max((float) res_metrics->n_batch_steps_total, 1.f)}
+            },{
+                    {"name",  "batch_decode_tokens_per_step"},
+                    {"help",  "Average number of generated tokens per batch."},
+                    {"value",  (float) res_metrics->n_batch_decode_tokens_total / std::max((float) res_metrics->n_batch_steps_total, 1.f)}
+            },{
+                    {"name",  "kv_host_bytes"},
+                    {"help",  "Size of the evicted sequence states held in host memory."},
+                    {"value",  res_metrics->n_kv_bytes_host}
+            },{
+                    {"name",  "kv_host_entries"},
+                    {"help",  "Number of evicted sequence states held in host memory."},
+                    {"value",  res_metrics->n_kv_entries_host}
+            },{
+                    {"name",  "kv_disk_bytes"},
+                    {"help",  "Size of the evicted sequence states spilled to disk."},
+                    {"value",  res_metrics->n_kv_bytes_disk}
+            },{
+                    {"name",  "kv_disk_entries"},
+                    {"help",  "Number of evicted sequence states spilled to disk."},
+                    {"value",  res_metrics->n_kv_entries_disk}
+            },{
+                    {"name",  "prompt_store_bytes"},
+                    {"help",  "Size of the files in the prompt store."},
+                    {"value",  res_metrics->n_prompt_store_bytes}
             }}}
         };
 
@@ -4176,11 +5833,13 @@ int main(int argc, char ** argv) {
             server_task_type type,
             json & data,
             const std::vector<raw_buffer> & files,
-            const std::function<bool()> & is_connection_closed,
+            const httplib::Request & req,
             httplib::Response & res,
             oaicompat_type oaicompat) -> void {
         GGML_ASSERT(type == SERVER_TASK_TYPE_COMPLETION || type == SERVER_TASK_TYPE_INFILL);
 
+        const auto & is_connection_closed = req.is_connection_closed;
+
         auto completion_id = gen_chatcmplid();
         std::unordered_set<int> task_ids;
         try {
@@ -4258,6 +5917,7 @@ int main(int argc, char ** argv) {
                         ctx_server.params_base,
                         data);
                 task.id_selected_slot = json_value(data, "id_slot", -1);
+                task.tenant           = get_api_key(req);
 
                 // OAI-compat
                 task.params.oaicompat                 = oaicompat;
@@ -4339,7 +5999,7 @@ int main(int argc, char ** argv) {
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
-            req.is_connection_closed,
+            req,
             res,
             OAICOMPAT_TYPE_NONE);
     };
@@ -4351,7 +6011,7 @@ int main(int argc, char ** argv) {
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
-            req.is_connection_closed,
+            req,
             res,
             OAICOMPAT_TYPE_COMPLETION);
     };
@@ -4430,7 +6090,7 @@ int main(int argc, char ** argv) {
             SERVER_TASK_TYPE_INFILL,
             data,
             files,
-            req.is_connection_closed,
+            req,
             res,
             OAICOMPAT_TYPE_NONE); // infill is not OAI compatible
     };
@@ -4449,7 +6109,7 @@ int main(int argc, char ** argv) {
             SERVER_TASK_TYPE_COMPLETION,
             data,
             files,
-            req.is_connection_closed,
+            req,
             res,
             OAICOMPAT_TYPE_CHAT);
     };
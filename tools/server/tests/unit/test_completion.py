@@ -145,6 +145,37 @@ def test_completion_stream_with_openai_library_stops():
     assert match_regex("Sure, here's one for[\\s\\S]*", output_text), f'Unexpected output: {output_text}'
 
 
+@pytest.mark.parametrize("stream", [False, True])
+def test_completion_stop_strings(stream: bool):
+    global server
+    server.start()
+    data = {
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 32,
+        "temperature": 0.0,
+    }
+    res = server.make_request("POST", "/completion", data=data)
+    assert res.status_code == 200
+    full = res.body["content"]
+    n = len(full)
+    # overlapping stop strings, the one that starts first wins
+    stops = [full[n//2:n//2+4], full[n//2+1:n//2+2], full[n//4:n//4+3], "not in the text"]
+    end = min(full.find(stop) for stop in stops if stop in full)
+    if stream:
+        content = ""
+        for chunk in server.make_stream_request("POST", "/completion", data={**data, "stop": stops, "stream": True}):
+            content += chunk["content"]
+            if chunk["stop"]:
+                assert chunk["stop_type"] == "word"
+    else:
+        res = server.make_request("POST", "/completion", data={**data, "stop": stops})
+        assert res.status_code == 200
+        assert res.body["stop_type"] == "word"
+        assert full[end:].startswith(res.body["stopping_word"])
+        content = res.body["content"]
+    assert content == full[:end]
+
+
 @pytest.mark.parametrize("n_slots", [1, 2])
 def test_consistent_result_same_seed(n_slots: int):
     global server
@@ -180,6 +211,31 @@ def test_different_result_different_seed(n_slots: int):
             assert res.body["content"] != last_res.body["content"]
         last_res = res
 
+@pytest.mark.parametrize("data", [
+    {"temperature": 0.0},
+    {"temperature": 1.0, "seed": 42},
+    {"temperature": 1.0, "seed": 42, "top_k": 5, "top_p": 1.0, "min_p": 0.0},
+    {"temperature": 1.0, "seed": 42, "repeat_penalty": 1.5},  # needs the full logits
+    {"temperature": 0.0, "n_probs": 3},                       # needs the full logits
+])
+def test_consistent_result_logits_top_k(data: dict):
+    global server
+    server.n_slots = 2
+    contents = []
+    for logits_top_k in [False, True]:
+        server.logits_top_k = logits_top_k
+        server.start()
+        res = server.make_request("POST", "/completion", data={
+            "prompt": "I believe the meaning of life is",
+            "n_predict": 32,
+            **data,
+        })
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+        server.stop()
+    assert contents[0] == contents[1]
+
+
 # TODO figure why it don't work with temperature = 1
 # @pytest.mark.parametrize("temperature", [0.0, 1.0])
 @pytest.mark.parametrize("n_batch", [16, 32])
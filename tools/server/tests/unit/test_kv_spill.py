@@ -0,0 +1,84 @@
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_slots = 1
+    server.kv_spill_ram = 64
+    server.server_metrics = True
+    server.temperature = 0.0
+
+
+def test_kv_spill_restore():
+    global server
+    server.start()
+
+    # First prompt should be fully processed
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "What is the capital of France?",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["prompt_n"] == 21  # all tokens are processed
+
+    # An unrelated prompt evicts the cache of the only slot, its state is spilled to host memory
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "Once upon a time, there was a little dog named Max.",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+
+    # The first session returns and its state is restored instead of being recomputed
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "What is the capital of Germany?",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert match_regex("(Jack|said)+", res.body["content"])
+    assert res.body["timings"]["prompt_n"] == 6  # only different part is processed
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:kv_spill_total 2" in res.body
+    assert "llamacpp:kv_restore_total 1" in res.body
+
+
+def test_kv_spill_disk_restore():
+    global server
+    # no host budget, the spilled states are written to files by the I/O worker
+    server.kv_spill_ram = 0
+    server.kv_spill_disk = 64
+    server.kv_spill_path = "./tmp/kv-spill/"
+    server.start()
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "What is the capital of France?",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "Once upon a time, there was a little dog named Max.",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:kv_disk_entries 1" in res.body
+
+    # the state is read back from the file, even if its write was still in progress
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "What is the capital of Germany?",
+        "cache_prompt": True,
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["prompt_n"] == 6
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:kv_restore_total 1" in res.body
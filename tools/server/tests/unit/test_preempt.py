@@ -0,0 +1,108 @@
+import pytest
+import re
+import time
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_slots = 1
+    server.n_ctx = 2048
+    server.preempt = True
+    server.priority_max = 5
+    server.kv_spill_ram = 64
+    server.server_metrics = True
+    server.temperature = 0.0
+
+
+def get_metric(body: str, name: str) -> float:
+    match = re.search(rf"^llamacpp:{name} ([0-9.e+-]+)$", body, re.MULTILINE)
+    assert match is not None
+    return float(match.group(1))
+
+
+def make_completion(prompt: str, n_predict: int, priority: int, delay: float = 0.0):
+    time.sleep(delay)
+    return server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "n_predict": n_predict,
+        "priority": priority,
+    })
+
+
+def test_preempt_low_priority():
+    global server
+    server.start()
+
+    # the reference output, computed without preemption
+    res_ref = make_completion("Once upon a time", 1024, 0)
+    assert res_ref.status_code == 200
+
+    results = parallel_function_calls([
+        (make_completion, ("Once upon a time", 1024, 0)),
+        (make_completion, ("What is the capital of France?", 8, 5, 0.1)),
+    ])
+    res_low, res_high = results
+    assert res_low.status_code == 200
+    assert res_high.status_code == 200
+
+    # the preempted request is resumed and produces the same output
+    assert res_low.body["content"] == res_ref.body["content"]
+    assert res_low.body["tokens_predicted"] == 1024
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:requests_preempted_total 1" in res.body
+    # the KV cache of the preempted request is restored, only the last tokens are processed again
+    assert get_metric(res.body, "resume_prompt_tokens_total") <= 2
+    assert get_metric(res.body, "resume_restored_tokens_total") > 4
+
+
+def test_preempt_without_kv_spill():
+    global server
+    server.kv_spill_ram = None
+    server.start()
+
+    res_ref = make_completion("Once upon a time", 256, 0)
+    assert res_ref.status_code == 200
+
+    results = parallel_function_calls([
+        (make_completion, ("Once upon a time", 256, 0)),
+        (make_completion, ("What is the capital of France?", 8, 5, 0.1)),
+    ])
+    res_low, res_high = results
+    assert res_low.status_code == 200
+    assert res_high.status_code == 200
+    assert res_low.body["content"] == res_ref.body["content"]
+
+    # without a KV spill tier, the resumed request processes its prompt and generated tokens again
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:requests_preempted_total 1" in res.body
+    assert get_metric(res.body, "resume_prompt_tokens_total") > 64
+    assert get_metric(res.body, "resume_restored_tokens_total") == 0
+
+
+def test_priority_clamped():
+    global server
+    server.priority_max = 0
+    server.start()
+
+    res_ref = make_completion("Once upon a time", 256, 0)
+    assert res_ref.status_code == 200
+
+    # the priority of the second request is clamped to 0, it cannot preempt the first one
+    results = parallel_function_calls([
+        (make_completion, ("Once upon a time", 256, 0)),
+        (make_completion, ("What is the capital of France?", 8, 5, 0.1)),
+    ])
+    for res in results:
+        assert res.status_code == 200
+    assert results[0].body["content"] == res_ref.body["content"]
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:requests_preempted_total 0" in res.body
@@ -0,0 +1,91 @@
+import pytest
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+LONG_TEXT = """
+Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.
+Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.
+Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur.
+Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum.
+""".strip()
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.n_slots = 2
+    server.prefill_chunk = 8
+    server.server_metrics = True
+    server.temperature = 0.0
+
+
+def test_prefill_chunk_single():
+    global server
+    server.start()
+    # without other generating slots, the prompt is not capped
+    res = server.make_request("POST", "/completion", data={
+        "prompt": LONG_TEXT,
+        "n_predict": 8,
+    })
+    assert res.status_code == 200
+    n_prompt = res.body["timings"]["prompt_n"]
+    assert n_prompt > 8
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert f"llamacpp:batch_prefill_tokens_total {n_prompt}" in res.body
+    assert "llamacpp:batch_decode_tokens_total 7" in res.body
+
+
+def get_metric(body: str, name: str) -> float:
+    match = re.search(rf"^llamacpp:{name} ([0-9.e+-]+)$", body, re.MULTILINE)
+    assert match is not None, f"metric {name} not found"
+    return float(match.group(1))
+
+
+def test_prefill_chunk_mixed():
+    global server
+    server.start()
+
+    # the reference output, computed without interleaving
+    res_ref = server.make_request("POST", "/completion", data={
+        "prompt": LONG_TEXT,
+        "n_predict": 16,
+    })
+    assert res_ref.status_code == 200
+
+    # keep a slot generating while the long prompt is processed: the long request is only sent once the first
+    # token of the short one has been streamed
+    stream = server.make_stream_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "n_predict": 200,
+        "ignore_eos": True,
+        "stream": True,
+    })
+    next(stream)
+
+    with ThreadPoolExecutor(max_workers=1) as executor:
+        future = executor.submit(server.make_request, "POST", "/completion", data={
+            "prompt": LONG_TEXT,
+            "n_predict": 16,
+            "cache_prompt": False,
+        })
+        for _ in stream:
+            pass
+        res = future.result()
+
+    assert res.status_code == 200
+    assert res.body["content"] == res_ref.body["content"]
+    n_prompt = res.body["timings"]["prompt_n"]
+    assert n_prompt > server.n_batch
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    n_mixed_steps   = get_metric(res.body, "batch_mixed_steps_total")
+    n_mixed_prefill = get_metric(res.body, "batch_mixed_prefill_tokens_total")
+
+    # the long prompt was split into chunks of at most prefill_chunk tokens, next to the tokens of the generating slot
+    # without --prefill-chunk, the prompt would take up to n_batch tokens per batch instead
+    assert n_mixed_prefill > server.n_batch
+    assert n_mixed_prefill <= n_mixed_steps*server.prefill_chunk
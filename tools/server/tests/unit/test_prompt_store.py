@@ -0,0 +1,67 @@
+import os
+import pytest
+import shutil
+import time
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+PROMPT_STORE_PATH = "./tmp/prompt-store"
+
+SYSTEM_PROMPT = "You are a helpful assistant. Answer the questions of the user about the capitals of the countries of Europe."
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    shutil.rmtree(PROMPT_STORE_PATH, ignore_errors=True)
+    server = ServerPreset.tinyllama2()
+    server.prompt_store = PROMPT_STORE_PATH
+    server.prompt_store_block = 8
+    server.server_metrics = True
+    server.temperature = 0.0
+
+
+def test_prompt_store_reload_after_restart():
+    global server
+    server.start()
+
+    # The prefix shared by two prompts is persisted once it has been seen twice
+    res = server.make_request("POST", "/completion", data={
+        "prompt": f"{SYSTEM_PROMPT} What is the capital of France?",
+        "id_slot": 0,
+    })
+    assert res.status_code == 200
+    n_prompt = res.body["timings"]["prompt_n"]
+    content = res.body["content"]
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": f"{SYSTEM_PROMPT} What is the capital of Germany?",
+        "id_slot": 1,
+    })
+    assert res.status_code == 200
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:prompt_store_save_total 1" in res.body
+
+    # The file is written in the background, wait for it before killing the server
+    for _ in range(100):
+        if any(f.endswith(".bin") for f in os.listdir(PROMPT_STORE_PATH)):
+            break
+        time.sleep(0.1)
+    assert any(f.endswith(".bin") for f in os.listdir(PROMPT_STORE_PATH))
+
+    # After a restart, the prefix is loaded from the store instead of being recomputed
+    server.stop()
+    server.start()
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": f"{SYSTEM_PROMPT} What is the capital of France?",
+    })
+    assert res.status_code == 200
+    assert res.body["timings"]["prompt_n"] < n_prompt
+    assert res.body["content"] == content
+
+    res = server.make_request("GET", "/metrics")
+    assert res.status_code == 200
+    assert "llamacpp:prompt_store_load_total 1" in res.body
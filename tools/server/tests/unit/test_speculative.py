@@ -1,4 +1,6 @@
+import os
 import pytest
+import time
 from utils import *
 
 # We use a F16 MOE gguf as main model, and q4_0 as draft model
@@ -124,3 +126,126 @@ def test_multi_requests_parallel(n_slots: int, n_requests: int):
     for res in results:
         assert res.status_code == 200
         assert match_regex("(wise|kind|owl|answer)+", res.body["content"])
+
+
+def test_multi_requests_parallel_with_and_without_draft():
+    global server
+    prompts = [
+        "I believe the meaning of life is",
+        "Once upon a time, there was a",
+        "The little girl wanted to",
+        "One day, a big dog",
+    ]
+
+    def run_parallel():
+        tasks = []
+        for prompt in prompts:
+            tasks.append((server.make_request, ("POST", "/completion", {
+                "prompt": prompt,
+                "temperature": 0.0,
+                "top_k": 1,
+            })))
+        results = parallel_function_calls(tasks)
+        for res in results:
+            assert res.status_code == 200
+        return [res.body["content"] for res in results]
+
+    server.model_draft = None  # disable draft model
+    server.n_slots = len(prompts)
+    server.start()
+    contents_no_draft = run_parallel()
+    server.stop()
+
+    # the drafts of all slots are generated and verified together
+    create_server()
+    server.n_slots = len(prompts)
+    server.start()
+    contents_draft = run_parallel()
+
+    assert contents_no_draft == contents_draft
+
+
+@pytest.mark.parametrize("adaptive", [True, False])
+def test_adaptive_draft_timings(adaptive: bool):
+    global server
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "I believe the meaning of life is",
+        "temperature": 0.0,
+        "top_k": 1,
+        "speculative.adaptive": adaptive,
+    })
+    assert res.status_code == 200
+    timings = res.body["timings"]
+    assert timings["draft_n"] > 0
+    if adaptive:
+        assert 0.0 <= timings["draft_p_accept"] <= 1.0
+        assert 0 <= timings["draft_len"] <= server.draft_max
+    else:
+        assert "draft_len" not in timings
+
+
+@pytest.mark.parametrize("adaptive", [True, False])
+def test_lookup_without_draft_model(adaptive: bool):
+    global server
+    server.model_draft = None  # prompt lookup does not need a draft model
+    server.start()
+    prompt = "Once upon a time, there was a little girl. Once upon a time, there was a little"
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "temperature": 0.0,
+        "top_k": 1,
+    })
+    assert res.status_code == 200
+    content_no_lookup = res.body["content"]
+
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "temperature": 0.0,
+        "top_k": 1,
+        "speculative.lookup": True,
+        "speculative.adaptive": adaptive,
+    })
+    assert res.status_code == 200
+    assert res.body["content"] == content_no_lookup
+    # the repeated sentence of the prompt must be drafted
+    assert res.body["timings"]["draft_n"] > 0
+
+
+def test_lookup_cache_dynamic():
+    global server
+    path = "./tmp/lookup-cache-dynamic.bin"
+    if os.path.exists(path):
+        os.remove(path)
+    server.model_draft = None
+    server.lookup_cache_dynamic = path
+    server.start()
+    prompt = "Once upon a time, there was a little girl. Once upon a time, there was a little"
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "temperature": 0.0,
+        "top_k": 1,
+        "speculative.lookup": True,
+    })
+    assert res.status_code == 200
+    content = res.body["content"]
+
+    # the n-grams of the finished request are saved in the background
+    for _ in range(100):
+        if os.path.exists(path) and os.path.getsize(path) > 0:
+            break
+        time.sleep(0.1)
+    assert os.path.getsize(path) > 0
+
+    # the cache is loaded again after a restart
+    server.stop()
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "temperature": 0.0,
+        "top_k": 1,
+        "speculative.lookup": True,
+    })
+    assert res.status_code == 200
+    assert res.body["content"] == content
+    assert res.body["timings"]["draft_n"] > 0
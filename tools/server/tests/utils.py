@@ -66,6 +66,16 @@ class ServerProcess:
     slot_save_path: str | None = None
     id_slot: int | None = None
     cache_prompt: bool | None = None
+    prefix_cache_min: int | None = None
+    prefill_chunk: int | None = None
+    preempt: bool | None = None
+    priority_max: int | None = None
+    kv_spill_ram: int | None = None
+    kv_spill_disk: int | None = None
+    kv_spill_path: str | None = None
+    prompt_store: str | None = None
+    prompt_store_block: int | None = None
+    logits_top_k: bool | None = None
     n_slots: int | None = None
     ctk: str | None = None
     ctv: str | None = None
@@ -82,6 +92,7 @@ class ServerProcess:
     disable_ctx_shift: int | None = False
     draft_min: int | None = None
     draft_max: int | None = None
+    lookup_cache_dynamic: str | None = None
     no_webui: bool | None = None
     jinja: bool | None = None
     reasoning_format: Literal['deepseek', 'none', 'nothink'] | None = None
@@ -169,6 +180,26 @@ class ServerProcess:
             server_args.extend(["--n-predict", self.n_predict])
         if self.slot_save_path:
             server_args.extend(["--slot-save-path", self.slot_save_path])
+        if self.prefill_chunk:
+            server_args.extend(["--prefill-chunk", self.prefill_chunk])
+        if self.preempt:
+            server_args.append("--preempt")
+        if self.priority_max is not None:
+            server_args.extend(["--priority-max", self.priority_max])
+        if self.prefix_cache_min:
+            server_args.extend(["--prefix-cache-min", self.prefix_cache_min])
+        if self.kv_spill_ram:
+            server_args.extend(["--kv-spill-ram", self.kv_spill_ram])
+        if self.kv_spill_disk:
+            server_args.extend(["--kv-spill-disk", self.kv_spill_disk])
+        if self.kv_spill_path:
+            server_args.extend(["--kv-spill-path", self.kv_spill_path])
+        if self.prompt_store:
+            server_args.extend(["--prompt-store", self.prompt_store])
+        if self.prompt_store_block:
+            server_args.extend(["--prompt-store-block", self.prompt_store_block])
+        if self.logits_top_k:
+            server_args.append("--logits-top-k")
         if self.n_ga:
             server_args.extend(["--grp-attn-n", self.n_ga])
         if self.n_ga_w:
@@ -186,6 +217,8 @@ class ServerProcess:
             server_args.extend(["--draft-max", self.draft_max])
         if self.draft_min:
             server_args.extend(["--draft-min", self.draft_min])
+        if self.lookup_cache_dynamic:
+            server_args.extend(["--lookup-cache-dynamic", self.lookup_cache_dynamic])
         if self.no_webui:
             server_args.append("--no-webui")
         if self.jinja:
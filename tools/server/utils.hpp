@@ -20,15 +20,26 @@
 #define JSON_ASSERT GGML_ASSERT
 #include <nlohmann/json.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <memory>
 #include <cinttypes>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #define DEFAULT_OAICOMPAT_MODEL "gpt-3.5-turbo"
 
+// the prompts of a request are tokenized in parallel when their text is larger than this, in bytes
+#define SERVER_TOKENIZE_PARALLEL_MIN_SIZE (64*1024)
+
 using json = nlohmann::ordered_json;
 
 #define SLT_INF(slot, fmt, ...) LOG_INF("slot %12.*s: id %2d | task %d | " fmt, 12, __func__, (slot).id, (slot).id_task, __VA_ARGS__)
@@ -91,6 +102,117 @@ struct server_grammar_trigger {
     }
 };
 
+//
+// threads shared by the HTTP threads for the CPU work of the requests, e.g. the tokenization of large batches of prompts
+//
+
+struct server_thread_pool {
+    explicit server_thread_pool(size_t n_workers) {
+        for (size_t i = 0; i < n_workers; ++i) {
+            workers.emplace_back([this]() { loop(); });
+        }
+    }
+
+    ~server_thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cv.notify_all();
+
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    // call fn(i) for each i in [0, n) on the calling thread and on the workers of the pool, the first exception is
+    // rethrown on the calling thread
+    // the loops of several HTTP threads share the workers: a worker that is still busy with another loop when it picks
+    // up this one finds no iteration left, so the loop never waits for the other requests
+    void parallel_for(size_t n, const std::function<void(size_t)> & fn) {
+        auto state = std::make_shared<loop_state>();
+        state->n  = n;
+        state->fn = &fn;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 1; i < std::min(n, workers.size() + 1); ++i) {
+                jobs.push_back(state);
+            }
+        }
+        cv.notify_all();
+
+        run(*state);
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [&]() { return state->n_done == n; });
+
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    struct loop_state {
+        size_t n = 0;
+
+        // only called for the claimed iterations, which the calling thread waits for
+        const std::function<void(size_t)> * fn = nullptr;
+
+        std::atomic<size_t> next = 0;
+
+        std::mutex              mutex;
+        std::condition_variable cv;
+
+        size_t             n_done = 0;
+        std::exception_ptr error;
+    };
+
+    static void run(loop_state & state) {
+        for (size_t i = state.next++; i < state.n; i = state.next++) {
+            std::exception_ptr error;
+            try {
+                (*state.fn)(i);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (error && !state.error) {
+                state.error = error;
+            }
+            if (++state.n_done == state.n) {
+                state.cv.notify_all();
+            }
+        }
+    }
+
+    void loop() {
+        while (true) {
+            std::shared_ptr<loop_state> state;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return !jobs.empty() || !running; });
+                if (!running) {
+                    return;
+                }
+                state = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            run(*state);
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::deque<std::shared_ptr<loop_state>> jobs;
+
+    bool running = true;
+};
+
 //
 // tokenizer and input processing utils
 //
@@ -145,12 +267,32 @@ static json json_get_nested_values(const std::vector<std::string> & paths, const
     return result;
 }
 
+// number of bytes of text of a prompt: a string or a mixed array of strings and tokens
+static size_t json_prompt_text_size(const json & json_prompt) {
+    if (json_prompt.is_string()) {
+        return json_prompt.get_ref<const std::string &>().size();
+    }
+
+    size_t n = 0;
+    if (json_prompt.is_array()) {
+        for (const auto & e : json_prompt) {
+            if (e.is_string()) {
+                n += e.get_ref<const std::string &>().size();
+            }
+        }
+    }
+    return n;
+}
+
 /**
  * this handles 2 cases:
  * - only string, example: "string"
  * - mixed string and tokens, example: [12, 34, "string", 56, 78]
+ *
+ * n_threads: long strings are split into chunks that are tokenized on up to n_threads threads (see llama_tokenize_parallel),
+ *            0 = hardware concurrency
  */
-static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special) {
+static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special, int32_t n_threads = 0) {
     // If `add_bos` is true, we only add BOS, when json_prompt is a string,
     // or the first element of the json_prompt array is a string.
     llama_tokens prompt_tokens;
@@ -163,10 +305,10 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
 
                 llama_tokens p;
                 if (first) {
-                    p = common_tokenize(vocab, s, add_special, parse_special);
+                    p = common_tokenize(vocab, s, add_special, parse_special, n_threads);
                     first = false;
                 } else {
-                    p = common_tokenize(vocab, s, false, parse_special);
+                    p = common_tokenize(vocab, s, false, parse_special, n_threads);
                 }
 
                 prompt_tokens.insert(prompt_tokens.end(), p.begin(), p.end());
@@ -179,8 +321,8 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
             }
         }
     } else {
-        auto s = json_prompt.template get<std::string>();
-        prompt_tokens = common_tokenize(vocab, s, add_special, parse_special);
+        const auto & s = json_prompt.template get_ref<const std::string &>();
+        prompt_tokens = common_tokenize(vocab, s, add_special, parse_special, n_threads);
     }
 
     return prompt_tokens;
@@ -208,17 +350,40 @@ static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * voca
         result.push_back(json_prompt.get<llama_tokens>());
     } else if (json_prompt.is_array()) {
         // array of prompts
-        result.reserve(json_prompt.size());
-        for (const auto & p : json_prompt) {
+        result.resize(json_prompt.size());
+
+        std::vector<size_t> idxs_text; // the prompts that need to be tokenized
+        for (size_t i = 0; i < json_prompt.size(); ++i) {
+            const auto & p = json_prompt[i];
             if (p.is_string() || json_is_array_of_mixed_numbers_strings(p)) {
-                result.push_back(tokenize_mixed(vocab, p, add_special, parse_special));
+                idxs_text.push_back(i);
             } else if (json_is_array_of_numbers(p)) {
                 // array of tokens
-                result.push_back(p.get<llama_tokens>());
+                result[i] = p.get<llama_tokens>();
             } else {
                 throw std::runtime_error("element of \"prompt\" must be a string, an list of tokens, or a list of mixed strings & tokens");
             }
         }
+
+        size_t n_text = 0;
+        for (size_t i : idxs_text) {
+            n_text += json_prompt_text_size(json_prompt[i]);
+        }
+
+        if (idxs_text.size() < 2 || n_text < SERVER_TOKENIZE_PARALLEL_MIN_SIZE) {
+            for (size_t i : idxs_text) {
+                result[i] = tokenize_mixed(vocab, json_prompt[i], add_special, parse_special);
+            }
+        } else {
+            // the prompts are independent, so they are tokenized in parallel on the threads of the pool, each prompt on a
+            // single thread, so there are at most as many threads as cores whatever the number of requests
+            static server_thread_pool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+            pool.parallel_for(idxs_text.size(), [&](size_t k) {
+                const size_t i = idxs_text[k];
+                result[i] = tokenize_mixed(vocab, json_prompt[i], add_special, parse_special, 1);
+            });
+        }
     } else {
         throw std::runtime_error("\"prompt\" must be a string, an list of tokens, a list of mixed strings & tokens, or a list of prompts");
     }
@@ -258,6 +423,109 @@ static size_t validate_utf8(const std::string& text) {
     return len;
 }
 
+// Aho-Corasick automaton of the stop strings, fed with the generated text as it is produced
+// the state is the longest suffix of the text that is a prefix of a stop string, so that each byte is processed in
+// amortized O(1), regardless of the length of the generated text and of the number of stop strings
+struct server_stop_matcher {
+    struct node {
+        std::vector<std::pair<uint8_t, int32_t>> next;
+
+        int32_t fail  =  0;
+        int32_t depth =  0;
+        int32_t word  = -1; // the longest stop string that is a suffix of the node
+    };
+
+    std::vector<node>   nodes;
+    std::vector<size_t> lengths;
+
+    int32_t state = 0;
+
+    void init(const std::vector<std::string> & words) {
+        nodes.assign(1, node());
+        lengths.clear();
+        state = 0;
+
+        for (size_t i = 0; i < words.size(); ++i) {
+            lengths.push_back(words[i].size());
+
+            int32_t cur = 0;
+            for (const char c : words[i]) {
+                int32_t child = find(cur, c);
+                if (child == 0) {
+                    child = nodes.size();
+                    nodes.emplace_back();
+                    nodes[child].depth = nodes[cur].depth + 1;
+                    nodes[cur].next.emplace_back(c, child);
+                }
+                cur = child;
+            }
+
+            // the empty stop strings never match
+            if (cur != 0 && nodes[cur].word < 0) {
+                nodes[cur].word = i;
+            }
+        }
+
+        // the failure link of a node points to a shallower node, so they are computed in breadth-first order
+        std::vector<int32_t> queue = { 0 };
+        for (size_t i = 0; i < queue.size(); ++i) {
+            const int32_t cur = queue[i];
+            for (const auto & [c, child] : nodes[cur].next) {
+                nodes[child].fail = cur == 0 ? 0 : step(nodes[cur].fail, c);
+                if (nodes[child].word < 0) {
+                    nodes[child].word = nodes[nodes[child].fail].word;
+                }
+                queue.push_back(child);
+            }
+        }
+    }
+
+    // feeds text[begin:], returns the position in text of the earliest stop string that ends in it, or npos
+    size_t feed(const std::string & text, size_t begin, int32_t & word) {
+        size_t pos = std::string::npos;
+
+        for (size_t i = begin; i < text.size(); ++i) {
+            state = step(state, text[i]);
+
+            const int32_t w = nodes[state].word;
+            if (w >= 0) {
+                const size_t start = i + 1 - lengths[w];
+                if (start < pos || (start == pos && w < word)) {
+                    pos  = start;
+                    word = w;
+                }
+            }
+        }
+
+        return pos;
+    }
+
+    // true if the end of the text could be the beginning of a stop string
+    bool partial() const {
+        return nodes[state].depth > 0;
+    }
+
+private:
+    int32_t find(int32_t cur, char c) const {
+        for (const auto & [k, child] : nodes[cur].next) {
+            if (k == (uint8_t) c) {
+                return child;
+            }
+        }
+        return 0;
+    }
+
+    int32_t step(int32_t cur, char c) const {
+        while (true) {
+            const int32_t child = find(cur, c);
+            if (child != 0 || cur == 0) {
+                return child;
+            }
+            cur = nodes[cur].fail;
+        }
+    }
+};
+
 //
 // template utils
 //
@@ -528,6 +796,18 @@ static bool server_sent_event(httplib::DataSink & sink, const char * event, cons
     return sink.write(str.c_str(), str.size());
 }
 
+// the API key passed in the "Authorization: Bearer <key>" header, empty if there is none
+static std::string get_api_key(const httplib::Request & req) {
+    const std::string auth_header = req.get_header_value("Authorization");
+    const std::string prefix      = "Bearer ";
+
+    if (auth_header.substr(0, prefix.size()) != prefix) {
+        return "";
+    }
+
+    return auth_header.substr(prefix.size());
+}
+
 //
 // OAI utils
 //
@@ -1345,6 +1625,231 @@ public:
     }
 };
 
+/**
+ * server_prefix_cache is a radix tree over token prefixes that are currently held in the KV cache.
+ * each node remembers which sequences hold the KV cells for the full prefix ending at that node,
+ * so that a new prompt can find the slot with the longest matching prefix in O(prompt length)
+ * and attach to it via llama_memory_seq_cp() instead of recomputing it.
+ */
+struct server_prefix_cache {
+    struct node {
+        llama_tokens tokens; // edge label, relative to the parent node
+
+        node * parent = nullptr;
+
+        std::unordered_map<llama_token, std::unique_ptr<node>> children;
+
+        // sequences that hold the KV cells for the entire prefix up to and including this node
+        // note: the set of a child is always a subset of the set of its parent
+        std::unordered_set<llama_seq_id> seq_ids;
+
+        int64_t t_last_used = 0;
+    };
+
+    node root;
+
+    size_t n_tokens     = 0; // total number of tokens stored in the tree
+    size_t n_tokens_max = 0; // 0 = unlimited
+
+    // deepest node for each sequence
+    std::unordered_map<llama_seq_id, node *> seq_leaf;
+
+    // record that seq_id holds the KV cells for tokens [0, n)
+    void insert(llama_seq_id seq_id, const llama_tokens & tokens, size_t n) {
+        remove(seq_id);
+
+        n = std::min(n, tokens.size());
+        if (n == 0) {
+            return;
+        }
+
+        const int64_t t_now = ggml_time_us();
+
+        node * cur = &root;
+        size_t i = 0;
+
+        while (i < n) {
+            auto it = cur->children.find(tokens[i]);
+            if (it == cur->children.end()) {
+                auto child = std::make_unique<node>();
+                child->tokens.assign(tokens.begin() + i, tokens.begin() + n);
+                child->parent = cur;
+
+                n_tokens += n - i;
+
+                node * next = child.get();
+                cur->children[tokens[i]] = std::move(child);
+
+                cur = next;
+                cur->seq_ids.insert(seq_id);
+                cur->t_last_used = t_now;
+
+                break;
+            }
+
+            node * child = it->second.get();
+
+            const size_t n_match = match(child->tokens, tokens, i, n);
+
+            if (n_match < child->tokens.size()) {
+                // split the edge at n_match
+                auto mid = std::make_unique<node>();
+                mid->tokens.assign(child->tokens.begin(), child->tokens.begin() + n_match);
+                mid->parent      = cur;
+                mid->seq_ids     = child->seq_ids;
+                mid->t_last_used = child->t_last_used;
+
+                std::unique_ptr<node> tail = std::move(it->second);
+                tail->tokens.erase(tail->tokens.begin(), tail->tokens.begin() + n_match);
+                tail->parent = mid.get();
+
+                mid->children[tail->tokens[0]] = std::move(tail);
+
+                child = mid.get();
+                it->second = std::move(mid);
+            }
+
+            cur = child;
+            cur->seq_ids.insert(seq_id);
+            cur->t_last_used = t_now;
+
+            i += n_match;
+        }
+
+        seq_leaf[seq_id] = cur;
+
+        evict();
+    }
+
+    // forget all prefixes held by seq_id
+    void remove(llama_seq_id seq_id) {
+        auto it = seq_leaf.find(seq_id);
+        if (it == seq_leaf.end()) {
+            return;
+        }
+
+        node * cur = it->second;
+        seq_leaf.erase(it);
+
+        while (cur != &root) {
+            node * parent = cur->parent;
+
+            cur->seq_ids.erase(seq_id);
+            if (cur->seq_ids.empty() && cur->children.empty()) {
+                // nobody holds this prefix anymore
+                n_tokens -= cur->tokens.size();
+                parent->children.erase(cur->tokens[0]);
+            }
+
+            cur = parent;
+        }
+    }
+
+    void clear() {
+        root.children.clear();
+        seq_leaf.clear();
+        n_tokens = 0;
+    }
+
+    // find the longest prefix of tokens held by a sequence other than seq_id_skip
+    // returns the length of the prefix and the id of the sequence that holds it (-1 if none)
+    std::pair<size_t, llama_seq_id> find(const llama_tokens & tokens, llama_seq_id seq_id_skip) {
+        const int64_t t_now = ggml_time_us();
+
+        size_t       n_best  = 0;
+        llama_seq_id id_best = -1;
+
+        node * cur = &root;
+        size_t i = 0;
+
+        while (i < tokens.size()) {
+            auto it = cur->children.find(tokens[i]);
+            if (it == cur->children.end()) {
+                break;
+            }
+
+            node * child = it->second.get();
+
+            llama_seq_id id = -1;
+            for (const auto & s : child->seq_ids) {
+                if (s != seq_id_skip) {
+                    id = s;
+                    break;
+                }
+            }
+
+            if (id == -1) {
+                // deeper nodes can only be held by a subset of these sequences
+                break;
+            }
+
+            const size_t n_match = match(child->tokens, tokens, i, tokens.size());
+
+            child->t_last_used = t_now;
+
+            n_best  = i + n_match;
+            id_best = id;
+
+            if (n_match < child->tokens.size()) {
+                break;
+            }
+
+            cur = child;
+            i  += n_match;
+        }
+
+        return { n_best, id_best };
+    }
+
+private:
+    static size_t match(const llama_tokens & edge, const llama_tokens & tokens, size_t i, size_t n) {
+        size_t n_match = 0;
+        while (n_match < edge.size() && i + n_match < n && edge[n_match] == tokens[i + n_match]) {
+            n_match++;
+        }
+        return n_match;
+    }
+
+    // drop the least recently used leaves until the tree fits in n_tokens_max
+    // note: this only removes entries from the index, the KV cells remain owned by their sequences
+    void evict() {
+        while (n_tokens_max > 0 && n_tokens > n_tokens_max) {
+            node * lru = nullptr;
+
+            std::vector<node *> stack = { &root };
+            while (!stack.empty()) {
+                node * cur = stack.back();
+                stack.pop_back();
+
+                if (cur != &root && cur->children.empty() && (lru == nullptr || cur->t_last_used < lru->t_last_used)) {
+                    lru = cur;
+                }
+
+                for (auto & it : cur->children) {
+                    stack.push_back(it.second.get());
+                }
+            }
+
+            if (lru == nullptr) {
+                break;
+            }
+
+            node * parent = lru->parent;
+
+            for (const auto & s : lru->seq_ids) {
+                if (parent == &root) {
+                    seq_leaf.erase(s);
+                } else {
+                    seq_leaf[s] = parent;
+                }
+            }
+
+            n_tokens -= lru->tokens.size();
+            parent->children.erase(lru->tokens[0]);
+        }
+    }
+};
+
 // Computes FNV-1a hash of the data
 static std::string fnv_hash(const uint8_t * data, size_t len) {
     const uint64_t fnv_prime = 0x100000001b3ULL;